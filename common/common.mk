@@ -19,7 +19,7 @@ LIB_DIR = $(INSTALL_DIR)/lib
 INCLUDE_DIR = $(INSTALL_DIR)/include
 
 # Common libraries
-COMMON_LIBS = -lbpf -lelf -lz
+COMMON_LIBS = -lbpf -lelf -lz -lpthread -lrt
 
 # Common includes
 COMMON_INCLUDES = -I$(PROJECT_ROOT)/src -I$(PROJECT_ROOT)/common
@@ -2,9 +2,30 @@
 #define PARSING_HELPERS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <string.h>
+
+/* glibc's netinet/in.h must precede linux/in6.h in userspace builds. */
+#ifdef __bpf__
+#include <linux/in.h>
+#include <bpf/bpf_endian.h>
+#define ntohs(x) bpf_ntohs(x)
+#define htons(x) bpf_htons(x)
+#define ntohl(x) bpf_ntohl(x)
+#define htonl(x) bpf_htonl(x)
+#else
+#include <arpa/inet.h>
 #include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#endif
+
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/if_arp.h>
+#include <linux/udp.h>
 #include "common_structs.h"
 
 static inline bool is_valid_ethernet_frame(const void *data, size_t data_len) {
@@ -61,44 +82,210 @@ static inline bool is_valid_arp_packet(const struct arphdr *arp, size_t data_len
     return true;
 }
 
-static inline __u32 parse_ip_address(const char *ip_str) {
-    if (!ip_str) {
-        return 0;
+#define MAX_VLAN_DEPTH 2
+#define MAX_MPLS_LABELS 4
+#define MPLS_LABEL_LEN 4
+#define MPLS_BOS_BYTE 2
+#define MPLS_BOS_BIT 0x01
+
+#define VXLAN_UDP_PORT 4789
+#define VXLAN_HEADER_LEN 8
+#define VXLAN_FLAG_VNI 0x08
+#define GENEVE_UDP_PORT 6081
+#define GENEVE_HEADER_LEN 8
+#define GENEVE_OPT_LEN_MASK 0x3F
+#define GENEVE_VERSION_MASK 0xC0
+
+#define GRE_HEADER_LEN 4
+#define GRE_FLAG_CSUM 0x8000
+#define GRE_FLAG_ROUTING 0x4000
+#define GRE_FLAG_KEY 0x2000
+#define GRE_FLAG_SEQ 0x1000
+#define GRE_VERSION_MASK 0x0007
+
+struct vlan_hdr {
+    __be16 h_vlan_TCI;
+    __be16 h_vlan_encapsulated_proto;
+};
+
+/* Where the network header of an Ethernet frame starts; l3_proto is host order, 0 if unknown. */
+typedef struct {
+    void *l3;
+    __u16 l3_proto;
+    __u8 vlan_depth;
+    __u8 mpls_labels;
+} l2_headers;
+
+static inline bool is_vlan_proto(__u16 proto) {
+    return proto == ETH_P_8021Q || proto == ETH_P_8021AD;
+}
+
+static inline bool is_tunnel_payload_proto(__u16 proto) {
+    return proto == ETH_P_TEB || proto == ETH_P_IP || proto == ETH_P_IPV6;
+}
+
+/*
+ * Skips up to MAX_VLAN_DEPTH 802.1Q/802.1ad tags and an MPLS label stack
+ * of up to MAX_MPLS_LABELS entries. MPLS has no payload type, so the
+ * version nibble after the bottom label picks IPv4 or IPv6. Deeper stacks
+ * leave l3_proto at 0; only a truncated header fails.
+ */
+static inline bool parse_l2_headers(struct ethhdr *eth, void *data_end, l2_headers *hdrs) {
+    unsigned char *pos = (unsigned char *)(eth + 1);
+    __u16 proto = ntohs(eth->h_proto);
+    
+    hdrs->vlan_depth = 0;
+    hdrs->mpls_labels = 0;
+
+#pragma unroll
+    for (int i = 0; i < MAX_VLAN_DEPTH; i++) {
+        if (!is_vlan_proto(proto)) {
+            break;
+        }
+        
+        struct vlan_hdr *vlan = (struct vlan_hdr *)pos;
+        if ((void *)(vlan + 1) > data_end) {
+            return false;
+        }
+        proto = ntohs(vlan->h_vlan_encapsulated_proto);
+        pos = (unsigned char *)(vlan + 1);
+        hdrs->vlan_depth++;
+    }
+    
+    if (proto == ETH_P_MPLS_UC || proto == ETH_P_MPLS_MC) {
+        bool bottom = false;
+
+#pragma unroll
+        for (int i = 0; i < MAX_MPLS_LABELS; i++) {
+            if ((void *)(pos + MPLS_LABEL_LEN + 1) > data_end) {
+                return false;
+            }
+            bottom = pos[MPLS_BOS_BYTE] & MPLS_BOS_BIT;
+            pos += MPLS_LABEL_LEN;
+            hdrs->mpls_labels++;
+            if (bottom) {
+                break;
+            }
+        }
+        
+        proto = 0;
+        if (bottom && (*pos >> 4) == 4) {
+            proto = ETH_P_IP;
+        } else if (bottom && (*pos >> 4) == 6) {
+            proto = ETH_P_IPV6;
+        }
+    } else if (is_vlan_proto(proto)) {
+        proto = 0;
     }
     
-    __u32 ip = 0;
-    int octet = 0;
-    char *token = strtok((char *)ip_str, ".");
+    hdrs->l3 = pos;
+    hdrs->l3_proto = proto;
+    return true;
+}
+
+/*
+ * Recognizes one VXLAN, GENEVE or GRE header at the outer L4 header and
+ * returns the inner packet, or NULL. *inner_proto is ETH_P_TEB for an
+ * Ethernet frame, else the ethertype of a bare IP packet. *check is the
+ * outer checksum covering the inner packet, NULL when there is none.
+ */
+static inline void *parse_tunnel_header(void *l4, __u8 protocol, void *data_end, __u8 *encap,
+                                        __u16 *inner_proto, __sum16 **check) {
+    *check = NULL;
+    
+    if (protocol == IPPROTO_UDP) {
+        struct udphdr *udph = l4;
+        unsigned char *tunnel = (unsigned char *)(udph + 1);
+        if ((void *)(tunnel + GENEVE_HEADER_LEN) > data_end) {
+            return NULL;
+        }
+        
+        if (udph->check) {
+            *check = &udph->check;
+        }
+        
+        if (udph->dest == htons(VXLAN_UDP_PORT) && (tunnel[0] & VXLAN_FLAG_VNI)) {
+            *encap = ENCAP_VXLAN;
+            *inner_proto = ETH_P_TEB;
+            return tunnel + VXLAN_HEADER_LEN;
+        }
+        
+        if (udph->dest == htons(GENEVE_UDP_PORT) && !(tunnel[0] & GENEVE_VERSION_MASK)) {
+            *encap = ENCAP_GENEVE;
+            *inner_proto = ntohs(*(__be16 *)(tunnel + 2));
+            if (!is_tunnel_payload_proto(*inner_proto)) {
+                return NULL;
+            }
+            return tunnel + GENEVE_HEADER_LEN + (tunnel[0] & GENEVE_OPT_LEN_MASK) * 4;
+        }
+        return NULL;
+    }
     
-    while (token && octet < 4) {
-        int value = atoi(token);
-        if (value < 0 || value > 255) {
-            return 0;
+    if (protocol == IPPROTO_GRE) {
+        unsigned char *gre = l4;
+        if ((void *)(gre + GRE_HEADER_LEN) > data_end) {
+            return NULL;
+        }
+        
+        __u16 flags = ntohs(*(__be16 *)gre);
+        if (flags & (GRE_FLAG_ROUTING | GRE_VERSION_MASK)) {
+            return NULL;
         }
-        ip |= (value << (24 - octet * 8));
-        octet++;
-        token = strtok(NULL, ".");
+        
+        *encap = ENCAP_GRE;
+        *inner_proto = ntohs(*(__be16 *)(gre + 2));
+        if (!is_tunnel_payload_proto(*inner_proto)) {
+            return NULL;
+        }
+        
+        __u32 len = GRE_HEADER_LEN;
+        if (flags & GRE_FLAG_CSUM) {
+            *check = (__sum16 *)(gre + len);
+            len += 4;
+        }
+        if (flags & GRE_FLAG_KEY) {
+            len += 4;
+        }
+        if (flags & GRE_FLAG_SEQ) {
+            len += 4;
+        }
+        return gre + len;
+    }
+    
+    return NULL;
+}
+
+#ifndef __bpf__
+
+/* Dotted quad to host order; 0.0.0.0 is a valid address, so success is separate. */
+static inline bool parse_ip_address(const char *ip_str, __u32 *ip) {
+    struct in_addr addr;
+    if (!ip_str || inet_pton(AF_INET, ip_str, &addr) != 1) {
+        return false;
     }
     
-    return octet == 4 ? ip : 0;
+    *ip = ntohl(addr.s_addr);
+    return true;
 }
 
+/* "first-last", both inclusive. */
 static inline bool parse_ip_range(const char *range_str, ip_range *range) {
     if (!range_str || !range) {
         return false;
     }
     
-    char *dash = strchr((char *)range_str, '-');
-    if (!dash) {
+    const char *dash = strchr(range_str, '-');
+    if (!dash || (size_t)(dash - range_str) >= INET_ADDRSTRLEN) {
         return false;
     }
     
-    *dash = '\0';
-    __u32 start_ip = parse_ip_address(range_str);
-    __u32 end_ip = parse_ip_address(dash + 1);
-    *dash = '-';
+    char start_str[INET_ADDRSTRLEN];
+    memcpy(start_str, range_str, dash - range_str);
+    start_str[dash - range_str] = '\0';
     
-    if (!start_ip || !end_ip || start_ip > end_ip) {
+    __u32 start_ip, end_ip;
+    if (!parse_ip_address(start_str, &start_ip) || !parse_ip_address(dash + 1, &end_ip) ||
+        start_ip > end_ip) {
         return false;
     }
     
@@ -114,17 +301,19 @@ static inline bool parse_cidr_range(const char *cidr_str, ip_range *range) {
         return false;
     }
     
-    char *slash = strchr((char *)cidr_str, '/');
-    if (!slash) {
+    const char *slash = strchr(cidr_str, '/');
+    if (!slash || (size_t)(slash - cidr_str) >= INET_ADDRSTRLEN) {
         return false;
     }
     
-    *slash = '\0';
-    __u32 ip = parse_ip_address(cidr_str);
-    int prefix_len = atoi(slash + 1);
-    *slash = '/';
+    char ip_str[INET_ADDRSTRLEN];
+    memcpy(ip_str, cidr_str, slash - cidr_str);
+    ip_str[slash - cidr_str] = '\0';
     
-    if (!ip || prefix_len < 0 || prefix_len > 32) {
+    char *end;
+    unsigned long prefix_len = strtoul(slash + 1, &end, 10);
+    __u32 ip;
+    if (!parse_ip_address(ip_str, &ip) || end == slash + 1 || *end != '\0' || prefix_len > 32) {
         return false;
     }
     
@@ -261,4 +450,6 @@ static inline bool parse_boolean(const char *str) {
            string_equals_ignore_case(str, "on");
 }
 
+#endif /* !__bpf__ */
+
 #endif
@@ -1,12 +1,49 @@
 #ifndef REWRITE_HELPERS_H
 #define REWRITE_HELPERS_H
 
-#include <linux/if_ether.h>
-#include <linux/ip.h>
-#include <linux/arp.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include "common_structs.h"
+#include "parsing_helpers.h"
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/tcp.h>
+
+/*
+ * Address mapping cache hooks. The XDP program defines ANON_MAPPING_CACHE
+ * and backs these with LRU maps; everywhere else they compile away.
+ */
+#ifndef ANON_MAPPING_CACHE
+#define mapping_cache_lookup_mac(ctx, mac, field) ((void)(field), false)
+#define mapping_cache_update_mac(ctx, original, mapped, field) ((void)(field))
+#define mapping_cache_lookup_ipv4(ctx, ip_addr, field, mapped) ((void)(field), false)
+#define mapping_cache_update_ipv4(ctx, ip_addr, field, mapped) ((void)(field))
+#endif
+
+/*
+ * Flow table hooks, backed by flow_table_map when ANON_FLOW_TABLE is
+ * defined. Lookups only return entries mapped under the current generation.
+ */
+#ifndef ANON_FLOW_TABLE
+#define flow_table_lookup(ctx, key, bytes) ((void)(key), (void)(bytes), (flow_entry *)0)
+#define flow_table_record(ctx, key, anonymized, bytes) ((void)(key), (void)(bytes))
+#endif
+
+/*
+ * Address policy hooks, backed by the policy LPM tries when
+ * ANON_ADDRESS_POLICY is defined. A match copies the rule and counts a hit.
+ */
+#ifndef ANON_ADDRESS_POLICY
+#define policy_lookup_ipv4(ctx, ip_addr, rule) ((void)(ip_addr), (void)(rule), false)
+#define policy_lookup_ipv6(ctx, addr, rule) ((void)(addr), (void)(rule), false)
+#endif
+
+/*
+ * Mapping vault hooks: with ANON_MAPPING_VAULT the XDP program reports
+ * each freshly computed pair on vault_ring_map.
+ */
+#ifndef ANON_MAPPING_VAULT
+#define mapping_vault_record_mac(ctx, original, mapped, field) ((void)(field))
+#define mapping_vault_record_ipv4(ctx, ip_addr, mapped, field) ((void)(field))
+#define mapping_vault_record_ipv6(ctx, original, mapped, field) ((void)(field))
+#endif
 
 static inline __u32 compute_hash(__u32 value, __u32 salt) {
     __u32 hash = value ^ salt;
@@ -17,9 +54,69 @@ static inline __u32 compute_hash(__u32 value, __u32 salt) {
     return hash;
 }
 
-static inline void process_mac_oui(unsigned char *mac, __u32 salt) {
+static inline __u64 rotl64(__u64 x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static inline void sipround(__u64 v[4]) {
+    v[0] += v[1];
+    v[1] = rotl64(v[1], 13) ^ v[0];
+    v[0] = rotl64(v[0], 32);
+    v[2] += v[3];
+    v[3] = rotl64(v[3], 16) ^ v[2];
+    v[0] += v[3];
+    v[3] = rotl64(v[3], 21) ^ v[0];
+    v[2] += v[1];
+    v[1] = rotl64(v[1], 17) ^ v[2];
+    v[2] = rotl64(v[2], 32);
+}
+
+/*
+ * SipHash-2-4 over `words` 64-bit message words (little-endian byte
+ * order on the wire) under a 128-bit key. Unlike compute_hash() this is a
+ * PRF: without the key, outputs cannot be inverted or linked.
+ */
+static inline __u64 siphash_2_4(const __u64 key[2], const __u64 *msg, __u32 words) {
+    __u64 v[4] = {
+        key[0] ^ 0x736f6d6570736575ULL,
+        key[1] ^ 0x646f72616e646f6dULL,
+        key[0] ^ 0x6c7967656e657261ULL,
+        key[1] ^ 0x7465646279746573ULL
+    };
+
+#pragma unroll
+    for (__u32 i = 0; i < words; i++) {
+        v[3] ^= msg[i];
+        sipround(v);
+        sipround(v);
+        v[0] ^= msg[i];
+    }
+    
+    __u64 length = (__u64)(words * 8) << 56;
+    v[3] ^= length;
+    sipround(v);
+    sipround(v);
+    v[0] ^= length;
+    v[2] ^= 0xFF;
+    sipround(v);
+    sipround(v);
+    sipround(v);
+    sipround(v);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/* Hash of one field value under the configured backend; the legacy mix ignores the domain. */
+static inline __u32 keyed_hash(__u32 value, __u32 domain, const anonymization_config *config) {
+    if (config->hash_function == HASH_FUNCTION_SIPHASH) {
+        __u64 msg = ((__u64)domain << 32) | value;
+        return (__u32)siphash_2_4(config->hash_key, &msg, 1);
+    }
+    return compute_hash(value, config->random_salt);
+}
+
+static inline void process_mac_oui(unsigned char *mac, const anonymization_config *config) {
     __u32 oui = (mac[0] << 16) | (mac[1] << 8) | mac[2];
-    __u32 hashed_oui = compute_hash(oui, salt);
+    __u32 hashed_oui = keyed_hash(oui, PRF_DOMAIN_MAC_OUI, config);
     
     bool multicast_flag = (mac[0] & 0x01) != 0;
     hashed_oui &= 0xFEFFFF;
@@ -32,66 +129,474 @@ static inline void process_mac_oui(unsigned char *mac, __u32 salt) {
     mac[2] = hashed_oui & 0xFF;
 }
 
-static inline void process_mac_id(unsigned char *mac, __u32 salt) {
+static inline void process_mac_id(unsigned char *mac, const anonymization_config *config) {
     __u32 id = (mac[3] << 16) | (mac[4] << 8) | mac[5];
-    __u32 hashed_id = compute_hash(id, salt);
+    __u32 hashed_id = keyed_hash(id, PRF_DOMAIN_MAC_ID, config);
     
     mac[3] = (hashed_id >> 16) & 0xFF;
     mac[4] = (hashed_id >> 8) & 0xFF;
     mac[5] = hashed_id & 0xFF;
 }
 
-static inline __u32 process_ip_with_prefix(__u32 ip_addr, __u32 salt, __u32 prefix_mask) {
+static inline __u32 process_ip_with_prefix(__u32 ip_addr, const anonymization_config *config,
+                                           __u32 prefix_mask) {
     __u32 network_part = ip_addr & prefix_mask;
     __u32 host_part = ip_addr & ~prefix_mask;
-    __u32 hashed_host = compute_hash(host_part, salt);
+    __u32 hashed_host = keyed_hash(host_part, PRF_DOMAIN_IPV4, config);
     
     return network_part | (hashed_host & ~prefix_mask);
 }
 
-static inline __u32 process_ip_full(__u32 ip_addr, __u32 salt) {
-    return compute_hash(ip_addr, salt);
+static inline __u32 process_ip_full(__u32 ip_addr, const anonymization_config *config) {
+    return keyed_hash(ip_addr, PRF_DOMAIN_IPV4, config);
+}
+
+#define PORT_PRESERVE_BELOW 1024
+#define PORT_BLOCK_SIZE 1024
+#define PORT_BLOCK_COUNT ((65536 - PORT_PRESERVE_BELOW) / PORT_BLOCK_SIZE)
+
+static inline __u32 mix32(__u32 h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
 }
 
-static inline __u16 recalculate_ip_checksum(const struct iphdr *iph) {
-    __u32 sum = 0;
-    __u16 *ptr = (__u16 *)iph;
-    int len = iph->ihl * 4;
+/*
+ * Round function of the port permutation. compute_hash() drops the low
+ * bits of its input, so neighbouring offsets would all get the same round
+ * value and neighbouring ports would stay neighbours; the legacy backend
+ * uses a full avalanche mix of the salt instead.
+ */
+static inline __u32 port_round(__u32 value, __u32 round, const anonymization_config *config) {
+    if (config->hash_function == HASH_FUNCTION_SIPHASH) {
+        return keyed_hash(value | (round << 16), PRF_DOMAIN_PORT, config);
+    }
+    __u32 salt = config->random_salt;
+    return mix32(mix32(value ^ salt) ^ (round * 0x9E3779B9) ^ salt);
+}
+
+/*
+ * Keyed permutation of the ports from PORT_PRESERVE_BELOW up: four rounds
+ * over (block, offset), each one a bijection, so distinct ports never
+ * collide. Three rounds leave about one neighbouring pair in
+ * PORT_BLOCK_COUNT next to each other; the fourth moves the block again.
+ * Well-known ports stay as they are.
+ */
+static inline __u16 process_port(__u16 port, const anonymization_config *config) {
+    if (port < PORT_PRESERVE_BELOW) {
+        return port;
+    }
     
-    sum -= ntohs(iph->check);
+    __u32 block = (port - PORT_PRESERVE_BELOW) / PORT_BLOCK_SIZE;
+    __u32 offset = (port - PORT_PRESERVE_BELOW) % PORT_BLOCK_SIZE;
+    offset = (offset + port_round(block, 0, config)) % PORT_BLOCK_SIZE;
+    block = (block + port_round(offset, 1, config)) % PORT_BLOCK_COUNT;
+    offset = (offset + port_round(block, 2, config)) % PORT_BLOCK_SIZE;
+    block = (block + port_round(offset, 3, config)) % PORT_BLOCK_COUNT;
+    return PORT_PRESERVE_BELOW + block * PORT_BLOCK_SIZE + offset;
+}
+
+/* Keyed PRF over the first prefix_len bits of an address, one output bit. */
+static inline __u32 pp_prf_bit(__u32 prefix, __u32 prefix_len, const anonymization_config *config) {
+    if (config->hash_function == HASH_FUNCTION_SIPHASH) {
+        __u64 msg = ((__u64)PRF_DOMAIN_PREFIX_BIT << 40) | ((__u64)prefix_len << 32) | prefix;
+        return siphash_2_4(config->hash_key, &msg, 1) & 1;
+    }
+    __u32 salt = config->random_salt;
+    return mix32(mix32(prefix ^ salt) ^ (prefix_len * 0x9E3779B9) ^ salt) & 1;
+}
+
+/* Flip mask for the top PP_TABLE_BITS bits; what userspace stores in the table. */
+static inline __u16 pp_compute_flips(__u32 high_bits, const anonymization_config *config) {
+    __u16 flips = 0;
+    for (__u32 i = 0; i < PP_TABLE_BITS; i++) {
+        __u32 prefix = i ? high_bits >> (PP_TABLE_BITS - i) : 0;
+        flips |= pp_prf_bit(prefix, i, config) << (PP_TABLE_BITS - 1 - i);
+    }
+    return flips;
+}
+
+/*
+ * Crypto-PAn style mapping: output bit i is input bit i XOR PRF(first i
+ * bits), so two addresses sharing a k-bit prefix map to addresses sharing
+ * exactly a k-bit prefix. The upper bits come from the table in one lookup.
+ */
+static inline __u32 process_ip_prefix_preserving(__u32 ip_addr, const anonymization_config *config,
+                                                 const prefix_preserving_table *table) {
+    __u32 high_bits = ip_addr >> (32 - PP_TABLE_BITS);
+    __u32 flips = table ? table->flips[high_bits & (PP_TABLE_SIZE - 1)] :
+                          pp_compute_flips(high_bits, config);
+    flips <<= 32 - PP_TABLE_BITS;
+
+#pragma unroll
+    for (__u32 i = PP_TABLE_BITS; i < 32; i++) {
+        flips |= pp_prf_bit(ip_addr >> (32 - i), i, config) << (31 - i);
+    }
     
-    for (int i = 0; i < len / 2; i++) {
-        sum += ntohs(ptr[i]);
+    return ip_addr ^ flips;
+}
+
+static inline void fill_prefix_preserving_table(prefix_preserving_table *table,
+                                                const anonymization_config *config) {
+    for (__u32 high_bits = 0; high_bits < PP_TABLE_SIZE; high_bits++) {
+        table->flips[high_bits] = pp_compute_flips(high_bits, config);
+    }
+}
+
+/* Bits of 32-bit word `index` that fall inside a prefix_len-bit prefix. */
+static inline __u32 ipv6_word_prefix_mask(__u32 prefix_len, __u32 index) {
+    __u32 start = index * 32;
+    if (prefix_len <= start) {
+        return 0;
     }
+    if (prefix_len >= start + 32) {
+        return 0xFFFFFFFF;
+    }
+    return 0xFFFFFFFF << (32 - (prefix_len - start));
+}
+
+/*
+ * Keyed 64-bit digest of the whole address, expanded into fresh bits for
+ * every position in [prefix_len, hash_end); bits outside stay verbatim.
+ * Words are in host order.
+ */
+static inline void process_ipv6_address(__u32 words[4], __u32 prefix_len, __u32 hash_end,
+                                        const anonymization_config *config) {
+    __u32 digest_lo = config->random_salt;
+    __u32 digest_hi = config->random_salt ^ HASH_MAGIC;
     
-    if (len % 2) {
-        sum += ((unsigned char *)iph)[len - 1] << 8;
+    if (config->hash_function == HASH_FUNCTION_SIPHASH) {
+        __u64 msg[3] = {
+            PRF_DOMAIN_IPV6,
+            ((__u64)words[0] << 32) | words[1],
+            ((__u64)words[2] << 32) | words[3]
+        };
+        __u64 digest = siphash_2_4(config->hash_key, msg, 3);
+        digest_lo = (__u32)digest;
+        digest_hi = (__u32)(digest >> 32);
+    } else {
+#pragma unroll
+        for (__u32 i = 0; i < 4; i++) {
+            digest_lo = mix32(digest_lo ^ words[i] ^ (i * 0x9E3779B9));
+            digest_hi = mix32(digest_hi + words[i] + (i * 0x85EBCA6B));
+        }
+    }
+
+#pragma unroll
+    for (__u32 i = 0; i < 4; i++) {
+        __u32 keep = ipv6_word_prefix_mask(prefix_len, i) | ~ipv6_word_prefix_mask(hash_end, i);
+        __u32 hashed = mix32(digest_lo ^ ((i + 1) * 0x9E3779B9)) ^ mix32(digest_hi + i);
+        words[i] = (words[i] & keep) | (hashed & ~keep);
+    }
+}
+
+/* prefix_mask is the part kept verbatim; callers pass 0 when nothing is preserved. */
+static inline __u32 anonymize_ipv4_address(__u32 ip_addr, __u32 prefix_mask,
+                                           const anonymization_config *config,
+                                           const prefix_preserving_table *pp_table) {
+    if (config->prefix_preserving) {
+        __u32 mapped = process_ip_prefix_preserving(ip_addr, config, pp_table);
+        return (ip_addr & prefix_mask) | (mapped & ~prefix_mask);
+    }
+    if (prefix_mask) {
+        return process_ip_with_prefix(ip_addr, config, prefix_mask);
+    }
+    return process_ip_full(ip_addr, config);
+}
+
+#define IPV4_FRAG_OFFSET_MASK 0x1FFF
+#define IPV4_MORE_FRAGMENTS 0x2000
+#define ARP_IPV4_PAYLOAD_LEN 20
+
+#define IPV6_MAX_EXT_HEADERS 6
+#define IPV6_FRAG_OFFSET_MASK 0xFFF8
+#define IPV6_EUI64_PREFIX_BITS 64
+
+#define NDP_NEIGHBOR_SOLICIT 135
+#define NDP_NEIGHBOR_ADVERT 136
+#define NDP_REDIRECT 137
+#define NDP_TARGET_OFFSET 8
+#define NDP_REDIRECT_DEST_OFFSET 24
+#define NDP_OPTIONS_OFFSET 24
+#define NDP_REDIRECT_OPTIONS_OFFSET 40
+#define NDP_OPT_SOURCE_LL 1
+#define NDP_OPT_TARGET_LL 2
+#define NDP_MAX_OPTIONS 4
+
+#define DNS_PORT 53
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+#define BOOTP_CIADDR_OFFSET 12
+#define BOOTP_YIADDR_OFFSET 16
+#define BOOTP_SIADDR_OFFSET 20
+#define BOOTP_GIADDR_OFFSET 24
+#define BOOTP_CHADDR_OFFSET 28
+#define DHCP_COOKIE_OFFSET 236
+#define DHCP_OPTIONS_OFFSET 240
+#define DHCP_MAGIC_COOKIE 0x63825363
+#define DHCP_MAX_OPTIONS 16
+#define DHCP_OPT_PAD 0
+#define DHCP_OPT_REQUESTED_IP 50
+#define DHCP_OPT_SERVER_ID 54
+#define DHCP_OPT_CLIENT_ID 61
+#define DHCP_OPT_END 255
+
+#define DNS_HEADER_LEN 12
+#define DNS_RR_HEADER_LEN 10
+#define DNS_MAX_LABELS 16
+#define DNS_MAX_RECORDS 8
+#define DNS_MAX_OFFSET 1500
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+
+/*
+ * Incremental Internet checksum update (RFC 1624, eqn. 3):
+ * HC' = ~(~HC + ~m + m'). Rewrites accumulate ~m + m' for every changed
+ * 16-bit word into one delta, which is then folded into each checksum
+ * that covers those words. Words are summed as stored, so no byte swaps.
+ */
+static inline __u32 csum_delta_add4(__u32 delta, __be32 from, __be32 to) {
+    delta += (__u16)~(from >> 16) + (__u16)~(from & 0xFFFF);
+    delta += (to >> 16) + (to & 0xFFFF);
+    return delta;
+}
+
+static inline __u16 csum_fold(__u32 sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (__u16)sum;
+}
+
+/* ~m + m' for one 16-bit word, as stored in the packet. */
+static inline __u32 csum_delta_add2(__u32 delta, __u16 from, __u16 to) {
+    return delta + (__u16)~from + to;
+}
+
+/*
+ * A change at an odd offset from the start of the checksummed data lands
+ * in the other byte of each 16-bit word, so its sum is byte-swapped.
+ */
+static inline __u32 csum_delta_at(__u32 delta, __u32 offset) {
+    if (!(offset & 1)) {
+        return delta;
+    }
+    __u16 folded = csum_fold(delta);
+    return (__u16)((folded << 8) | (folded >> 8));
+}
+
+static inline __u32 csum_delta_words(__u32 delta, const __u16 *from, const __u16 *to, __u32 words) {
+#pragma unroll
+    for (__u32 i = 0; i < words; i++) {
+        delta = csum_delta_add2(delta, from[i], to[i]);
+    }
+    return delta;
+}
+
+/*
+ * Returns the change made to the checksum word itself, which is all an
+ * enclosing checksum (a tunnel's outer UDP or GRE) still has to absorb.
+ */
+static inline __u32 csum_apply_delta(__sum16 *check, __u32 delta) {
+    __u16 original = *check;
+    __u32 sum = (__u16)~*check;
+    *check = (__sum16)~csum_fold(sum + csum_fold(delta));
+    return csum_delta_add2(0, original, *check);
+}
+
+static inline __u32 apply_l4_checksum_delta(void *l4, __u8 protocol, void *data_end, __u32 delta) {
+    if (protocol == IPPROTO_TCP) {
+        struct tcphdr *tcph = l4;
+        if ((void *)(tcph + 1) > data_end) {
+            return 0;
+        }
+        return csum_apply_delta(&tcph->check, delta);
+    } else if (protocol == IPPROTO_UDP) {
+        struct udphdr *udph = l4;
+        if ((void *)(udph + 1) > data_end || !udph->check) {
+            return 0;
+        }
+        __u32 change = csum_apply_delta(&udph->check, delta);
+        if (!udph->check) {
+            udph->check = (__sum16)0xFFFF;
+        }
+        return change;
+    }
+    return 0;
+}
+
+static inline __u32 update_l4_checksum(struct iphdr *iph, void *data_end, __u32 delta) {
+    if (iph->frag_off & htons(IPV4_FRAG_OFFSET_MASK)) {
+        return 0;
     }
     
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+    return apply_l4_checksum_delta((void *)iph + iph->ihl * 4, iph->protocol, data_end, delta);
+}
+
+static inline void anonymize_mac_address(unsigned char *mac, bool oui, bool id, __u32 field,
+                                         anonymization_context *ctx) {
+    if (!oui && !id) {
+        return;
+    }
+    
+    if (mapping_cache_lookup_mac(ctx, mac, field)) {
+        return;
     }
     
-    return htons(~sum);
+    unsigned char original[6];
+    __builtin_memcpy(original, mac, sizeof(original));
+    
+    if (oui) {
+        process_mac_oui(mac, ctx->config);
+    }
+    if (id) {
+        process_mac_id(mac, ctx->config);
+    }
+    
+    mapping_cache_update_mac(ctx, original, mac, field);
+    mapping_vault_record_mac(ctx, original, mac, field);
 }
 
-static inline void process_arp_mac(struct arphdr *arp, unsigned char *arp_data, __u32 salt) {
-    process_mac_oui(&arp_data[0], salt);
-    process_mac_id(&arp_data[0], salt);
+/*
+ * Applies a matching policy rule: pass keeps the address, drop flags the
+ * whole frame, and the other actions override how much prefix is kept.
+ * Returns false when the address must be left as it is.
+ */
+static inline bool apply_address_policy(const policy_rule *rule, __u32 *prefix_len,
+                                        anonymization_context *ctx) {
+    if (rule->action == POLICY_ACTION_DROP) {
+        ctx->mods->policy_drop = true;
+        return false;
+    }
+    if (rule->action == POLICY_ACTION_PASS) {
+        return false;
+    }
+    *prefix_len = rule->prefix_len;
+    return true;
+}
+
+static inline __u32 map_ipv4_address(__u32 ip_addr, __u32 field, anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    __u32 prefix_mask = 0;
+    if (config->preserve_prefix) {
+        prefix_mask = field == MAPPING_FIELD_DST ? config->dest_ip_mask_lengths :
+                                                   config->src_ip_mask_lengths;
+    }
+    
+    policy_rule rule;
+    if (config->address_policy && policy_lookup_ipv4(ctx, ip_addr, &rule)) {
+        __u32 prefix_len;
+        if (!apply_address_policy(&rule, &prefix_len, ctx)) {
+            return ip_addr;
+        }
+        prefix_mask = prefix_len ? 0xFFFFFFFFu << (32 - prefix_len) : 0;
+    }
+    
+    __u32 mapped;
+    if (mapping_cache_lookup_ipv4(ctx, ip_addr, field, &mapped)) {
+        return mapped;
+    }
     
-    process_mac_oui(&arp_data[6], salt);
-    process_mac_id(&arp_data[6], salt);
+    mapped = anonymize_ipv4_address(ip_addr, prefix_mask, ctx->config, ctx->pp_table);
+    
+    mapping_cache_update_ipv4(ctx, ip_addr, field, mapped);
+    mapping_vault_record_ipv4(ctx, ip_addr, mapped, field);
+    return mapped;
 }
 
-static inline void process_arp_ip(struct arphdr *arp, unsigned char *arp_data, __u32 salt) {
-    __u32 *sender_ip = (__u32 *)&arp_data[12];
-    __u32 *target_ip = (__u32 *)&arp_data[16];
+static inline bool ipv6_address_is_link_local(const __u32 words[4]) {
+    return (words[0] >> 22) == (0xFE80 >> 6);
+}
+
+static inline bool ipv6_address_is_reserved(const __u32 words[4]) {
+    if ((words[0] >> 24) == 0xFF) {
+        return true;
+    }
+    return !words[0] && !words[1] && !words[2] && words[3] <= 1;
+}
+
+/*
+ * Rewrites one IPv6 address in place and folds the change into *delta.
+ * Multicast, :: and ::1 are left alone. Link-local addresses keep their
+ * fe80::/64 prefix, but not their interface ID, which often embeds the
+ * MAC. A modified EUI-64 interface ID is rebuilt from the anonymized MAC,
+ * so it matches the Ethernet rewrite of the same station.
+ */
+static inline void map_ipv6_address(__be32 *addr, __u32 field, anonymization_context *ctx,
+                                    __u32 *delta) {
+    const anonymization_config *config = ctx->config;
+    bool dst = field == MAPPING_FIELD_DST;
+    __u32 words[4];
+
+#pragma unroll
+    for (__u32 i = 0; i < 4; i++) {
+        words[i] = ntohl(addr[i]);
+    }
+    
+    if (ipv6_address_is_reserved(words)) {
+        return;
+    }
+    
+    __u32 prefix_len = 0;
+    if (config->preserve_prefix) {
+        prefix_len = dst ? config->dest_ipv6_prefix_length : config->src_ipv6_prefix_length;
+    }
     
-    *sender_ip = process_ip_full(ntohl(*sender_ip), salt);
-    *target_ip = process_ip_full(ntohl(*target_ip), salt);
+    policy_rule rule;
+    if (config->address_policy && policy_lookup_ipv6(ctx, addr, &rule) &&
+        !apply_address_policy(&rule, &prefix_len, ctx)) {
+        return;
+    }
+    if (ipv6_address_is_link_local(words) && prefix_len < IPV6_EUI64_PREFIX_BITS) {
+        prefix_len = IPV6_EUI64_PREFIX_BITS;
+    }
+    bool eui64 = prefix_len <= IPV6_EUI64_PREFIX_BITS &&
+                 (words[2] & 0xFF) == 0xFF && (words[3] >> 24) == 0xFE;
+    
+    process_ipv6_address(words, prefix_len, eui64 ? IPV6_EUI64_PREFIX_BITS : 128, config);
     
-    *sender_ip = htonl(*sender_ip);
-    *target_ip = htonl(*target_ip);
+    if (eui64) {
+        unsigned char mac[ETH_ALEN] = {
+            ((words[2] >> 24) & 0xFF) ^ 0x02, (words[2] >> 16) & 0xFF, (words[2] >> 8) & 0xFF,
+            (words[3] >> 16) & 0xFF, (words[3] >> 8) & 0xFF, words[3] & 0xFF
+        };
+        anonymize_mac_address(mac, dst ? config->anonymize_dstmac_oui : config->anonymize_srcmac_oui,
+                              dst ? config->anonymize_dstmac_id : config->anonymize_srcmac_id,
+                              field, ctx);
+        words[2] = ((__u32)(mac[0] ^ 0x02) << 24) | ((__u32)mac[1] << 16) |
+                   ((__u32)mac[2] << 8) | 0xFF;
+        words[3] = (0xFEu << 24) | ((__u32)mac[3] << 16) | ((__u32)mac[4] << 8) | mac[5];
+    }
+    
+    __be32 mapped[4];
+#pragma unroll
+    for (__u32 i = 0; i < 4; i++) {
+        mapped[i] = htonl(words[i]);
+    }
+    mapping_vault_record_ipv6(ctx, addr, mapped, field);
+
+#pragma unroll
+    for (__u32 i = 0; i < 4; i++) {
+        *delta = csum_delta_add4(*delta, addr[i], mapped[i]);
+        addr[i] = mapped[i];
+    }
+}
+
+static inline void process_arp_mac(unsigned char *arp_data, anonymization_context *ctx) {
+    anonymize_mac_address(&arp_data[0], true, true, MAPPING_FIELD_ARP, ctx);
+    anonymize_mac_address(&arp_data[10], true, true, MAPPING_FIELD_ARP, ctx);
+}
+
+static inline void process_arp_ip(unsigned char *arp_data, anonymization_context *ctx) {
+    __u32 *sender_ip = (__u32 *)&arp_data[6];
+    __u32 *target_ip = (__u32 *)&arp_data[16];
+    
+    *sender_ip = htonl(map_ipv4_address(ntohl(*sender_ip), MAPPING_FIELD_SRC, ctx));
+    *target_ip = htonl(map_ipv4_address(ntohl(*target_ip), MAPPING_FIELD_DST, ctx));
 }
 
 static inline bool is_multicast_mac(const unsigned char *mac) {
@@ -103,6 +608,12 @@ static inline bool is_broadcast_mac(const unsigned char *mac) {
             mac[3] == 0xFF && mac[4] == 0xFF && mac[5] == 0xFF);
 }
 
+/* Frames the datapath passes through untouched; shared with offline tools. */
+static inline bool is_passthrough_frame(const struct ethhdr *eth, const anonymization_config *config) {
+    return (is_multicast_mac(eth->h_dest) || is_broadcast_mac(eth->h_dest)) &&
+           !config->anonymize_multicast_broadcast;
+}
+
 static inline bool is_arp_packet(const struct ethhdr *eth) {
     return ntohs(eth->h_proto) == ETH_P_ARP;
 }
@@ -111,6 +622,10 @@ static inline bool is_ipv4_packet(const struct ethhdr *eth) {
     return ntohs(eth->h_proto) == ETH_P_IP;
 }
 
+static inline bool is_ipv6_packet(const struct ethhdr *eth) {
+    return ntohs(eth->h_proto) == ETH_P_IPV6;
+}
+
 static inline bool is_multicast_ip(__u32 ip_addr) {
     return (ip_addr & 0xF0000000) == 0xE0000000;
 }
@@ -126,94 +641,828 @@ static inline bool is_private_ip(__u32 ip_addr) {
            (first_byte == 192 && ((ip_addr >> 16) & 0xFF) == 168);
 }
 
-static inline void anonymize_ethernet_header(struct ethhdr *eth, const anonymization_config *config) {
-    if (config->anonymize_srcmac_oui) {
-        process_mac_oui(eth->h_source, config->random_salt);
-    }
-    if (config->anonymize_srcmac_id) {
-        process_mac_id(eth->h_source, config->random_salt);
+static inline void anonymize_ethernet_header(struct ethhdr *eth, anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    
+    anonymize_mac_address(eth->h_source, config->anonymize_srcmac_oui,
+                          config->anonymize_srcmac_id, MAPPING_FIELD_SRC, ctx);
+    anonymize_mac_address(eth->h_dest, config->anonymize_dstmac_oui,
+                          config->anonymize_dstmac_id, MAPPING_FIELD_DST, ctx);
+}
+
+/*
+ * Returns the net change to the packet's 16-bit word sum. The IPv4 header
+ * checksum absorbs the address rewrite, so only the L4 checksum word is left.
+ */
+static inline __u32 anonymize_ip_header(struct iphdr *iph, void *data_end,
+                                        anonymization_context *ctx) {
+    __u32 delta = 0;
+    
+    if (ctx->config->anonymize_srcipv4) {
+        __be32 original = iph->saddr;
+        iph->saddr = htonl(map_ipv4_address(ntohl(original), MAPPING_FIELD_SRC, ctx));
+        delta = csum_delta_add4(delta, original, iph->saddr);
     }
-    if (config->anonymize_dstmac_oui) {
-        process_mac_oui(eth->h_dest, config->random_salt);
+    
+    if (ctx->config->anonymize_dstipv4) {
+        __be32 original = iph->daddr;
+        iph->daddr = htonl(map_ipv4_address(ntohl(original), MAPPING_FIELD_DST, ctx));
+        delta = csum_delta_add4(delta, original, iph->daddr);
     }
-    if (config->anonymize_dstmac_id) {
-        process_mac_id(eth->h_dest, config->random_salt);
+    
+    if (!delta) {
+        return 0;
     }
+    
+    csum_apply_delta(&iph->check, delta);
+    return update_l4_checksum(iph, data_end, delta);
 }
 
-static inline void anonymize_ip_header(struct iphdr *iph, const anonymization_config *config) {
-    if (config->anonymize_srcipv4) {
-        if (config->preserve_prefix) {
-            iph->saddr = process_ip_with_prefix(iph->saddr, config->random_salt, config->src_ip_mask_lengths);
+static inline bool ipv6_is_extension_header(__u8 nexthdr) {
+    return nexthdr == IPPROTO_HOPOPTS || nexthdr == IPPROTO_ROUTING ||
+           nexthdr == IPPROTO_FRAGMENT || nexthdr == IPPROTO_DSTOPTS || nexthdr == IPPROTO_AH;
+}
+
+/*
+ * Walks at most IPV6_MAX_EXT_HEADERS extension headers and returns the
+ * upper-layer header, or NULL when the chain is truncated or longer.
+ */
+static inline void *ipv6_find_l4(struct ipv6hdr *ip6h, void *data_end, __u8 *protocol,
+                                 bool *later_fragment) {
+    unsigned char *pos = (unsigned char *)(ip6h + 1);
+    __u8 nexthdr = ip6h->nexthdr;
+    *later_fragment = false;
+
+#pragma unroll
+    for (int i = 0; i < IPV6_MAX_EXT_HEADERS; i++) {
+        if (!ipv6_is_extension_header(nexthdr)) {
+            break;
+        }
+        
+        struct ipv6_opt_hdr *ext = (struct ipv6_opt_hdr *)pos;
+        if ((void *)(pos + 8) > data_end) {
+            return NULL;
+        }
+        
+        __u32 len;
+        if (nexthdr == IPPROTO_FRAGMENT) {
+            len = 8;
+            if (ntohs(*(__be16 *)(pos + 2)) & IPV6_FRAG_OFFSET_MASK) {
+                *later_fragment = true;
+            }
+        } else if (nexthdr == IPPROTO_AH) {
+            len = (ext->hdrlen + 2) * 4;
         } else {
-            iph->saddr = process_ip_full(iph->saddr, config->random_salt);
+            len = (ext->hdrlen + 1) * 8;
         }
+        nexthdr = ext->nexthdr;
+        pos += len;
     }
     
-    if (config->anonymize_dstipv4) {
-        if (config->preserve_prefix) {
-            iph->daddr = process_ip_with_prefix(iph->daddr, config->random_salt, config->dest_ip_mask_lengths);
-        } else {
-            iph->daddr = process_ip_full(iph->daddr, config->random_salt);
+    if (ipv6_is_extension_header(nexthdr)) {
+        return NULL;
+    }
+    *protocol = nexthdr;
+    return pos;
+}
+
+/* Link-layer address options carry the sender's MAC; rewrite it like the Ethernet source. */
+static inline void anonymize_ndp_options(unsigned char *opt, void *data_end,
+                                         anonymization_context *ctx, __u32 *delta) {
+    const anonymization_config *config = ctx->config;
+
+#pragma unroll
+    for (int i = 0; i < NDP_MAX_OPTIONS; i++) {
+        if ((void *)(opt + 8) > data_end || !opt[1]) {
+            return;
         }
+        
+        if ((opt[0] == NDP_OPT_SOURCE_LL || opt[0] == NDP_OPT_TARGET_LL) && opt[1] == 1) {
+            __u16 before[3];
+            __u16 after[3];
+            __builtin_memcpy(before, opt + 2, sizeof(before));
+            anonymize_mac_address(opt + 2, config->anonymize_srcmac_oui,
+                                  config->anonymize_srcmac_id, MAPPING_FIELD_SRC, ctx);
+            __builtin_memcpy(after, opt + 2, sizeof(after));
+            *delta = csum_delta_words(*delta, before, after, 3);
+        }
+        opt += opt[1] * 8;
+    }
+}
+
+/* ff02::1:ffXX:XXXX embeds the low 24 bits of the solicited target. */
+static inline void update_solicited_node(struct ipv6hdr *ip6h, const __be32 *target,
+                                         __u32 *delta) {
+    __be32 *dst = (__be32 *)&ip6h->daddr;
+    if (dst[0] != htonl(0xFF020000) || dst[1] || dst[2] != htonl(1) ||
+        (ntohl(dst[3]) >> 24) != 0xFF) {
+        return;
     }
     
-    iph->check = recalculate_ip_checksum(iph);
+    __be32 mapped = htonl(0xFF000000 | (ntohl(target[3]) & 0x00FFFFFF));
+    *delta = csum_delta_add4(*delta, dst[3], mapped);
+    dst[3] = mapped;
 }
 
-static inline bool anonymize_packet(void *data, size_t data_len, 
-                                  const anonymization_config *config,
-                                  packet_modifications *mods) {
-    if (data_len < sizeof(struct ethhdr)) {
+static inline bool anonymize_ndp(struct ipv6hdr *ip6h, struct icmp6hdr *icmp6h, void *data_end,
+                                 anonymization_context *ctx, __u32 *delta) {
+    __u8 type = icmp6h->icmp6_type;
+    if (type < NDP_NEIGHBOR_SOLICIT || type > NDP_REDIRECT) {
         return false;
     }
     
-    struct ethhdr *eth = (struct ethhdr *)data;
+    unsigned char *body = (unsigned char *)icmp6h;
+    __u32 options = type == NDP_REDIRECT ? NDP_REDIRECT_OPTIONS_OFFSET : NDP_OPTIONS_OFFSET;
+    if ((void *)(body + options) > data_end) {
+        return false;
+    }
     
-    if (is_arp_packet(eth)) {
-        if (data_len < sizeof(struct ethhdr) + sizeof(struct arphdr)) {
-            return false;
+    __be32 *target = (__be32 *)(body + NDP_TARGET_OFFSET);
+    map_ipv6_address(target, type == NDP_NEIGHBOR_ADVERT ? MAPPING_FIELD_SRC : MAPPING_FIELD_DST,
+                     ctx, delta);
+    if (type == NDP_REDIRECT) {
+        map_ipv6_address((__be32 *)(body + NDP_REDIRECT_DEST_OFFSET), MAPPING_FIELD_DST, ctx, delta);
+    }
+    if (type == NDP_NEIGHBOR_SOLICIT) {
+        update_solicited_node(ip6h, target, delta);
+    }
+    
+    anonymize_ndp_options(body + options, data_end, ctx, delta);
+    return true;
+}
+
+/*
+ * *residual receives the net change to the packet's 16-bit word sum. When
+ * the upper-layer checksum is updated it cancels the address change exactly.
+ */
+static inline bool anonymize_ipv6_header(struct ipv6hdr *ip6h, void *data_end,
+                                         anonymization_context *ctx, __u32 *residual) {
+    const anonymization_config *config = ctx->config;
+    packet_modifications *mods = ctx->mods;
+    bool later_fragment;
+    __u8 protocol;
+    __u32 delta = 0;
+    
+    void *l4 = ipv6_find_l4(ip6h, data_end, &protocol, &later_fragment);
+    if (!l4) {
+        return false;
+    }
+    
+    if (config->anonymize_srcipv6) {
+        map_ipv6_address((__be32 *)&ip6h->saddr, MAPPING_FIELD_SRC, ctx, &delta);
+        mods->ipv6_src_modified = true;
+    }
+    if (config->anonymize_dstipv6) {
+        map_ipv6_address((__be32 *)&ip6h->daddr, MAPPING_FIELD_DST, ctx, &delta);
+        mods->ipv6_dst_modified = true;
+    }
+    
+    *residual = delta;
+    if (later_fragment) {
+        return true;
+    }
+    
+    if (protocol == IPPROTO_ICMPV6) {
+        struct icmp6hdr *icmp6h = l4;
+        if ((void *)(icmp6h + 1) > data_end) {
+            return true;
         }
-        
-        struct arphdr *arp = (struct arphdr *)(eth + 1);
+        if (config->anonymize_ndp && anonymize_ndp(ip6h, icmp6h, data_end, ctx, &delta)) {
+            mods->ndp_modified = true;
+        }
+        *residual = delta;
+        if (delta) {
+            *residual += csum_apply_delta(&icmp6h->icmp6_cksum, delta);
+        }
+        return true;
+    }
+    
+    if (delta) {
+        *residual += apply_l4_checksum_delta(l4, protocol, data_end, delta);
+    }
+    return true;
+}
+
+static inline void anonymize_arp_payload(unsigned char *arp_data, anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    
+    if (config->anonymize_mac_in_arphdr) {
+        process_arp_mac(arp_data, ctx);
+        ctx->mods->arp_modified = true;
+    }
+    
+    if (config->anonymize_ipv4_in_arphdr) {
+        process_arp_ip(arp_data, ctx);
+        ctx->mods->arp_modified = true;
+    }
+}
+
+/*
+ * Rewrites the ARP, IPv4 or IPv6 header the walker found; other payloads
+ * are left alone. *residual is only maintained when non-NULL, for packets
+ * nested in a tunnel whose outer checksum covers them.
+ */
+static inline bool anonymize_network_header(const l2_headers *hdrs, void *data_end,
+                                            anonymization_context *ctx, __u32 *residual) {
+    const anonymization_config *config = ctx->config;
+    packet_modifications *mods = ctx->mods;
+    __u32 change = 0;
+    
+    if (hdrs->l3_proto == ETH_P_ARP) {
+        struct arphdr *arp = hdrs->l3;
         unsigned char *arp_data = (unsigned char *)(arp + 1);
         
-        if (config->anonymize_mac_in_arphdr) {
-            process_arp_mac(arp, arp_data, config->random_salt);
-            mods->arp_modified = true;
+        if ((void *)(arp_data + ARP_IPV4_PAYLOAD_LEN) > data_end) {
+            mods->error_reason = ANON_ERROR_TRUNCATED_ARP;
+            return false;
         }
         
-        if (config->anonymize_ipv4_in_arphdr) {
-            process_arp_ip(arp, arp_data, config->random_salt);
-            mods->arp_modified = true;
+        if (!residual) {
+            anonymize_arp_payload(arp_data, ctx);
+            return true;
         }
         
-        anonymize_ethernet_header(eth, config);
-        mods->eth_src_modified = config->anonymize_srcmac_oui || config->anonymize_srcmac_id;
-        mods->eth_dst_modified = config->anonymize_dstmac_oui || config->anonymize_dstmac_id;
+        __u16 before[ARP_IPV4_PAYLOAD_LEN / 2];
+        __u16 after[ARP_IPV4_PAYLOAD_LEN / 2];
+        __builtin_memcpy(before, arp_data, sizeof(before));
+        anonymize_arp_payload(arp_data, ctx);
+        __builtin_memcpy(after, arp_data, sizeof(after));
+        change = csum_delta_words(0, before, after, ARP_IPV4_PAYLOAD_LEN / 2);
+    } else if (hdrs->l3_proto == ETH_P_IP) {
+        struct iphdr *iph = hdrs->l3;
         
+        if ((void *)(iph + 1) > data_end || iph->ihl < 5) {
+            mods->error_reason = ANON_ERROR_BAD_IPV4;
+            return false;
+        }
+        
+        change = anonymize_ip_header(iph, data_end, ctx);
+        mods->ip_src_modified = config->anonymize_srcipv4;
+        mods->ip_dst_modified = config->anonymize_dstipv4;
+    } else if (hdrs->l3_proto == ETH_P_IPV6) {
+        struct ipv6hdr *ip6h = hdrs->l3;
+        
+        if ((void *)(ip6h + 1) > data_end || !anonymize_ipv6_header(ip6h, data_end, ctx, &change)) {
+            mods->error_reason = ANON_ERROR_BAD_IPV6;
+            return false;
+        }
+    }
+    
+    if (residual) {
+        *residual += change;
+    }
+    return true;
+}
+
+/* Upper-layer header of an unfragmented (or first-fragment) IP packet, or NULL. */
+static inline void *network_header_l4(const l2_headers *hdrs, void *data_end, __u8 *protocol) {
+    if (hdrs->l3_proto == ETH_P_IP) {
+        struct iphdr *iph = hdrs->l3;
+        if (iph->frag_off & htons(IPV4_FRAG_OFFSET_MASK)) {
+            return NULL;
+        }
+        *protocol = iph->protocol;
+        return (void *)iph + iph->ihl * 4;
+    }
+    
+    if (hdrs->l3_proto == ETH_P_IPV6) {
+        bool later_fragment;
+        void *l4 = ipv6_find_l4(hdrs->l3, data_end, protocol, &later_fragment);
+        return later_fragment ? NULL : l4;
+    }
+    
+    return NULL;
+}
+
+/*
+ * One level of decapsulation: the inner frame is rewritten with the same
+ * config as the outer one and the outer UDP or GRE checksum is patched
+ * with the inner frame's residual, so no payload checksum is recomputed.
+ */
+static inline bool anonymize_tunnel(const l2_headers *outer, void *data_end,
+                                    anonymization_context *ctx) {
+    __u8 protocol;
+    void *l4 = network_header_l4(outer, data_end, &protocol);
+    if (!l4) {
+        return true;
+    }
+    
+    __u8 encap = ENCAP_NONE;
+    __u16 inner_proto;
+    __sum16 *check;
+    void *inner = parse_tunnel_header(l4, protocol, data_end, &encap, &inner_proto, &check);
+    if (!inner) {
         return true;
     }
+    ctx->mods->encap = encap;
     
-    if (is_ipv4_packet(eth)) {
-        if (data_len < sizeof(struct ethhdr) + sizeof(struct iphdr)) {
+    l2_headers hdrs = { .l3 = inner, .l3_proto = inner_proto };
+    struct ethhdr *inner_eth = inner;
+    __u32 residual = 0;
+    
+    if (inner_proto == ETH_P_TEB) {
+        if ((void *)(inner_eth + 1) > data_end || !parse_l2_headers(inner_eth, data_end, &hdrs)) {
+            ctx->mods->error_reason = ANON_ERROR_BAD_INNER_FRAME;
             return false;
         }
-        
-        struct iphdr *iph = (struct iphdr *)(eth + 1);
-        
-        anonymize_ip_header(iph, config);
+    }
+    
+    if (!anonymize_network_header(&hdrs, data_end, ctx, &residual)) {
+        return false;
+    }
+    
+    if (inner_proto == ETH_P_TEB) {
+        /* h_dest and h_source: 2 * ETH_ALEN bytes, ETH_ALEN words. */
+        __u16 before[ETH_ALEN];
+        __u16 after[ETH_ALEN];
+        __builtin_memcpy(before, inner_eth, sizeof(before));
+        anonymize_ethernet_header(inner_eth, ctx);
+        __builtin_memcpy(after, inner_eth, sizeof(after));
+        residual = csum_delta_words(residual, before, after, ETH_ALEN);
+    }
+    
+    if (check && residual) {
+        csum_apply_delta(check, residual);
+        if (encap != ENCAP_GRE && !*check) {
+            *check = (__sum16)0xFFFF;
+        }
+    }
+    return true;
+}
+
+/*
+ * 5-tuple of an unfragmented TCP or UDP packet. Returns its L4 header, or
+ * NULL for anything the flow table and port rewrite leave alone.
+ */
+static inline void *read_flow_tuple(const l2_headers *hdrs, void *data_end, flow_tuple *tuple) {
+    __builtin_memset(tuple, 0, sizeof(*tuple));
+    
+    if (hdrs->l3_proto == ETH_P_IP) {
+        struct iphdr *iph = hdrs->l3;
+        if ((void *)(iph + 1) > data_end || iph->ihl < 5 ||
+            (iph->frag_off & htons(IPV4_FRAG_OFFSET_MASK | IPV4_MORE_FRAGMENTS))) {
+            return NULL;
+        }
+        tuple->family = FLOW_FAMILY_IPV4;
+        tuple->saddr[0] = iph->saddr;
+        tuple->daddr[0] = iph->daddr;
+    } else if (hdrs->l3_proto == ETH_P_IPV6) {
+        struct ipv6hdr *ip6h = hdrs->l3;
+        if ((void *)(ip6h + 1) > data_end) {
+            return NULL;
+        }
+        tuple->family = FLOW_FAMILY_IPV6;
+        __builtin_memcpy(tuple->saddr, &ip6h->saddr, sizeof(tuple->saddr));
+        __builtin_memcpy(tuple->daddr, &ip6h->daddr, sizeof(tuple->daddr));
+    } else {
+        return NULL;
+    }
+    
+    __u8 protocol;
+    __be16 *ports = network_header_l4(hdrs, data_end, &protocol);
+    if (!ports || (protocol != IPPROTO_TCP && protocol != IPPROTO_UDP) ||
+        (void *)(ports + 2) > data_end) {
+        return NULL;
+    }
+    tuple->protocol = protocol;
+    tuple->sport = ports[0];
+    tuple->dport = ports[1];
+    return ports;
+}
+
+/* Flow table hit: writes the stored addresses with the checksum updates of the full rewrite. */
+static inline void apply_flow_addresses(const l2_headers *hdrs, void *l4, void *data_end,
+                                        const flow_tuple *anonymized, anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    packet_modifications *mods = ctx->mods;
+    __u32 delta = 0;
+    
+    if (anonymized->family == FLOW_FAMILY_IPV4) {
+        struct iphdr *iph = hdrs->l3;
+        if ((void *)(iph + 1) > data_end) {
+            return;
+        }
+        if (config->anonymize_srcipv4) {
+            delta = csum_delta_add4(delta, iph->saddr, anonymized->saddr[0]);
+            iph->saddr = anonymized->saddr[0];
+        }
+        if (config->anonymize_dstipv4) {
+            delta = csum_delta_add4(delta, iph->daddr, anonymized->daddr[0]);
+            iph->daddr = anonymized->daddr[0];
+        }
+        if (delta) {
+            csum_apply_delta(&iph->check, delta);
+        }
         mods->ip_src_modified = config->anonymize_srcipv4;
         mods->ip_dst_modified = config->anonymize_dstipv4;
+    } else {
+        struct ipv6hdr *ip6h = hdrs->l3;
+        if ((void *)(ip6h + 1) > data_end) {
+            return;
+        }
+        if (config->anonymize_srcipv6) {
+            delta = csum_delta_words(delta, (const __u16 *)&ip6h->saddr,
+                                     (const __u16 *)anonymized->saddr, 8);
+            __builtin_memcpy(&ip6h->saddr, anonymized->saddr, sizeof(anonymized->saddr));
+        }
+        if (config->anonymize_dstipv6) {
+            delta = csum_delta_words(delta, (const __u16 *)&ip6h->daddr,
+                                     (const __u16 *)anonymized->daddr, 8);
+            __builtin_memcpy(&ip6h->daddr, anonymized->daddr, sizeof(anonymized->daddr));
+        }
+        mods->ipv6_src_modified = config->anonymize_srcipv6;
+        mods->ipv6_dst_modified = config->anonymize_dstipv6;
+    }
+    
+    if (delta) {
+        apply_l4_checksum_delta(l4, anonymized->protocol, data_end, delta);
+    }
+}
+
+/* Ports are only covered by the L4 checksum. Returns the net change to the word sum. */
+static inline __u32 write_transport_ports(__be16 *ports, __u8 protocol, void *data_end,
+                                          __be16 sport, __be16 dport) {
+    if ((void *)(ports + 2) > data_end) {
+        return 0;
+    }
+    
+    __u32 delta = csum_delta_add2(0, ports[0], sport);
+    delta = csum_delta_add2(delta, ports[1], dport);
+    ports[0] = sport;
+    ports[1] = dport;
+    return delta + apply_l4_checksum_delta(ports, protocol, data_end, delta);
+}
+
+static inline __u32 anonymize_transport_ports(__be16 *ports, __u8 protocol, void *data_end,
+                                              const anonymization_config *config) {
+    if ((void *)(ports + 2) > data_end) {
+        return 0;
+    }
+    
+    return write_transport_ports(ports, protocol, data_end,
+                          htons(process_port(ntohs(ports[0]), config)),
+                          htons(process_port(ntohs(ports[1]), config)));
+}
+
+/*
+ * Payload scrubbing. Addresses embedded in DHCP, DNS answers and ICMP
+ * error quotes go through the same mapping functions as the headers, so
+ * they match. Each writer is handed a pointer the caller bounds-checked
+ * and the field's offset from the start of the checksummed data, and
+ * returns its contribution to that checksum. 0.0.0.0 marks an unset
+ * field and is kept.
+ */
+static inline __u32 scrub_ipv4_at(unsigned char *pos, __u32 offset, __u32 field,
+                                  anonymization_context *ctx) {
+    __be32 original;
+    __builtin_memcpy(&original, pos, sizeof(original));
+    if (!original) {
+        return 0;
+    }
+    
+    __be32 mapped = htonl(map_ipv4_address(ntohl(original), field, ctx));
+    __builtin_memcpy(pos, &mapped, sizeof(mapped));
+    return csum_delta_at(csum_delta_add4(0, original, mapped), offset);
+}
+
+static inline __u32 scrub_ipv6_at(unsigned char *pos, __u32 offset, __u32 field,
+                                  anonymization_context *ctx) {
+    __be32 addr[4];
+    __u32 delta = 0;
+    __builtin_memcpy(addr, pos, sizeof(addr));
+    map_ipv6_address(addr, field, ctx, &delta);
+    __builtin_memcpy(pos, addr, sizeof(addr));
+    return csum_delta_at(delta, offset);
+}
+
+/* Embedded MACs are the client's own, so they follow the source MAC settings. */
+static inline __u32 scrub_mac_at(unsigned char *pos, __u32 offset, anonymization_context *ctx) {
+    __u16 before[3];
+    __u16 after[3];
+    __builtin_memcpy(before, pos, sizeof(before));
+    anonymize_mac_address(pos, ctx->config->anonymize_srcmac_oui, ctx->config->anonymize_srcmac_id,
+                          MAPPING_FIELD_SRC, ctx);
+    __builtin_memcpy(after, pos, sizeof(after));
+    return csum_delta_at(csum_delta_words(0, before, after, 3), offset);
+}
+
+/*
+ * BOOTP client and server addresses, chaddr, and the requested-IP,
+ * server-ID and client-ID options. Client addresses map as sources,
+ * server and relay addresses as destinations.
+ */
+static inline bool scrub_dhcp(unsigned char *bootp, void *data_end, anonymization_context *ctx,
+                              __u32 *delta) {
+    if ((void *)(bootp + DHCP_OPTIONS_OFFSET) > data_end) {
+        return false;
+    }
+    
+    *delta += scrub_ipv4_at(bootp + BOOTP_CIADDR_OFFSET, 0, MAPPING_FIELD_SRC, ctx);
+    *delta += scrub_ipv4_at(bootp + BOOTP_YIADDR_OFFSET, 0, MAPPING_FIELD_SRC, ctx);
+    *delta += scrub_ipv4_at(bootp + BOOTP_SIADDR_OFFSET, 0, MAPPING_FIELD_DST, ctx);
+    *delta += scrub_ipv4_at(bootp + BOOTP_GIADDR_OFFSET, 0, MAPPING_FIELD_DST, ctx);
+    if (bootp[1] == ARPHRD_ETHER && bootp[2] == ETH_ALEN) {
+        *delta += scrub_mac_at(bootp + BOOTP_CHADDR_OFFSET, 0, ctx);
+    }
+    
+    __be32 cookie;
+    __builtin_memcpy(&cookie, bootp + DHCP_COOKIE_OFFSET, sizeof(cookie));
+    if (cookie != htonl(DHCP_MAGIC_COOKIE)) {
+        return true;
+    }
+    
+    __u32 offset = DHCP_OPTIONS_OFFSET;
+    for (int i = 0; i < DHCP_MAX_OPTIONS; i++) {
+        unsigned char *opt = bootp + offset;
+        if ((void *)(opt + 2) > data_end || opt[0] == DHCP_OPT_END) {
+            break;
+        }
+        if (opt[0] == DHCP_OPT_PAD) {
+            offset++;
+            continue;
+        }
         
-        anonymize_ethernet_header(eth, config);
-        mods->eth_src_modified = config->anonymize_srcmac_oui || config->anonymize_srcmac_id;
-        mods->eth_dst_modified = config->anonymize_dstmac_oui || config->anonymize_dstmac_id;
+        if ((opt[0] == DHCP_OPT_REQUESTED_IP || opt[0] == DHCP_OPT_SERVER_ID) && opt[1] == 4 &&
+            (void *)(opt + 6) <= data_end) {
+            *delta += scrub_ipv4_at(opt + 2, offset + 2, opt[0] == DHCP_OPT_REQUESTED_IP ?
+                                    MAPPING_FIELD_SRC : MAPPING_FIELD_DST, ctx);
+        } else if (opt[0] == DHCP_OPT_CLIENT_ID && opt[1] == ETH_ALEN + 1 &&
+                   opt[2] == ARPHRD_ETHER && (void *)(opt + 3 + ETH_ALEN) <= data_end) {
+            *delta += scrub_mac_at(opt + 3, offset + 3, ctx);
+        }
+        offset += 2 + opt[1];
+    }
+    return true;
+}
+
+/* Offset just past the name at offset, or 0 when it is malformed or too long. */
+static inline __u32 dns_skip_name(unsigned char *dns, __u32 offset, void *data_end) {
+    for (int i = 0; i < DNS_MAX_LABELS; i++) {
+        if (offset > DNS_MAX_OFFSET) {
+            return 0;
+        }
+        unsigned char *label = dns + offset;
+        if ((void *)(label + 1) > data_end) {
+            return 0;
+        }
+        if ((*label & 0xC0) == 0xC0) {
+            return offset + 2;
+        }
+        if (*label & 0xC0) {
+            return 0;
+        }
+        if (!*label) {
+            return offset + 1;
+        }
+        offset += *label + 1;
+    }
+    return 0;
+}
+
+/*
+ * A and AAAA records of a response, in every section, up to
+ * DNS_MAX_RECORDS. The walk stops at the first record it cannot parse.
+ * PTR names are text of a different length and are left alone.
+ */
+static inline bool scrub_dns(unsigned char *dns, void *data_end, anonymization_context *ctx,
+                             __u32 *delta) {
+    if ((void *)(dns + DNS_HEADER_LEN) > data_end || !(dns[2] & 0x80) ||
+        ((dns[4] << 8) | dns[5]) != 1) {
+        return false;
+    }
+    __u32 records = ((dns[6] << 8) | dns[7]) + ((dns[8] << 8) | dns[9]) +
+                    ((dns[10] << 8) | dns[11]);
+    
+    __u32 offset = dns_skip_name(dns, DNS_HEADER_LEN, data_end);
+    if (!offset) {
+        return false;
+    }
+    offset += 4;
+    
+    for (__u32 i = 0; i < DNS_MAX_RECORDS && i < records; i++) {
+        offset = dns_skip_name(dns, offset, data_end);
+        if (!offset || offset > DNS_MAX_OFFSET) {
+            break;
+        }
+        unsigned char *rr = dns + offset;
+        if ((void *)(rr + DNS_RR_HEADER_LEN) > data_end) {
+            break;
+        }
         
+        __u16 type = (rr[0] << 8) | rr[1];
+        __u16 rr_class = (rr[2] << 8) | rr[3];
+        __u16 rdlength = (rr[8] << 8) | rr[9];
+        unsigned char *rdata = rr + DNS_RR_HEADER_LEN;
+        if (rr_class == DNS_CLASS_IN && type == DNS_TYPE_A && rdlength == 4 &&
+            (void *)(rdata + 4) <= data_end) {
+            *delta += scrub_ipv4_at(rdata, offset + DNS_RR_HEADER_LEN, MAPPING_FIELD_DST, ctx);
+        } else if (rr_class == DNS_CLASS_IN && type == DNS_TYPE_AAAA && rdlength == 16 &&
+                   (void *)(rdata + 16) <= data_end) {
+            *delta += scrub_ipv6_at(rdata, offset + DNS_RR_HEADER_LEN, MAPPING_FIELD_DST, ctx);
+        }
+        offset += DNS_RR_HEADER_LEN + rdlength;
+    }
+    return true;
+}
+
+static inline bool is_icmp_error(__u8 type) {
+    return type == ICMP_DEST_UNREACH || type == ICMP_SOURCE_QUENCH || type == ICMP_REDIRECT ||
+           type == ICMP_TIME_EXCEEDED || type == ICMP_PARAMETERPROB;
+}
+
+static inline bool is_icmpv6_error(__u8 type) {
+    return type == ICMPV6_DEST_UNREACH || type == ICMPV6_PKT_TOOBIG ||
+           type == ICMPV6_TIME_EXCEED || type == ICMPV6_PARAMPROB;
+}
+
+/*
+ * The quoted packet is rewritten the way the packet that caused the error
+ * was, addresses and ports alike, so the error still matches its flow.
+ * Returns the change to the ICMP checksum's word sum.
+ */
+static inline __u32 scrub_quoted_packet(void *quoted, __u16 proto, void *data_end,
+                                        anonymization_context *ctx) {
+    __u32 change = 0;
+    if (proto == ETH_P_IP) {
+        struct iphdr *iph = quoted;
+        if ((void *)(iph + 1) > data_end || iph->version != 4 || iph->ihl < 5) {
+            return 0;
+        }
+        change = anonymize_ip_header(iph, data_end, ctx);
+    } else {
+        struct ipv6hdr *ip6h = quoted;
+        if ((void *)(ip6h + 1) > data_end || ip6h->version != 6 ||
+            !anonymize_ipv6_header(ip6h, data_end, ctx, &change)) {
+            return 0;
+        }
+    }
+    
+    if (ctx->config->anonymize_ports) {
+        l2_headers hdrs = { .l3 = quoted, .l3_proto = proto };
+        __u8 protocol;
+        __be16 *ports = network_header_l4(&hdrs, data_end, &protocol);
+        if (ports && (protocol == IPPROTO_TCP || protocol == IPPROTO_UDP)) {
+            change += anonymize_transport_ports(ports, protocol, data_end, ctx->config);
+        }
+    }
+    return change;
+}
+
+static inline void scrub_udp_payload(struct udphdr *udph, void *data_end, __u16 l3_proto,
+                                     anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    __u16 sport = ntohs(udph->source);
+    __u16 dport = ntohs(udph->dest);
+    unsigned char *payload = (unsigned char *)(udph + 1);
+    __u32 delta = 0;
+    
+    if (config->scrub_dhcp && l3_proto == ETH_P_IP &&
+        (sport == DHCP_SERVER_PORT || sport == DHCP_CLIENT_PORT) &&
+        (dport == DHCP_SERVER_PORT || dport == DHCP_CLIENT_PORT)) {
+        ctx->mods->dhcp_scrubbed = scrub_dhcp(payload, data_end, ctx, &delta);
+    } else if (config->scrub_dns && sport == DNS_PORT) {
+        ctx->mods->dns_scrubbed = scrub_dns(payload, data_end, ctx, &delta);
+    }
+    
+    if (delta) {
+        apply_l4_checksum_delta(udph, IPPROTO_UDP, data_end, delta);
+    }
+}
+
+/* Runs on the outermost packet only, after its headers were rewritten. */
+static inline void scrub_payload(const l2_headers *hdrs, void *data_end,
+                                 anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    if (!config->scrub_dhcp && !config->scrub_dns && !config->scrub_icmp_errors) {
+        return;
+    }
+    
+    __u8 protocol;
+    void *l4 = network_header_l4(hdrs, data_end, &protocol);
+    if (!l4) {
+        return;
+    }
+    
+    if (protocol == IPPROTO_UDP) {
+        struct udphdr *udph = l4;
+        if ((void *)(udph + 1) <= data_end) {
+            scrub_udp_payload(udph, data_end, hdrs->l3_proto, ctx);
+        }
+    } else if (protocol == IPPROTO_ICMP && config->scrub_icmp_errors &&
+               hdrs->l3_proto == ETH_P_IP) {
+        struct icmphdr *icmph = l4;
+        if ((void *)(icmph + 1) > data_end || !is_icmp_error(icmph->type)) {
+            return;
+        }
+        __u32 delta = 0;
+        if (icmph->type == ICMP_REDIRECT) {
+            delta = scrub_ipv4_at((unsigned char *)&icmph->un.gateway, 0, MAPPING_FIELD_DST, ctx);
+        }
+        delta += scrub_quoted_packet(icmph + 1, ETH_P_IP, data_end, ctx);
+        if (delta) {
+            csum_apply_delta(&icmph->checksum, delta);
+        }
+        ctx->mods->icmp_error_scrubbed = true;
+    } else if (protocol == IPPROTO_ICMPV6 && config->scrub_icmp_errors) {
+        struct icmp6hdr *icmp6h = l4;
+        if ((void *)(icmp6h + 1) > data_end || !is_icmpv6_error(icmp6h->icmp6_type)) {
+            return;
+        }
+        __u32 delta = scrub_quoted_packet(icmp6h + 1, ETH_P_IPV6, data_end, ctx);
+        if (delta) {
+            csum_apply_delta(&icmp6h->icmp6_cksum, delta);
+        }
+        ctx->mods->icmp_error_scrubbed = true;
+    }
+}
+
+/* Stage protocol for frames that are not ARP, IPv4 or IPv6; 0xffff is a reserved EtherType. */
+#define STAGE_PROTO_OTHER 0xFFFF
+
+/*
+ * A pipeline stage sets ctx->stage_proto to the one network protocol it
+ * handles. Pinning hdrs->l3_proto to that constant lets the compiler drop
+ * every other protocol's code from the stage.
+ */
+static inline bool pin_stage_protocol(l2_headers *hdrs, __u16 stage_proto) {
+    __u16 proto = hdrs->l3_proto;
+    if (stage_proto == STAGE_PROTO_OTHER) {
+        if (proto == ETH_P_ARP || proto == ETH_P_IP || proto == ETH_P_IPV6) {
+            return false;
+        }
+        hdrs->l3_proto = 0;
+        return true;
+    }
+    if (proto != stage_proto) {
+        return false;
+    }
+    hdrs->l3_proto = stage_proto;
+    return true;
+}
+
+static inline bool anonymize_packet(void *data, void *data_end,
+                                    anonymization_context *ctx) {
+    const anonymization_config *config = ctx->config;
+    packet_modifications *mods = ctx->mods;
+    struct ethhdr *eth = data;
+    l2_headers hdrs;
+    
+    if ((void *)(eth + 1) > data_end || !parse_l2_headers(eth, data_end, &hdrs)) {
+        mods->error_reason = ANON_ERROR_TRUNCATED_L2;
+        return false;
+    }
+    mods->l3_proto = hdrs.l3_proto;
+    if (ctx->stage_proto && !pin_stage_protocol(&hdrs, ctx->stage_proto)) {
+        mods->error_reason = ANON_ERROR_NO_STAGE;
+        return false;
+    }
+    mods->vlan_depth = hdrs.vlan_depth;
+    mods->mpls_labels = hdrs.mpls_labels;
+    
+    flow_tuple original;
+    __be16 *ports = NULL;
+    if (config->flow_table || config->anonymize_ports) {
+        ports = read_flow_tuple(&hdrs, data_end, &original);
+    }
+    __u64 bytes = data_end - hdrs.l3 + ctx->frag_bytes;
+    flow_entry *flow = NULL;
+    if (ports && config->flow_table) {
+        flow = flow_table_lookup(ctx, &original, bytes);
+    }
+    
+    if (flow) {
+        apply_flow_addresses(&hdrs, ports, data_end, &flow->anonymized, ctx);
+    } else if (!anonymize_network_header(&hdrs, data_end, ctx, NULL)) {
+        return false;
+    }
+    if (!anonymize_tunnel(&hdrs, data_end, ctx)) {
+        return false;
+    }
+    scrub_payload(&hdrs, data_end, ctx);
+    /* The frame is dropped, so it must not seed a flow entry either. */
+    if (mods->policy_drop) {
         return true;
     }
     
-    anonymize_ethernet_header(eth, config);
+    /* After decapsulation, so a remapped port is never taken for VXLAN or GENEVE. */
+    if (ports && config->anonymize_ports && mods->encap == ENCAP_NONE) {
+        if (flow) {
+            write_transport_ports(ports, original.protocol, data_end,
+                                  flow->anonymized.sport, flow->anonymized.dport);
+        } else {
+            anonymize_transport_ports(ports, original.protocol, data_end, config);
+        }
+        mods->ports_modified = true;
+    }
+    
+    if (ports && config->flow_table && !flow) {
+        flow_tuple anonymized;
+        if (read_flow_tuple(&hdrs, data_end, &anonymized)) {
+            flow_table_record(ctx, &original, &anonymized, bytes);
+        }
+    }
+    
+    anonymize_ethernet_header(eth, ctx);
     mods->eth_src_modified = config->anonymize_srcmac_oui || config->anonymize_srcmac_id;
     mods->eth_dst_modified = config->anonymize_dstmac_oui || config->anonymize_dstmac_id;
     
@@ -71,6 +71,9 @@ install_debian() {
     # Install BPF dependencies
     sudo apt-get install -y libbpf-dev libelf-dev zlib1g-dev
     
+    # Install bpftool (generates the BPF skeleton)
+    sudo apt-get install -y linux-tools-common linux-tools-$(uname -r) || sudo apt-get install -y bpftool
+    
     # Install kernel headers
     sudo apt-get install -y linux-headers-$(uname -r)
     
@@ -105,7 +108,7 @@ install_rhel() {
     sudo yum install -y clang llvm llvm-devel
     
     # Install BPF dependencies
-    sudo yum install -y libbpf-devel elfutils-libelf-devel zlib-devel
+    sudo yum install -y libbpf-devel elfutils-libelf-devel zlib-devel bpftool
     
     # Install kernel headers
     sudo yum install -y kernel-devel
@@ -126,7 +129,7 @@ install_fedora() {
     sudo dnf install -y clang llvm llvm-devel
     
     # Install BPF dependencies
-    sudo dnf install -y libbpf-devel elfutils-libelf-devel zlib-devel
+    sudo dnf install -y libbpf-devel elfutils-libelf-devel zlib-devel bpftool
     
     # Install kernel headers
     sudo dnf install -y kernel-devel
@@ -146,7 +149,7 @@ install_arch() {
     sudo pacman -S --noconfirm clang llvm
     
     # Install BPF dependencies
-    sudo pacman -S --noconfirm libbpf elfutils zlib
+    sudo pacman -S --noconfirm libbpf elfutils zlib bpf
     
     # Install kernel headers
     sudo pacman -S --noconfirm linux-headers
@@ -177,6 +180,10 @@ verify_installation() {
         missing_deps+=("llvm-strip")
     fi
     
+    if ! command_exists bpftool; then
+        missing_deps+=("bpftool")
+    fi
+    
     if ! command_exists pkg-config; then
         missing_deps+=("pkg-config")
     fi
@@ -198,13 +205,13 @@ verify_installation() {
 # Function to check kernel version
 check_kernel_version() {
     local kernel_version=$(uname -r | cut -d. -f1,2)
-    local required_version="5.10"
+    local required_version="5.18"
     
     if [ "$(printf '%s\n' "$required_version" "$kernel_version" | sort -V | head -n1)" = "$required_version" ]; then
         print_success "Kernel version $(uname -r) is compatible"
     else
         print_warning "Kernel version $(uname -r) may not support all eBPF features"
-        print_warning "Recommended: Linux kernel 5.10 or later"
+        print_warning "Recommended: Linux kernel 5.18 or later"
     fi
 }
 
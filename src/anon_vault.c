@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "mapping_vault.h"
+
+#define MAX_MAPPING_IDS 64
+
+static const char *const field_names[] = {
+    [MAPPING_FIELD_SRC] = "src",
+    [MAPPING_FIELD_DST] = "dst",
+    [MAPPING_FIELD_ARP] = "arp"
+};
+
+static const char *field_name(__u32 field) {
+    return field <= MAPPING_FIELD_ARP ? field_names[field] : "unknown";
+}
+
+static bool parse_address(const char *text, __u8 *kind, __u8 address[16]) {
+    memset(address, 0, 16);
+    unsigned int mac[6];
+    char trailing;
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%c", &mac[0], &mac[1], &mac[2], &mac[3],
+               &mac[4], &mac[5], &trailing) == 6) {
+        for (int i = 0; i < 6; i++) {
+            address[i] = mac[i];
+        }
+        *kind = VAULT_KIND_MAC;
+        return true;
+    }
+    if (inet_pton(AF_INET, text, address) == 1) {
+        *kind = VAULT_KIND_IPV4;
+        return true;
+    }
+    if (inet_pton(AF_INET6, text, address) == 1) {
+        *kind = VAULT_KIND_IPV6;
+        return true;
+    }
+    return false;
+}
+
+static void format_address(__u8 kind, const __u8 *address, char *out, size_t size) {
+    if (kind == VAULT_KIND_MAC) {
+        snprintf(out, size, "%02x:%02x:%02x:%02x:%02x:%02x", address[0], address[1],
+                 address[2], address[3], address[4], address[5]);
+    } else if (!inet_ntop(kind == VAULT_KIND_IPV4 ? AF_INET : AF_INET6, address, out, size)) {
+        snprintf(out, size, "?");
+    }
+}
+
+static void print_record(const vault_record *record) {
+    char original[INET6_ADDRSTRLEN];
+    char anonymized[INET6_ADDRSTRLEN];
+    format_address(record->kind, record->original, original, sizeof(original));
+    format_address(record->kind, record->anonymized, anonymized, sizeof(anonymized));
+    
+    time_t seconds = record->first_seen_ms / 1000;
+    struct tm tm;
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&seconds, &tm));
+    printf("%-4s %-3s %08x %s -> %s first seen %s%s\n", vault_kind_name(record->kind),
+           field_name(record->field), record->mapping_id, original, anonymized, when,
+           record->flags & VAULT_FLAG_COLLISION ? " COLLISION" : "");
+}
+
+/* Vaults are scanned front to back, so matches print in first-seen order. */
+static int lookup(const mapping_vault *vault, const char *text, bool reverse) {
+    __u8 kind;
+    __u8 address[16];
+    if (!parse_address(text, &kind, address)) {
+        fprintf(stderr, "Not a MAC, IPv4 or IPv6 address: %s\n", text);
+        return 1;
+    }
+    
+    __u64 matches = 0;
+    __u64 count = mapping_vault_count(vault);
+    for (__u64 i = 0; i < count; i++) {
+        const vault_record *record = mapping_vault_record(vault, i);
+        const __u8 *stored = reverse ? record->anonymized : record->original;
+        if (record->kind == kind && memcmp(stored, address, 16) == 0) {
+            print_record(record);
+            matches++;
+        }
+    }
+    if (!matches) {
+        fprintf(stderr, "%s not found in %s\n", text, mapping_vault_path(vault));
+        return 1;
+    }
+    return 0;
+}
+
+/* Prints each flagged record after the earlier record it collided with. */
+static int list_collisions(const mapping_vault *vault) {
+    __u64 count = mapping_vault_count(vault);
+    __u64 collisions = 0;
+    for (__u64 i = 0; i < count; i++) {
+        const vault_record *record = mapping_vault_record(vault, i);
+        if (!(record->flags & VAULT_FLAG_COLLISION)) {
+            continue;
+        }
+        for (__u64 j = 0; j < i; j++) {
+            const vault_record *first = mapping_vault_record(vault, j);
+            if (first->mapping_id == record->mapping_id && first->kind == record->kind &&
+                memcmp(first->anonymized, record->anonymized, 16) == 0 &&
+                memcmp(first->original, record->original, 16) != 0) {
+                print_record(first);
+                break;
+            }
+        }
+        print_record(record);
+        printf("\n");
+        collisions++;
+    }
+    printf("%llu collisions\n", (unsigned long long)collisions);
+    return 0;
+}
+
+static int show_stats(const mapping_vault *vault) {
+    __u64 kinds[VAULT_KIND_IPV6 + 1] = {0};
+    __u32 mapping_ids[MAX_MAPPING_IDS];
+    __u64 id_records[MAX_MAPPING_IDS] = {0};
+    __u32 id_count = 0;
+    __u64 collisions = 0;
+    
+    __u64 count = mapping_vault_count(vault);
+    for (__u64 i = 0; i < count; i++) {
+        const vault_record *record = mapping_vault_record(vault, i);
+        if (record->kind <= VAULT_KIND_IPV6) {
+            kinds[record->kind]++;
+        }
+        if (record->flags & VAULT_FLAG_COLLISION) {
+            collisions++;
+        }
+        __u32 id = 0;
+        while (id < id_count && mapping_ids[id] != record->mapping_id) {
+            id++;
+        }
+        if (id == id_count && id_count < MAX_MAPPING_IDS) {
+            mapping_ids[id_count++] = record->mapping_id;
+        }
+        if (id < id_count) {
+            id_records[id]++;
+        }
+    }
+    
+    printf("Vault:       %s\n", mapping_vault_path(vault));
+    printf("Pairs:       %llu (%llu MAC, %llu IPv4, %llu IPv6)\n", (unsigned long long)count,
+           (unsigned long long)kinds[VAULT_KIND_MAC], (unsigned long long)kinds[VAULT_KIND_IPV4],
+           (unsigned long long)kinds[VAULT_KIND_IPV6]);
+    printf("Collisions:  %llu\n", (unsigned long long)collisions);
+    for (__u32 id = 0; id < id_count; id++) {
+        printf("Mapping %08x: %llu pairs\n", mapping_ids[id], (unsigned long long)id_records[id]);
+    }
+    if (id_count == MAX_MAPPING_IDS) {
+        printf("(only the first %d mapping ids are listed)\n", MAX_MAPPING_IDS);
+    }
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s forward <vault_file> <original_address>\n", prog);
+    fprintf(stderr, "       %s reverse <vault_file> <anonymized_address>\n", prog);
+    fprintf(stderr, "       %s collisions <vault_file>\n", prog);
+    fprintf(stderr, "       %s stats <vault_file>\n", prog);
+    fprintf(stderr, "Example: %s reverse /var/lib/xdp-anon/vault 10.83.2.17\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    const char *command = argv[1];
+    bool lookup_command = strcmp(command, "forward") == 0 || strcmp(command, "reverse") == 0;
+    bool listing_command = strcmp(command, "collisions") == 0 || strcmp(command, "stats") == 0;
+    if ((lookup_command && argc != 4) || (listing_command && argc != 3) ||
+        (!lookup_command && !listing_command)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    mapping_vault *vault = mapping_vault_open(argv[2], false);
+    if (!vault) {
+        return 1;
+    }
+    
+    int status;
+    if (lookup_command) {
+        status = lookup(vault, argv[3], strcmp(command, "reverse") == 0);
+    } else if (strcmp(command, "collisions") == 0) {
+        status = list_collisions(vault);
+    } else {
+        status = show_stats(vault);
+    }
+    mapping_vault_close(vault);
+    return status;
+}
@@ -0,0 +1,690 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common_structs.h"
+#include "config_parser.h"
+
+/*
+ * Address policy hooks, backed by offline_policy instead of the LPM tries.
+ * Defined below; they only read the policy, so workers share it.
+ */
+#define ANON_ADDRESS_POLICY
+static bool policy_lookup_ipv4(anonymization_context *ctx, __u32 ip_addr, policy_rule *rule);
+static bool policy_lookup_ipv6(anonymization_context *ctx, const __be32 *addr, policy_rule *rule);
+
+#include "rewrite_helpers.h"
+
+#define WINDOW_SIZE (256ULL << 20)
+#define MAX_WINDOW_RECORDS (1u << 20)
+#define MAX_WORKERS 64
+#define MAX_PCAPNG_INTERFACES 256
+
+#define PCAP_MAGIC_USEC 0xA1B2C3D4
+#define PCAP_MAGIC_NSEC 0xA1B23C4D
+#define PCAP_FILE_HEADER_LEN 24
+#define PCAP_RECORD_HEADER_LEN 16
+
+#define PCAPNG_BLOCK_SHB 0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_SPB 0x00000003
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_BLOCK_MIN_LEN 12
+#define PCAPNG_EPB_HEADER_LEN 28
+#define PCAPNG_SPB_HEADER_LEN 12
+
+#define LINKTYPE_ETHERNET 1
+
+#define MAX_POLICY_RUNS (33 + 129)
+
+#define CAPTURE_FORMAT_PCAP 0
+#define CAPTURE_FORMAT_PCAPNG 1
+
+#define RECORD_COPY 0
+#define RECORD_ANONYMIZED 1
+#define RECORD_DROP 2
+
+typedef struct {
+    __u64 start;
+    __u64 end;
+    __u64 data_offset;
+    __u32 captured_len;
+    __u32 action;
+} capture_record;
+
+typedef struct {
+    unsigned char *base;
+    size_t size;
+    int format;
+    bool swapped;
+    __u32 pcap_linktype;
+    __u32 interface_count;
+    __u32 interface_linktypes[MAX_PCAPNG_INTERFACES];
+} capture_file;
+
+typedef struct {
+    __u64 records;
+    __u64 anonymized;
+    __u64 passed_through;
+    __u64 dropped;
+    __u64 policy_dropped;
+    __u64 non_ethernet;
+} offline_stats;
+
+/* Prefixes of one family and length, a sorted slice of offline_policy.set.prefixes. */
+typedef struct {
+    __u8 family;
+    __u8 prefix_len;
+    __u32 first;
+    __u32 count;
+} policy_run;
+
+typedef struct {
+    policy_set set;
+    __u32 run_count;
+    policy_run runs[MAX_POLICY_RUNS];
+} offline_policy_index;
+
+typedef struct {
+    capture_file *file;
+    capture_record *records;
+    size_t first;
+    size_t count;
+    const anonymization_config *config;
+    const prefix_preserving_table *pp_table;
+    offline_stats stats;
+} worker_task;
+
+static offline_policy_index offline_policy;
+
+/*
+ * Longest prefix first, like the trie. Equal prefixes keep the last rule,
+ * which is the one the daemon's in-order inserts leave in the map.
+ */
+static int compare_policy_prefix(const void *a, const void *b) {
+    const policy_prefix *x = a;
+    const policy_prefix *y = b;
+    if (x->family != y->family) {
+        return x->family < y->family ? -1 : 1;
+    }
+    if (x->prefix_len != y->prefix_len) {
+        return x->prefix_len > y->prefix_len ? -1 : 1;
+    }
+    int order = memcmp(x->addr, y->addr, sizeof(x->addr));
+    if (order) {
+        return order;
+    }
+    return (x->rule.rule_id < y->rule.rule_id) - (x->rule.rule_id > y->rule.rule_id);
+}
+
+static int load_offline_policy(const char *path) {
+    policy_parse_result parsed = parse_policy_file(path);
+    if (!parsed.success) {
+        fprintf(stderr, "Policy error: %s\n", parsed.error_message);
+        return -1;
+    }
+    
+    offline_policy.set = parsed.policy;
+    policy_prefix *prefixes = offline_policy.set.prefixes;
+    __u32 count = offline_policy.set.prefix_count;
+    if (count) {
+        qsort(prefixes, count, sizeof(*prefixes), compare_policy_prefix);
+    }
+    
+    for (__u32 i = 0; i < count; i++) {
+        policy_run *run = NULL;
+        if (offline_policy.run_count) {
+            run = &offline_policy.runs[offline_policy.run_count - 1];
+        }
+        if (!run || run->family != prefixes[i].family ||
+            run->prefix_len != prefixes[i].prefix_len) {
+            run = &offline_policy.runs[offline_policy.run_count++];
+            *run = (policy_run){
+                .family = prefixes[i].family,
+                .prefix_len = prefixes[i].prefix_len,
+                .first = i
+            };
+        }
+        run->count++;
+    }
+    return 0;
+}
+
+/* One binary search per prefix length, longest first; returns the first hit. */
+static bool policy_lookup(__u8 family, const __u8 *addr, __u32 addr_len, policy_rule *rule) {
+    const policy_prefix *prefixes = offline_policy.set.prefixes;
+    for (__u32 r = 0; r < offline_policy.run_count; r++) {
+        const policy_run *run = &offline_policy.runs[r];
+        if (run->family != family) {
+            continue;
+        }
+        
+        __u8 key[16] = {0};
+        memcpy(key, addr, addr_len);
+        for (__u32 bit = run->prefix_len; bit < addr_len * 8; bit++) {
+            key[bit / 8] &= ~(0x80 >> (bit % 8));
+        }
+        
+        __u32 low = run->first;
+        __u32 high = run->first + run->count;
+        while (low < high) {
+            __u32 mid = low + (high - low) / 2;
+            if (memcmp(prefixes[mid].addr, key, sizeof(key)) < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low < run->first + run->count && !memcmp(prefixes[low].addr, key, sizeof(key))) {
+            *rule = prefixes[low].rule;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool policy_lookup_ipv4(anonymization_context *ctx, __u32 ip_addr, policy_rule *rule) {
+    (void)ctx;
+    __be32 addr = htonl(ip_addr);
+    return policy_lookup(FLOW_FAMILY_IPV4, (const __u8 *)&addr, sizeof(addr), rule);
+}
+
+static bool policy_lookup_ipv6(anonymization_context *ctx, const __be32 *addr, policy_rule *rule) {
+    (void)ctx;
+    return policy_lookup(FLOW_FAMILY_IPV6, (const __u8 *)addr, 16, rule);
+}
+
+static __u32 read_u32(const capture_file *file, __u64 offset) {
+    __u32 value;
+    memcpy(&value, file->base + offset, sizeof(value));
+    return file->swapped ? __builtin_bswap32(value) : value;
+}
+
+static __u16 read_u16(const capture_file *file, __u64 offset) {
+    __u16 value;
+    memcpy(&value, file->base + offset, sizeof(value));
+    return file->swapped ? __builtin_bswap16(value) : value;
+}
+
+static int open_capture_header(capture_file *file, __u64 *offset) {
+    if (file->size < PCAPNG_BLOCK_MIN_LEN) {
+        fprintf(stderr, "Input too short for a capture header\n");
+        return -1;
+    }
+    
+    __u32 magic;
+    memcpy(&magic, file->base, sizeof(magic));
+    
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+        magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        if (file->size < PCAP_FILE_HEADER_LEN) {
+            fprintf(stderr, "Truncated pcap file header\n");
+            return -1;
+        }
+        file->format = CAPTURE_FORMAT_PCAP;
+        file->swapped = magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC;
+        file->pcap_linktype = read_u32(file, 20) & 0x0FFFFFFF;
+        if (file->pcap_linktype != LINKTYPE_ETHERNET) {
+            fprintf(stderr, "Unsupported pcap link type %u (Ethernet only)\n", file->pcap_linktype);
+            return -1;
+        }
+        *offset = PCAP_FILE_HEADER_LEN;
+        return 0;
+    }
+    
+    if (magic == PCAPNG_BLOCK_SHB) {
+        file->format = CAPTURE_FORMAT_PCAPNG;
+        *offset = 0;
+        return 0;
+    }
+    
+    fprintf(stderr, "Input is neither pcap nor pcapng\n");
+    return -1;
+}
+
+static int index_pcap_record(capture_file *file, __u64 offset, capture_record *record) {
+    if (offset + PCAP_RECORD_HEADER_LEN > file->size) {
+        return -1;
+    }
+    
+    __u32 captured_len = read_u32(file, offset + 8);
+    __u64 end = offset + PCAP_RECORD_HEADER_LEN + captured_len;
+    if (end > file->size) {
+        return -1;
+    }
+    
+    record->start = offset;
+    record->end = end;
+    record->data_offset = offset + PCAP_RECORD_HEADER_LEN;
+    record->captured_len = captured_len;
+    record->action = RECORD_COPY;
+    return 0;
+}
+
+static int parse_section_header(capture_file *file, __u64 offset) {
+    __u32 byte_order;
+    memcpy(&byte_order, file->base + offset + 8, sizeof(byte_order));
+    if (byte_order == PCAPNG_BYTE_ORDER_MAGIC) {
+        file->swapped = false;
+    } else if (byte_order == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+        file->swapped = true;
+    } else {
+        fprintf(stderr, "Bad pcapng byte-order magic at offset %llu\n", (unsigned long long)offset);
+        return -1;
+    }
+    file->interface_count = 0;
+    return 0;
+}
+
+/*
+ * Walks one pcapng block. Packet blocks fill in record and return 1,
+ * metadata blocks update interface state and return 0.
+ */
+static int index_pcapng_block(capture_file *file, __u64 offset, __u64 *block_end,
+                              capture_record *record) {
+    if (offset + PCAPNG_BLOCK_MIN_LEN > file->size) {
+        return -1;
+    }
+    
+    __u32 raw_type;
+    memcpy(&raw_type, file->base + offset, sizeof(raw_type));
+    if (raw_type == PCAPNG_BLOCK_SHB) {
+        if (offset + 16 > file->size || parse_section_header(file, offset)) {
+            return -1;
+        }
+    }
+    
+    __u32 block_type = read_u32(file, offset);
+    __u32 block_len = read_u32(file, offset + 4);
+    if (block_len < PCAPNG_BLOCK_MIN_LEN || (block_len & 3) || offset + block_len > file->size) {
+        fprintf(stderr, "Malformed pcapng block at offset %llu\n", (unsigned long long)offset);
+        return -1;
+    }
+    *block_end = offset + block_len;
+    
+    if (block_type == PCAPNG_BLOCK_IDB) {
+        if (file->interface_count < MAX_PCAPNG_INTERFACES && block_len >= 20) {
+            file->interface_linktypes[file->interface_count] = read_u16(file, offset + 8);
+        }
+        file->interface_count++;
+        return 0;
+    }
+    
+    __u32 interface_id;
+    __u64 data_offset;
+    __u32 captured_len;
+    if (block_type == PCAPNG_BLOCK_EPB && block_len >= PCAPNG_EPB_HEADER_LEN + 4) {
+        interface_id = read_u32(file, offset + 8);
+        captured_len = read_u32(file, offset + 20);
+        data_offset = offset + PCAPNG_EPB_HEADER_LEN;
+    } else if (block_type == PCAPNG_BLOCK_SPB && block_len >= PCAPNG_SPB_HEADER_LEN + 4) {
+        __u32 original_len = read_u32(file, offset + 8);
+        __u32 available = block_len - PCAPNG_SPB_HEADER_LEN - 4;
+        interface_id = 0;
+        captured_len = original_len < available ? original_len : available;
+        data_offset = offset + PCAPNG_SPB_HEADER_LEN;
+    } else {
+        return 0;
+    }
+    
+    if (data_offset + captured_len > *block_end - 4) {
+        fprintf(stderr, "Packet overruns pcapng block at offset %llu\n", (unsigned long long)offset);
+        return -1;
+    }
+    
+    record->start = offset;
+    record->end = *block_end;
+    record->data_offset = data_offset;
+    record->captured_len = captured_len;
+    record->action = interface_id < file->interface_count && interface_id < MAX_PCAPNG_INTERFACES &&
+                     file->interface_linktypes[interface_id] == LINKTYPE_ETHERNET ?
+                     RECORD_ANONYMIZED : RECORD_COPY;
+    return 1;
+}
+
+static int index_window(capture_file *file, __u64 *offset, capture_record *records,
+                        size_t *count, __u64 *non_ethernet) {
+    __u64 window_limit = *offset + WINDOW_SIZE;
+    *count = 0;
+    
+    while (*offset < file->size && *count < MAX_WINDOW_RECORDS) {
+        capture_record *record = &records[*count];
+        
+        if (file->format == CAPTURE_FORMAT_PCAP) {
+            if (index_pcap_record(file, *offset, record)) {
+                fprintf(stderr, "Truncated pcap record at offset %llu\n", (unsigned long long)*offset);
+                return -1;
+            }
+            if (record->end > window_limit && *count > 0) {
+                break;
+            }
+            record->action = RECORD_ANONYMIZED;
+            *offset = record->end;
+            (*count)++;
+            continue;
+        }
+        
+        __u64 block_end;
+        int is_packet = index_pcapng_block(file, *offset, &block_end, record);
+        if (is_packet < 0) {
+            return -1;
+        }
+        if (block_end > window_limit && *count > 0) {
+            break;
+        }
+        *offset = block_end;
+        if (is_packet) {
+            if (record->action == RECORD_COPY) {
+                (*non_ethernet)++;
+                continue;
+            }
+            (*count)++;
+        }
+    }
+    return 0;
+}
+
+/* Mirrors xdp_anonymize_prog: pass-through frames are untouched, failures are dropped. */
+static void anonymize_record(worker_task *task, capture_record *record) {
+    unsigned char *data = task->file->base + record->data_offset;
+    unsigned char *data_end = data + record->captured_len;
+    packet_modifications mods = {0};
+    anonymization_context ctx = {
+        .config = task->config,
+        .pp_table = task->pp_table,
+        .mods = &mods
+    };
+    
+    task->stats.records++;
+    
+    if (data + sizeof(struct ethhdr) > data_end) {
+        record->action = RECORD_COPY;
+        task->stats.passed_through++;
+        return;
+    }
+    
+    if (is_passthrough_frame((struct ethhdr *)data, task->config)) {
+        record->action = RECORD_COPY;
+        task->stats.passed_through++;
+        return;
+    }
+    
+    if (!anonymize_packet(data, data_end, &ctx)) {
+        record->action = RECORD_DROP;
+        task->stats.dropped++;
+        return;
+    }
+    
+    if (mods.policy_drop) {
+        record->action = RECORD_DROP;
+        task->stats.policy_dropped++;
+        return;
+    }
+    
+    task->stats.anonymized++;
+}
+
+static void *worker_main(void *arg) {
+    worker_task *task = arg;
+    for (size_t i = 0; i < task->count; i++) {
+        anonymize_record(task, &task->records[task->first + i]);
+    }
+    return NULL;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Output write failed: %s\n", strerror(errno));
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static int write_window(int out_fd, const capture_file *file, __u64 window_start,
+                        __u64 window_end, const capture_record *records, size_t count) {
+    __u64 position = window_start;
+    
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].action != RECORD_DROP) {
+            continue;
+        }
+        if (write_all(out_fd, file->base + position, records[i].start - position)) {
+            return -1;
+        }
+        position = records[i].end;
+    }
+    
+    return write_all(out_fd, file->base + position, window_end - position);
+}
+
+static int process_window(capture_file *file, capture_record *records, size_t count,
+                          int worker_count, const anonymization_config *config,
+                          const prefix_preserving_table *pp_table, offline_stats *totals) {
+    worker_task tasks[MAX_WORKERS];
+    pthread_t threads[MAX_WORKERS];
+    size_t per_worker = (count + worker_count - 1) / worker_count;
+    int started = 0;
+    
+    for (int i = 0; i < worker_count; i++) {
+        size_t first = (size_t)i * per_worker;
+        if (first >= count) {
+            break;
+        }
+        tasks[i] = (worker_task){
+            .file = file,
+            .records = records,
+            .first = first,
+            .count = first + per_worker > count ? count - first : per_worker,
+            .config = config,
+            .pp_table = pp_table
+        };
+        if (pthread_create(&threads[i], NULL, worker_main, &tasks[i])) {
+            fprintf(stderr, "Worker thread start failed\n");
+            worker_main(&tasks[i]);
+            threads[i] = 0;
+        }
+        started++;
+    }
+    
+    for (int i = 0; i < started; i++) {
+        if (threads[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        totals->records += tasks[i].stats.records;
+        totals->anonymized += tasks[i].stats.anonymized;
+        totals->passed_through += tasks[i].stats.passed_through;
+        totals->dropped += tasks[i].stats.dropped;
+        totals->policy_dropped += tasks[i].stats.policy_dropped;
+    }
+    return 0;
+}
+
+static int anonymize_capture(capture_file *file, int out_fd, int worker_count,
+                             const anonymization_config *config,
+                             const prefix_preserving_table *pp_table, offline_stats *stats) {
+    __u64 offset;
+    if (open_capture_header(file, &offset)) {
+        return -1;
+    }
+    
+    capture_record *records = malloc(sizeof(*records) * MAX_WINDOW_RECORDS);
+    if (!records) {
+        fprintf(stderr, "Record index allocation failed\n");
+        return -1;
+    }
+    
+    long page_size = sysconf(_SC_PAGESIZE);
+    __u64 window_start = 0;
+    int err = 0;
+    
+    while (window_start < file->size) {
+        size_t count;
+        err = index_window(file, &offset, records, &count, &stats->non_ethernet);
+        if (err) {
+            break;
+        }
+        
+        process_window(file, records, count, worker_count, config, pp_table, stats);
+        
+        err = write_window(out_fd, file, window_start, offset, records, count);
+        if (err) {
+            break;
+        }
+        
+        __u64 release_start = window_start & ~(__u64)(page_size - 1);
+        __u64 release_end = offset & ~(__u64)(page_size - 1);
+        if (release_end > release_start) {
+            madvise(file->base + release_start, release_end - release_start, MADV_DONTNEED);
+        }
+        window_start = offset;
+    }
+    
+    free(records);
+    return err;
+}
+
+static int parse_worker_count(const char *value) {
+    int workers = atoi(value);
+    if (workers < 1) {
+        return 1;
+    }
+    return workers > MAX_WORKERS ? MAX_WORKERS : workers;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j threads] <config_file> <input.pcap|pcapng> <output>\n", prog);
+    fprintf(stderr, "Example: %s -j 8 anonymization_config.txt capture.pcapng anonymized.pcapng\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int worker_count = online_cpus > 0 ? (int)online_cpus : 1;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "j:h")) != -1) {
+        if (opt == 'j') {
+            worker_count = parse_worker_count(optarg);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (worker_count > MAX_WORKERS) {
+        worker_count = MAX_WORKERS;
+    }
+    
+    if (argc - optind != 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    const char *config_file = argv[optind];
+    const char *input_path = argv[optind + 1];
+    const char *output_path = argv[optind + 2];
+    
+    config_parse_result config_result = parse_config_file(config_file);
+    if (!config_result.success) {
+        fprintf(stderr, "Configuration error: %s\n", config_result.error_message);
+        return 1;
+    }
+    const anonymization_config *config = &config_result.config;
+    if (config->address_policy && load_offline_policy(config_result.policy_file)) {
+        return 1;
+    }
+    if (config->mapping_vault) {
+        fprintf(stderr, "Warning: vault_file is only recorded by the XDP datapath, ignoring it\n");
+    }
+    
+    prefix_preserving_table *pp_table = NULL;
+    if (config->prefix_preserving) {
+        pp_table = malloc(sizeof(*pp_table));
+        if (!pp_table) {
+            fprintf(stderr, "Prefix-preserving table allocation failed\n");
+            free_policy_set(&offline_policy.set);
+            return 1;
+        }
+        fill_prefix_preserving_table(pp_table, config);
+    }
+    
+    int in_fd = open(input_path, O_RDONLY);
+    if (in_fd < 0) {
+        fprintf(stderr, "Input open failed for %s: %s\n", input_path, strerror(errno));
+        free(pp_table);
+        free_policy_set(&offline_policy.set);
+        return 1;
+    }
+    
+    struct stat st;
+    if (fstat(in_fd, &st) || st.st_size == 0) {
+        fprintf(stderr, "Input %s is empty or unreadable\n", input_path);
+        close(in_fd);
+        free(pp_table);
+        free_policy_set(&offline_policy.set);
+        return 1;
+    }
+    
+    capture_file file = { .size = (size_t)st.st_size };
+    file.base = mmap(NULL, file.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, in_fd, 0);
+    close(in_fd);
+    if (file.base == MAP_FAILED) {
+        fprintf(stderr, "Input map failed: %s\n", strerror(errno));
+        free(pp_table);
+        free_policy_set(&offline_policy.set);
+        return 1;
+    }
+    madvise(file.base, file.size, MADV_SEQUENTIAL);
+    
+    int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        fprintf(stderr, "Output open failed for %s: %s\n", output_path, strerror(errno));
+        munmap(file.base, file.size);
+        free(pp_table);
+        free_policy_set(&offline_policy.set);
+        return 1;
+    }
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    offline_stats stats = {0};
+    int err = anonymize_capture(&file, out_fd, worker_count, config, pp_table, &stats);
+    
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    
+    if (close(out_fd)) {
+        fprintf(stderr, "Output close failed: %s\n", strerror(errno));
+        err = -1;
+    }
+    munmap(file.base, file.size);
+    free(pp_table);
+    free_policy_set(&offline_policy.set);
+    
+    printf("Records:            %llu\n", stats.records);
+    printf("Anonymized:         %llu\n", stats.anonymized);
+    printf("Passed through:     %llu\n", stats.passed_through);
+    printf("Dropped (errors):   %llu\n", stats.dropped);
+    printf("Dropped (policy):   %llu\n", stats.policy_dropped);
+    printf("Non-Ethernet:       %llu\n", stats.non_ethernet);
+    printf("Elapsed:            %.3f s (%.2f Mpps, %d workers)\n", seconds,
+           seconds > 0 ? stats.records / seconds / 1e6 : 0.0, worker_count);
+    
+    return err ? 1 : 0;
+}
@@ -0,0 +1,651 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/bpf.h>
+#include "common_structs.h"
+#include "config_parser.h"
+#include "rewrite_helpers.h"
+#include "specialization.h"
+
+#define BENCH_DEFAULT_REPEAT 100000
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAX_RUNS 64
+#define BENCH_MAX_FRAME 9014
+#define BENCH_MIN_FRAME 60
+#define PIPELINE_PROG_NAME "xdp_anonymize_pipeline"
+
+typedef struct {
+    const char *name;
+    __u32 (*build)(unsigned char *frame);
+} bench_frame;
+
+typedef struct {
+    struct bpf_object *obj;
+    int prog_fd;
+    int specialized_prog_fd;
+    int pipeline_prog_fd;
+    int config_map_fd;
+    int pp_table_map_fd;
+    int stats_map_fd;
+} bench_program;
+
+typedef struct {
+    const char *kern_object;
+    const char *output_path;
+    int repeat;
+    int runs;
+} bench_options;
+
+static const unsigned char bench_src_mac[ETH_ALEN] = { 0x00, 0x1b, 0x21, 0x3a, 0x4f, 0x10 };
+static const unsigned char bench_dst_mac[ETH_ALEN] = { 0x3c, 0xfd, 0xfe, 0x9e, 0x7f, 0x71 };
+static const unsigned char bench_mcast_mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, 0x01, 0x01, 0x01 };
+
+static __u16 ipv4_header_checksum(const struct iphdr *iph) {
+    const __u16 *words = (const __u16 *)iph;
+    __u32 sum = 0;
+    for (int i = 0; i < iph->ihl * 2; i++) {
+        sum += words[i];
+    }
+    return (__u16)~csum_fold(sum);
+}
+
+static unsigned char *put_ethernet(unsigned char *frame, const unsigned char *dst, __u16 proto) {
+    struct ethhdr *eth = (struct ethhdr *)frame;
+    memcpy(eth->h_dest, dst, ETH_ALEN);
+    memcpy(eth->h_source, bench_src_mac, ETH_ALEN);
+    eth->h_proto = htons(proto);
+    return frame + sizeof(*eth);
+}
+
+static unsigned char *put_vlan_tag(unsigned char *pos, __u16 tpid_after, __u16 vid) {
+    __u16 tci = htons(vid);
+    __u16 proto = htons(tpid_after);
+    memcpy(pos, &tci, sizeof(tci));
+    memcpy(pos + 2, &proto, sizeof(proto));
+    return pos + 4;
+}
+
+static __u32 put_ipv4(unsigned char *frame, unsigned char *pos, __u8 protocol, __u32 daddr,
+                      __u32 option_len, __u32 l4_len) {
+    struct iphdr *iph = (struct iphdr *)pos;
+    memset(iph, 0, sizeof(*iph) + option_len);
+    iph->version = 4;
+    iph->ihl = (sizeof(*iph) + option_len) / 4;
+    iph->ttl = 64;
+    iph->protocol = protocol;
+    iph->tot_len = htons(iph->ihl * 4 + l4_len);
+    iph->saddr = htonl(0x0A000105);
+    iph->daddr = htonl(daddr);
+    memset(pos + sizeof(*iph), 0x01, option_len);
+    iph->check = ipv4_header_checksum(iph);
+    
+    __u32 len = (pos - frame) + iph->ihl * 4 + l4_len;
+    return len < BENCH_MIN_FRAME ? BENCH_MIN_FRAME : len;
+}
+
+static __u32 put_udp(unsigned char *frame, unsigned char *pos, __u32 daddr, __u32 payload_len) {
+    struct udphdr *udph = (struct udphdr *)(pos + sizeof(struct iphdr));
+    __u32 l4_len = sizeof(*udph) + payload_len;
+    memset(udph, 0, l4_len);
+    udph->source = htons(40000);
+    udph->dest = htons(53);
+    udph->len = htons(l4_len);
+    udph->check = htons(0x1c46);
+    return put_ipv4(frame, pos, IPPROTO_UDP, daddr, 0, l4_len);
+}
+
+static __u32 put_tcp(unsigned char *frame, unsigned char *pos, __u32 ip_option_len,
+                     __u32 tcp_option_len, __u32 payload_len) {
+    struct tcphdr *tcph = (struct tcphdr *)(pos + sizeof(struct iphdr) + ip_option_len);
+    __u32 l4_len = sizeof(*tcph) + tcp_option_len + payload_len;
+    memset(tcph, 0, l4_len);
+    tcph->source = htons(51000);
+    tcph->dest = htons(443);
+    tcph->doff = (sizeof(*tcph) + tcp_option_len) / 4;
+    tcph->ack = 1;
+    tcph->window = htons(65535);
+    tcph->check = htons(0x8d21);
+    memset((unsigned char *)(tcph + 1), 0x01, tcp_option_len);
+    return put_ipv4(frame, pos, IPPROTO_TCP, 0xC0A80A14, ip_option_len, l4_len);
+}
+
+static __u32 put_ipv6(unsigned char *frame, unsigned char *pos, __u8 nexthdr, __u32 payload_len,
+                      bool solicited_node) {
+    static const unsigned char src[16] = {
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0x00, 0x02,
+        0x02, 0x1b, 0x21, 0xff, 0xfe, 0x3a, 0x4f, 0x10
+    };
+    static const unsigned char dst[16] = {
+        0x20, 0x01, 0x0d, 0xb8, 0xaa, 0xaa, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xbe, 0xef
+    };
+    static const unsigned char snm[16] = {
+        0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x01, 0xff, 0x00, 0xbe, 0xef
+    };
+    struct ipv6hdr *ip6h = (struct ipv6hdr *)pos;
+    memset(ip6h, 0, sizeof(*ip6h));
+    ip6h->version = 6;
+    ip6h->payload_len = htons(payload_len);
+    ip6h->nexthdr = nexthdr;
+    ip6h->hop_limit = nexthdr == IPPROTO_ICMPV6 ? 255 : 64;
+    memcpy(&ip6h->saddr, src, sizeof(src));
+    memcpy(&ip6h->daddr, solicited_node ? snm : dst, sizeof(dst));
+    
+    __u32 len = (pos - frame) + sizeof(*ip6h) + payload_len;
+    return len < BENCH_MIN_FRAME ? BENCH_MIN_FRAME : len;
+}
+
+static __u32 build_arp_request(unsigned char *frame) {
+    static const unsigned char broadcast[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    unsigned char *pos = put_ethernet(frame, broadcast, ETH_P_ARP);
+    struct arphdr *arp = (struct arphdr *)pos;
+    arp->ar_hrd = htons(ARPHRD_ETHER);
+    arp->ar_pro = htons(ETH_P_IP);
+    arp->ar_hln = ETH_ALEN;
+    arp->ar_pln = 4;
+    arp->ar_op = htons(ARPOP_REQUEST);
+    
+    unsigned char *payload = pos + sizeof(*arp);
+    __u32 sender_ip = htonl(0x0A000105);
+    __u32 target_ip = htonl(0x0A000101);
+    memcpy(payload, bench_src_mac, ETH_ALEN);
+    memcpy(payload + 6, &sender_ip, 4);
+    memset(payload + 10, 0, ETH_ALEN);
+    memcpy(payload + 16, &target_ip, 4);
+    return BENCH_MIN_FRAME;
+}
+
+static __u32 build_ipv4_udp(unsigned char *frame) {
+    return put_udp(frame, put_ethernet(frame, bench_dst_mac, ETH_P_IP), 0xC0A80A14, 18);
+}
+
+static __u32 build_ipv4_tcp(unsigned char *frame) {
+    return put_tcp(frame, put_ethernet(frame, bench_dst_mac, ETH_P_IP), 0, 0, 6);
+}
+
+static __u32 build_ipv4_tcp_1500(unsigned char *frame) {
+    return put_tcp(frame, put_ethernet(frame, bench_dst_mac, ETH_P_IP), 0, 12, 1448);
+}
+
+/* Larger than a page, so BPF_PROG_TEST_RUN hands it to the xdp.frags programs as multi-buffer. */
+static __u32 build_ipv4_tcp_9000(unsigned char *frame) {
+    return put_tcp(frame, put_ethernet(frame, bench_dst_mac, ETH_P_IP), 0, 12, 8948);
+}
+
+static __u32 build_ipv4_options_tcp(unsigned char *frame) {
+    return put_tcp(frame, put_ethernet(frame, bench_dst_mac, ETH_P_IP), 40, 40, 0);
+}
+
+static __u32 build_multicast_udp(unsigned char *frame) {
+    return put_udp(frame, put_ethernet(frame, bench_mcast_mac, ETH_P_IP), 0xEF010101, 18);
+}
+
+static __u32 build_vlan_udp(unsigned char *frame) {
+    unsigned char *pos = put_ethernet(frame, bench_dst_mac, ETH_P_8021Q);
+    return put_udp(frame, put_vlan_tag(pos, ETH_P_IP, 100), 0xC0A80A14, 18);
+}
+
+static __u32 build_qinq_udp(unsigned char *frame) {
+    unsigned char *pos = put_ethernet(frame, bench_dst_mac, ETH_P_8021AD);
+    pos = put_vlan_tag(pos, ETH_P_8021Q, 200);
+    return put_udp(frame, put_vlan_tag(pos, ETH_P_IP, 100), 0xC0A80A14, 18);
+}
+
+static __u32 build_mpls_udp(unsigned char *frame) {
+    static const unsigned char label[MPLS_LABEL_LEN] = { 0x00, 0x06, 0x41, 0x40 };
+    unsigned char *pos = put_ethernet(frame, bench_dst_mac, ETH_P_MPLS_UC);
+    memcpy(pos, label, sizeof(label));
+    return put_udp(frame, pos + sizeof(label), 0xC0A80A14, 18);
+}
+
+static __u32 build_vxlan_tcp(unsigned char *frame) {
+    unsigned char *pos = put_ethernet(frame, bench_dst_mac, ETH_P_IP);
+    struct udphdr *udph = (struct udphdr *)(pos + sizeof(struct iphdr));
+    unsigned char *vxlan = (unsigned char *)(udph + 1);
+    memset(vxlan, 0, VXLAN_HEADER_LEN);
+    vxlan[0] = VXLAN_FLAG_VNI;
+    vxlan[6] = 0x01;
+    
+    unsigned char *inner = vxlan + VXLAN_HEADER_LEN;
+    __u32 inner_len = put_tcp(inner, put_ethernet(inner, bench_dst_mac, ETH_P_IP), 0, 0, 6);
+    __u32 l4_len = sizeof(*udph) + VXLAN_HEADER_LEN + inner_len;
+    udph->source = htons(49152);
+    udph->dest = htons(VXLAN_UDP_PORT);
+    udph->len = htons(l4_len);
+    udph->check = htons(0x3b07);
+    return put_ipv4(frame, pos, IPPROTO_UDP, 0x0A000202, 0, l4_len);
+}
+
+static __u32 put_ipv6_tcp(unsigned char *frame, __u32 payload_len) {
+    unsigned char *pos = put_ethernet(frame, bench_dst_mac, ETH_P_IPV6);
+    struct tcphdr *tcph = (struct tcphdr *)(pos + sizeof(struct ipv6hdr));
+    memset(tcph, 0, sizeof(*tcph) + payload_len);
+    tcph->source = htons(51000);
+    tcph->dest = htons(443);
+    tcph->doff = sizeof(*tcph) / 4;
+    tcph->ack = 1;
+    tcph->check = htons(0x8d21);
+    return put_ipv6(frame, pos, IPPROTO_TCP, sizeof(*tcph) + payload_len, false);
+}
+
+static __u32 build_ipv6_tcp(unsigned char *frame) {
+    return put_ipv6_tcp(frame, 6);
+}
+
+static __u32 build_ipv6_tcp_9000(unsigned char *frame) {
+    return put_ipv6_tcp(frame, 8940);
+}
+
+static __u32 build_ipv6_ext_udp(unsigned char *frame) {
+    unsigned char *pos = put_ethernet(frame, bench_dst_mac, ETH_P_IPV6);
+    unsigned char *ext = pos + sizeof(struct ipv6hdr);
+    memset(ext, 0, 16);
+    ext[0] = IPPROTO_DSTOPTS;
+    ext[8] = IPPROTO_UDP;
+    struct udphdr *udph = (struct udphdr *)(ext + 16);
+    memset(udph, 0, sizeof(*udph) + 18);
+    udph->source = htons(40000);
+    udph->dest = htons(53);
+    udph->len = htons(sizeof(*udph) + 18);
+    udph->check = htons(0x1c46);
+    return put_ipv6(frame, pos, IPPROTO_HOPOPTS, 16 + sizeof(*udph) + 18, false);
+}
+
+static __u32 build_ipv6_ndp_ns(unsigned char *frame) {
+    static const unsigned char solicited_mac[ETH_ALEN] = { 0x33, 0x33, 0xff, 0x00, 0xbe, 0xef };
+    unsigned char *pos = put_ethernet(frame, solicited_mac, ETH_P_IPV6);
+    unsigned char *ns = pos + sizeof(struct ipv6hdr);
+    memset(ns, 0, 32);
+    ns[0] = NDP_NEIGHBOR_SOLICIT;
+    static const unsigned char target[16] = {
+        0x20, 0x01, 0x0d, 0xb8, 0xaa, 0xaa, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xbe, 0xef
+    };
+    memcpy(ns + NDP_TARGET_OFFSET, target, sizeof(target));
+    ns[NDP_OPTIONS_OFFSET] = NDP_OPT_SOURCE_LL;
+    ns[NDP_OPTIONS_OFFSET + 1] = 1;
+    memcpy(ns + NDP_OPTIONS_OFFSET + 2, bench_src_mac, ETH_ALEN);
+    return put_ipv6(frame, pos, IPPROTO_ICMPV6, 32, true);
+}
+
+static const bench_frame bench_frames[] = {
+    { "arp_request", build_arp_request },
+    { "ipv4_udp", build_ipv4_udp },
+    { "ipv4_tcp", build_ipv4_tcp },
+    { "ipv4_tcp_1500", build_ipv4_tcp_1500 },
+    { "ipv4_tcp_9000", build_ipv4_tcp_9000 },
+    { "ipv4_options_tcp", build_ipv4_options_tcp },
+    { "multicast_udp", build_multicast_udp },
+    { "vlan_udp", build_vlan_udp },
+    { "qinq_udp", build_qinq_udp },
+    { "mpls_udp", build_mpls_udp },
+    { "vxlan_tcp", build_vxlan_tcp },
+    { "ipv6_tcp", build_ipv6_tcp },
+    { "ipv6_tcp_9000", build_ipv6_tcp_9000 },
+    { "ipv6_ext_udp", build_ipv6_ext_udp },
+    { "ipv6_ndp_ns", build_ipv6_ndp_ns },
+};
+
+static const char *xdp_action_name(__u32 action) {
+    switch (action) {
+    case XDP_ABORTED: return "aborted";
+    case XDP_DROP: return "drop";
+    case XDP_PASS: return "pass";
+    case XDP_TX: return "tx";
+    case XDP_REDIRECT: return "redirect";
+    default: return "unknown";
+    }
+}
+
+static void json_string(FILE *out, const char *value) {
+    fputc('"', out);
+    for (; *value; value++) {
+        if (*value == '"' || *value == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*value, out);
+    }
+    fputc('"', out);
+}
+
+static void profile_name(const char *path, char *name, size_t name_len) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(name, name_len, "%s", base);
+    char *dot = strrchr(name, '.');
+    if (dot && dot != name) {
+        *dot = '\0';
+    }
+}
+
+static void unload_program(bench_program *program) {
+    if (program->obj) {
+        bpf_object__close(program->obj);
+    }
+    memset(program, 0, sizeof(*program));
+}
+
+/* Fills pipeline_map with the built-in stages; -1 when the object has no pipeline. */
+static int setup_pipeline(struct bpf_object *obj) {
+    int map_fd = bpf_object__find_map_fd_by_name(obj, "pipeline_map");
+    struct bpf_program *entry = bpf_object__find_program_by_name(obj, PIPELINE_PROG_NAME);
+    if (map_fd < 0 || !entry) {
+        return -1;
+    }
+    
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        char name[32];
+        snprintf(name, sizeof(name), "xdp_stage_%s", pipeline_stage_name(stage));
+        struct bpf_program *prog = bpf_object__find_program_by_name(obj, name);
+        int prog_fd = prog ? bpf_program__fd(prog) : -1;
+        if (prog_fd < 0 || bpf_map_update_elem(map_fd, &stage, &prog_fd, BPF_ANY)) {
+            fprintf(stderr, "Pipeline stage %s setup failed, skipping the pipeline run\n", name);
+            return -1;
+        }
+    }
+    return bpf_program__fd(entry);
+}
+
+static int load_program(const char *path, const anonymization_config *config,
+                        bench_program *program) {
+    memset(program, 0, sizeof(*program));
+    program->obj = bpf_object__open_file(path, NULL);
+    if (libbpf_get_error(program->obj)) {
+        fprintf(stderr, "BPF object file open failed for %s\n", path);
+        program->obj = NULL;
+        return -ENOENT;
+    }
+    
+    const char *cache_maps[] = { "mac_cache_map", "ipv4_cache_map" };
+    for (size_t i = 0; i < sizeof(cache_maps) / sizeof(cache_maps[0]); i++) {
+        struct bpf_map *map = bpf_object__find_map_by_name(program->obj, cache_maps[i]);
+        if (map) {
+            bpf_map__set_max_entries(map, config->mapping_cache_size);
+        }
+    }
+    
+    /* Generation 0 reads slot 0, which is where the generic run's config goes too. */
+    bool specialized = specialize_bpf_object(program->obj, find_specialization_data(program->obj),
+                                             config, 0, true) == 0;
+    
+    int err = bpf_object__load(program->obj);
+    if (err) {
+        fprintf(stderr, "BPF object load failed: %s\n", strerror(-err));
+        unload_program(program);
+        return err;
+    }
+    
+    struct bpf_program *prog = bpf_object__find_program_by_name(program->obj, GENERIC_PROG_NAME);
+    program->prog_fd = prog ? bpf_program__fd(prog) : -1;
+    prog = specialized ? bpf_object__find_program_by_name(program->obj, SPECIALIZED_PROG_NAME) : NULL;
+    program->specialized_prog_fd = prog ? bpf_program__fd(prog) : -1;
+    program->pipeline_prog_fd = setup_pipeline(program->obj);
+    program->config_map_fd = bpf_object__find_map_fd_by_name(program->obj, "config_map");
+    program->pp_table_map_fd = bpf_object__find_map_fd_by_name(program->obj, "pp_table_map");
+    program->stats_map_fd = bpf_object__find_map_fd_by_name(program->obj, "stats_map");
+    if (program->prog_fd < 0 || program->config_map_fd < 0 || program->pp_table_map_fd < 0 ||
+        program->stats_map_fd < 0) {
+        fprintf(stderr, "XDP program or maps not found\n");
+        unload_program(program);
+        return -ENOENT;
+    }
+    
+    __u32 key = 0;
+    if (config->prefix_preserving) {
+        prefix_preserving_table *table = malloc(sizeof(*table));
+        if (!table) {
+            unload_program(program);
+            return -ENOMEM;
+        }
+        fill_prefix_preserving_table(table, config);
+        err = bpf_map_update_elem(program->pp_table_map_fd, &key, table, BPF_ANY);
+        free(table);
+        if (err) {
+            fprintf(stderr, "Prefix-preserving table update failed: %s\n", strerror(errno));
+            unload_program(program);
+            return -errno;
+        }
+    }
+    
+    if (bpf_map_update_elem(program->config_map_fd, &key, config, BPF_ANY)) {
+        fprintf(stderr, "Configuration update failed: %s\n", strerror(errno));
+        unload_program(program);
+        return -errno;
+    }
+    return 0;
+}
+
+/* Test runs report RX queue 0; sums its per-CPU counters. */
+static int read_queue_stats(int stats_map_fd, anonymization_stats *total) {
+    int cpus = libbpf_num_possible_cpus();
+    if (cpus <= 0) {
+        return -1;
+    }
+    anonymization_stats *per_cpu = calloc(cpus, sizeof(*per_cpu));
+    if (!per_cpu) {
+        return -1;
+    }
+    
+    __u32 key = 0;
+    int err = bpf_map_lookup_elem(stats_map_fd, &key, per_cpu);
+    memset(total, 0, sizeof(*total));
+    for (int cpu = 0; !err && cpu < cpus; cpu++) {
+        total->packets_anonymized += per_cpu[cpu].packets_anonymized;
+        total->errors += per_cpu[cpu].errors;
+        total->policy_drops += per_cpu[cpu].policy_drops;
+    }
+    free(per_cpu);
+    return err;
+}
+
+/*
+ * Runs the frame once before timing it. A frame that hits an error path is
+ * dropped just like an anonymized one in drop mode, so the action alone
+ * proves nothing: it must also be counted as anonymized, with no errors.
+ */
+static int check_frame_run(const char *profile, const char *variant, int prog_fd,
+                           const bench_program *program, const anonymization_config *config,
+                           const bench_frame *frame) {
+    unsigned char data[BENCH_MAX_FRAME] = {0};
+    __u32 len = frame->build(data);
+    bool passthrough = is_passthrough_frame((const struct ethhdr *)data, config);
+    __u32 expected = passthrough ? XDP_PASS : XDP_DROP;
+    
+    anonymization_stats before, after;
+    LIBBPF_OPTS(bpf_test_run_opts, opts,
+        .data_in = data,
+        .data_size_in = len,
+        .repeat = 1
+    );
+    if (read_queue_stats(program->stats_map_fd, &before) ||
+        bpf_prog_test_run_opts(prog_fd, &opts) ||
+        read_queue_stats(program->stats_map_fd, &after)) {
+        fprintf(stderr, "Check run failed for %s/%s/%s: %s\n", profile, variant, frame->name,
+                strerror(errno));
+        return -1;
+    }
+    
+    __u64 anonymized = after.packets_anonymized - before.packets_anonymized;
+    __u64 errors = after.errors - before.errors;
+    __u64 policy_drops = after.policy_drops - before.policy_drops;
+    if (opts.retval != expected || errors || policy_drops || anonymized != !passthrough) {
+        fprintf(stderr, "Check failed for %s/%s/%s: returned %s (expected %s), %llu anonymized, "
+                "%llu errors, %llu policy drops\n", profile, variant, frame->name,
+                xdp_action_name(opts.retval), xdp_action_name(expected), anonymized, errors,
+                policy_drops);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    __u32 x = *(const __u32 *)a;
+    __u32 y = *(const __u32 *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Each run replays one frame `repeat` times inside the kernel; duration is
+ * the mean ns per invocation for that run. The packet buffer persists across
+ * repeats, so later iterations re-anonymize already rewritten addresses,
+ * which costs the same as the first pass.
+ */
+static int bench_frame_run(FILE *out, const char *profile, const char *variant, int prog_fd,
+                           const bench_frame *frame, const bench_options *options, bool first) {
+    unsigned char data[BENCH_MAX_FRAME] = {0};
+    unsigned char data_out[BENCH_MAX_FRAME];
+    __u32 durations[BENCH_MAX_RUNS];
+    __u32 len = frame->build(data);
+    __u32 retval = 0;
+    
+    for (int run = 0; run < options->runs; run++) {
+        LIBBPF_OPTS(bpf_test_run_opts, opts,
+            .data_in = data,
+            .data_size_in = len,
+            .data_out = data_out,
+            .data_size_out = sizeof(data_out),
+            .repeat = options->repeat
+        );
+        if (bpf_prog_test_run_opts(prog_fd, &opts)) {
+            fprintf(stderr, "Test run failed for %s/%s: %s\n", profile, frame->name, strerror(errno));
+            return -1;
+        }
+        durations[run] = opts.duration;
+        retval = opts.retval;
+    }
+    
+    qsort(durations, options->runs, sizeof(durations[0]), compare_u32);
+    __u32 median = durations[options->runs / 2];
+    double mpps = median ? 1000.0 / median : 0.0;
+    double gbps = mpps * len * 8 / 1000.0;
+    
+    fprintf(out, "%s\n    {\"profile\": ", first ? "" : ",");
+    json_string(out, profile);
+    fprintf(out, ", \"program\": \"%s\", \"frame\": \"%s\", \"frame_len\": %u, \"xdp_action\": \"%s\", "
+            "\"ns_per_packet_min\": %u, \"ns_per_packet_median\": %u, "
+            "\"ns_per_packet_max\": %u, \"mpps\": %.3f, \"gbps\": %.2f}",
+            variant, frame->name, len, xdp_action_name(retval), durations[0], median,
+            durations[options->runs - 1], mpps, gbps);
+    
+    fprintf(stderr, "%-20s %-12s %-18s %5u B  %6u ns/pkt  %8.3f Mpps  %8.2f Gbps\n", profile,
+            variant, frame->name, len, median, mpps, gbps);
+    return 0;
+}
+
+static void write_header(FILE *out, const bench_options *options) {
+    struct utsname uts;
+    const char *kernel = uname(&uts) == 0 ? uts.release : "unknown";
+    
+    fprintf(out, "{\n  \"schema\": 1,\n  \"timestamp\": %lld,\n  \"kernel\": ", (long long)time(NULL));
+    json_string(out, kernel);
+    fprintf(out, ",\n  \"repeat\": %d,\n  \"runs\": %d,\n", options->repeat, options->runs);
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-k prog_kern.o] [-r repeat] [-n runs] [-o results.json] <profile>...\n", prog);
+    fprintf(stderr, "Example: %s -k ../build/prog_kern.o -o bench.json profiles/*.txt\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    bench_options options = {
+        .kern_object = "prog_kern.o",
+        .output_path = NULL,
+        .repeat = BENCH_DEFAULT_REPEAT,
+        .runs = BENCH_DEFAULT_RUNS
+    };
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "k:r:n:o:h")) != -1) {
+        switch (opt) {
+        case 'k': options.kern_object = optarg; break;
+        case 'r': options.repeat = atoi(optarg); break;
+        case 'n': options.runs = atoi(optarg); break;
+        case 'o': options.output_path = optarg; break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (optind >= argc || options.repeat < 1 || options.runs < 1 || options.runs > BENCH_MAX_RUNS) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    FILE *out = stdout;
+    if (options.output_path) {
+        out = fopen(options.output_path, "w");
+        if (!out) {
+            fprintf(stderr, "Output open failed for %s: %s\n", options.output_path, strerror(errno));
+            return 1;
+        }
+    }
+    
+    struct rlimit rlim = { .rlim_cur = RLIM_INFINITY, .rlim_max = RLIM_INFINITY };
+    setrlimit(RLIMIT_MEMLOCK, &rlim);
+    
+    write_header(out, &options);
+    fprintf(out, "  \"results\": [");
+    
+    int err = 0;
+    bool first = true;
+    for (int i = optind; i < argc && !err; i++) {
+        config_parse_result parsed = parse_config_file(argv[i]);
+        if (!parsed.success) {
+            fprintf(stderr, "Configuration error in %s: %s\n", argv[i], parsed.error_message);
+            err = 1;
+            break;
+        }
+        parsed.config.output_mode = OUTPUT_MODE_DROP;
+        
+        char name[128];
+        profile_name(argv[i], name, sizeof(name));
+        
+        bench_program program;
+        int load_err = load_program(options.kern_object, &parsed.config, &program);
+        /* The verifier rejects with EACCES, which must fail the run rather than skip it. */
+        if (load_err == -EPERM) {
+            fprintf(out, "\n  ],\n  \"skipped\": \"BPF program load not permitted; run with CAP_BPF and CAP_NET_ADMIN\"\n}\n");
+            fprintf(stderr, "Benchmark skipped: insufficient privileges to load BPF programs\n");
+            if (out != stdout) fclose(out);
+            return 0;
+        }
+        if (load_err) {
+            err = 1;
+            break;
+        }
+        
+        const char *variants[] = { "generic", "specialized", "pipeline" };
+        int prog_fds[] = { program.prog_fd, program.specialized_prog_fd, program.pipeline_prog_fd };
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]) && !err; v++) {
+            if (prog_fds[v] < 0) {
+                continue;
+            }
+            for (size_t f = 0; f < sizeof(bench_frames) / sizeof(bench_frames[0]); f++) {
+                if (check_frame_run(name, variants[v], prog_fds[v], &program, &parsed.config,
+                                    &bench_frames[f]) ||
+                    bench_frame_run(out, name, variants[v], prog_fds[v], &bench_frames[f],
+                                    &options, first)) {
+                    err = 1;
+                    break;
+                }
+                first = false;
+            }
+        }
+        unload_program(&program);
+    }
+    
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) fclose(out);
+    return err;
+}
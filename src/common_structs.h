@@ -11,27 +11,255 @@ typedef struct {
     bool anonymize_dstmac_oui;
     bool anonymize_dstmac_id;
     bool preserve_prefix;
+    bool prefix_preserving;
+    bool anonymize_srcipv4;
+    bool anonymize_dstipv4;
     bool anonymize_mac_in_arphdr;
     bool anonymize_ipv4_in_arphdr;
+    bool anonymize_srcipv6;
+    bool anonymize_dstipv6;
+    bool anonymize_ndp;
+    bool scrub_dhcp;
+    bool scrub_dns;
+    bool scrub_icmp_errors;
     __u32 src_ip_mask_lengths;
     __u32 dest_ip_mask_lengths;
+    __u32 src_ipv6_prefix_length;
+    __u32 dest_ipv6_prefix_length;
     __u32 random_salt;
+    __u32 hash_function;
+    __u64 hash_key[2];
+    __u32 output_mode;
+    __u32 output_ifindex;
+    bool mapping_cache;
+    __u32 mapping_cache_size;
+    bool anonymize_ports;
+    bool flow_table;
+    __u32 flow_table_size;
+    bool address_policy;
+    bool error_events;
+    __u32 event_sample_rate;
+    __u32 event_rate_limit;
+    bool mapping_vault;
+    __u32 vault_mapping_id;
+    __u32 salt_rotation_interval;
+    bool specialize;
+    bool pipeline;
+    bool latency_histogram;
 } anonymization_config;
 
+/* .rodata of prog_kern.o, written by the loader before load. */
+typedef struct {
+    anonymization_config config;
+    __u32 generation;
+} config_specialization;
+
+/*
+ * config_map and pp_table_map hold CONFIG_SLOT_COUNT copies; the packet
+ * path reads slot (generation % CONFIG_SLOT_COUNT) where generation comes
+ * from config_generation_map. Userspace fills the idle slot, then bumps
+ * the generation, and waits CONFIG_SLOT_GRACE_MS before reusing a slot.
+ */
+#define CONFIG_SLOT_COUNT 2
+#define CONFIG_SLOT_GRACE_MS 100
+
+#define MAX_SINK_SPEC_LENGTH 256
+
+#define MAX_INTERFACES 16
+#define MAX_INTERFACE_NAME_LENGTH 16
+#define MAX_PROFILE_PATH_LENGTH 256
+
 typedef struct {
     __u32 start_ip;
     __u32 end_ip;
     __u32 mask;
 } ip_range;
 
+/*
+ * Address policy: policy_ipv4_map and policy_ipv6_map are LPM tries whose
+ * keys lead with the config slot byte, so each slot carries its own rule
+ * set and flips with the generation. Matches for rule r in slot s count
+ * into policy_hits_map[s * MAX_POLICY_RULES + r].
+ */
+#define POLICY_ACTION_ANONYMIZE 0
+#define POLICY_ACTION_PRESERVE 1
+#define POLICY_ACTION_PASS 2
+#define POLICY_ACTION_DROP 3
+
+#define MAX_POLICY_RULES 8192
+#define MAX_POLICY_PREFIXES 32768
+#define MAX_POLICY_LABEL_LENGTH 64
+#define POLICY_SLOT_BITS 8
+
+typedef struct {
+    __u32 prefixlen;
+    __u8 slot;
+    __u8 addr[4];
+    __u8 reserved[3];
+} policy_ipv4_key;
+
+typedef struct {
+    __u32 prefixlen;
+    __u8 slot;
+    __u8 addr[16];
+    __u8 reserved[3];
+} policy_ipv6_key;
+
+typedef struct {
+    __u32 rule_id;
+    __u8 action;
+    __u8 prefix_len;
+    __u16 reserved;
+} policy_rule;
+
+/* One CIDR of a parsed rule; a range rule expands to several. */
+typedef struct {
+    __u8 family;
+    __u8 prefix_len;
+    __u8 addr[16];
+    policy_rule rule;
+} policy_prefix;
+
+/* Parsed policy file; the arrays are heap-allocated, release with free_policy_set(). */
+typedef struct {
+    __u32 rule_count;
+    __u32 prefix_count;
+    policy_prefix *prefixes;
+    char (*labels)[MAX_POLICY_LABEL_LENGTH];
+} policy_set;
+
+typedef struct {
+    bool success;
+    char error_message[256];
+    policy_set policy;
+} policy_parse_result;
+
+/*
+ * events_map carries packet_event records: one per dropped frame with its
+ * reason code, and with event_sample_rate N, one frame in N per CPU with
+ * its headers before and after rewriting. Each CPU emits at most
+ * event_rate_limit events per second; the rest count as events_suppressed.
+ */
+#define EVENT_TYPE_ERROR 1
+#define EVENT_TYPE_SAMPLE 2
+
+#define ANON_ERROR_NONE 0
+#define ANON_ERROR_TRUNCATED_L2 1
+#define ANON_ERROR_TRUNCATED_ARP 2
+#define ANON_ERROR_BAD_IPV4 3
+#define ANON_ERROR_BAD_IPV6 4
+#define ANON_ERROR_BAD_INNER_FRAME 5
+#define ANON_ERROR_NO_STAGE 6
+#define ANON_ERROR_COUNT 7
+
+#define EVENT_SNAPSHOT_LENGTH 96
+#define EVENT_RATE_WINDOW_NS 1000000000ULL
+#define DEFAULT_EVENT_RATE_LIMIT 100
+#define DEFAULT_EVENT_RING_SIZE (256 * 1024)
+#define MIN_EVENT_RING_SIZE 4096
+
+/* Error events end at after[]; only samples carry the rewritten headers. */
+typedef struct {
+    __u64 timestamp_ns;
+    __u32 type;
+    __u32 reason;
+    __u32 ifindex;
+    __u32 rx_queue;
+    __u32 generation;
+    __u32 frame_length;
+    __u32 snapshot_length;
+    __u32 reserved;
+    __u8 before[EVENT_SNAPSHOT_LENGTH];
+    __u8 after[EVENT_SNAPSHOT_LENGTH];
+} packet_event;
+
+/* Per-CPU event_state_map value: rate-limit window, sample countdown and the event being built. */
+typedef struct {
+    __u64 window_start_ns;
+    __u32 window_events;
+    __u32 sample_countdown;
+    packet_event event;
+} event_state;
+
+/*
+ * Mapping vault: with vault_file set, every original->anonymized pair is
+ * sent on vault_ring_map the first time vault_seen_map sees it under the
+ * current vault_mapping_id, a fingerprint of the salt, key, prefix and
+ * policy settings. The daemon appends new pairs to the vault file.
+ */
+#define VAULT_KIND_MAC 1
+#define VAULT_KIND_IPV4 2
+#define VAULT_KIND_IPV6 3
+
+#define VAULT_SEEN_ENTRIES 262144
+#define VAULT_RING_SIZE (1024 * 1024)
+
+/* The first 24 bytes double as the vault_seen_map key. */
+typedef struct {
+    __u32 mapping_id;
+    __u8 kind;
+    __u8 field;
+    __u8 reserved[2];
+    __u8 original[16];
+    __u8 anonymized[16];
+} vault_mapping;
+
+#define VAULT_SEEN_KEY_SIZE 24
+
+/*
+ * Multi-buffer (xdp.frags) frames are anonymized in place when their
+ * linear part holds at least FRAG_HEADER_WINDOW bytes. Shorter linear
+ * parts have their first FRAG_HEADER_WINDOW bytes copied into the per-CPU
+ * frag_window_map with bpf_xdp_load_bytes(), rewritten there and stored
+ * back. The buffer is larger than the window because the verifier bounds
+ * map-value accesses by the deepest offset the parsers can compute.
+ */
+#define FRAG_HEADER_WINDOW 512
+#define FRAG_WINDOW_SIZE 32760
+
+typedef struct {
+    __u32 length;
+    __u8 bytes[FRAG_WINDOW_SIZE];
+} frag_window;
+
+#define CACHE_LINE_SIZE 64
+
+/* Stored per CPU in stats_map; padded so no two CPUs ever share a line. */
 typedef struct {
     __u64 packets_processed;
     __u64 packets_anonymized;
+    __u64 bytes_processed;
     __u64 mac_addresses_anonymized;
     __u64 ip_addresses_anonymized;
     __u64 arp_packets_anonymized;
     __u64 errors;
-} anonymization_stats;
+    __u64 packets_forwarded;
+    __u64 forward_errors;
+    __u64 cache_hits;
+    __u64 cache_misses;
+    __u64 cache_inserts;
+    __u64 ipv6_addresses_anonymized;
+    __u64 ndp_packets_anonymized;
+    __u64 vlan_packets;
+    __u64 qinq_packets;
+    __u64 mpls_packets;
+    __u64 vxlan_packets;
+    __u64 geneve_packets;
+    __u64 gre_packets;
+    __u64 ports_anonymized;
+    __u64 flow_hits;
+    __u64 flows_created;
+    __u64 policy_drops;
+    __u64 dhcp_scrubbed;
+    __u64 dns_scrubbed;
+    __u64 icmp_errors_scrubbed;
+    __u64 events_suppressed;
+    __u64 events_lost;
+    __u64 vault_records;
+    __u64 vault_lost;
+    __u64 frag_packets;
+    __u64 frag_copies;
+} __attribute__((aligned(CACHE_LINE_SIZE))) anonymization_stats;
 
 typedef struct {
     __u32 original_length;
@@ -43,30 +271,280 @@ typedef struct {
     bool is_broadcast;
 } packet_metadata;
 
+#define PP_TABLE_BITS 16
+#define PP_TABLE_SIZE (1u << PP_TABLE_BITS)
+
+/*
+ * Precomputed flip masks for the first PP_TABLE_BITS bits of a
+ * prefix-preserving IPv4 mapping, indexed by the top address bits.
+ */
+typedef struct {
+    __u16 flips[PP_TABLE_SIZE];
+} prefix_preserving_table;
+
 typedef struct {
     __u32 hash_value;
     __u32 salt;
 } hash_result;
 
+typedef struct {
+    __u32 queue_count;
+    bool zero_copy;
+    char sink_spec[MAX_SINK_SPEC_LENGTH];
+} xsk_settings;
+
+/* Userspace side of the flow table: sweep cadence, timeouts and IPFIX target. */
+typedef struct {
+    __u32 interval;
+    __u32 idle_timeout;
+    __u32 active_timeout;
+    char target[MAX_SINK_SPEC_LENGTH];
+} flow_export_settings;
+
+/*
+ * Software RSS: with cpumap_cpus set, xdp_cpumap_dispatch runs on the RX
+ * queues, hashes each flow the same way in both directions and redirects
+ * it through cpumap_map to worker cpus[hash % worker_count], where
+ * xdp_anonymize_cpumap does the anonymization. cpumap_stats_map is keyed
+ * by worker CPU; queue drops come from the xdp_cpumap_enqueue tracepoint,
+ * which map_id ties to this object's cpumap_map.
+ */
+#define CPUMAP_MAX_WORKERS 64
+#define CPUMAP_MAX_CPUS 1024
+#define CPUMAP_DEFAULT_QUEUE_SIZE 2048
+#define CPUMAP_MAX_QUEUE_SIZE 16384
+
+typedef struct {
+    __u32 map_id;
+    __u32 worker_count;
+    __u32 cpus[CPUMAP_MAX_WORKERS];
+} cpumap_dispatch;
+
+typedef struct {
+    __u64 enqueued;
+    __u64 queue_drops;
+    __u64 redirect_errors;
+} cpumap_worker_stats;
+
+/* Worker CPUs and per-CPU queue length, applied at program load. */
+typedef struct {
+    __u32 worker_count;
+    __u32 cpus[CPUMAP_MAX_WORKERS];
+    __u32 queue_size;
+} cpumap_settings;
+
+/*
+ * Tail-call pipeline: with pipeline set, xdp_anonymize_pipeline reads the
+ * config generation, counts the frame, then tail-calls pipeline_map[stage]
+ * for its network protocol. The stage reads the rest of the frame state
+ * from this CPU's pipeline_frame_map entry. An empty slot drops the frame
+ * as ANON_ERROR_NO_STAGE. pipeline_stats_map is a per-CPU array keyed by
+ * stage.
+ */
+#define PIPELINE_STAGE_L2 0
+#define PIPELINE_STAGE_ARP 1
+#define PIPELINE_STAGE_IPV4 2
+#define PIPELINE_STAGE_IPV6 3
+#define PIPELINE_STAGE_COUNT 4
+
+typedef struct {
+    __u64 start_ns;
+    __u32 generation;
+    __u32 frame_length;
+    bool windowed;
+    bool sampled;
+} pipeline_frame;
+
+typedef struct {
+    __u64 packets;
+    __u64 anonymized;
+    __u64 errors;
+    __u64 missed;
+} pipeline_stage_stats;
+
+/*
+ * Latency histogram: with latency_histogram set, the time from config
+ * lookup to verdict is added to latency_map[class], a per-CPU log2
+ * histogram. Bucket b counts frames that took [2^b, 2^(b+1)) ns, bucket 0
+ * also takes 0 ns, and the last bucket takes everything slower.
+ */
+#define LATENCY_CLASS_ARP 0
+#define LATENCY_CLASS_IPV4 1
+#define LATENCY_CLASS_IPV6 2
+#define LATENCY_CLASS_OTHER 3
+#define LATENCY_CLASS_ERROR 4
+#define LATENCY_CLASS_COUNT 5
+#define LATENCY_BUCKET_COUNT 32
+
+typedef struct {
+    __u64 buckets[LATENCY_BUCKET_COUNT];
+    __u64 total_ns;
+} latency_histogram;
+
+/* Userspace side of the event stream: ring size (fixed at load) and optional log file. */
+typedef struct {
+    __u32 ring_size;
+    char log_path[MAX_PROFILE_PATH_LENGTH];
+} event_settings;
+
 typedef struct {
     bool success;
     char error_message[256];
     anonymization_config config;
+    xsk_settings xsk;
+    flow_export_settings flow_export;
+    event_settings events;
+    cpumap_settings cpumap;
+    char pipeline_stages[PIPELINE_STAGE_COUNT][MAX_PROFILE_PATH_LENGTH];
+    char policy_file[MAX_PROFILE_PATH_LENGTH];
+    char vault_file[MAX_PROFILE_PATH_LENGTH];
+    char pin_dir[MAX_PROFILE_PATH_LENGTH];
 } config_parse_result;
 
+typedef struct {
+    char interface_name[MAX_INTERFACE_NAME_LENGTH];
+    char config_path[MAX_PROFILE_PATH_LENGTH];
+} interface_profile;
+
+typedef struct {
+    bool success;
+    char error_message[256];
+    __u32 count;
+    interface_profile profiles[MAX_INTERFACES];
+} interface_map_parse_result;
+
 typedef struct {
     bool eth_src_modified;
     bool eth_dst_modified;
     bool ip_src_modified;
     bool ip_dst_modified;
     bool arp_modified;
+    bool ipv6_src_modified;
+    bool ipv6_dst_modified;
+    bool ndp_modified;
+    __u8 vlan_depth;
+    __u8 mpls_labels;
+    __u8 encap;
+    bool ports_modified;
+    bool flow_hit;
+    bool flow_created;
+    bool policy_drop;
+    bool dhcp_scrubbed;
+    bool dns_scrubbed;
+    bool icmp_error_scrubbed;
+    __u8 error_reason;
+    __u16 l3_proto;
+    __u8 vault_records;
+    __u8 vault_lost;
+    __u32 cache_hits;
+    __u32 cache_misses;
+    __u32 cache_inserts;
 } packet_modifications;
 
+typedef struct {
+    const anonymization_config *config;
+    const prefix_preserving_table *pp_table;
+    packet_modifications *mods;
+    __u32 generation;
+    __u32 frag_bytes;
+    __u16 stage_proto;
+} anonymization_context;
+
+#define MAPPING_FIELD_SRC 0
+#define MAPPING_FIELD_DST 1
+#define MAPPING_FIELD_ARP 2
+
+#define ENCAP_NONE 0
+#define ENCAP_VXLAN 1
+#define ENCAP_GENEVE 2
+#define ENCAP_GRE 3
+
+typedef struct {
+    __u8 addr[6];
+    __u16 field;
+} mac_cache_key;
+
+typedef struct {
+    __u8 addr[6];
+    __u8 valid;
+    __u8 reserved;
+    __u32 generation;
+} mac_cache_value;
+
+typedef struct {
+    __u32 addr;
+    __u32 field;
+} ipv4_cache_key;
+
+typedef struct {
+    __u32 addr;
+    __u32 valid;
+    __u32 generation;
+} ipv4_cache_value;
+
+/*
+ * flow_table_map is keyed by the original 5-tuple and stores the tuple it
+ * was anonymized to, so each flow is mapped once per config generation.
+ * Addresses are in network byte order; IPv4 uses word 0 only.
+ */
+typedef struct {
+    __be32 saddr[4];
+    __be32 daddr[4];
+    __be16 sport;
+    __be16 dport;
+    __u8 protocol;
+    __u8 family;
+    __u16 reserved;
+} flow_tuple;
+
+typedef struct {
+    flow_tuple anonymized;
+    __u64 packets;
+    __u64 bytes;
+    __u64 first_seen_ns;
+    __u64 last_seen_ns;
+    __u32 generation;
+    __u32 reserved;
+} flow_entry;
+
+#define FLOW_FAMILY_IPV4 4
+#define FLOW_FAMILY_IPV6 6
+
+#define DEFAULT_MAPPING_CACHE_SIZE 65536
+#define DEFAULT_FLOW_TABLE_SIZE 65536
+#define DEFAULT_FLOW_EXPORT_INTERVAL 10
+#define DEFAULT_FLOW_IDLE_TIMEOUT 30
+#define DEFAULT_FLOW_ACTIVE_TIMEOUT 300
+#define DEFAULT_IPV6_PREFIX_LENGTH 48
+
+#define OUTPUT_MODE_DROP 0
+#define OUTPUT_MODE_PASS 1
+#define OUTPUT_MODE_TX 2
+#define OUTPUT_MODE_REDIRECT 3
+#define OUTPUT_MODE_XSK 4
+
+#define MAX_OUTPUT_PORTS 64
+#define MAX_XSK_QUEUES 64
+#define MAX_RX_QUEUES 64
+
 #define MAX_IP_RANGES 16
 #define MAX_CONFIG_LINE_LENGTH 256
 #define DEFAULT_SALT 0x12345678
 #define HASH_MAGIC 0xDEADBEEF
 
+#define HASH_FUNCTION_LEGACY 0
+#define HASH_FUNCTION_SIPHASH 1
+#define ANON_KEY_LENGTH 16
+
+/* SipHash domain tags, so every field gets an independent PRF. */
+#define PRF_DOMAIN_MAC_OUI 1
+#define PRF_DOMAIN_MAC_ID 2
+#define PRF_DOMAIN_IPV4 3
+#define PRF_DOMAIN_PREFIX_BIT 4
+#define PRF_DOMAIN_IPV6 5
+#define PRF_DOMAIN_EPOCH 6
+#define PRF_DOMAIN_PORT 7
+
 #define SUCCESS 0
 #define ERROR_INVALID_CONFIG -1
 #define ERROR_MEMORY_ALLOCATION -2
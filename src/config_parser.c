@@ -0,0 +1,839 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <net/if.h>
+#include "config_parser.h"
+#include "key_derivation.h"
+#include "parsing_helpers.h"
+
+/* Key settings resolved after the whole file is read, so their order does not matter. */
+typedef struct {
+    bool have_key;
+    bool hash_function_set;
+} key_options;
+
+anonymization_config create_default_config(void) {
+    return (anonymization_config){
+        .anonymize_multicast_broadcast = false,
+        .anonymize_srcmac_oui = true,
+        .anonymize_srcmac_id = false,
+        .anonymize_dstmac_oui = false,
+        .anonymize_dstmac_id = true,
+        .preserve_prefix = true,
+        .prefix_preserving = false,
+        .anonymize_srcipv4 = true,
+        .anonymize_dstipv4 = true,
+        .anonymize_mac_in_arphdr = true,
+        .anonymize_ipv4_in_arphdr = true,
+        .anonymize_srcipv6 = true,
+        .anonymize_dstipv6 = true,
+        .anonymize_ndp = true,
+        .scrub_dhcp = false,
+        .scrub_dns = false,
+        .scrub_icmp_errors = false,
+        .src_ip_mask_lengths = 0xFFFFFF00,
+        .dest_ip_mask_lengths = 0xFFFFFF00,
+        .src_ipv6_prefix_length = DEFAULT_IPV6_PREFIX_LENGTH,
+        .dest_ipv6_prefix_length = DEFAULT_IPV6_PREFIX_LENGTH,
+        .random_salt = DEFAULT_SALT,
+        .hash_function = HASH_FUNCTION_LEGACY,
+        .output_mode = OUTPUT_MODE_DROP,
+        .output_ifindex = 0,
+        .mapping_cache = false,
+        .mapping_cache_size = DEFAULT_MAPPING_CACHE_SIZE,
+        .anonymize_ports = false,
+        .flow_table = false,
+        .flow_table_size = DEFAULT_FLOW_TABLE_SIZE,
+        .error_events = true,
+        .event_sample_rate = 0,
+        .event_rate_limit = DEFAULT_EVENT_RATE_LIMIT,
+        .salt_rotation_interval = 0,
+        .specialize = true,
+        .pipeline = false,
+        .latency_histogram = false
+    };
+}
+
+static const char *const pipeline_stage_names[PIPELINE_STAGE_COUNT] = {
+    [PIPELINE_STAGE_L2] = "l2",
+    [PIPELINE_STAGE_ARP] = "arp",
+    [PIPELINE_STAGE_IPV4] = "ipv4",
+    [PIPELINE_STAGE_IPV6] = "ipv6"
+};
+
+const char *pipeline_stage_name(__u32 stage) {
+    return stage < PIPELINE_STAGE_COUNT ? pipeline_stage_names[stage] : "unknown";
+}
+
+static char *trim_whitespace(char *str) {
+    while (*str == ' ' || *str == '\t') str++;
+    char *end = str + strlen(str) - 1;
+    while (end >= str && (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')) {
+        *end = '\0';
+        end--;
+    }
+    return str;
+}
+
+static bool parse_boolean_value(const char *value) {
+    return strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+}
+
+static bool parse_prefix_mask(const char *value, __u32 *mask) {
+    char *end;
+    if (value[0] == '/') {
+        unsigned long prefix_len = strtoul(value + 1, &end, 10);
+        if (*end != '\0' || prefix_len > 32) {
+            return false;
+        }
+        *mask = prefix_len == 0 ? 0 : 0xFFFFFFFFu << (32 - prefix_len);
+        return true;
+    }
+    
+    unsigned long parsed = strtoul(value, &end, 0);
+    if (*end != '\0' || parsed > 0xFFFFFFFFul) {
+        return false;
+    }
+    *mask = (__u32)parsed;
+    return true;
+}
+
+static bool parse_prefix_length(const char *value, __u32 max_length, __u32 *length) {
+    char *end;
+    const char *digits = value[0] == '/' ? value + 1 : value;
+    unsigned long parsed = strtoul(digits, &end, 10);
+    if (end == digits || *end != '\0' || parsed > max_length) {
+        return false;
+    }
+    *length = (__u32)parsed;
+    return true;
+}
+
+/* Seconds, optionally suffixed with s, m, h or d. */
+static bool parse_duration_seconds(const char *value, __u32 *seconds) {
+    char *end;
+    unsigned long parsed = strtoul(value, &end, 10);
+    unsigned long scale = 1;
+    
+    if (end == value) {
+        return false;
+    }
+    if (*end == 'm') {
+        scale = 60;
+    } else if (*end == 'h') {
+        scale = 3600;
+    } else if (*end == 'd') {
+        scale = 86400;
+    } else if (*end != 's' && *end != '\0') {
+        return false;
+    }
+    if (*end != '\0' && end[1] != '\0') {
+        return false;
+    }
+    if (parsed > 0xFFFFFFFFul / scale) {
+        return false;
+    }
+    
+    *seconds = (__u32)(parsed * scale);
+    return true;
+}
+
+static bool string_has_prefix(const char *str, const char *prefix) {
+    return strncmp(str, prefix, strlen(prefix)) == 0;
+}
+
+static bool parse_output_mode(const char *value, __u32 *mode) {
+    if (strcmp(value, "drop") == 0) {
+        *mode = OUTPUT_MODE_DROP;
+    } else if (strcmp(value, "pass") == 0) {
+        *mode = OUTPUT_MODE_PASS;
+    } else if (strcmp(value, "tx") == 0) {
+        *mode = OUTPUT_MODE_TX;
+    } else if (strcmp(value, "redirect") == 0) {
+        *mode = OUTPUT_MODE_REDIRECT;
+    } else if (strcmp(value, "xsk") == 0) {
+        *mode = OUTPUT_MODE_XSK;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool apply_xsk_option(xsk_settings *xsk, const char *key, const char *value) {
+    if (strcmp(key, "xsk_queues") == 0) {
+        xsk->queue_count = (__u32)strtoul(value, NULL, 0);
+        return xsk->queue_count > 0 && xsk->queue_count <= MAX_XSK_QUEUES;
+    } else if (strcmp(key, "xsk_zero_copy") == 0) {
+        xsk->zero_copy = parse_boolean_value(value);
+    } else if (strcmp(key, "xsk_sink") == 0) {
+        snprintf(xsk->sink_spec, sizeof(xsk->sink_spec), "%s", value);
+    }
+    return true;
+}
+
+/* file:<path> or udp:<host>:<port>; the exporter resolves it. */
+static bool apply_flow_export_option(flow_export_settings *export, const char *key,
+                                     const char *value) {
+    if (strcmp(key, "flow_export") == 0) {
+        if (!string_has_prefix(value, "file:") && !string_has_prefix(value, "udp:")) {
+            return false;
+        }
+        snprintf(export->target, sizeof(export->target), "%s", value);
+    } else if (strcmp(key, "flow_export_interval") == 0) {
+        return parse_duration_seconds(value, &export->interval) && export->interval > 0;
+    } else if (strcmp(key, "flow_export_idle_timeout") == 0) {
+        return parse_duration_seconds(value, &export->idle_timeout) && export->idle_timeout > 0;
+    } else if (strcmp(key, "flow_export_active_timeout") == 0) {
+        return parse_duration_seconds(value, &export->active_timeout) && export->active_timeout > 0;
+    }
+    return true;
+}
+
+/* event_ring_size must be a power of two of at least one page, as BPF_MAP_TYPE_RINGBUF requires. */
+static bool apply_event_option(anonymization_config *config, event_settings *events,
+                               const char *key, const char *value) {
+    if (strcmp(key, "event_sample_rate") == 0) {
+        config->event_sample_rate = (__u32)strtoul(value, NULL, 0);
+    } else if (strcmp(key, "event_rate_limit") == 0) {
+        config->event_rate_limit = (__u32)strtoul(value, NULL, 0);
+        return config->event_rate_limit > 0;
+    } else if (strcmp(key, "event_ring_size") == 0) {
+        events->ring_size = (__u32)strtoul(value, NULL, 0);
+        return events->ring_size >= MIN_EVENT_RING_SIZE &&
+               !(events->ring_size & (events->ring_size - 1));
+    } else if (strcmp(key, "event_log") == 0) {
+        return (size_t)snprintf(events->log_path, sizeof(events->log_path), "%s",
+                                value) < sizeof(events->log_path);
+    }
+    return true;
+}
+
+/* Comma-separated CPUs and first-last ranges, e.g. 2-5,8; each CPU at most once. */
+static bool parse_cpu_list(const char *value, cpumap_settings *cpumap) {
+    cpumap->worker_count = 0;
+    const char *pos = value;
+    while (*pos) {
+        char *end;
+        unsigned long first = strtoul(pos, &end, 10);
+        unsigned long last = first;
+        if (end == pos) {
+            return false;
+        }
+        if (*end == '-') {
+            pos = end + 1;
+            last = strtoul(pos, &end, 10);
+            if (end == pos || last < first) {
+                return false;
+            }
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            if (cpu >= CPUMAP_MAX_CPUS || cpumap->worker_count >= CPUMAP_MAX_WORKERS) {
+                return false;
+            }
+            for (__u32 i = 0; i < cpumap->worker_count; i++) {
+                if (cpumap->cpus[i] == cpu) {
+                    return false;
+                }
+            }
+            cpumap->cpus[cpumap->worker_count++] = (__u32)cpu;
+        }
+        
+        while (*end == ' ') end++;
+        if (*end == ',') {
+            end++;
+            while (*end == ' ') end++;
+            if (!*end) {
+                return false;
+            }
+        } else if (*end) {
+            return false;
+        }
+        pos = end;
+    }
+    return cpumap->worker_count > 0;
+}
+
+static bool apply_cpumap_option(cpumap_settings *cpumap, const char *key, const char *value) {
+    if (strcmp(key, "cpumap_cpus") == 0) {
+        return parse_cpu_list(value, cpumap);
+    } else if (strcmp(key, "cpumap_queue_size") == 0) {
+        cpumap->queue_size = (__u32)strtoul(value, NULL, 0);
+        return cpumap->queue_size > 0 && cpumap->queue_size <= CPUMAP_MAX_QUEUE_SIZE;
+    }
+    return true;
+}
+
+/* pipeline_stage_<name>: BPF object whose xdp_stage_<name> program replaces the built-in one. */
+static bool apply_pipeline_option(config_parse_result *result, const char *key, const char *value) {
+    const char *name = key + strlen("pipeline_stage_");
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        if (strcmp(name, pipeline_stage_names[stage]) == 0) {
+            return (size_t)snprintf(result->pipeline_stages[stage],
+                                    sizeof(result->pipeline_stages[stage]), "%s",
+                                    value) < sizeof(result->pipeline_stages[stage]);
+        }
+    }
+    return false;
+}
+
+static bool parse_hash_function(const char *value, __u32 *function) {
+    if (strcmp(value, "legacy") == 0) {
+        *function = HASH_FUNCTION_LEGACY;
+    } else if (strcmp(value, "siphash") == 0) {
+        *function = HASH_FUNCTION_SIPHASH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool apply_key_option(anonymization_config *config, key_options *keys, const char *key,
+                             const char *value) {
+    if (strcmp(key, "hash_function") == 0) {
+        keys->hash_function_set = true;
+        return parse_hash_function(value, &config->hash_function);
+    } else if (strcmp(key, "key_file") == 0) {
+        keys->have_key = true;
+        return load_key_file(value, config->hash_key) == 0;
+    } else if (strcmp(key, "key_passphrase") == 0) {
+        keys->have_key = true;
+        return derive_key_from_passphrase(value, config->hash_key) == 0;
+    }
+    return true;
+}
+
+static bool is_key_option(const char *key) {
+    return string_has_prefix(key, "key_") || strcmp(key, "hash_function") == 0;
+}
+
+/*
+ * fgets() stops short of a newline only at the end of the file or a full
+ * buffer, so a shorter unterminated line was cut at a NUL byte.
+ */
+static const char *check_config_line(FILE *file, const char *line) {
+    size_t length = strlen(line);
+    if ((!length || line[length - 1] != '\n') && !feof(file)) {
+        return length + 1 == MAX_CONFIG_LINE_LENGTH ? "line too long" : "not a text line";
+    }
+    for (const unsigned char *c = (const unsigned char *)line; *c; c++) {
+        if ((*c < ' ' && *c != '\t' && *c != '\r' && *c != '\n') || *c == 0x7F) {
+            return "not a text line";
+        }
+    }
+    return NULL;
+}
+
+static bool apply_config_option(anonymization_config *config, const char *key, const char *value) {
+    if (strcmp(key, "anonymize_srcmac_oui") == 0) {
+        config->anonymize_srcmac_oui = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_srcmac_id") == 0) {
+        config->anonymize_srcmac_id = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_dstmac_oui") == 0) {
+        config->anonymize_dstmac_oui = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_dstmac_id") == 0) {
+        config->anonymize_dstmac_id = parse_boolean_value(value);
+    } else if (strcmp(key, "preserve_prefix") == 0) {
+        config->preserve_prefix = parse_boolean_value(value);
+    } else if (strcmp(key, "prefix_preserving") == 0) {
+        config->prefix_preserving = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_srcipv4") == 0) {
+        config->anonymize_srcipv4 = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_dstipv4") == 0) {
+        config->anonymize_dstipv4 = parse_boolean_value(value);
+    } else if (strcmp(key, "src_ip_mask_lengths") == 0) {
+        return parse_prefix_mask(value, &config->src_ip_mask_lengths);
+    } else if (strcmp(key, "dest_ip_mask_lengths") == 0) {
+        return parse_prefix_mask(value, &config->dest_ip_mask_lengths);
+    } else if (strcmp(key, "anonymize_srcipv6") == 0) {
+        config->anonymize_srcipv6 = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_dstipv6") == 0) {
+        config->anonymize_dstipv6 = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_ndp") == 0) {
+        config->anonymize_ndp = parse_boolean_value(value);
+    } else if (strcmp(key, "scrub_dhcp") == 0) {
+        config->scrub_dhcp = parse_boolean_value(value);
+    } else if (strcmp(key, "scrub_dns") == 0) {
+        config->scrub_dns = parse_boolean_value(value);
+    } else if (strcmp(key, "scrub_icmp_errors") == 0) {
+        config->scrub_icmp_errors = parse_boolean_value(value);
+    } else if (strcmp(key, "src_ipv6_prefix_length") == 0) {
+        return parse_prefix_length(value, 128, &config->src_ipv6_prefix_length);
+    } else if (strcmp(key, "dest_ipv6_prefix_length") == 0) {
+        return parse_prefix_length(value, 128, &config->dest_ipv6_prefix_length);
+    } else if (strcmp(key, "anonymize_multicast_broadcast") == 0) {
+        config->anonymize_multicast_broadcast = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_mac_in_arphdr") == 0) {
+        config->anonymize_mac_in_arphdr = parse_boolean_value(value);
+    } else if (strcmp(key, "anonymize_ipv4_in_arphdr") == 0) {
+        config->anonymize_ipv4_in_arphdr = parse_boolean_value(value);
+    } else if (strcmp(key, "random_salt") == 0) {
+        config->random_salt = (__u32)strtoul(value, NULL, 0);
+    } else if (strcmp(key, "mapping_cache") == 0) {
+        config->mapping_cache = parse_boolean_value(value);
+    } else if (strcmp(key, "mapping_cache_size") == 0) {
+        config->mapping_cache_size = (__u32)strtoul(value, NULL, 0);
+        return config->mapping_cache_size > 0;
+    } else if (strcmp(key, "anonymize_ports") == 0) {
+        config->anonymize_ports = parse_boolean_value(value);
+    } else if (strcmp(key, "flow_table") == 0) {
+        config->flow_table = parse_boolean_value(value);
+    } else if (strcmp(key, "flow_table_size") == 0) {
+        config->flow_table_size = (__u32)strtoul(value, NULL, 0);
+        return config->flow_table_size > 0;
+    } else if (strcmp(key, "error_events") == 0) {
+        config->error_events = parse_boolean_value(value);
+    } else if (strcmp(key, "specialize") == 0) {
+        config->specialize = parse_boolean_value(value);
+    } else if (strcmp(key, "pipeline") == 0) {
+        config->pipeline = parse_boolean_value(value);
+    } else if (strcmp(key, "latency_histogram") == 0) {
+        config->latency_histogram = parse_boolean_value(value);
+    } else if (strcmp(key, "salt_rotation_interval") == 0) {
+        return parse_duration_seconds(value, &config->salt_rotation_interval);
+    } else if (strcmp(key, "output_mode") == 0) {
+        return parse_output_mode(value, &config->output_mode);
+    } else if (strcmp(key, "output_interface") == 0) {
+        config->output_ifindex = if_nametoindex(value);
+        return config->output_ifindex != 0;
+    }
+    return true;
+}
+
+config_parse_result parse_config_file(const char *filename) {
+    config_parse_result result = {0};
+    result.success = false;
+    
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        snprintf(result.error_message, sizeof(result.error_message), 
+                "Config file open failed: %s", strerror(errno));
+        return result;
+    }
+    
+    result.config = create_default_config();
+    result.xsk = (xsk_settings){
+        .queue_count = 1,
+        .zero_copy = true,
+        .sink_spec = "pcap:anonymized.pcap"
+    };
+    result.flow_export = (flow_export_settings){
+        .interval = DEFAULT_FLOW_EXPORT_INTERVAL,
+        .idle_timeout = DEFAULT_FLOW_IDLE_TIMEOUT,
+        .active_timeout = DEFAULT_FLOW_ACTIVE_TIMEOUT,
+        .target = ""
+    };
+    result.events = (event_settings){
+        .ring_size = DEFAULT_EVENT_RING_SIZE,
+        .log_path = ""
+    };
+    result.cpumap = (cpumap_settings){
+        .worker_count = 0,
+        .queue_size = CPUMAP_DEFAULT_QUEUE_SIZE
+    };
+    
+    key_options keys = {0};
+    char line[MAX_CONFIG_LINE_LENGTH];
+    __u32 line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        const char *problem = check_config_line(file, line);
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        
+        char *separator = strchr(line, ':');
+        if (separator) {
+            *separator = '\0';
+        }
+        char *key = trim_whitespace(line);
+        char *value = separator ? trim_whitespace(separator + 1) : key;
+        
+        if (!problem && !separator && *key) {
+            problem = "expected <key>: <value>";
+        } else if (!problem && separator && (!*key || !*value)) {
+            problem = *key ? "missing value" : "missing key";
+        }
+        if (problem) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Invalid config line at %s:%u: %s", filename, line_number, problem);
+            fclose(file);
+            return result;
+        }
+        if (!*key) {
+            continue;
+        }
+        
+        bool valid;
+        if (string_has_prefix(key, "xsk_")) {
+            valid = apply_xsk_option(&result.xsk, key, value);
+        } else if (string_has_prefix(key, "flow_export")) {
+            valid = apply_flow_export_option(&result.flow_export, key, value);
+        } else if (string_has_prefix(key, "event_")) {
+            valid = apply_event_option(&result.config, &result.events, key, value);
+        } else if (string_has_prefix(key, "cpumap_")) {
+            valid = apply_cpumap_option(&result.cpumap, key, value);
+        } else if (string_has_prefix(key, "pipeline_stage_")) {
+            valid = apply_pipeline_option(&result, key, value);
+        } else if (is_key_option(key)) {
+            valid = apply_key_option(&result.config, &keys, key, value);
+        } else if (strcmp(key, "policy_file") == 0) {
+            valid = (size_t)snprintf(result.policy_file, sizeof(result.policy_file), "%s",
+                                     value) < sizeof(result.policy_file);
+            result.config.address_policy = true;
+        } else if (strcmp(key, "vault_file") == 0) {
+            valid = (size_t)snprintf(result.vault_file, sizeof(result.vault_file), "%s",
+                                     value) < sizeof(result.vault_file);
+            result.config.mapping_vault = true;
+        } else if (strcmp(key, "bpf_pin_dir") == 0) {
+            valid = value[0] == '/' && (size_t)snprintf(result.pin_dir, sizeof(result.pin_dir),
+                                                        "%s", value) < sizeof(result.pin_dir);
+        } else {
+            valid = apply_config_option(&result.config, key, value);
+        }
+        if (!valid) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Invalid value for %s at %s:%u: %s", key, filename, line_number, value);
+            fclose(file);
+            return result;
+        }
+    }
+    
+    fclose(file);
+    
+    if (keys.have_key && !keys.hash_function_set) {
+        result.config.hash_function = HASH_FUNCTION_SIPHASH;
+    }
+    if (result.config.hash_function == HASH_FUNCTION_SIPHASH && !keys.have_key) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "hash_function siphash requires key_file or key_passphrase");
+        return result;
+    }
+    
+    if (result.config.output_mode == OUTPUT_MODE_REDIRECT && !result.config.output_ifindex) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "output_mode redirect requires output_interface");
+        return result;
+    }
+    
+    /* The cpumap stage has no RX queue to transmit on or to match an AF_XDP socket. */
+    if (result.cpumap.worker_count && (result.config.output_mode == OUTPUT_MODE_TX ||
+                                       result.config.output_mode == OUTPUT_MODE_XSK)) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "output_mode tx and xsk are not available with cpumap_cpus");
+        return result;
+    }
+    
+    /* cpumap workers run xdp_anonymize_cpumap, which has no pipeline to tail-call into. */
+    if (result.config.pipeline && result.cpumap.worker_count) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "pipeline is not available with cpumap_cpus");
+        return result;
+    }
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        if (result.pipeline_stages[stage][0] && !result.config.pipeline) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "pipeline_stage_%s requires pipeline", pipeline_stage_names[stage]);
+            return result;
+        }
+    }
+    
+    if (result.flow_export.target[0] && !result.config.flow_table) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "flow_export requires flow_table");
+        return result;
+    }
+    
+    /* Parsed again by the loader; here it only has to be valid. */
+    if (result.config.address_policy) {
+        policy_parse_result policy = parse_policy_file(result.policy_file);
+        free_policy_set(&policy.policy);
+        if (!policy.success) {
+            snprintf(result.error_message, sizeof(result.error_message), "%s",
+                    policy.error_message);
+            return result;
+        }
+    }
+    
+    result.success = true;
+    return result;
+}
+
+static bool resolve_profile_path(const char *map_path, const char *profile, char *out, size_t size) {
+    if (profile[0] == '/') {
+        return (size_t)snprintf(out, size, "%s", profile) < size;
+    }
+    
+    char dir_copy[MAX_PROFILE_PATH_LENGTH];
+    snprintf(dir_copy, sizeof(dir_copy), "%s", map_path);
+    return (size_t)snprintf(out, size, "%s/%s", dirname(dir_copy), profile) < size;
+}
+
+interface_map_parse_result parse_interface_map(const char *filename) {
+    interface_map_parse_result result = {0};
+    result.success = false;
+    
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Interface map open failed: %s", strerror(errno));
+        return result;
+    }
+    
+    char line[MAX_CONFIG_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file)) {
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        
+        char *separator = strchr(line, ':');
+        if (!separator) {
+            continue;
+        }
+        *separator = '\0';
+        
+        char *name = trim_whitespace(line);
+        char *profile = trim_whitespace(separator + 1);
+        
+        if (!*name || !*profile) {
+            continue;
+        }
+        
+        const char *problem = NULL;
+        if (strlen(name) >= MAX_INTERFACE_NAME_LENGTH) {
+            problem = "interface name too long";
+        } else if (result.count == MAX_INTERFACES) {
+            problem = "too many interfaces";
+        }
+        for (__u32 i = 0; !problem && i < result.count; i++) {
+            if (strcmp(result.profiles[i].interface_name, name) == 0) {
+                problem = "interface listed twice";
+            }
+        }
+        
+        interface_profile *entry = &result.profiles[result.count];
+        if (!problem && !resolve_profile_path(filename, profile, entry->config_path,
+                                              sizeof(entry->config_path))) {
+            problem = "profile path too long";
+        }
+        if (problem) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Invalid entry for %s: %s", name, problem);
+            fclose(file);
+            return result;
+        }
+        
+        snprintf(entry->interface_name, sizeof(entry->interface_name), "%s", name);
+        result.count++;
+    }
+    
+    fclose(file);
+    
+    if (!result.count) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Interface map lists no interfaces");
+        return result;
+    }
+    
+    result.success = true;
+    return result;
+}
+
+static bool add_policy_prefix(policy_set *policy, __u8 family, const __u8 *addr, __u32 prefix_len,
+                              const policy_rule *rule) {
+    if (policy->prefix_count == MAX_POLICY_PREFIXES) {
+        return false;
+    }
+    
+    /* Grown at every power of two, so no separate capacity is kept. */
+    __u32 count = policy->prefix_count;
+    if (!(count & (count - 1))) {
+        policy_prefix *grown = realloc(policy->prefixes, (count ? count * 2 : 16) * sizeof(*grown));
+        if (!grown) {
+            return false;
+        }
+        policy->prefixes = grown;
+    }
+    
+    policy_prefix *prefix = &policy->prefixes[count];
+    memset(prefix, 0, sizeof(*prefix));
+    prefix->family = family;
+    prefix->prefix_len = (__u8)prefix_len;
+    memcpy(prefix->addr, addr, family == FLOW_FAMILY_IPV4 ? 4 : 16);
+    prefix->rule = *rule;
+    policy->prefix_count++;
+    return true;
+}
+
+/* Smallest set of aligned CIDR blocks covering [start, end]. */
+static bool add_ipv4_range(policy_set *policy, __u32 start, __u32 end, const policy_rule *rule) {
+    __u64 next = start;
+    while (next <= end) {
+        __u32 prefix_len = 32;
+        while (prefix_len > 0) {
+            __u64 size = 1ull << (33 - prefix_len);
+            if ((next & (size - 1)) || next + size - 1 > end) {
+                break;
+            }
+            prefix_len--;
+        }
+        
+        __be32 addr = htonl((__u32)next);
+        if (!add_policy_prefix(policy, FLOW_FAMILY_IPV4, (const __u8 *)&addr, prefix_len, rule)) {
+            return false;
+        }
+        next += 1ull << (32 - prefix_len);
+    }
+    return true;
+}
+
+static bool add_ipv6_target(policy_set *policy, const char *target, const policy_rule *rule) {
+    char addr_str[INET6_ADDRSTRLEN];
+    __u32 prefix_len = 128;
+    const char *slash = strchr(target, '/');
+    size_t addr_len = slash ? (size_t)(slash - target) : strlen(target);
+    
+    if (addr_len >= sizeof(addr_str)) {
+        return false;
+    }
+    memcpy(addr_str, target, addr_len);
+    addr_str[addr_len] = '\0';
+    
+    __u8 addr[16];
+    if (inet_pton(AF_INET6, addr_str, addr) != 1 ||
+        (slash && !parse_prefix_length(slash + 1, 128, &prefix_len))) {
+        return false;
+    }
+    for (__u32 bit = prefix_len; bit < 128; bit++) {
+        addr[bit / 8] &= ~(0x80 >> (bit % 8));
+    }
+    return add_policy_prefix(policy, FLOW_FAMILY_IPV6, addr, prefix_len, rule);
+}
+
+static bool parse_policy_action(const char *action, const char *argument, __u32 max_length,
+                                policy_rule *rule) {
+    if (strcmp(action, "preserve") == 0) {
+        __u32 prefix_len;
+        if (!argument || !parse_prefix_length(argument, max_length, &prefix_len)) {
+            return false;
+        }
+        rule->action = POLICY_ACTION_PRESERVE;
+        rule->prefix_len = (__u8)prefix_len;
+        return true;
+    }
+    
+    if (strcmp(action, "anonymize") == 0) {
+        rule->action = POLICY_ACTION_ANONYMIZE;
+    } else if (strcmp(action, "pass") == 0) {
+        rule->action = POLICY_ACTION_PASS;
+    } else if (strcmp(action, "drop") == 0) {
+        rule->action = POLICY_ACTION_DROP;
+    } else {
+        return false;
+    }
+    return !argument;
+}
+
+/* "<address | cidr | first-last> <action> [prefix bits]"; returns NULL or what is wrong. */
+static const char *parse_policy_line(policy_set *policy, char *line) {
+    char *saveptr;
+    char *target = strtok_r(line, " \t", &saveptr);
+    char *action = strtok_r(NULL, " \t", &saveptr);
+    char *argument = strtok_r(NULL, " \t", &saveptr);
+    
+    if (!action || strtok_r(NULL, " \t", &saveptr)) {
+        return "expected <address> <action> [prefix bits]";
+    }
+    if (policy->rule_count == MAX_POLICY_RULES) {
+        return "too many rules";
+    }
+    
+    bool ipv6 = strchr(target, ':') != NULL;
+    policy_rule rule = { .rule_id = policy->rule_count };
+    if (!parse_policy_action(action, argument, ipv6 ? 128 : 32, &rule)) {
+        return "unknown action or bad prefix length";
+    }
+    
+    bool added;
+    ip_range range;
+    if (ipv6) {
+        added = add_ipv6_target(policy, target, &rule);
+    } else if (strchr(target, '-')) {
+        added = parse_ip_range(target, &range) &&
+                add_ipv4_range(policy, range.start_ip, range.end_ip, &rule);
+    } else if (strchr(target, '/')) {
+        added = parse_cidr_range(target, &range) &&
+                add_ipv4_range(policy, range.start_ip, range.end_ip, &rule);
+    } else {
+        __u32 ip;
+        added = parse_ip_address(target, &ip) && add_ipv4_range(policy, ip, ip, &rule);
+    }
+    if (!added) {
+        return policy->prefix_count == MAX_POLICY_PREFIXES ? "too many prefixes" : "bad address";
+    }
+    
+    if (!(policy->rule_count & (policy->rule_count - 1))) {
+        __u32 capacity = policy->rule_count ? policy->rule_count * 2 : 16;
+        char (*grown)[MAX_POLICY_LABEL_LENGTH] = realloc(policy->labels,
+                                                         capacity * sizeof(*grown));
+        if (!grown) {
+            return "out of memory";
+        }
+        policy->labels = grown;
+    }
+    snprintf(policy->labels[policy->rule_count], MAX_POLICY_LABEL_LENGTH, "%s %s%s%s", target,
+             action, argument ? " " : "", argument ? argument : "");
+    policy->rule_count++;
+    return NULL;
+}
+
+policy_parse_result parse_policy_file(const char *filename) {
+    policy_parse_result result = {0};
+    result.success = false;
+    
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Policy file open failed for %s: %s", filename, strerror(errno));
+        return result;
+    }
+    
+    char line[MAX_CONFIG_LINE_LENGTH];
+    __u32 line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        
+        char *rule = trim_whitespace(line);
+        if (!*rule) {
+            continue;
+        }
+        
+        const char *problem = parse_policy_line(&result.policy, rule);
+        if (problem) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Invalid policy rule at %s:%u: %s", filename, line_number, problem);
+            free_policy_set(&result.policy);
+            fclose(file);
+            return result;
+        }
+    }
+    
+    fclose(file);
+    result.success = true;
+    return result;
+}
+
+void free_policy_set(policy_set *policy) {
+    free(policy->prefixes);
+    free(policy->labels);
+    *policy = (policy_set){0};
+}
@@ -0,0 +1,33 @@
+#ifndef CONFIG_PARSER_H
+#define CONFIG_PARSER_H
+
+#include "common_structs.h"
+
+anonymization_config create_default_config(void);
+
+/*
+ * Reads "<key>: <value>" lines; blank lines and # comments are skipped.
+ * Binary data, lines without a key or value and bad values fail with the
+ * line number, never with a default config.
+ */
+config_parse_result parse_config_file(const char *filename);
+
+/* Config key suffix of a PIPELINE_STAGE_* value, e.g. "ipv4" for pipeline_stage_ipv4. */
+const char *pipeline_stage_name(__u32 stage);
+
+/*
+ * Reads "<interface>: <profile>" lines for the multi-interface daemon.
+ * Relative profile paths are resolved against the map file's directory.
+ */
+interface_map_parse_result parse_interface_map(const char *filename);
+
+/*
+ * Reads address policy rules, one "<target> <action> [bits]" per line.
+ * Targets are IPv4 or IPv6 addresses, CIDRs or IPv4 "first-last" ranges;
+ * actions are anonymize, preserve <bits>, pass and drop. A rule's id is
+ * its position in the file. On failure the result holds no allocations.
+ */
+policy_parse_result parse_policy_file(const char *filename);
+void free_policy_set(policy_set *policy);
+
+#endif
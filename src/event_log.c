@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "event_log.h"
+
+#define NSEC_PER_SEC 1000000000ull
+#define NSEC_PER_MSEC 1000000ull
+
+struct event_log {
+    FILE *file;
+};
+
+static const char *const reason_names[ANON_ERROR_COUNT] = {
+    [ANON_ERROR_NONE] = "none",
+    [ANON_ERROR_TRUNCATED_L2] = "truncated-l2",
+    [ANON_ERROR_TRUNCATED_ARP] = "truncated-arp",
+    [ANON_ERROR_BAD_IPV4] = "bad-ipv4-header",
+    [ANON_ERROR_BAD_IPV6] = "bad-ipv6-header",
+    [ANON_ERROR_BAD_INNER_FRAME] = "bad-inner-frame",
+    [ANON_ERROR_NO_STAGE] = "no-pipeline-stage"
+};
+
+const char *event_reason_name(__u32 reason) {
+    return reason < ANON_ERROR_COUNT ? reason_names[reason] : "unknown";
+}
+
+event_log *event_log_open(const char *path) {
+    event_log *log = calloc(1, sizeof(*log));
+    if (!log) {
+        fprintf(stderr, "Event log allocation failed\n");
+        return NULL;
+    }
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Event log open failed for %s: %s\n", path, strerror(errno));
+        free(log);
+        return NULL;
+    }
+    log->file = fdopen(fd, "a");
+    if (!log->file) {
+        fprintf(stderr, "Event log open failed for %s: %s\n", path, strerror(errno));
+        close(fd);
+        free(log);
+        return NULL;
+    }
+    setvbuf(log->file, NULL, _IOLBF, 0);
+    printf("Logging anonymization events to %s\n", path);
+    return log;
+}
+
+void event_log_close(event_log *log) {
+    if (!log) {
+        return;
+    }
+    fclose(log->file);
+    free(log);
+}
+
+static void write_hex(FILE *file, const __u8 *bytes, __u32 length) {
+    for (__u32 i = 0; i < length; i++) {
+        fprintf(file, "%02x", bytes[i]);
+    }
+}
+
+/* Event times come from bpf_ktime_get_ns(), i.e. CLOCK_MONOTONIC. */
+static __u64 event_epoch_ms(__u64 timestamp_ns) {
+    struct timespec mono, wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    __u64 now_ns = (__u64)mono.tv_sec * NSEC_PER_SEC + mono.tv_nsec;
+    __u64 now_ms = (__u64)wall.tv_sec * 1000 + wall.tv_nsec / NSEC_PER_MSEC;
+    __u64 ago_ms = now_ns > timestamp_ns ? (now_ns - timestamp_ns) / NSEC_PER_MSEC : 0;
+    return now_ms - ago_ms;
+}
+
+void event_log_write(event_log *log, const char *interface_name, const packet_event *event) {
+    __u64 epoch_ms = event_epoch_ms(event->timestamp_ns);
+    __u32 length = event->snapshot_length;
+    if (length > EVENT_SNAPSHOT_LENGTH) {
+        length = EVENT_SNAPSHOT_LENGTH;
+    }
+    
+    fprintf(log->file, "%llu.%03llu %s queue %u gen %u len %u ",
+            epoch_ms / 1000, epoch_ms % 1000, interface_name, event->rx_queue,
+            event->generation, event->frame_length);
+    if (event->type == EVENT_TYPE_SAMPLE) {
+        fprintf(log->file, "sample before ");
+        write_hex(log->file, event->before, length);
+        fprintf(log->file, " after ");
+        write_hex(log->file, event->after, length);
+    } else {
+        fprintf(log->file, "error %s before ", event_reason_name(event->reason));
+        write_hex(log->file, event->before, length);
+    }
+    fputc('\n', log->file);
+}
@@ -0,0 +1,23 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <linux/types.h>
+#include "common_structs.h"
+
+/*
+ * Text log of events_map records, one line per event:
+ *   <epoch.ms> <interface> queue <n> gen <g> len <bytes> error <reason> before <hex>
+ *   <epoch.ms> <interface> queue <n> gen <g> len <bytes> sample before <hex> after <hex>
+ * "before" holds the original headers, so the file is created mode 0600.
+ */
+typedef struct event_log event_log;
+
+event_log *event_log_open(const char *path);
+void event_log_close(event_log *log);
+
+/* Error records stop short of after[], which is only read for samples. */
+void event_log_write(event_log *log, const char *interface_name, const packet_event *event);
+
+const char *event_reason_name(__u32 reason);
+
+#endif
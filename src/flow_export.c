@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <bpf/bpf.h>
+#include "flow_export.h"
+
+#define IPFIX_HEADER_LEN 16
+#define IPFIX_SET_HEADER_LEN 4
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+
+typedef struct {
+    __u16 id;
+    __u16 length;
+} ipfix_field;
+
+/* IANA information elements, in record order. */
+static const ipfix_field ipv4_fields[] = {
+    { 8, 4 },       /* sourceIPv4Address */
+    { 12, 4 },      /* destinationIPv4Address */
+    { 7, 2 },       /* sourceTransportPort */
+    { 11, 2 },      /* destinationTransportPort */
+    { 4, 1 },       /* protocolIdentifier */
+    { 1, 8 },       /* octetDeltaCount */
+    { 2, 8 },       /* packetDeltaCount */
+    { 152, 8 },     /* flowStartMilliseconds */
+    { 153, 8 }      /* flowEndMilliseconds */
+};
+
+static const ipfix_field ipv6_fields[] = {
+    { 27, 16 },     /* sourceIPv6Address */
+    { 28, 16 },     /* destinationIPv6Address */
+    { 7, 2 },
+    { 11, 2 },
+    { 4, 1 },
+    { 1, 8 },
+    { 2, 8 },
+    { 152, 8 },
+    { 153, 8 }
+};
+
+#define IPFIX_FIELD_COUNT (sizeof(ipv4_fields) / sizeof(ipv4_fields[0]))
+#define IPFIX_IPV4_RECORD_LEN 45
+#define IPFIX_IPV6_RECORD_LEN 69
+
+struct flow_exporter {
+    int fd;
+    bool datagram;
+    __u32 observation_domain;
+    __u32 sequence;
+    __u32 records;
+    size_t used;
+    size_t set_offset;
+    __u16 set_id;
+    unsigned char message[IPFIX_MAX_MESSAGE_SIZE];
+};
+
+static void put_u8(flow_exporter *exporter, __u8 value) {
+    exporter->message[exporter->used++] = value;
+}
+
+static void put_u16(flow_exporter *exporter, __u16 value) {
+    put_u8(exporter, value >> 8);
+    put_u8(exporter, value);
+}
+
+static void put_u32(flow_exporter *exporter, __u32 value) {
+    put_u16(exporter, value >> 16);
+    put_u16(exporter, value);
+}
+
+static void put_u64(flow_exporter *exporter, __u64 value) {
+    put_u32(exporter, value >> 32);
+    put_u32(exporter, value);
+}
+
+static void put_bytes(flow_exporter *exporter, const void *data, size_t len) {
+    memcpy(exporter->message + exporter->used, data, len);
+    exporter->used += len;
+}
+
+static void patch_u16(flow_exporter *exporter, size_t offset, __u16 value) {
+    exporter->message[offset] = value >> 8;
+    exporter->message[offset + 1] = value;
+}
+
+static void put_template(flow_exporter *exporter, __u16 template_id, const ipfix_field *fields) {
+    put_u16(exporter, template_id);
+    put_u16(exporter, IPFIX_FIELD_COUNT);
+    for (size_t i = 0; i < IPFIX_FIELD_COUNT; i++) {
+        put_u16(exporter, fields[i].id);
+        put_u16(exporter, fields[i].length);
+    }
+}
+
+/* Header is filled in on flush; the template set leads every message. */
+static void begin_message(flow_exporter *exporter) {
+    exporter->used = IPFIX_HEADER_LEN;
+    
+    size_t set_start = exporter->used;
+    put_u16(exporter, IPFIX_TEMPLATE_SET_ID);
+    put_u16(exporter, 0);
+    put_template(exporter, IPFIX_TEMPLATE_IPV4, ipv4_fields);
+    put_template(exporter, IPFIX_TEMPLATE_IPV6, ipv6_fields);
+    patch_u16(exporter, set_start + 2, exporter->used - set_start);
+}
+
+static void close_data_set(flow_exporter *exporter) {
+    if (exporter->set_offset) {
+        patch_u16(exporter, exporter->set_offset + 2, exporter->used - exporter->set_offset);
+    }
+    exporter->set_offset = 0;
+    exporter->set_id = 0;
+}
+
+static int write_message(flow_exporter *exporter) {
+    size_t written = 0;
+    while (written < exporter->used) {
+        ssize_t ret = exporter->datagram ?
+                      send(exporter->fd, exporter->message, exporter->used, 0) :
+                      write(exporter->fd, exporter->message + written, exporter->used - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Flow export failed: %s\n", strerror(errno));
+            return -1;
+        }
+        written = exporter->datagram ? exporter->used : written + ret;
+    }
+    return 0;
+}
+
+static int flush_message(flow_exporter *exporter) {
+    if (!exporter->records) {
+        return 0;
+    }
+    
+    close_data_set(exporter);
+    size_t used = exporter->used;
+    exporter->used = 0;
+    put_u16(exporter, IPFIX_VERSION);
+    put_u16(exporter, used);
+    put_u32(exporter, (__u32)time(NULL));
+    put_u32(exporter, exporter->sequence);
+    put_u32(exporter, exporter->observation_domain);
+    exporter->used = used;
+    
+    int err = write_message(exporter);
+    /* The sequence counts records sent, lost messages included, so gaps are visible. */
+    exporter->sequence += exporter->records;
+    exporter->records = 0;
+    exporter->used = 0;
+    return err;
+}
+
+static int export_flow(flow_exporter *exporter, const flow_entry *flow, __u64 start_ms,
+                       __u64 end_ms) {
+    const flow_tuple *tuple = &flow->anonymized;
+    bool ipv4 = tuple->family == FLOW_FAMILY_IPV4;
+    __u16 set_id = ipv4 ? IPFIX_TEMPLATE_IPV4 : IPFIX_TEMPLATE_IPV6;
+    size_t needed = ipv4 ? IPFIX_IPV4_RECORD_LEN : IPFIX_IPV6_RECORD_LEN;
+    
+    if (exporter->set_id != set_id) {
+        needed += IPFIX_SET_HEADER_LEN;
+    }
+    if (exporter->used && exporter->used + needed > sizeof(exporter->message)) {
+        if (flush_message(exporter)) {
+            return -1;
+        }
+    }
+    if (!exporter->used) {
+        begin_message(exporter);
+    }
+    if (exporter->set_id != set_id) {
+        close_data_set(exporter);
+        exporter->set_offset = exporter->used;
+        exporter->set_id = set_id;
+        put_u16(exporter, set_id);
+        put_u16(exporter, 0);
+    }
+    
+    /* Addresses and ports are already in network byte order. */
+    put_bytes(exporter, tuple->saddr, ipv4 ? 4 : 16);
+    put_bytes(exporter, tuple->daddr, ipv4 ? 4 : 16);
+    put_bytes(exporter, &tuple->sport, 2);
+    put_bytes(exporter, &tuple->dport, 2);
+    put_u8(exporter, tuple->protocol);
+    put_u64(exporter, flow->bytes);
+    put_u64(exporter, flow->packets);
+    put_u64(exporter, start_ms);
+    put_u64(exporter, end_ms);
+    exporter->records++;
+    return 0;
+}
+
+static int open_udp_target(const char *spec) {
+    char host[MAX_SINK_SPEC_LENGTH];
+    snprintf(host, sizeof(host), "%s", spec);
+    
+    char *port = strrchr(host, ':');
+    if (!port) {
+        fprintf(stderr, "Flow export target udp:%s has no port\n", spec);
+        return -1;
+    }
+    *port++ = '\0';
+    
+    char *name = host;
+    if (name[0] == '[' && name[strlen(name) - 1] == ']') {
+        name[strlen(name) - 1] = '\0';
+        name++;
+    }
+    
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *addresses;
+    int err = getaddrinfo(name, port, &hints, &addresses);
+    if (err) {
+        fprintf(stderr, "Flow collector lookup failed for %s: %s\n", spec, gai_strerror(err));
+        return -1;
+    }
+    
+    int fd = -1;
+    for (struct addrinfo *ai = addresses; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    
+    if (fd < 0) {
+        fprintf(stderr, "Flow collector connect failed for %s: %s\n", spec, strerror(errno));
+    }
+    return fd;
+}
+
+flow_exporter *flow_exporter_open(const char *target, __u32 observation_domain) {
+    flow_exporter *exporter = calloc(1, sizeof(*exporter));
+    if (!exporter) {
+        fprintf(stderr, "Flow exporter allocation failed\n");
+        return NULL;
+    }
+    exporter->observation_domain = observation_domain;
+    
+    if (strncmp(target, "file:", 5) == 0) {
+        exporter->fd = open(target + 5, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (exporter->fd < 0) {
+            fprintf(stderr, "Flow export file open failed for %s: %s\n", target + 5, strerror(errno));
+        }
+    } else if (strncmp(target, "udp:", 4) == 0) {
+        exporter->datagram = true;
+        exporter->fd = open_udp_target(target + 4);
+    } else {
+        fprintf(stderr, "Unknown flow export target %s\n", target);
+        exporter->fd = -1;
+    }
+    
+    if (exporter->fd < 0) {
+        free(exporter);
+        return NULL;
+    }
+    printf("Exporting expired flows as IPFIX to %s\n", target);
+    return exporter;
+}
+
+void flow_exporter_close(flow_exporter *exporter) {
+    if (!exporter) {
+        return;
+    }
+    flush_message(exporter);
+    close(exporter->fd);
+    free(exporter);
+}
+
+static bool flow_expired(const flow_entry *flow, __u64 now_ns,
+                         const flow_export_settings *settings) {
+    __u64 idle = now_ns > flow->last_seen_ns ? now_ns - flow->last_seen_ns : 0;
+    __u64 age = now_ns > flow->first_seen_ns ? now_ns - flow->first_seen_ns : 0;
+    return idle >= settings->idle_timeout * NSEC_PER_SEC ||
+           age >= settings->active_timeout * NSEC_PER_SEC;
+}
+
+/* flow_entry times come from bpf_ktime_get_ns(), i.e. CLOCK_MONOTONIC. */
+static __u64 monotonic_to_epoch_ms(__u64 ns, __u64 now_ns, __u64 now_epoch_ms) {
+    __u64 ago_ms = now_ns > ns ? (now_ns - ns) / NSEC_PER_MSEC : 0;
+    return now_epoch_ms - ago_ms;
+}
+
+static void delete_flows(int map_fd, flow_tuple *keys, __u32 count) {
+    __u32 deleted = count;
+    if (!count || bpf_map_delete_batch(map_fd, keys, &deleted, NULL) == 0) {
+        return;
+    }
+    
+    /* The batch stops at the first key the LRU already evicted. */
+    for (__u32 i = deleted; i < count; i++) {
+        bpf_map_delete_elem(map_fd, &keys[i]);
+    }
+}
+
+static int sweep_batches(int map_fd, flow_exporter *exporter, const flow_export_settings *settings,
+                         bool drain, flow_sweep_stats *stats, flow_tuple *keys, flow_entry *values,
+                         flow_tuple *expired) {
+    struct timespec mono;
+    struct timespec wall;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    __u64 now_ns = (__u64)mono.tv_sec * NSEC_PER_SEC + mono.tv_nsec;
+    __u64 now_epoch_ms = (__u64)wall.tv_sec * 1000 + wall.tv_nsec / NSEC_PER_MSEC;
+    
+    /* The batch token is a bucket index past the returned keys, so deleting them is safe. */
+    __u32 batch = 0;
+    bool first = true;
+    bool done = false;
+    while (!done) {
+        __u32 count = FLOW_SWEEP_BATCH;
+        int err = bpf_map_lookup_batch(map_fd, first ? NULL : &batch, &batch, keys, values,
+                                       &count, NULL);
+        if (err && errno != ENOENT) {
+            fprintf(stderr, "Flow table dump failed: %s\n", strerror(errno));
+            return -1;
+        }
+        done = err != 0;
+        first = false;
+        
+        __u32 expired_count = 0;
+        for (__u32 i = 0; i < count; i++) {
+            stats->active++;
+            if (!drain && !flow_expired(&values[i], now_ns, settings)) {
+                continue;
+            }
+            if (exporter) {
+                export_flow(exporter, &values[i],
+                            monotonic_to_epoch_ms(values[i].first_seen_ns, now_ns, now_epoch_ms),
+                            monotonic_to_epoch_ms(values[i].last_seen_ns, now_ns, now_epoch_ms));
+            }
+            expired[expired_count++] = keys[i];
+        }
+        delete_flows(map_fd, expired, expired_count);
+        stats->active -= expired_count;
+        stats->expired += expired_count;
+    }
+    return 0;
+}
+
+int flow_table_sweep(int map_fd, flow_exporter *exporter, const flow_export_settings *settings,
+                     bool drain, flow_sweep_stats *stats) {
+    stats->active = 0;
+    stats->expired = 0;
+    
+    flow_tuple *keys = calloc(FLOW_SWEEP_BATCH, sizeof(*keys));
+    flow_entry *values = calloc(FLOW_SWEEP_BATCH, sizeof(*values));
+    flow_tuple *expired = calloc(FLOW_SWEEP_BATCH, sizeof(*expired));
+    int err = -1;
+    if (keys && values && expired) {
+        err = sweep_batches(map_fd, exporter, settings, drain, stats, keys, values, expired);
+    } else {
+        fprintf(stderr, "Flow sweep buffer allocation failed\n");
+    }
+    
+    if (exporter && flush_message(exporter)) {
+        err = -1;
+    }
+    free(keys);
+    free(values);
+    free(expired);
+    return err;
+}
@@ -0,0 +1,41 @@
+#ifndef FLOW_EXPORT_H
+#define FLOW_EXPORT_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+#include "common_structs.h"
+
+/*
+ * IPFIX (RFC 7011) export of expired flow_table_map entries. Targets:
+ *   file:<path>         messages appended to a file (RFC 5655 layout)
+ *   udp:<host>:<port>   one message per datagram to a collector
+ * Every message repeats the IPv4 and IPv6 templates, so a collector can
+ * start listening at any time. Only the anonymized tuple is exported.
+ */
+#define IPFIX_VERSION 10
+#define IPFIX_TEMPLATE_SET_ID 2
+#define IPFIX_TEMPLATE_IPV4 256
+#define IPFIX_TEMPLATE_IPV6 257
+#define IPFIX_MAX_MESSAGE_SIZE 1400
+#define FLOW_SWEEP_BATCH 256
+
+typedef struct flow_exporter flow_exporter;
+
+typedef struct {
+    __u32 active;
+    __u32 expired;
+} flow_sweep_stats;
+
+flow_exporter *flow_exporter_open(const char *target, __u32 observation_domain);
+void flow_exporter_close(flow_exporter *exporter);
+
+/*
+ * Dumps flow_table_map with bpf_map_lookup_batch(), exports the flows idle
+ * for idle_timeout or alive for active_timeout (all of them with drain)
+ * and removes them with bpf_map_delete_batch(). A NULL exporter expires
+ * without exporting. Returns -1 when the dump fails.
+ */
+int flow_table_sweep(int map_fd, flow_exporter *exporter, const flow_export_settings *settings,
+                     bool drain, flow_sweep_stats *stats);
+
+#endif
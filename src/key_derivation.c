@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include "key_derivation.h"
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+#define KEY_FILE_MAX_SIZE 128
+
+typedef struct {
+    __u32 state[8];
+    __u64 length;
+    unsigned char block[SHA256_BLOCK_SIZE];
+    __u32 used;
+} sha256_ctx;
+
+static const __u32 sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static __u32 rotr32(__u32 x, int bits) {
+    return (x >> bits) | (x << (32 - bits));
+}
+
+static void sha256_transform(sha256_ctx *ctx, const unsigned char *block) {
+    __u32 w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((__u32)block[i * 4] << 24) | ((__u32)block[i * 4 + 1] << 16) |
+               ((__u32)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        __u32 s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        __u32 s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    
+    __u32 v[8];
+    memcpy(v, ctx->state, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+        __u32 s1 = rotr32(v[4], 6) ^ rotr32(v[4], 11) ^ rotr32(v[4], 25);
+        __u32 ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        __u32 t1 = v[7] + s1 + ch + sha256_k[i] + w[i];
+        __u32 s0 = rotr32(v[0], 2) ^ rotr32(v[0], 13) ^ rotr32(v[0], 22);
+        __u32 maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(&v[1], &v[0], 7 * sizeof(v[0]));
+        v[4] += t1;
+        v[0] = t1 + s0 + maj;
+    }
+    for (int i = 0; i < 8; i++) {
+        ctx->state[i] += v[i];
+    }
+}
+
+static void sha256_init(sha256_ctx *ctx) {
+    static const __u32 initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+static void sha256_update(sha256_ctx *ctx, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    ctx->length += len;
+    while (len) {
+        size_t chunk = SHA256_BLOCK_SIZE - ctx->used;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(ctx->block + ctx->used, bytes, chunk);
+        ctx->used += chunk;
+        bytes += chunk;
+        len -= chunk;
+        if (ctx->used == SHA256_BLOCK_SIZE) {
+            sha256_transform(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha256_final(sha256_ctx *ctx, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    __u64 bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != SHA256_BLOCK_SIZE - 8) {
+        sha256_update(ctx, &pad, 1);
+    }
+    
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++) {
+        length[i] = bits >> (56 - i * 8);
+    }
+    sha256_update(ctx, length, sizeof(length));
+    
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = ctx->state[i] >> 24;
+        digest[i * 4 + 1] = ctx->state[i] >> 16;
+        digest[i * 4 + 2] = ctx->state[i] >> 8;
+        digest[i * 4 + 3] = ctx->state[i];
+    }
+}
+
+/* Inner and outer HMAC states, keyed once and cloned for every PBKDF2 iteration. */
+typedef struct {
+    sha256_ctx inner;
+    sha256_ctx outer;
+} hmac_sha256_key;
+
+static void hmac_sha256_init(hmac_sha256_key *hmac, const void *key, size_t key_len) {
+    unsigned char block[SHA256_BLOCK_SIZE] = {0};
+    if (key_len > SHA256_BLOCK_SIZE) {
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, key, key_len);
+        sha256_final(&ctx, block);
+    } else {
+        memcpy(block, key, key_len);
+    }
+    
+    unsigned char pad[SHA256_BLOCK_SIZE];
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        pad[i] = block[i] ^ 0x36;
+    }
+    sha256_init(&hmac->inner);
+    sha256_update(&hmac->inner, pad, sizeof(pad));
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    sha256_init(&hmac->outer);
+    sha256_update(&hmac->outer, pad, sizeof(pad));
+}
+
+static void hmac_sha256(const hmac_sha256_key *hmac, const void *data, size_t len,
+                        unsigned char mac[SHA256_DIGEST_SIZE]) {
+    sha256_ctx ctx = hmac->inner;
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, mac);
+    
+    ctx = hmac->outer;
+    sha256_update(&ctx, mac, SHA256_DIGEST_SIZE);
+    sha256_final(&ctx, mac);
+}
+
+/* PBKDF2-HMAC-SHA256 (RFC 8018) over KEY_KDF_SALT, first block only: out_len <= 32. */
+static void pbkdf2_sha256(const char *passphrase, __u32 iterations, unsigned char *out,
+                          size_t out_len) {
+    hmac_sha256_key hmac;
+    hmac_sha256_init(&hmac, passphrase, strlen(passphrase));
+    
+    unsigned char first[sizeof(KEY_KDF_SALT) - 1 + 4] = KEY_KDF_SALT;
+    memcpy(first + sizeof(KEY_KDF_SALT) - 1, "\0\0\0\1", 4);
+    
+    unsigned char u[SHA256_DIGEST_SIZE];
+    unsigned char t[SHA256_DIGEST_SIZE];
+    hmac_sha256(&hmac, first, sizeof(first), u);
+    memcpy(t, u, sizeof(t));
+    for (__u32 i = 1; i < iterations; i++) {
+        hmac_sha256(&hmac, u, sizeof(u), u);
+        for (int j = 0; j < SHA256_DIGEST_SIZE; j++) {
+            t[j] ^= u[j];
+        }
+    }
+    memcpy(out, t, out_len);
+}
+
+static void key_from_bytes(const unsigned char bytes[ANON_KEY_LENGTH], __u64 key[2]) {
+    key[0] = 0;
+    key[1] = 0;
+    for (int i = 7; i >= 0; i--) {
+        key[0] = (key[0] << 8) | bytes[i];
+        key[1] = (key[1] << 8) | bytes[i + 8];
+    }
+}
+
+static bool parse_hex_key(const char *text, size_t len, unsigned char bytes[ANON_KEY_LENGTH]) {
+    size_t digits = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (isspace((unsigned char)text[i])) {
+            continue;
+        }
+        if (!isxdigit((unsigned char)text[i]) || digits == ANON_KEY_LENGTH * 2) {
+            return false;
+        }
+        char hex[2] = { text[i], '\0' };
+        __u8 nibble = (__u8)strtoul(hex, NULL, 16);
+        bytes[digits / 2] = (digits % 2) ? (bytes[digits / 2] | nibble) : (nibble << 4);
+        digits++;
+    }
+    return digits == ANON_KEY_LENGTH * 2;
+}
+
+int load_key_file(const char *path, __u64 key[2]) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Key file open failed for %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && (st.st_mode & (S_IRWXG | S_IRWXO))) {
+        fprintf(stderr, "Warning: key file %s is accessible to other users\n", path);
+    }
+    
+    char buffer[KEY_FILE_MAX_SIZE];
+    size_t len = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    
+    unsigned char bytes[ANON_KEY_LENGTH];
+    if (len == ANON_KEY_LENGTH) {
+        memcpy(bytes, buffer, ANON_KEY_LENGTH);
+    } else if (!parse_hex_key(buffer, len, bytes)) {
+        fprintf(stderr, "Key file %s must hold 16 raw bytes or 32 hex digits\n", path);
+        return -1;
+    }
+    
+    key_from_bytes(bytes, key);
+    return 0;
+}
+
+int derive_key_from_passphrase(const char *passphrase, __u64 key[2]) {
+    if (!*passphrase) {
+        fprintf(stderr, "Empty key passphrase\n");
+        return -1;
+    }
+    
+    unsigned char bytes[ANON_KEY_LENGTH];
+    pbkdf2_sha256(passphrase, KEY_KDF_ITERATIONS, bytes, sizeof(bytes));
+    key_from_bytes(bytes, key);
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef KEY_DERIVATION_H
+#define KEY_DERIVATION_H
+
+#include <linux/types.h>
+#include "common_structs.h"
+
+#define KEY_KDF_ITERATIONS 200000
+#define KEY_KDF_SALT "packet-anonymization/siphash-key/v1"
+
+/*
+ * 128-bit SipHash key for anonymization_config.hash_key. A key file holds
+ * either 16 raw bytes or 32 hex digits; a passphrase is stretched with
+ * PBKDF2-HMAC-SHA256 over a fixed salt, so the same passphrase always
+ * yields the same key. Both return -1 after reporting on stderr.
+ */
+int load_key_file(const char *path, __u64 key[2]);
+int derive_key_from_passphrase(const char *passphrase, __u64 key[2]);
+
+#endif
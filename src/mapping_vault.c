@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapping_vault.h"
+
+#define VAULT_INDEX_MIN_SLOTS 4096
+#define VAULT_INDEX_EMPTY UINT32_MAX
+#define VAULT_ANY_FIELD 0xff
+
+/*
+ * Open-addressing tables of record indexes. by_original finds the record
+ * for (mapping_id, kind, field, original); by_anonymized finds the first
+ * record that produced (mapping_id, kind, anonymized) in any field, since
+ * a reverse lookup cannot tell a src pair from a dst pair either.
+ */
+typedef struct {
+    __u32 *slots;
+    __u32 mask;
+    __u32 used;
+} vault_index;
+
+struct mapping_vault {
+    char *path;
+    int fd;
+    bool writable;
+    void *base;
+    size_t mapped_size;
+    vault_index by_original;
+    vault_index by_anonymized;
+    __u64 collisions;
+};
+
+static const char *const kind_names[] = {
+    [VAULT_KIND_MAC] = "mac",
+    [VAULT_KIND_IPV4] = "ipv4",
+    [VAULT_KIND_IPV6] = "ipv6"
+};
+
+__u32 vault_kind_length(__u32 kind) {
+    switch (kind) {
+    case VAULT_KIND_MAC:
+        return 6;
+    case VAULT_KIND_IPV4:
+        return 4;
+    case VAULT_KIND_IPV6:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+const char *vault_kind_name(__u32 kind) {
+    return vault_kind_length(kind) ? kind_names[kind] : "unknown";
+}
+
+static vault_header *vault_header_of(const mapping_vault *vault) {
+    return (vault_header *)vault->base;
+}
+
+/* A reader's mapping is fixed at open, while the daemon may keep appending past it. */
+__u64 mapping_vault_count(const mapping_vault *vault) {
+    __u64 count = __atomic_load_n(&vault_header_of(vault)->record_count, __ATOMIC_ACQUIRE);
+    __u64 capacity = (vault->mapped_size - VAULT_HEADER_SIZE) / sizeof(vault_record);
+    return count < capacity ? count : capacity;
+}
+
+const vault_record *mapping_vault_record(const mapping_vault *vault, __u64 index) {
+    if (index >= mapping_vault_count(vault)) {
+        return NULL;
+    }
+    return (const vault_record *)((const char *)vault->base + VAULT_HEADER_SIZE) + index;
+}
+
+__u64 mapping_vault_collisions(const mapping_vault *vault) {
+    return vault->collisions;
+}
+
+const char *mapping_vault_path(const mapping_vault *vault) {
+    return vault->path;
+}
+
+static __u32 fnv1a(__u32 hash, const void *data, size_t length) {
+    const __u8 *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define FINGERPRINT_FIELD(hash, value) fnv1a(hash, &(value), sizeof(value))
+
+__u32 mapping_vault_fingerprint(const anonymization_config *config, const policy_set *policy) {
+    __u32 hash = 2166136261u;
+    hash = FINGERPRINT_FIELD(hash, config->random_salt);
+    hash = FINGERPRINT_FIELD(hash, config->hash_function);
+    hash = FINGERPRINT_FIELD(hash, config->hash_key);
+    hash = FINGERPRINT_FIELD(hash, config->src_ip_mask_lengths);
+    hash = FINGERPRINT_FIELD(hash, config->dest_ip_mask_lengths);
+    hash = FINGERPRINT_FIELD(hash, config->src_ipv6_prefix_length);
+    hash = FINGERPRINT_FIELD(hash, config->dest_ipv6_prefix_length);
+    hash = FINGERPRINT_FIELD(hash, config->preserve_prefix);
+    hash = FINGERPRINT_FIELD(hash, config->prefix_preserving);
+    hash = FINGERPRINT_FIELD(hash, config->anonymize_srcmac_oui);
+    hash = FINGERPRINT_FIELD(hash, config->anonymize_srcmac_id);
+    hash = FINGERPRINT_FIELD(hash, config->anonymize_dstmac_oui);
+    hash = FINGERPRINT_FIELD(hash, config->anonymize_dstmac_id);
+    for (__u32 i = 0; policy && i < policy->prefix_count; i++) {
+        const policy_prefix *prefix = &policy->prefixes[i];
+        hash = FINGERPRINT_FIELD(hash, prefix->family);
+        hash = FINGERPRINT_FIELD(hash, prefix->prefix_len);
+        hash = FINGERPRINT_FIELD(hash, prefix->addr);
+        hash = FINGERPRINT_FIELD(hash, prefix->rule.action);
+        hash = FINGERPRINT_FIELD(hash, prefix->rule.prefix_len);
+    }
+    return hash;
+}
+
+static __u32 record_hash(__u32 mapping_id, __u8 kind, __u8 field, const __u8 *address) {
+    __u32 hash = fnv1a(2166136261u, &mapping_id, sizeof(mapping_id));
+    hash = fnv1a(hash, &kind, sizeof(kind));
+    hash = fnv1a(hash, &field, sizeof(field));
+    return fnv1a(hash, address, 16);
+}
+
+static bool record_matches(const vault_record *record, __u32 mapping_id, __u8 kind, __u8 field) {
+    return record->mapping_id == mapping_id && record->kind == kind &&
+           (field == VAULT_ANY_FIELD || record->field == field);
+}
+
+static int index_init(vault_index *index, __u64 records) {
+    __u64 slots = VAULT_INDEX_MIN_SLOTS;
+    while (slots < records * 2) {
+        slots <<= 1;
+    }
+    index->slots = malloc(slots * sizeof(*index->slots));
+    if (!index->slots) {
+        return -1;
+    }
+    memset(index->slots, 0xff, slots * sizeof(*index->slots));
+    index->mask = slots - 1;
+    index->used = 0;
+    return 0;
+}
+
+/*
+ * Returns the slot holding a record whose mapping_id, kind, field and
+ * address (original or anonymized per by_anonymized) match, or the empty
+ * slot where one would go. by_anonymized lookups ignore field.
+ */
+static __u32 *index_find(const mapping_vault *vault, const vault_index *index, bool by_anonymized,
+                         __u32 mapping_id, __u8 kind, __u8 field, const __u8 *address) {
+    if (by_anonymized) {
+        field = VAULT_ANY_FIELD;
+    }
+    __u32 slot = record_hash(mapping_id, kind, field, address) & index->mask;
+    for (;;) {
+        __u32 *entry = &index->slots[slot];
+        if (*entry == VAULT_INDEX_EMPTY) {
+            return entry;
+        }
+        const vault_record *record = mapping_vault_record(vault, *entry);
+        const __u8 *stored = by_anonymized ? record->anonymized : record->original;
+        if (record_matches(record, mapping_id, kind, field) && memcmp(stored, address, 16) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+}
+
+static int index_insert(mapping_vault *vault, vault_index *index, bool by_anonymized, __u32 position);
+
+static int index_grow(mapping_vault *vault, vault_index *index, bool by_anonymized) {
+    vault_index old = *index;
+    if (index_init(index, (__u64)(old.mask + 1))) {
+        *index = old;
+        return -1;
+    }
+    for (__u32 i = 0; i <= old.mask; i++) {
+        if (old.slots[i] != VAULT_INDEX_EMPTY) {
+            index_insert(vault, index, by_anonymized, old.slots[i]);
+        }
+    }
+    free(old.slots);
+    return 0;
+}
+
+/* Keeps the first record for a key; later duplicates are not indexed. */
+static int index_insert(mapping_vault *vault, vault_index *index, bool by_anonymized, __u32 position) {
+    if ((index->used + 1) * 2 > index->mask + 1 && index_grow(vault, index, by_anonymized)) {
+        return -1;
+    }
+    const vault_record *record = mapping_vault_record(vault, position);
+    __u32 *entry = index_find(vault, index, by_anonymized, record->mapping_id, record->kind,
+                              record->field, by_anonymized ? record->anonymized : record->original);
+    if (*entry == VAULT_INDEX_EMPTY) {
+        *entry = position;
+        index->used++;
+    }
+    return 0;
+}
+
+static int build_indexes(mapping_vault *vault) {
+    __u64 count = mapping_vault_count(vault);
+    if (index_init(&vault->by_original, count) || index_init(&vault->by_anonymized, count)) {
+        fprintf(stderr, "Vault index allocation failed\n");
+        return -1;
+    }
+    for (__u64 i = 0; i < count; i++) {
+        if (index_insert(vault, &vault->by_original, false, i) ||
+            index_insert(vault, &vault->by_anonymized, true, i)) {
+            fprintf(stderr, "Vault index allocation failed\n");
+            return -1;
+        }
+        if (mapping_vault_record(vault, i)->flags & VAULT_FLAG_COLLISION) {
+            vault->collisions++;
+        }
+    }
+    return 0;
+}
+
+static int map_file(mapping_vault *vault, size_t size) {
+    int prot = PROT_READ | (vault->writable ? PROT_WRITE : 0);
+    void *base = vault->base ? mremap(vault->base, vault->mapped_size, size, MREMAP_MAYMOVE)
+                             : mmap(NULL, size, prot, MAP_SHARED, vault->fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Vault mmap failed for %s: %s\n", vault->path, strerror(errno));
+        return -1;
+    }
+    vault->base = base;
+    vault->mapped_size = size;
+    return 0;
+}
+
+static int check_header(const mapping_vault *vault, size_t file_size) {
+    const vault_header *header = vault_header_of(vault);
+    if (header->magic != VAULT_MAGIC || header->version != VAULT_VERSION ||
+        header->record_size != sizeof(vault_record)) {
+        fprintf(stderr, "%s is not a version %u mapping vault\n", vault->path, VAULT_VERSION);
+        return -1;
+    }
+    if (header->record_count > (file_size - VAULT_HEADER_SIZE) / sizeof(vault_record)) {
+        fprintf(stderr, "Mapping vault %s is truncated\n", vault->path);
+        return -1;
+    }
+    return 0;
+}
+
+mapping_vault *mapping_vault_open(const char *path, bool writable) {
+    mapping_vault *vault = calloc(1, sizeof(*vault));
+    if (!vault || !(vault->path = strdup(path))) {
+        fprintf(stderr, "Vault allocation failed\n");
+        free(vault);
+        return NULL;
+    }
+    vault->writable = writable;
+    vault->fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+    if (vault->fd < 0) {
+        fprintf(stderr, "Vault open failed for %s: %s\n", path, strerror(errno));
+        mapping_vault_close(vault);
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(vault->fd, &st)) {
+        fprintf(stderr, "Vault stat failed for %s: %s\n", path, strerror(errno));
+        mapping_vault_close(vault);
+        return NULL;
+    }
+    
+    size_t size = st.st_size;
+    bool created = size == 0;
+    if (created && !writable) {
+        fprintf(stderr, "Mapping vault %s is empty\n", path);
+        mapping_vault_close(vault);
+        return NULL;
+    }
+    if (created) {
+        size = VAULT_MIN_MAPPING_SIZE;
+        if (ftruncate(vault->fd, size)) {
+            fprintf(stderr, "Vault resize failed for %s: %s\n", path, strerror(errno));
+            mapping_vault_close(vault);
+            return NULL;
+        }
+    }
+    if (size < VAULT_HEADER_SIZE) {
+        fprintf(stderr, "%s is not a version %u mapping vault\n", path, VAULT_VERSION);
+        mapping_vault_close(vault);
+        return NULL;
+    }
+    if (map_file(vault, size)) {
+        mapping_vault_close(vault);
+        return NULL;
+    }
+    
+    if (created) {
+        vault_header *header = vault_header_of(vault);
+        header->magic = VAULT_MAGIC;
+        header->version = VAULT_VERSION;
+        header->record_size = sizeof(vault_record);
+        header->record_count = 0;
+    }
+    if (check_header(vault, size) || (writable && build_indexes(vault))) {
+        mapping_vault_close(vault);
+        return NULL;
+    }
+    return vault;
+}
+
+void mapping_vault_close(mapping_vault *vault) {
+    if (!vault) {
+        return;
+    }
+    if (vault->base) {
+        if (vault->writable) {
+            msync(vault->base, vault->mapped_size, MS_SYNC);
+        }
+        munmap(vault->base, vault->mapped_size);
+    }
+    if (vault->fd >= 0) {
+        close(vault->fd);
+    }
+    free(vault->by_original.slots);
+    free(vault->by_anonymized.slots);
+    free(vault->path);
+    free(vault);
+}
+
+void mapping_vault_sync(mapping_vault *vault) {
+    if (vault->writable) {
+        msync(vault->base, vault->mapped_size, MS_ASYNC);
+    }
+}
+
+/* Doubles the file until one more record fits. */
+static int reserve_record(mapping_vault *vault, __u64 count) {
+    size_t needed = VAULT_HEADER_SIZE + (count + 1) * sizeof(vault_record);
+    if (needed <= vault->mapped_size) {
+        return 0;
+    }
+    size_t size = vault->mapped_size;
+    while (size < needed) {
+        size *= 2;
+    }
+    if (ftruncate(vault->fd, size)) {
+        fprintf(stderr, "Vault resize failed for %s: %s\n", vault->path, strerror(errno));
+        return -1;
+    }
+    return map_file(vault, size);
+}
+
+vault_add_result mapping_vault_add(mapping_vault *vault, const vault_mapping *mapping,
+                                   __u64 now_ms) {
+    if (!vault->writable || !vault_kind_length(mapping->kind)) {
+        return VAULT_ADD_FAILED;
+    }
+    __u32 *existing = index_find(vault, &vault->by_original, false, mapping->mapping_id,
+                                 mapping->kind, mapping->field, mapping->original);
+    if (*existing != VAULT_INDEX_EMPTY) {
+        return VAULT_ADD_DUPLICATE;
+    }
+    
+    __u64 count = mapping_vault_count(vault);
+    if (count >= VAULT_INDEX_EMPTY || reserve_record(vault, count)) {
+        return VAULT_ADD_FAILED;
+    }
+    
+    vault_record *record = (vault_record *)((char *)vault->base + VAULT_HEADER_SIZE) + count;
+    memset(record, 0, sizeof(*record));
+    record->first_seen_ms = now_ms;
+    record->mapping_id = mapping->mapping_id;
+    record->kind = mapping->kind;
+    record->field = mapping->field;
+    memcpy(record->original, mapping->original, sizeof(record->original));
+    memcpy(record->anonymized, mapping->anonymized, sizeof(record->anonymized));
+    
+    __u32 *previous = index_find(vault, &vault->by_anonymized, true, mapping->mapping_id,
+                                 mapping->kind, VAULT_ANY_FIELD, mapping->anonymized);
+    bool collision = *previous != VAULT_INDEX_EMPTY &&
+                     memcmp(mapping_vault_record(vault, *previous)->original, mapping->original,
+                            sizeof(mapping->original)) != 0;
+    if (collision) {
+        record->flags |= VAULT_FLAG_COLLISION;
+        vault->collisions++;
+    }
+    __atomic_store_n(&vault_header_of(vault)->record_count, count + 1, __ATOMIC_RELEASE);
+    
+    if (index_insert(vault, &vault->by_original, false, count) ||
+        index_insert(vault, &vault->by_anonymized, true, count)) {
+        fprintf(stderr, "Vault index allocation failed\n");
+    }
+    return collision ? VAULT_ADD_COLLISION : VAULT_ADD_NEW;
+}
@@ -0,0 +1,82 @@
+#ifndef MAPPING_VAULT_H
+#define MAPPING_VAULT_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+#include "common_structs.h"
+
+/*
+ * Append-only file of original->anonymized pairs reported on vault_ring_map.
+ * A 64-byte header is followed by fixed-size records; the file is mapped
+ * MAP_SHARED and grown in place, and record_count in the header is bumped
+ * after each record is complete, so readers never see a partial record.
+ * The file holds original addresses and is created mode 0600.
+ */
+#define VAULT_MAGIC 0x544c5641584e4158ull /* "XANXAVLT" */
+#define VAULT_VERSION 1
+#define VAULT_HEADER_SIZE 64
+#define VAULT_MIN_MAPPING_SIZE (1024 * 1024)
+
+#define VAULT_FLAG_COLLISION 0x01
+
+typedef struct {
+    __u64 magic;
+    __u32 version;
+    __u32 record_size;
+    __u64 record_count;
+    __u8 reserved[40];
+} vault_header;
+
+typedef struct {
+    __u64 first_seen_ms;
+    __u32 mapping_id;
+    __u8 kind;
+    __u8 field;
+    __u8 flags;
+    __u8 reserved;
+    __u8 original[16];
+    __u8 anonymized[16];
+} vault_record;
+
+typedef enum {
+    VAULT_ADD_DUPLICATE,
+    VAULT_ADD_NEW,
+    VAULT_ADD_COLLISION,
+    VAULT_ADD_FAILED
+} vault_add_result;
+
+typedef struct mapping_vault mapping_vault;
+
+/* Read-only vaults skip building the dedup and collision indexes. */
+mapping_vault *mapping_vault_open(const char *path, bool writable);
+void mapping_vault_close(mapping_vault *vault);
+
+/*
+ * Appends a pair unless the same original already maps under the same
+ * mapping id and field. A pair whose anonymized value was already recorded
+ * for a different original under the same mapping id, in either field, is
+ * appended with VAULT_FLAG_COLLISION.
+ */
+vault_add_result mapping_vault_add(mapping_vault *vault, const vault_mapping *mapping,
+                                   __u64 now_ms);
+
+/* MS_ASYNC flush of appended records; close does a synchronous one. */
+void mapping_vault_sync(mapping_vault *vault);
+
+__u64 mapping_vault_count(const mapping_vault *vault);
+const vault_record *mapping_vault_record(const mapping_vault *vault, __u64 index);
+__u64 mapping_vault_collisions(const mapping_vault *vault);
+const char *mapping_vault_path(const mapping_vault *vault);
+
+/*
+ * Identifies the address mapping a config produces: salt, hash key,
+ * masks, prefix settings and policy prefixes. Pairs are deduplicated per
+ * fingerprint, so a salt rotation or key change starts a new set.
+ */
+__u32 mapping_vault_fingerprint(const anonymization_config *config, const policy_set *policy);
+
+/* Address width in bytes for a VAULT_KIND_* value, 0 if unknown. */
+__u32 vault_kind_length(__u32 kind);
+const char *vault_kind_name(__u32 kind);
+
+#endif
@@ -0,0 +1,580 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "config_parser.h"
+#include "event_log.h"
+#include "metrics_server.h"
+
+#define METRICS_LISTEN_BACKLOG 16
+#define METRICS_RESPONSE_HEADER_MAX 256
+
+typedef struct {
+    const char *name;
+    const char *help;
+    size_t offset;
+} stats_metric;
+
+#define STATS_METRIC(field, help) { #field, help, offsetof(anonymization_stats, field) }
+
+static const stats_metric stats_metrics[] = {
+    STATS_METRIC(packets_processed, "Frames seen by the XDP program"),
+    STATS_METRIC(packets_anonymized, "Frames rewritten successfully"),
+    STATS_METRIC(bytes_processed, "Bytes of the frames seen by the XDP program"),
+    STATS_METRIC(mac_addresses_anonymized, "Frames with a rewritten MAC address"),
+    STATS_METRIC(ip_addresses_anonymized, "Frames with a rewritten IPv4 address"),
+    STATS_METRIC(arp_packets_anonymized, "ARP frames rewritten"),
+    STATS_METRIC(errors, "Frames dropped as malformed"),
+    STATS_METRIC(packets_forwarded, "Frames handed to the output action"),
+    STATS_METRIC(forward_errors, "Frames the output action failed to redirect"),
+    STATS_METRIC(cache_hits, "Mapping cache hits"),
+    STATS_METRIC(cache_misses, "Mapping cache misses"),
+    STATS_METRIC(cache_inserts, "Mapping cache insertions"),
+    STATS_METRIC(ipv6_addresses_anonymized, "Frames with a rewritten IPv6 address"),
+    STATS_METRIC(ndp_packets_anonymized, "NDP messages rewritten"),
+    STATS_METRIC(vlan_packets, "Frames with one VLAN tag"),
+    STATS_METRIC(qinq_packets, "Frames with stacked VLAN tags"),
+    STATS_METRIC(mpls_packets, "Frames with an MPLS label stack"),
+    STATS_METRIC(vxlan_packets, "VXLAN frames"),
+    STATS_METRIC(geneve_packets, "GENEVE frames"),
+    STATS_METRIC(gre_packets, "GRE frames"),
+    STATS_METRIC(ports_anonymized, "Frames with remapped TCP or UDP ports"),
+    STATS_METRIC(flow_hits, "Frames mapped from an existing flow entry"),
+    STATS_METRIC(flows_created, "Flow entries created"),
+    STATS_METRIC(policy_drops, "Frames dropped by the address policy"),
+    STATS_METRIC(dhcp_scrubbed, "DHCP messages scrubbed"),
+    STATS_METRIC(dns_scrubbed, "DNS responses scrubbed"),
+    STATS_METRIC(icmp_errors_scrubbed, "ICMP errors with a scrubbed quoted packet"),
+    STATS_METRIC(events_suppressed, "Events dropped by the per-CPU rate limit"),
+    STATS_METRIC(events_lost, "Events dropped on a full ring buffer"),
+    STATS_METRIC(vault_records, "Mapping vault pairs sent to the daemon"),
+    STATS_METRIC(vault_lost, "Mapping vault pairs dropped on a full ring buffer"),
+    STATS_METRIC(frag_packets, "Multi-buffer frames seen"),
+    STATS_METRIC(frag_copies, "Multi-buffer frames whose headers were copied out of the linear part")
+};
+
+/* Broken down per CPU and per RX queue; the rest only per interface. */
+static const stats_metric breakdown_metrics[] = {
+    STATS_METRIC(packets_processed, "Frames seen by the XDP program"),
+    STATS_METRIC(packets_anonymized, "Frames rewritten successfully"),
+    STATS_METRIC(errors, "Frames dropped as malformed")
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct {
+    int fd;
+    __u64 serial;
+    size_t received;
+    char request[METRICS_REQUEST_MAX];
+    char *response;
+    size_t response_length;
+    size_t sent;
+} metrics_client;
+
+struct metrics_server {
+    int listen_fd;
+    int epoll_fd;
+    char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    char *page;
+    size_t page_length;
+    __u64 serial;
+    metrics_client clients[METRICS_MAX_CLIENTS];
+};
+
+static const char *const latency_class_names[LATENCY_CLASS_COUNT] = {
+    [LATENCY_CLASS_ARP] = "arp",
+    [LATENCY_CLASS_IPV4] = "ipv4",
+    [LATENCY_CLASS_IPV6] = "ipv6",
+    [LATENCY_CLASS_OTHER] = "other",
+    [LATENCY_CLASS_ERROR] = "error"
+};
+
+const char *latency_class_name(__u32 latency_class) {
+    return latency_class < LATENCY_CLASS_COUNT ? latency_class_names[latency_class] : "unknown";
+}
+
+static __u64 stats_value(const anonymization_stats *stats, size_t offset) {
+    return *(const __u64 *)((const char *)stats + offset);
+}
+
+static void write_family(FILE *out, const char *prefix, const char *name, const char *suffix,
+                         const char *help, const char *type) {
+    fprintf(out, "# HELP xdp_anon_%s%s%s %s.\n", prefix, name, suffix, help);
+    fprintf(out, "# TYPE xdp_anon_%s%s%s %s\n", prefix, name, suffix, type);
+}
+
+static void write_breakdowns(FILE *out, const metrics_interface *interfaces, __u32 count,
+                             __u32 cpu_count) {
+    for (size_t m = 0; m < ARRAY_SIZE(breakdown_metrics); m++) {
+        const stats_metric *metric = &breakdown_metrics[m];
+        write_family(out, "cpu_", metric->name, "_total", metric->help, "counter");
+        for (__u32 i = 0; i < count; i++) {
+            for (__u32 cpu = 0; cpu < cpu_count; cpu++) {
+                const anonymization_stats *stats = &interfaces[i].cpu_totals[cpu];
+                if (stats->packets_processed) {
+                    fprintf(out, "xdp_anon_cpu_%s_total{interface=\"%s\",cpu=\"%u\"} %llu\n",
+                            metric->name, interfaces[i].interface_name, cpu,
+                            stats_value(stats, metric->offset));
+                }
+            }
+        }
+        
+        /* The last queue also counts every queue past it, as in stats_map. */
+        write_family(out, "queue_", metric->name, "_total", metric->help, "counter");
+        for (__u32 i = 0; i < count; i++) {
+            for (__u32 queue = 0; queue < MAX_RX_QUEUES; queue++) {
+                const anonymization_stats *stats = &interfaces[i].queue_totals[queue];
+                if (stats->packets_processed) {
+                    fprintf(out, "xdp_anon_queue_%s_total{interface=\"%s\",queue=\"%u\"} %llu\n",
+                            metric->name, interfaces[i].interface_name, queue,
+                            stats_value(stats, metric->offset));
+                }
+            }
+        }
+    }
+}
+
+static void write_cpumap_family(FILE *out, const metrics_interface *interfaces, __u32 count,
+                                const char *name, const char *help, size_t offset) {
+    write_family(out, "", name, "_total", help, "counter");
+    for (__u32 i = 0; i < count; i++) {
+        for (__u32 w = 0; w < interfaces[i].cpumap_worker_count; w++) {
+            const __u64 *value = (const __u64 *)((const char *)&interfaces[i].cpumap_workers[w] +
+                                                 offset);
+            fprintf(out, "xdp_anon_%s_total{interface=\"%s\",cpu=\"%u\"} %llu\n", name,
+                    interfaces[i].interface_name, interfaces[i].cpumap_cpus[w],
+                    (unsigned long long)*value);
+        }
+    }
+}
+
+/* Only interfaces running the tail-call pipeline have stage counters. */
+static void write_pipeline_family(FILE *out, const metrics_interface *interfaces, __u32 count,
+                                  const char *name, const char *help, size_t offset) {
+    write_family(out, "pipeline_", name, "_total", help, "counter");
+    for (__u32 i = 0; i < count; i++) {
+        if (!interfaces[i].pipeline_stages) {
+            continue;
+        }
+        for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+            const char *stage_stats = (const char *)&interfaces[i].pipeline_stages[stage];
+            const __u64 *value = (const __u64 *)(stage_stats + offset);
+            fprintf(out, "xdp_anon_pipeline_%s_total{interface=\"%s\",stage=\"%s\"} %llu\n", name,
+                    interfaces[i].interface_name, pipeline_stage_name(stage),
+                    (unsigned long long)*value);
+        }
+    }
+}
+
+/* Bucket b of latency_map ends at 2^(b+1) ns; the last one is open-ended. */
+static void write_latency_histograms(FILE *out, const metrics_interface *interfaces, __u32 count) {
+    write_family(out, "", "frame_latency_seconds", "",
+                 "Time from config lookup to verdict per frame, by frame class", "histogram");
+    for (__u32 i = 0; i < count; i++) {
+        if (!interfaces[i].latency) {
+            continue;
+        }
+        for (__u32 class = 0; class < LATENCY_CLASS_COUNT; class++) {
+            const latency_histogram *histogram = &interfaces[i].latency[class];
+            const char *name = interfaces[i].interface_name;
+            __u64 cumulative = 0;
+            for (__u32 bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++) {
+                cumulative += histogram->buckets[bucket];
+                if (bucket < LATENCY_BUCKET_COUNT - 1) {
+                    fprintf(out, "xdp_anon_frame_latency_seconds_bucket{interface=\"%s\","
+                            "class=\"%s\",le=\"%.9g\"} %llu\n", name, latency_class_name(class),
+                            (double)(1ull << (bucket + 1)) / 1e9, (unsigned long long)cumulative);
+                }
+            }
+            fprintf(out, "xdp_anon_frame_latency_seconds_bucket{interface=\"%s\",class=\"%s\","
+                    "le=\"+Inf\"} %llu\n", name, latency_class_name(class),
+                    (unsigned long long)cumulative);
+            fprintf(out, "xdp_anon_frame_latency_seconds_sum{interface=\"%s\",class=\"%s\"} "
+                    "%.9f\n", name, latency_class_name(class), (double)histogram->total_ns / 1e9);
+            fprintf(out, "xdp_anon_frame_latency_seconds_count{interface=\"%s\",class=\"%s\"} "
+                    "%llu\n", name, latency_class_name(class), (unsigned long long)cumulative);
+        }
+    }
+}
+
+static void write_daemon_metrics(FILE *out, const metrics_interface *interfaces, __u32 count) {
+    write_family(out, "", "error_events", "_total", "Error events received, by reason", "counter");
+    for (__u32 i = 0; i < count; i++) {
+        for (__u32 reason = ANON_ERROR_NONE + 1; reason < ANON_ERROR_COUNT; reason++) {
+            fprintf(out, "xdp_anon_error_events_total{interface=\"%s\",reason=\"%s\"} %llu\n",
+                    interfaces[i].interface_name, event_reason_name(reason),
+                    interfaces[i].error_events[reason]);
+        }
+    }
+    
+    write_family(out, "", "sample_events", "_total", "Sample events received", "counter");
+    for (__u32 i = 0; i < count; i++) {
+        fprintf(out, "xdp_anon_sample_events_total{interface=\"%s\"} %llu\n",
+                interfaces[i].interface_name, interfaces[i].sample_events);
+    }
+    
+    write_family(out, "", "flows_expired", "_total", "Flow entries expired by the sweeper",
+                 "counter");
+    for (__u32 i = 0; i < count; i++) {
+        fprintf(out, "xdp_anon_flows_expired_total{interface=\"%s\"} %llu\n",
+                interfaces[i].interface_name, interfaces[i].flows_expired);
+    }
+    
+    write_family(out, "", "vault_collisions", "_total",
+                 "Vault pairs whose anonymized value already maps from another address", "counter");
+    for (__u32 i = 0; i < count; i++) {
+        fprintf(out, "xdp_anon_vault_collisions_total{interface=\"%s\"} %llu\n",
+                interfaces[i].interface_name, interfaces[i].vault_collisions);
+    }
+    
+    write_cpumap_family(out, interfaces, count, "cpumap_enqueued",
+                        "Frames queued to a CPUMAP worker", offsetof(cpumap_worker_stats, enqueued));
+    write_cpumap_family(out, interfaces, count, "cpumap_queue_drops",
+                        "Frames dropped on a full CPUMAP worker queue",
+                        offsetof(cpumap_worker_stats, queue_drops));
+    write_cpumap_family(out, interfaces, count, "cpumap_redirect_errors",
+                        "Frames the dispatcher failed to redirect",
+                        offsetof(cpumap_worker_stats, redirect_errors));
+    
+    write_pipeline_family(out, interfaces, count, "packets",
+                          "Frames dispatched to a pipeline stage",
+                          offsetof(pipeline_stage_stats, packets));
+    write_pipeline_family(out, interfaces, count, "anonymized",
+                          "Frames a pipeline stage anonymized",
+                          offsetof(pipeline_stage_stats, anonymized));
+    write_pipeline_family(out, interfaces, count, "errors",
+                          "Frames a pipeline stage dropped as errors",
+                          offsetof(pipeline_stage_stats, errors));
+    write_pipeline_family(out, interfaces, count, "missed",
+                          "Frames dropped because the stage slot was empty",
+                          offsetof(pipeline_stage_stats, missed));
+    
+    write_family(out, "", "packets_per_second", "", "Frames seen per second over the last interval",
+                 "gauge");
+    for (__u32 i = 0; i < count; i++) {
+        fprintf(out, "xdp_anon_packets_per_second{interface=\"%s\"} %.1f\n",
+                interfaces[i].interface_name, interfaces[i].packet_rate);
+    }
+    
+    write_family(out, "", "bits_per_second", "", "Bits seen per second over the last interval",
+                 "gauge");
+    for (__u32 i = 0; i < count; i++) {
+        fprintf(out, "xdp_anon_bits_per_second{interface=\"%s\"} %.1f\n",
+                interfaces[i].interface_name, interfaces[i].bit_rate);
+    }
+    
+    write_family(out, "", "config_generation", "", "Active configuration generation", "gauge");
+    for (__u32 i = 0; i < count; i++) {
+        fprintf(out, "xdp_anon_config_generation{interface=\"%s\"} %u\n",
+                interfaces[i].interface_name, interfaces[i].generation);
+    }
+    
+    write_family(out, "", "map_entries", "", "Entries held by a BPF map", "gauge");
+    for (__u32 i = 0; i < count; i++) {
+        for (__u32 m = 0; m < interfaces[i].map_count; m++) {
+            fprintf(out, "xdp_anon_map_entries{interface=\"%s\",map=\"%s\"} %llu\n",
+                    interfaces[i].interface_name, interfaces[i].maps[m].name,
+                    interfaces[i].maps[m].entries);
+        }
+    }
+    
+    write_family(out, "", "map_capacity", "", "Entries a BPF map can hold", "gauge");
+    for (__u32 i = 0; i < count; i++) {
+        for (__u32 m = 0; m < interfaces[i].map_count; m++) {
+            fprintf(out, "xdp_anon_map_capacity{interface=\"%s\",map=\"%s\"} %llu\n",
+                    interfaces[i].interface_name, interfaces[i].maps[m].name,
+                    interfaces[i].maps[m].capacity);
+        }
+    }
+}
+
+char *metrics_render(const metrics_interface *interfaces, __u32 count, __u32 cpu_count,
+                     size_t *length) {
+    char *page = NULL;
+    FILE *out = open_memstream(&page, length);
+    if (!out) {
+        fprintf(stderr, "Metrics page allocation failed\n");
+        return NULL;
+    }
+    
+    for (size_t m = 0; m < ARRAY_SIZE(stats_metrics); m++) {
+        const stats_metric *metric = &stats_metrics[m];
+        write_family(out, "", metric->name, "_total", metric->help, "counter");
+        for (__u32 i = 0; i < count; i++) {
+            fprintf(out, "xdp_anon_%s_total{interface=\"%s\"} %llu\n", metric->name,
+                    interfaces[i].interface_name, stats_value(interfaces[i].totals, metric->offset));
+        }
+    }
+    write_breakdowns(out, interfaces, count, cpu_count);
+    write_daemon_metrics(out, interfaces, count);
+    write_latency_histograms(out, interfaces, count);
+    
+    if (fclose(out)) {
+        fprintf(stderr, "Metrics page allocation failed\n");
+        free(page);
+        return NULL;
+    }
+    return page;
+}
+
+static int open_tcp_listener(const char *spec) {
+    char host[MAX_SINK_SPEC_LENGTH];
+    const char *port = strrchr(spec, ':');
+    if (port) {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - spec), spec);
+        port++;
+    } else {
+        snprintf(host, sizeof(host), "127.0.0.1");
+        port = spec;
+    }
+    
+    char *name = host;
+    if (name[0] == '[' && name[strlen(name) - 1] == ']') {
+        name[strlen(name) - 1] = '\0';
+        name++;
+    }
+    
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+    struct addrinfo *addresses;
+    int err = getaddrinfo(name, port, &hints, &addresses);
+    if (err) {
+        fprintf(stderr, "Metrics address lookup failed for tcp:%s: %s\n", spec, gai_strerror(err));
+        return -1;
+    }
+    
+    int fd = -1;
+    for (struct addrinfo *ai = addresses; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        int reuse = 1;
+        if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) ||
+                        bind(fd, ai->ai_addr, ai->ai_addrlen))) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    
+    if (fd < 0) {
+        fprintf(stderr, "Metrics bind failed for tcp:%s: %s\n", spec, strerror(errno));
+    }
+    return fd;
+}
+
+static int open_unix_listener(metrics_server *server, const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Metrics socket path %s is too long\n", path);
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    
+    /* A socket left by a previous run would make bind() fail; anything else stays. */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Metrics bind failed for unix:%s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    snprintf(server->unix_path, sizeof(server->unix_path), "%s", path);
+    return fd;
+}
+
+metrics_server *metrics_server_open(const char *target) {
+    metrics_server *server = calloc(1, sizeof(*server));
+    if (!server) {
+        fprintf(stderr, "Metrics server allocation failed\n");
+        return NULL;
+    }
+    for (__u32 i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+    
+    if (strncmp(target, "tcp:", 4) == 0) {
+        server->listen_fd = open_tcp_listener(target + 4);
+    } else if (strncmp(target, "unix:", 5) == 0) {
+        server->listen_fd = open_unix_listener(server, target + 5);
+    } else {
+        fprintf(stderr, "Unknown metrics listen address %s\n", target);
+        server->listen_fd = -1;
+    }
+    if (server->listen_fd < 0) {
+        free(server);
+        return NULL;
+    }
+    
+    struct epoll_event event = { .events = EPOLLIN, .data.u32 = 0 };
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (listen(server->listen_fd, METRICS_LISTEN_BACKLOG) || server->epoll_fd < 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event)) {
+        fprintf(stderr, "Metrics listen failed for %s: %s\n", target, strerror(errno));
+        metrics_server_close(server);
+        return NULL;
+    }
+    printf("Serving metrics on %s\n", target);
+    return server;
+}
+
+static void close_client(metrics_client *client) {
+    close(client->fd);
+    free(client->response);
+    client->fd = -1;
+    client->response = NULL;
+}
+
+void metrics_server_close(metrics_server *server) {
+    if (!server) {
+        return;
+    }
+    for (__u32 i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            close_client(&server->clients[i]);
+        }
+    }
+    if (server->epoll_fd >= 0) close(server->epoll_fd);
+    close(server->listen_fd);
+    if (server->unix_path[0]) {
+        unlink(server->unix_path);
+    }
+    free(server->page);
+    free(server);
+}
+
+int metrics_server_fd(const metrics_server *server) {
+    return server->epoll_fd;
+}
+
+void metrics_server_publish(metrics_server *server, char *page, size_t length) {
+    free(server->page);
+    server->page = page;
+    server->page_length = length;
+}
+
+/* A full table evicts the oldest connection, so a stalled scraper cannot lock others out. */
+static void accept_clients(metrics_server *server) {
+    int fd;
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        metrics_client *slot = NULL;
+        for (__u32 i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            metrics_client *client = &server->clients[i];
+            if (client->fd < 0) {
+                slot = client;
+                break;
+            }
+            if (!slot || client->serial < slot->serial) {
+                slot = client;
+            }
+        }
+        if (slot->fd >= 0) {
+            close_client(slot);
+        }
+        
+        *slot = (metrics_client){ .fd = fd, .serial = ++server->serial };
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = slot - server->clients + 1 };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+            close_client(slot);
+        }
+    }
+}
+
+/* Each client gets its own copy, so a publish mid-transfer cannot tear the page. */
+static bool build_response(const metrics_server *server, metrics_client *client) {
+    const char *status = "200 OK";
+    const char *body = server->page;
+    size_t body_length = server->page_length;
+    if (strncmp(client->request, "GET /metrics ", 13) != 0 &&
+        strncmp(client->request, "GET / ", 6) != 0) {
+        status = "404 Not Found";
+        body = "Not found\n";
+        body_length = strlen(body);
+    } else if (!body) {
+        status = "503 Service Unavailable";
+        body = "No statistics yet\n";
+        body_length = strlen(body);
+    }
+    
+    char header[METRICS_RESPONSE_HEADER_MAX];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 %s\r\n"
+                                 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Connection: close\r\n\r\n", status, body_length);
+    client->response = malloc(header_length + body_length);
+    if (!client->response) {
+        return false;
+    }
+    memcpy(client->response, header, header_length);
+    memcpy(client->response + header_length, body, body_length);
+    client->response_length = header_length + body_length;
+    client->sent = 0;
+    return true;
+}
+
+static void serve_client(metrics_server *server, metrics_client *client) {
+    if (!client->response) {
+        ssize_t received = read(client->fd, client->request + client->received,
+                                sizeof(client->request) - 1 - client->received);
+        if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+        if (received <= 0) {
+            close_client(client);
+            return;
+        }
+        client->received += received;
+        client->request[client->received] = '\0';
+        if (!strstr(client->request, "\r\n\r\n")) {
+            if (client->received == sizeof(client->request) - 1) {
+                close_client(client);
+            }
+            return;
+        }
+        if (!build_response(server, client)) {
+            close_client(client);
+            return;
+        }
+    }
+    
+    ssize_t sent = send(client->fd, client->response + client->sent,
+                        client->response_length - client->sent, MSG_NOSIGNAL);
+    if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+        close_client(client);
+        return;
+    }
+    if (sent > 0) {
+        client->sent += sent;
+    }
+    if (client->sent == client->response_length) {
+        close_client(client);
+        return;
+    }
+    
+    struct epoll_event event = { .events = EPOLLOUT, .data.u32 = client - server->clients + 1 };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+void metrics_server_poll(metrics_server *server) {
+    struct epoll_event events[METRICS_MAX_CLIENTS + 1];
+    int ready = epoll_wait(server->epoll_fd, events, METRICS_MAX_CLIENTS + 1, 0);
+    for (int i = 0; i < ready; i++) {
+        __u32 index = events[i].data.u32;
+        if (index == 0) {
+            accept_clients(server);
+        } else if (server->clients[index - 1].fd >= 0) {
+            serve_client(server, &server->clients[index - 1]);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <linux/types.h>
+#include <stddef.h>
+#include "common_structs.h"
+
+/*
+ * Prometheus text-format (0.0.4) endpoint, served at /metrics from:
+ *   tcp:<port>          127.0.0.1 only
+ *   tcp:<host>:<port>   any address, [v6] in brackets
+ *   unix:<path>         stream socket, replaced if stale
+ * Scrapes get the page last published by the daemon and never read BPF
+ * maps. The server is non-blocking; watch metrics_server_fd() for input
+ * and call metrics_server_poll().
+ */
+#define METRICS_MAX_CLIENTS 8
+#define METRICS_REQUEST_MAX 4096
+#define METRICS_MAX_MAPS 4
+
+typedef struct metrics_server metrics_server;
+
+typedef struct {
+    const char *name;
+    __u64 entries;
+    __u64 capacity;
+} metrics_map_gauge;
+
+/* One interface as of its last statistics refresh; the caller owns the pointers. */
+typedef struct {
+    const char *interface_name;
+    const anonymization_stats *totals;
+    const anonymization_stats *cpu_totals;
+    const anonymization_stats *queue_totals;
+    double packet_rate;
+    double bit_rate;
+    const __u64 *error_events;
+    __u64 sample_events;
+    __u64 flows_expired;
+    __u64 vault_collisions;
+    const __u32 *cpumap_cpus;
+    const cpumap_worker_stats *cpumap_workers;
+    __u32 cpumap_worker_count;
+    const pipeline_stage_stats *pipeline_stages;
+    const latency_histogram *latency;
+    __u32 generation;
+    const metrics_map_gauge *maps;
+    __u32 map_count;
+} metrics_interface;
+
+metrics_server *metrics_server_open(const char *target);
+void metrics_server_close(metrics_server *server);
+int metrics_server_fd(const metrics_server *server);
+void metrics_server_poll(metrics_server *server);
+
+/* Replaces the served page; the server takes ownership of the malloc'd text. */
+void metrics_server_publish(metrics_server *server, char *page, size_t length);
+
+/* Label value of a LATENCY_CLASS_* value, e.g. "ipv4". */
+const char *latency_class_name(__u32 latency_class);
+
+/* Returns a malloc'd page, or NULL when out of memory. */
+char *metrics_render(const metrics_interface *interfaces, __u32 count, __u32 cpu_count,
+                     size_t *length);
+
+#endif
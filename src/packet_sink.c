@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "packet_sink.h"
+
+#define PCAP_MAGIC 0xA1B2C3D4
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_SNAPLEN 65535
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_BUFFER_SIZE (1u << 20)
+
+typedef struct {
+    __u32 magic;
+    __u16 version_major;
+    __u16 version_minor;
+    __s32 thiszone;
+    __u32 sigfigs;
+    __u32 snaplen;
+    __u32 linktype;
+} pcap_file_header;
+
+typedef struct {
+    __u32 ts_sec;
+    __u32 ts_usec;
+    __u32 incl_len;
+    __u32 orig_len;
+} pcap_record_header;
+
+typedef struct {
+    FILE *file;
+    char *buffer;
+} pcap_sink_state;
+
+typedef struct {
+    shm_ring_header *header;
+    unsigned char *data;
+    size_t mapping_size;
+    char name[MAX_SINK_NAME_LENGTH];
+} shm_sink_state;
+
+static void format_queue_path(char *out, size_t out_len, const char *base,
+                              const char *extension, __u32 queue_id) {
+    size_t base_len = strlen(base);
+    size_t ext_len = strlen(extension);
+    
+    if (base_len > ext_len && strcmp(base + base_len - ext_len, extension) == 0) {
+        snprintf(out, out_len, "%.*s-q%u%s", (int)(base_len - ext_len), base,
+                 queue_id, extension);
+    } else {
+        snprintf(out, out_len, "%s-q%u", base, queue_id);
+    }
+}
+
+static int pcap_sink_write(packet_sink *sink, const void *data, __u32 len,
+                           const struct timespec *ts) {
+    pcap_sink_state *state = sink->priv;
+    __u32 captured = len > PCAP_SNAPLEN ? PCAP_SNAPLEN : len;
+    pcap_record_header record = {
+        .ts_sec = (__u32)ts->tv_sec,
+        .ts_usec = (__u32)(ts->tv_nsec / 1000),
+        .incl_len = captured,
+        .orig_len = len
+    };
+    
+    if (fwrite(&record, sizeof(record), 1, state->file) != 1 ||
+        fwrite(data, 1, captured, state->file) != captured) {
+        __atomic_fetch_add(&sink->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+static void pcap_sink_flush(packet_sink *sink) {
+    pcap_sink_state *state = sink->priv;
+    fflush(state->file);
+}
+
+static void pcap_sink_close(packet_sink *sink) {
+    pcap_sink_state *state = sink->priv;
+    fclose(state->file);
+    free(state->buffer);
+    free(state);
+}
+
+static packet_sink *pcap_sink_open(packet_sink *sink, const char *path, __u32 queue_id) {
+    char queue_path[MAX_SINK_NAME_LENGTH];
+    format_queue_path(queue_path, sizeof(queue_path), path, ".pcap", queue_id);
+    
+    pcap_sink_state *state = calloc(1, sizeof(*state));
+    if (!state) {
+        return NULL;
+    }
+    
+    state->file = fopen(queue_path, "wb");
+    if (!state->file) {
+        fprintf(stderr, "Pcap sink open failed for %s: %s\n", queue_path, strerror(errno));
+        free(state);
+        return NULL;
+    }
+    
+    state->buffer = malloc(PCAP_BUFFER_SIZE);
+    if (state->buffer) {
+        setvbuf(state->file, state->buffer, _IOFBF, PCAP_BUFFER_SIZE);
+    }
+    
+    pcap_file_header header = {
+        .magic = PCAP_MAGIC,
+        .version_major = PCAP_VERSION_MAJOR,
+        .version_minor = PCAP_VERSION_MINOR,
+        .thiszone = 0,
+        .sigfigs = 0,
+        .snaplen = PCAP_SNAPLEN,
+        .linktype = PCAP_LINKTYPE_ETHERNET
+    };
+    if (fwrite(&header, sizeof(header), 1, state->file) != 1) {
+        fprintf(stderr, "Pcap header write failed for %s\n", queue_path);
+        fclose(state->file);
+        free(state->buffer);
+        free(state);
+        return NULL;
+    }
+    
+    sink->write = pcap_sink_write;
+    sink->flush = pcap_sink_flush;
+    sink->close = pcap_sink_close;
+    sink->priv = state;
+    return sink;
+}
+
+static int shm_sink_write(packet_sink *sink, const void *data, __u32 len,
+                          const struct timespec *ts) {
+    shm_sink_state *state = sink->priv;
+    shm_ring_header *header = state->header;
+    __u64 capacity = header->capacity;
+    __u64 record_len = (sizeof(shm_ring_record) + len + 7) & ~7ULL;
+    __u64 head = header->head;
+    __u64 tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    __u64 offset = head % capacity;
+    __u64 wrap_len = 0;
+    
+    if (offset + record_len > capacity) {
+        wrap_len = capacity - offset;
+    }
+    
+    if (head + wrap_len + record_len - tail > capacity) {
+        __atomic_fetch_add(&sink->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    
+    if (wrap_len) {
+        shm_ring_record *marker = (shm_ring_record *)(state->data + offset);
+        marker->len = SHM_RING_WRAP;
+        head += wrap_len;
+        offset = 0;
+    }
+    
+    shm_ring_record *record = (shm_ring_record *)(state->data + offset);
+    record->len = len;
+    record->reserved = 0;
+    record->timestamp_ns = (__u64)ts->tv_sec * 1000000000ULL + (__u64)ts->tv_nsec;
+    memcpy(record + 1, data, len);
+    
+    __atomic_store_n(&header->head, head + record_len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void shm_sink_flush(packet_sink *sink) {
+    (void)sink;
+}
+
+static void shm_sink_close(packet_sink *sink) {
+    shm_sink_state *state = sink->priv;
+    munmap(state->header, state->mapping_size);
+    free(state);
+}
+
+static packet_sink *shm_sink_open(packet_sink *sink, const char *name, __u32 queue_id) {
+    shm_sink_state *state = calloc(1, sizeof(*state));
+    if (!state) {
+        return NULL;
+    }
+    
+    format_queue_path(state->name, sizeof(state->name), name, "", queue_id);
+    state->mapping_size = sizeof(shm_ring_header) + SHM_RING_DEFAULT_CAPACITY;
+    
+    int fd = shm_open(state->name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Shared memory open failed for %s: %s\n", state->name, strerror(errno));
+        free(state);
+        return NULL;
+    }
+    
+    if (ftruncate(fd, state->mapping_size)) {
+        fprintf(stderr, "Shared memory resize failed for %s: %s\n", state->name, strerror(errno));
+        close(fd);
+        free(state);
+        return NULL;
+    }
+    
+    void *mapping = mmap(NULL, state->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Shared memory map failed for %s: %s\n", state->name, strerror(errno));
+        free(state);
+        return NULL;
+    }
+    
+    state->header = mapping;
+    state->data = (unsigned char *)mapping + sizeof(shm_ring_header);
+    state->header->capacity = SHM_RING_DEFAULT_CAPACITY;
+    state->header->version = 1;
+    state->header->head = 0;
+    state->header->tail = 0;
+    __atomic_store_n(&state->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    
+    sink->write = shm_sink_write;
+    sink->flush = shm_sink_flush;
+    sink->close = shm_sink_close;
+    sink->priv = state;
+    return sink;
+}
+
+packet_sink *packet_sink_open(const char *spec, __u32 queue_id) {
+    packet_sink *sink = calloc(1, sizeof(*sink));
+    if (!sink) {
+        return NULL;
+    }
+    
+    packet_sink *opened = NULL;
+    if (strncmp(spec, "pcap:", 5) == 0) {
+        opened = pcap_sink_open(sink, spec + 5, queue_id);
+    } else if (strncmp(spec, "shm:", 4) == 0) {
+        opened = shm_sink_open(sink, spec + 4, queue_id);
+    } else {
+        fprintf(stderr, "Unknown sink type: %s\n", spec);
+    }
+    
+    if (!opened) {
+        free(sink);
+    }
+    return opened;
+}
+
+void packet_sink_close(packet_sink *sink) {
+    if (!sink) {
+        return;
+    }
+    sink->flush(sink);
+    sink->close(sink);
+    free(sink);
+}
@@ -0,0 +1,57 @@
+#ifndef PACKET_SINK_H
+#define PACKET_SINK_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Destination for frames delivered to userspace. A sink is owned by a
+ * single consumer thread, so implementations need no locking; only
+ * dropped is read from other threads, through relaxed atomics.
+ *
+ * Spec strings:
+ *   pcap:<path>   classic pcap file, one per queue (<path> gets -q<N>)
+ *   shm:<name>    POSIX shared-memory ring, one per queue (<name>-q<N>)
+ */
+#define MAX_SINK_NAME_LENGTH 512
+
+typedef struct packet_sink packet_sink;
+
+struct packet_sink {
+    int (*write)(packet_sink *sink, const void *data, __u32 len, const struct timespec *ts);
+    void (*flush)(packet_sink *sink);
+    void (*close)(packet_sink *sink);
+    void *priv;
+    __u64 dropped;
+};
+
+/*
+ * Shared-memory ring layout for shm: sinks. The producer advances head,
+ * the reader advances tail; both are byte offsets that only grow and are
+ * taken modulo capacity. Each record is a shm_ring_record followed by
+ * len bytes of frame data, padded to 8 bytes. A record with
+ * len == SHM_RING_WRAP tells the reader to continue at offset 0.
+ */
+#define SHM_RING_MAGIC 0x414E4F4E
+#define SHM_RING_WRAP 0xFFFFFFFF
+#define SHM_RING_DEFAULT_CAPACITY (64u << 20)
+
+typedef struct {
+    __u32 magic;
+    __u32 version;
+    __u64 capacity;
+    __u64 head;
+    __u64 tail;
+} __attribute__((aligned(64))) shm_ring_header;
+
+typedef struct {
+    __u32 len;
+    __u32 reserved;
+    __u64 timestamp_ns;
+} shm_ring_record;
+
+packet_sink *packet_sink_open(const char *spec, __u32 queue_id);
+void packet_sink_close(packet_sink *sink);
+
+#endif
@@ -1,41 +1,440 @@
 #include <linux/bpf.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
-#include <linux/arp.h>
+#include <linux/if_arp.h>
 #include <linux/in.h>
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>
 #include "../src/common_structs.h"
 #include "../common/parsing_helpers.h"
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __uint(max_entries, DEFAULT_MAPPING_CACHE_SIZE);
+    __type(key, mac_cache_key);
+    __type(value, mac_cache_value);
+} mac_cache_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __uint(max_entries, DEFAULT_MAPPING_CACHE_SIZE);
+    __type(key, ipv4_cache_key);
+    __type(value, ipv4_cache_value);
+} ipv4_cache_map SEC(".maps");
+
+#define ANON_MAPPING_CACHE
+
+/*
+ * Per-CPU values: a key inserted on another CPU reads back as an invalid
+ * slot here, so only BPF_NOEXIST successes count as new entries. Entries
+ * from an older config generation are misses and get overwritten.
+ */
+static inline void mapping_cache_store(anonymization_context *ctx, void *map,
+                                       const void *key, const void *value) {
+    if (bpf_map_update_elem(map, key, value, BPF_NOEXIST) == 0) {
+        ctx->mods->cache_inserts++;
+    } else {
+        bpf_map_update_elem(map, key, value, BPF_EXIST);
+    }
+}
+
+static inline bool mapping_cache_lookup_mac(anonymization_context *ctx, unsigned char *mac,
+                                            __u32 field) {
+    if (!ctx->config->mapping_cache) {
+        return false;
+    }
+    
+    mac_cache_key key = { .field = field };
+    __builtin_memcpy(key.addr, mac, sizeof(key.addr));
+    
+    mac_cache_value *value = bpf_map_lookup_elem(&mac_cache_map, &key);
+    if (!value || !value->valid || value->generation != ctx->generation) {
+        ctx->mods->cache_misses++;
+        return false;
+    }
+    
+    __builtin_memcpy(mac, value->addr, sizeof(value->addr));
+    ctx->mods->cache_hits++;
+    return true;
+}
+
+static inline void mapping_cache_update_mac(anonymization_context *ctx,
+                                            const unsigned char *original,
+                                            const unsigned char *mapped, __u32 field) {
+    if (!ctx->config->mapping_cache) {
+        return;
+    }
+    
+    mac_cache_key key = { .field = field };
+    mac_cache_value value = { .valid = 1, .generation = ctx->generation };
+    __builtin_memcpy(key.addr, original, sizeof(key.addr));
+    __builtin_memcpy(value.addr, mapped, sizeof(value.addr));
+    mapping_cache_store(ctx, &mac_cache_map, &key, &value);
+}
+
+static inline bool mapping_cache_lookup_ipv4(anonymization_context *ctx, __u32 ip_addr,
+                                             __u32 field, __u32 *mapped) {
+    if (!ctx->config->mapping_cache) {
+        return false;
+    }
+    
+    ipv4_cache_key key = { .addr = ip_addr, .field = field };
+    ipv4_cache_value *value = bpf_map_lookup_elem(&ipv4_cache_map, &key);
+    if (!value || !value->valid || value->generation != ctx->generation) {
+        ctx->mods->cache_misses++;
+        return false;
+    }
+    
+    *mapped = value->addr;
+    ctx->mods->cache_hits++;
+    return true;
+}
+
+static inline void mapping_cache_update_ipv4(anonymization_context *ctx, __u32 ip_addr,
+                                             __u32 field, __u32 mapped) {
+    if (!ctx->config->mapping_cache) {
+        return;
+    }
+    
+    ipv4_cache_key key = { .addr = ip_addr, .field = field };
+    ipv4_cache_value value = { .addr = mapped, .valid = 1, .generation = ctx->generation };
+    mapping_cache_store(ctx, &ipv4_cache_map, &key, &value);
+}
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, DEFAULT_FLOW_TABLE_SIZE);
+    __type(key, flow_tuple);
+    __type(value, flow_entry);
+} flow_table_map SEC(".maps");
+
+#define ANON_FLOW_TABLE
+
+/*
+ * One entry per flow shared by all CPUs, so counters are added atomically.
+ * An entry from an older generation still counts the packet, then gets
+ * its anonymized tuple replaced by flow_table_record().
+ */
+static inline flow_entry *flow_table_lookup(anonymization_context *ctx, const flow_tuple *key,
+                                            __u64 bytes) {
+    flow_entry *flow = bpf_map_lookup_elem(&flow_table_map, key);
+    if (!flow) {
+        return NULL;
+    }
+    
+    __sync_fetch_and_add(&flow->packets, 1);
+    __sync_fetch_and_add(&flow->bytes, bytes);
+    flow->last_seen_ns = bpf_ktime_get_ns();
+    if (flow->generation != ctx->generation) {
+        return NULL;
+    }
+    
+    ctx->mods->flow_hit = true;
+    return flow;
+}
+
+static inline void flow_table_record(anonymization_context *ctx, const flow_tuple *key,
+                                     const flow_tuple *anonymized, __u64 bytes) {
+    flow_entry *flow = bpf_map_lookup_elem(&flow_table_map, key);
+    if (flow) {
+        flow->anonymized = *anonymized;
+        flow->generation = ctx->generation;
+        return;
+    }
+    
+    __u64 now = bpf_ktime_get_ns();
+    flow_entry entry = {
+        .anonymized = *anonymized,
+        .packets = 1,
+        .bytes = bytes,
+        .first_seen_ns = now,
+        .last_seen_ns = now,
+        .generation = ctx->generation
+    };
+    if (bpf_map_update_elem(&flow_table_map, key, &entry, BPF_NOEXIST) == 0) {
+        ctx->mods->flow_created = true;
+        return;
+    }
+    
+    /* Another CPU created it first. */
+    flow = bpf_map_lookup_elem(&flow_table_map, key);
+    if (flow) {
+        __sync_fetch_and_add(&flow->packets, 1);
+        __sync_fetch_and_add(&flow->bytes, bytes);
+    }
+}
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, CONFIG_SLOT_COUNT * MAX_POLICY_PREFIXES);
+    __type(key, policy_ipv4_key);
+    __type(value, policy_rule);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} policy_ipv4_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, CONFIG_SLOT_COUNT * MAX_POLICY_PREFIXES);
+    __type(key, policy_ipv6_key);
+    __type(value, policy_rule);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} policy_ipv6_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, CONFIG_SLOT_COUNT * MAX_POLICY_RULES);
+    __type(key, __u32);
+    __type(value, __u64);
+} policy_hits_map SEC(".maps");
+
+#define ANON_ADDRESS_POLICY
+
+static inline bool policy_match(anonymization_context *ctx, const policy_rule *match,
+                                policy_rule *rule) {
+    if (!match) {
+        return false;
+    }
+    
+    __u32 index = (ctx->generation % CONFIG_SLOT_COUNT) * MAX_POLICY_RULES + match->rule_id;
+    __u64 *hits = bpf_map_lookup_elem(&policy_hits_map, &index);
+    if (hits) {
+        (*hits)++;
+    }
+    *rule = *match;
+    return true;
+}
+
+static inline bool policy_lookup_ipv4(anonymization_context *ctx, __u32 ip_addr,
+                                      policy_rule *rule) {
+    policy_ipv4_key key = {
+        .prefixlen = POLICY_SLOT_BITS + 32,
+        .slot = ctx->generation % CONFIG_SLOT_COUNT
+    };
+    __be32 addr = htonl(ip_addr);
+    __builtin_memcpy(key.addr, &addr, sizeof(key.addr));
+    return policy_match(ctx, bpf_map_lookup_elem(&policy_ipv4_map, &key), rule);
+}
+
+static inline bool policy_lookup_ipv6(anonymization_context *ctx, const __be32 *addr,
+                                      policy_rule *rule) {
+    policy_ipv6_key key = {
+        .prefixlen = POLICY_SLOT_BITS + 128,
+        .slot = ctx->generation % CONFIG_SLOT_COUNT
+    };
+    __builtin_memcpy(key.addr, addr, sizeof(key.addr));
+    return policy_match(ctx, bpf_map_lookup_elem(&policy_ipv6_map, &key), rule);
+}
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, VAULT_SEEN_ENTRIES);
+    __uint(key_size, VAULT_SEEN_KEY_SIZE);
+    __uint(value_size, sizeof(__u8));
+} vault_seen_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, VAULT_RING_SIZE);
+} vault_ring_map SEC(".maps");
+
+#define ANON_MAPPING_VAULT
+
+/*
+ * Sends a pair the first time it is seen under the current mapping id;
+ * the leading bytes of the record are the vault_seen_map key. On a full
+ * ring the key is forgotten again, so a later packet retries.
+ */
+static inline void mapping_vault_submit(anonymization_context *ctx, vault_mapping *mapping) {
+    __u8 seen = 1;
+    if (bpf_map_update_elem(&vault_seen_map, mapping, &seen, BPF_NOEXIST)) {
+        return;
+    }
+    if (bpf_ringbuf_output(&vault_ring_map, mapping, sizeof(*mapping), 0)) {
+        bpf_map_delete_elem(&vault_seen_map, mapping);
+        ctx->mods->vault_lost++;
+        return;
+    }
+    ctx->mods->vault_records++;
+}
+
+static inline void mapping_vault_record_mac(anonymization_context *ctx, const unsigned char *original,
+                                            const unsigned char *mapped, __u32 field) {
+    if (!ctx->config->mapping_vault) {
+        return;
+    }
+    vault_mapping mapping = {
+        .mapping_id = ctx->config->vault_mapping_id,
+        .kind = VAULT_KIND_MAC,
+        .field = field
+    };
+    __builtin_memcpy(mapping.original, original, ETH_ALEN);
+    __builtin_memcpy(mapping.anonymized, mapped, ETH_ALEN);
+    mapping_vault_submit(ctx, &mapping);
+}
+
+static inline void mapping_vault_record_ipv4(anonymization_context *ctx, __u32 ip_addr,
+                                             __u32 mapped, __u32 field) {
+    if (!ctx->config->mapping_vault) {
+        return;
+    }
+    vault_mapping mapping = {
+        .mapping_id = ctx->config->vault_mapping_id,
+        .kind = VAULT_KIND_IPV4,
+        .field = field
+    };
+    __be32 original_be = bpf_htonl(ip_addr);
+    __be32 mapped_be = bpf_htonl(mapped);
+    __builtin_memcpy(mapping.original, &original_be, sizeof(original_be));
+    __builtin_memcpy(mapping.anonymized, &mapped_be, sizeof(mapped_be));
+    mapping_vault_submit(ctx, &mapping);
+}
+
+static inline void mapping_vault_record_ipv6(anonymization_context *ctx, const __be32 *original,
+                                             const __be32 *mapped, __u32 field) {
+    if (!ctx->config->mapping_vault) {
+        return;
+    }
+    vault_mapping mapping = {
+        .mapping_id = ctx->config->vault_mapping_id,
+        .kind = VAULT_KIND_IPV6,
+        .field = field
+    };
+    __builtin_memcpy(mapping.original, original, sizeof(mapping.original));
+    __builtin_memcpy(mapping.anonymized, mapped, sizeof(mapping.anonymized));
+    mapping_vault_submit(ctx, &mapping);
+}
+
 #include "../common/rewrite_helpers.h"
 
 struct {
     __uint(type, BPF_MAP_TYPE_ARRAY);
     __uint(max_entries, 1);
     __type(key, __u32);
+    __type(value, __u32);
+} config_generation_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, CONFIG_SLOT_COUNT);
+    __type(key, __u32);
     __type(value, anonymization_config);
 } config_map SEC(".maps");
 
 struct {
-    __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, 1);
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, MAX_RX_QUEUES);
     __type(key, __u32);
     __type(value, anonymization_stats);
 } stats_map SEC(".maps");
 
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, CONFIG_SLOT_COUNT);
+    __type(key, __u32);
+    __type(value, prefix_preserving_table);
+} pp_table_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_DEVMAP_HASH);
+    __uint(max_entries, MAX_OUTPUT_PORTS);
+    __type(key, __u32);
+    __type(value, __u32);
+} output_devmap SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, MAX_XSK_QUEUES);
+    __type(key, __u32);
+    __type(value, __u32);
+} xsks_map SEC(".maps");
+
+/* Sized by the loader from event_ring_size. */
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, DEFAULT_EVENT_RING_SIZE);
+} events_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, event_state);
+} event_state_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, frag_window);
+} frag_window_map SEC(".maps");
+
+/* Keyed by CPU number; the loader sizes both to the possible CPUs. */
+struct {
+    __uint(type, BPF_MAP_TYPE_CPUMAP);
+    __uint(max_entries, CPUMAP_MAX_CPUS);
+    __type(key, __u32);
+    __type(value, struct bpf_cpumap_val);
+} cpumap_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, CPUMAP_MAX_CPUS);
+    __type(key, __u32);
+    __type(value, cpumap_worker_stats);
+} cpumap_stats_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, cpumap_dispatch);
+} cpumap_dispatch_map SEC(".maps");
+
+/* Filled by the loader with the xdp_stage_* programs; userspace may swap a slot at any time. */
+struct {
+    __uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+    __uint(max_entries, PIPELINE_STAGE_COUNT);
+    __uint(key_size, sizeof(__u32));
+    __uint(value_size, sizeof(__u32));
+} pipeline_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, pipeline_frame);
+} pipeline_frame_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, PIPELINE_STAGE_COUNT);
+    __type(key, __u32);
+    __type(value, pipeline_stage_stats);
+} pipeline_stats_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, LATENCY_CLASS_COUNT);
+    __type(key, __u32);
+    __type(value, latency_histogram);
+} latency_map SEC(".maps");
+
+/*
+ * Filled in by the loader before bpf_object__load(). libbpf freezes
+ * .rodata, so the verifier reads these fields as constants and drops every
+ * branch the active config leaves dead in xdp_anonymize_specialized.
+ */
+const volatile config_specialization specialization = {};
+
 static inline int process_packet_headers(void *data, void *data_end, 
                                        struct ethhdr *eth, 
-                                       anonymization_config *config,
+                                       const anonymization_config *config,
                                        anonymization_stats *stats) {
     if (data + sizeof(struct ethhdr) > data_end) {
         return XDP_PASS;
     }
     
-    bool multicast_detected = is_multicast_mac(eth->h_dest);
-    bool broadcast_detected = is_broadcast_mac(eth->h_dest);
-    
-    if ((multicast_detected || broadcast_detected) && 
-        !config->anonymize_multicast_broadcast) {
+    if (is_passthrough_frame(eth, config)) {
         return XDP_PASS;
     }
     
@@ -53,44 +452,688 @@ static inline void update_anonymization_stats(packet_modifications *mods,
     if (mods->arp_modified) {
         stats->arp_packets_anonymized++;
     }
+    if (mods->ipv6_src_modified || mods->ipv6_dst_modified) {
+        stats->ipv6_addresses_anonymized++;
+    }
+    if (mods->ndp_modified) {
+        stats->ndp_packets_anonymized++;
+    }
+    if (mods->vlan_depth == 1) {
+        stats->vlan_packets++;
+    } else if (mods->vlan_depth > 1) {
+        stats->qinq_packets++;
+    }
+    if (mods->mpls_labels) {
+        stats->mpls_packets++;
+    }
+    if (mods->encap == ENCAP_VXLAN) {
+        stats->vxlan_packets++;
+    } else if (mods->encap == ENCAP_GENEVE) {
+        stats->geneve_packets++;
+    } else if (mods->encap == ENCAP_GRE) {
+        stats->gre_packets++;
+    }
+    if (mods->ports_modified) {
+        stats->ports_anonymized++;
+    }
+    if (mods->flow_hit) {
+        stats->flow_hits++;
+    }
+    if (mods->flow_created) {
+        stats->flows_created++;
+    }
+    if (mods->dhcp_scrubbed) {
+        stats->dhcp_scrubbed++;
+    }
+    if (mods->dns_scrubbed) {
+        stats->dns_scrubbed++;
+    }
+    if (mods->icmp_error_scrubbed) {
+        stats->icmp_errors_scrubbed++;
+    }
+    stats->vault_records += mods->vault_records;
+    stats->vault_lost += mods->vault_lost;
+    stats->cache_hits += mods->cache_hits;
+    stats->cache_misses += mods->cache_misses;
+    stats->cache_inserts += mods->cache_inserts;
 }
 
-SEC("xdp")
-int xdp_anonymize_prog(struct xdp_md *ctx) {
-    void *data_end = (void *)(long)ctx->data_end;
-    void *data = (void *)(long)ctx->data;
+/* Copies the head of the frame; shorter frames go byte by byte under a constant bound. */
+static inline __u32 snapshot_frame(__u8 *dst, void *data, void *data_end) {
+    if (data + EVENT_SNAPSHOT_LENGTH <= data_end) {
+        __builtin_memcpy(dst, data, EVENT_SNAPSHOT_LENGTH);
+        return EVENT_SNAPSHOT_LENGTH;
+    }
+    
+    __u32 length = 0;
+    for (__u32 i = 0; i < EVENT_SNAPSHOT_LENGTH; i++) {
+        __u8 *byte = data + i;
+        if ((void *)(byte + 1) > data_end) {
+            break;
+        }
+        dst[i] = *byte;
+        length++;
+    }
+    return length;
+}
+
+/* Takes one event from this CPU's budget for the current second. */
+static inline bool claim_event(event_state *state, const anonymization_config *config,
+                               anonymization_stats *stats) {
+    __u64 now = bpf_ktime_get_ns();
+    if (now - state->window_start_ns >= EVENT_RATE_WINDOW_NS) {
+        state->window_start_ns = now;
+        state->window_events = 0;
+    }
+    if (state->window_events >= config->event_rate_limit) {
+        stats->events_suppressed++;
+        return false;
+    }
     
-    __u32 config_key = 0;
-    anonymization_config *config = bpf_map_lookup_elem(&config_map, &config_key);
-    if (!config) {
+    state->window_events++;
+    state->event.timestamp_ns = now;
+    return true;
+}
+
+/* Claims the event buffer and saves the untouched headers when this frame is due for a sample. */
+static inline event_state *sample_frame(void *data, void *data_end,
+                                        const anonymization_config *config,
+                                        anonymization_stats *stats) {
+    __u32 key = 0;
+    event_state *state = bpf_map_lookup_elem(&event_state_map, &key);
+    if (!state) {
+        return NULL;
+    }
+    if (state->sample_countdown > 1) {
+        state->sample_countdown--;
+        return NULL;
+    }
+    
+    state->sample_countdown = config->event_sample_rate;
+    if (!claim_event(state, config, stats)) {
+        return NULL;
+    }
+    state->event.snapshot_length = snapshot_frame(state->event.before, data, data_end);
+    return state;
+}
+
+static inline void emit_event(struct xdp_md *ctx, event_state *state, __u32 type, __u32 reason,
+                              __u32 generation, __u32 frame_length, anonymization_stats *stats) {
+    packet_event *event = &state->event;
+    event->type = type;
+    event->reason = reason;
+    event->ifindex = ctx->ingress_ifindex;
+    event->rx_queue = ctx->rx_queue_index;
+    event->generation = generation;
+    event->frame_length = frame_length;
+    
+    __u64 size = type == EVENT_TYPE_SAMPLE ? sizeof(*event) : __builtin_offsetof(packet_event, after);
+    if (bpf_ringbuf_output(&events_map, event, size, 0)) {
+        stats->events_lost++;
+    }
+}
+
+/* A sampled frame already holds its original headers; otherwise the frame is taken as dropped. */
+static inline void report_error(struct xdp_md *ctx, void *data, void *data_end, event_state *sample,
+                                __u32 reason, const anonymization_config *config, __u32 generation,
+                                __u32 frame_length, anonymization_stats *stats) {
+    event_state *state = sample;
+    if (!state) {
+        __u32 key = 0;
+        state = bpf_map_lookup_elem(&event_state_map, &key);
+        if (!state || !claim_event(state, config, stats)) {
+            return;
+        }
+        state->event.snapshot_length = snapshot_frame(state->event.before, data, data_end);
+    }
+    emit_event(ctx, state, EVENT_TYPE_ERROR, reason, generation, frame_length, stats);
+}
+
+static inline int select_output_action(struct xdp_md *ctx,
+                                      const anonymization_config *config,
+                                      anonymization_stats *stats) {
+    switch (config->output_mode) {
+    case OUTPUT_MODE_PASS:
         return XDP_PASS;
+    case OUTPUT_MODE_TX:
+        stats->packets_forwarded++;
+        return XDP_TX;
+    case OUTPUT_MODE_REDIRECT: {
+        int action = bpf_redirect_map(&output_devmap, config->output_ifindex, XDP_DROP);
+        if (action == XDP_REDIRECT) {
+            stats->packets_forwarded++;
+        } else {
+            stats->forward_errors++;
+        }
+        return action;
+    }
+    case OUTPUT_MODE_XSK: {
+        int action = bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_DROP);
+        if (action == XDP_REDIRECT) {
+            stats->packets_forwarded++;
+        } else {
+            stats->forward_errors++;
+        }
+        return action;
+    }
+    default:
+        return XDP_DROP;
+    }
+}
+
+/*
+ * Copies the head of a multi-buffer frame whose linear part is too short
+ * for its headers; the caller rewrites the copy and stores it back.
+ */
+static inline frag_window *load_frag_window(struct xdp_md *ctx, __u32 frame_length,
+                                            __u32 *length) {
+    __u32 key = 0;
+    frag_window *window = bpf_map_lookup_elem(&frag_window_map, &key);
+    if (!window) {
+        return NULL;
     }
     
-    __u32 stats_key = 0;
-    anonymization_stats *stats = bpf_map_lookup_elem(&stats_map, &stats_key);
+    *length = frame_length;
+    if (*length > FRAG_HEADER_WINDOW) {
+        *length = FRAG_HEADER_WINDOW;
+    }
+    if (*length < sizeof(struct ethhdr) || bpf_xdp_load_bytes(ctx, 0, window->bytes, *length)) {
+        return NULL;
+    }
+    window->length = *length;
+    return window;
+}
+
+/*
+ * Config, stats and packet bounds of the frame being anonymized.
+ * window_length is the bounded copy of window->length: the map value is
+ * rewritten during anonymization, so the verifier cannot bound a re-read.
+ */
+typedef struct {
+    const anonymization_config *config;
+    anonymization_stats *stats;
+    frag_window *window;
+    __u32 window_length;
+    void *data;
+    void *data_end;
+    __u64 start_ns;
+    __u32 generation;
+    __u32 frame_length;
+} frame_state;
+
+/* Per RX queue; queues past MAX_RX_QUEUES share the last entry. */
+static inline anonymization_stats *lookup_queue_stats(__u32 rx_queue) {
+    __u32 stats_key = rx_queue;
+    if (stats_key >= MAX_RX_QUEUES) {
+        stats_key = MAX_RX_QUEUES - 1;
+    }
+    return bpf_map_lookup_elem(&stats_map, &stats_key);
+}
+
+/* floor(log2(ns)), capped at the last bucket. */
+static inline __u32 latency_bucket(__u64 ns) {
+    if (ns >> 32) {
+        return LATENCY_BUCKET_COUNT - 1;
+    }
+    __u32 value = ns;
+    __u32 bucket = (value > 0xFFFF) << 4;
+    value >>= bucket;
+    __u32 shift = (value > 0xFF) << 3;
+    value >>= shift;
+    bucket |= shift;
+    shift = (value > 0xF) << 2;
+    value >>= shift;
+    bucket |= shift;
+    shift = (value > 0x3) << 1;
+    value >>= shift;
+    bucket |= shift;
+    bucket |= value >> 1;
+    return bucket < LATENCY_BUCKET_COUNT ? bucket : LATENCY_BUCKET_COUNT - 1;
+}
+
+static inline __u32 latency_class(__u16 l3_proto) {
+    switch (l3_proto) {
+    case ETH_P_ARP:
+        return LATENCY_CLASS_ARP;
+    case ETH_P_IP:
+        return LATENCY_CLASS_IPV4;
+    case ETH_P_IPV6:
+        return LATENCY_CLASS_IPV6;
+    default:
+        return LATENCY_CLASS_OTHER;
+    }
+}
+
+/* start_ns is only set while latency_histogram is on, so this is a single branch otherwise. */
+static inline void record_latency(const frame_state *frame, __u32 class) {
+    if (!frame->start_ns) {
+        return;
+    }
+    
+    __u64 elapsed = bpf_ktime_get_ns() - frame->start_ns;
+    latency_histogram *histogram = bpf_map_lookup_elem(&latency_map, &class);
+    if (histogram) {
+        histogram->buckets[latency_bucket(elapsed)]++;
+        histogram->total_ns += elapsed;
+    }
+}
+
+/*
+ * Returns 0 with frame filled in, or the action for a frame that goes no
+ * further. start_ns stays 0 until the config is known, so callers can
+ * record_latency() on every early return.
+ */
+static __always_inline int open_frame(struct xdp_md *ctx, bool specialized, __u32 rx_queue,
+                                      frame_state *frame) {
+    frame->start_ns = 0;
+    frame->data_end = (void *)(long)ctx->data_end;
+    frame->data = (void *)(long)ctx->data;
+    frame->window = NULL;
+    frame->window_length = 0;
+    
+    if (specialized) {
+        /*
+         * Plain loads from the const volatile global fold to its zero
+         * initializer. Hiding where the pointer comes from keeps every field
+         * a load from .rodata, which the verifier reads as the loader's value.
+         */
+        const anonymization_config *config = (const anonymization_config *)&specialization.config;
+        asm volatile("" : "+r"(config));
+        frame->config = config;
+        frame->generation = specialization.generation;
+    } else {
+        __u32 generation_key = 0;
+        __u32 *generation_ptr = bpf_map_lookup_elem(&config_generation_map, &generation_key);
+        if (!generation_ptr) {
+            return XDP_PASS;
+        }
+        
+        /* One read per packet: the whole packet sees a single config slot. */
+        frame->generation = *(volatile __u32 *)generation_ptr;
+        __u32 generation_slot = frame->generation % CONFIG_SLOT_COUNT;
+        frame->config = bpf_map_lookup_elem(&config_map, &generation_slot);
+        if (!frame->config) {
+            return XDP_PASS;
+        }
+    }
+    frame->start_ns = frame->config->latency_histogram ? bpf_ktime_get_ns() : 0;
+    
+    anonymization_stats *stats = lookup_queue_stats(rx_queue);
     if (!stats) {
         return XDP_PASS;
     }
+    frame->stats = stats;
     
+    __u32 linear_length = frame->data_end - frame->data;
+    frame->frame_length = bpf_xdp_get_buff_len(ctx);
     stats->packets_processed++;
+    stats->bytes_processed += frame->frame_length;
+    
+    /* Linear frames stay on direct packet access; only short linear parts go through a copy. */
+    if (frame->frame_length > linear_length) {
+        stats->frag_packets++;
+        if (linear_length < FRAG_HEADER_WINDOW) {
+            frame->window = load_frag_window(ctx, frame->frame_length, &frame->window_length);
+            if (!frame->window) {
+                stats->errors++;
+                return XDP_DROP;
+            }
+            frame->data = frame->window->bytes;
+            frame->data_end = frame->window->bytes + frame->window_length;
+            stats->frag_copies++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Rewrites an opened frame and picks its output action. stage_proto and
+ * stage_stats are set when a pipeline stage runs it, 0 and NULL otherwise.
+ */
+static __always_inline int finish_frame(struct xdp_md *ctx, frame_state *frame, event_state *sample,
+                                        __u16 stage_proto, pipeline_stage_stats *stage_stats) {
+    const anonymization_config *config = frame->config;
+    anonymization_stats *stats = frame->stats;
+    void *data = frame->data;
+    void *data_end = frame->data_end;
+    __u32 config_slot = frame->generation % CONFIG_SLOT_COUNT;
+    
+    const prefix_preserving_table *pp_table = NULL;
+    if (config->prefix_preserving) {
+        pp_table = bpf_map_lookup_elem(&pp_table_map, &config_slot);
+    }
+    
+    packet_modifications mods = {0};
+    anonymization_context anon_ctx = {
+        .config = config,
+        .pp_table = pp_table,
+        .mods = &mods,
+        .generation = frame->generation,
+        .frag_bytes = frame->frame_length - (__u32)(data_end - data),
+        .stage_proto = stage_proto
+    };
+    bool anonymization_success = anonymize_packet(data, data_end, &anon_ctx);
+    
+    if (!anonymization_success) {
+        stats->errors++;
+        if (stage_stats) {
+            stage_stats->errors++;
+        }
+        if (config->error_events) {
+            report_error(ctx, data, data_end, sample, mods.error_reason, config, frame->generation,
+                         frame->frame_length, stats);
+        }
+        record_latency(frame, LATENCY_CLASS_ERROR);
+        return XDP_DROP;
+    }
+    
+    if (mods.policy_drop) {
+        stats->policy_drops++;
+        record_latency(frame, latency_class(mods.l3_proto));
+        return XDP_DROP;
+    }
     
+    if (frame->window && bpf_xdp_store_bytes(ctx, 0, frame->window->bytes, frame->window_length)) {
+        stats->errors++;
+        if (stage_stats) {
+            stage_stats->errors++;
+        }
+        record_latency(frame, LATENCY_CLASS_ERROR);
+        return XDP_DROP;
+    }
+    
+    stats->packets_anonymized++;
+    if (stage_stats) {
+        stage_stats->anonymized++;
+    }
+    update_anonymization_stats(&mods, stats);
+    
+    if (sample) {
+        snapshot_frame(sample->event.after, data, data_end);
+        emit_event(ctx, sample, EVENT_TYPE_SAMPLE, ANON_ERROR_NONE, frame->generation,
+                   frame->frame_length, stats);
+    }
+    
+    int action = select_output_action(ctx, config, stats);
+    record_latency(frame, latency_class(mods.l3_proto));
+    return action;
+}
+
+static __always_inline int anonymize_frame(struct xdp_md *ctx, bool specialized, __u32 rx_queue) {
+    frame_state frame;
+    int action = open_frame(ctx, specialized, rx_queue, &frame);
+    if (action != 0) {
+        record_latency(&frame, LATENCY_CLASS_ERROR);
+        return action;
+    }
+    
+    struct ethhdr *eth = frame.data;
+    int header_result = process_packet_headers(frame.data, frame.data_end, eth, frame.config,
+                                               frame.stats);
+    if (header_result != 0) {
+        record_latency(&frame, LATENCY_CLASS_OTHER);
+        return header_result;
+    }
+    
+    event_state *sample = NULL;
+    if (frame.config->event_sample_rate) {
+        sample = sample_frame(frame.data, frame.data_end, frame.config, frame.stats);
+    }
+    return finish_frame(ctx, &frame, sample, 0, NULL);
+}
+
+/* xdp.frags: jumbo and GRO-sized frames arrive as multi-buffer; the linear part is the first buffer. */
+SEC("xdp.frags")
+int xdp_anonymize_prog(struct xdp_md *ctx) {
+    return anonymize_frame(ctx, false, ctx->rx_queue_index);
+}
+
+/* Same datapath with the config baked in; the loader swaps back to the generic program on reload. */
+SEC("xdp.frags")
+int xdp_anonymize_specialized(struct xdp_md *ctx) {
+    return anonymize_frame(ctx, true, ctx->rx_queue_index);
+}
+
+static inline __u32 pipeline_stage_for(void *data, void *data_end) {
     struct ethhdr *eth = data;
-    int header_result = process_packet_headers(data, data_end, eth, config, stats);
+    l2_headers hdrs;
+    if ((void *)(eth + 1) > data_end || !parse_l2_headers(eth, data_end, &hdrs)) {
+        return PIPELINE_STAGE_L2;
+    }
+    
+    switch (hdrs.l3_proto) {
+    case ETH_P_ARP:
+        return PIPELINE_STAGE_ARP;
+    case ETH_P_IP:
+        return PIPELINE_STAGE_IPV4;
+    case ETH_P_IPV6:
+        return PIPELINE_STAGE_IPV6;
+    default:
+        return PIPELINE_STAGE_L2;
+    }
+}
+
+/*
+ * Pipeline entry point: the per-frame work every protocol shares, then a
+ * tail call into the stage for the frame's network protocol. Returns only
+ * when the stage slot is empty.
+ */
+SEC("xdp.frags")
+int xdp_anonymize_pipeline(struct xdp_md *ctx) {
+    frame_state frame;
+    int action = open_frame(ctx, false, ctx->rx_queue_index, &frame);
+    if (action != 0) {
+        record_latency(&frame, LATENCY_CLASS_ERROR);
+        return action;
+    }
+    
+    struct ethhdr *eth = frame.data;
+    int header_result = process_packet_headers(frame.data, frame.data_end, eth, frame.config,
+                                               frame.stats);
     if (header_result != 0) {
+        record_latency(&frame, LATENCY_CLASS_OTHER);
         return header_result;
     }
     
-    packet_modifications mods = {0};
-    bool anonymization_success = anonymize_packet(data, data_end - data, config, &mods);
+    __u32 key = 0;
+    pipeline_frame *handoff = bpf_map_lookup_elem(&pipeline_frame_map, &key);
+    if (!handoff) {
+        frame.stats->errors++;
+        record_latency(&frame, LATENCY_CLASS_ERROR);
+        return XDP_DROP;
+    }
+    event_state *sample = NULL;
+    if (frame.config->event_sample_rate) {
+        sample = sample_frame(frame.data, frame.data_end, frame.config, frame.stats);
+    }
+    handoff->start_ns = frame.start_ns;
+    handoff->generation = frame.generation;
+    handoff->frame_length = frame.frame_length;
+    handoff->windowed = frame.window != NULL;
+    handoff->sampled = sample != NULL;
     
-    if (anonymization_success) {
-        stats->packets_anonymized++;
-        update_anonymization_stats(&mods, stats);
-    } else {
-        stats->errors++;
+    __u32 stage = pipeline_stage_for(frame.data, frame.data_end);
+    pipeline_stage_stats *stage_stats = bpf_map_lookup_elem(&pipeline_stats_map, &stage);
+    if (stage_stats) {
+        stage_stats->packets++;
     }
+    bpf_tail_call(ctx, &pipeline_map, stage);
     
+    if (stage_stats) {
+        stage_stats->missed++;
+    }
+    frame.stats->errors++;
+    if (frame.config->error_events) {
+        report_error(ctx, frame.data, frame.data_end, sample, ANON_ERROR_NO_STAGE, frame.config,
+                     frame.generation, frame.frame_length, frame.stats);
+    }
+    record_latency(&frame, LATENCY_CLASS_ERROR);
     return XDP_DROP;
 }
 
+/* Picks up the frame where xdp_anonymize_pipeline left it, under the same config generation. */
+static __always_inline int run_pipeline_stage(struct xdp_md *ctx, __u32 stage, __u16 stage_proto) {
+    __u32 key = 0;
+    pipeline_frame *handoff = bpf_map_lookup_elem(&pipeline_frame_map, &key);
+    pipeline_stage_stats *stage_stats = bpf_map_lookup_elem(&pipeline_stats_map, &stage);
+    if (!handoff || !stage_stats) {
+        return XDP_DROP;
+    }
+    
+    frame_state frame = {
+        .data = (void *)(long)ctx->data,
+        .data_end = (void *)(long)ctx->data_end,
+        .start_ns = handoff->start_ns,
+        .generation = handoff->generation,
+        .frame_length = handoff->frame_length
+    };
+    __u32 generation_slot = frame.generation % CONFIG_SLOT_COUNT;
+    frame.config = bpf_map_lookup_elem(&config_map, &generation_slot);
+    frame.stats = lookup_queue_stats(ctx->rx_queue_index);
+    if (!frame.config || !frame.stats) {
+        record_latency(&frame, LATENCY_CLASS_ERROR);
+        return XDP_DROP;
+    }
+    
+    if (handoff->windowed) {
+        frame.window = bpf_map_lookup_elem(&frag_window_map, &key);
+        frame.window_length = frame.window ? frame.window->length : 0;
+        if (frame.window_length < sizeof(struct ethhdr) ||
+            frame.window_length > FRAG_HEADER_WINDOW) {
+            frame.stats->errors++;
+            stage_stats->errors++;
+            record_latency(&frame, LATENCY_CLASS_ERROR);
+            return XDP_DROP;
+        }
+        frame.data = frame.window->bytes;
+        frame.data_end = frame.window->bytes + frame.window_length;
+    }
+    event_state *sample = handoff->sampled ? bpf_map_lookup_elem(&event_state_map, &key) : NULL;
+    return finish_frame(ctx, &frame, sample, stage_proto, stage_stats);
+}
+
+SEC("xdp.frags")
+int xdp_stage_l2(struct xdp_md *ctx) {
+    return run_pipeline_stage(ctx, PIPELINE_STAGE_L2, STAGE_PROTO_OTHER);
+}
+
+SEC("xdp.frags")
+int xdp_stage_arp(struct xdp_md *ctx) {
+    return run_pipeline_stage(ctx, PIPELINE_STAGE_ARP, ETH_P_ARP);
+}
+
+SEC("xdp.frags")
+int xdp_stage_ipv4(struct xdp_md *ctx) {
+    return run_pipeline_stage(ctx, PIPELINE_STAGE_IPV4, ETH_P_IP);
+}
+
+SEC("xdp.frags")
+int xdp_stage_ipv6(struct xdp_md *ctx) {
+    return run_pipeline_stage(ctx, PIPELINE_STAGE_IPV6, ETH_P_IPV6);
+}
+
+/* Symmetric, so both directions of a flow land on the same worker and its flow entry. */
+static inline __u32 cpumap_flow_hash(void *data, void *data_end) {
+    struct ethhdr *eth = data;
+    l2_headers hdrs;
+    if ((void *)(eth + 1) > data_end || !parse_l2_headers(eth, data_end, &hdrs)) {
+        return 0;
+    }
+    
+    flow_tuple tuple;
+    read_flow_tuple(&hdrs, data_end, &tuple);
+    if (!tuple.family) {
+        __u32 src, dst;
+        __builtin_memcpy(&src, eth->h_source + 2, sizeof(src));
+        __builtin_memcpy(&dst, eth->h_dest + 2, sizeof(dst));
+        return mix32(src ^ dst);
+    }
+    
+    __u32 hash = tuple.protocol ^ ((__u32)(tuple.sport ^ tuple.dport) << 8);
+#pragma unroll
+    for (__u32 i = 0; i < 4; i++) {
+        hash = mix32(hash ^ tuple.saddr[i] ^ tuple.daddr[i]);
+    }
+    return hash;
+}
+
+/* Written in front of the frame by the dispatcher; the worker stage always sees RX queue 0. */
+typedef struct {
+    __u32 rx_queue;
+} cpumap_meta;
+
+/* First stage on the RX queue: pick a worker CPU and hand the frame over untouched. */
+SEC("xdp.frags")
+int xdp_cpumap_dispatch(struct xdp_md *ctx) {
+    __u32 key = 0;
+    cpumap_dispatch *dispatch = bpf_map_lookup_elem(&cpumap_dispatch_map, &key);
+    if (!dispatch || !dispatch->worker_count) {
+        return XDP_DROP;
+    }
+    
+    __u32 hash = cpumap_flow_hash((void *)(long)ctx->data, (void *)(long)ctx->data_end);
+    __u32 worker = hash % dispatch->worker_count;
+    if (worker >= CPUMAP_MAX_WORKERS) {
+        return XDP_DROP;
+    }
+    __u32 cpu = dispatch->cpus[worker];
+    
+    /* Drivers without metadata support refuse the headroom; those frames count as queue 0. */
+    if (bpf_xdp_adjust_meta(ctx, -(int)sizeof(cpumap_meta)) == 0) {
+        cpumap_meta *meta = (void *)(long)ctx->data_meta;
+        if ((void *)(meta + 1) <= (void *)(long)ctx->data) {
+            meta->rx_queue = ctx->rx_queue_index;
+        }
+    }
+    
+    int action = bpf_redirect_map(&cpumap_map, cpu, XDP_DROP);
+    if (action != XDP_REDIRECT) {
+        cpumap_worker_stats *stats = bpf_map_lookup_elem(&cpumap_stats_map, &cpu);
+        if (stats) {
+            __sync_fetch_and_add(&stats->redirect_errors, 1);
+        }
+    }
+    return action;
+}
+
+/* Second stage, run by the cpumap kthread of each worker CPU. */
+SEC("xdp.frags/cpumap")
+int xdp_anonymize_cpumap(struct xdp_md *ctx) {
+    cpumap_meta *meta = (void *)(long)ctx->data_meta;
+    __u32 rx_queue = 0;
+    if ((void *)(meta + 1) <= (void *)(long)ctx->data) {
+        rx_queue = meta->rx_queue;
+    }
+    return anonymize_frame(ctx, false, rx_queue);
+}
+
+/* Layout of events/xdp/xdp_cpumap_enqueue/format after the common fields. */
+struct cpumap_enqueue_args {
+    __u64 common;
+    int map_id;
+    __u32 act;
+    int cpu;
+    unsigned int drops;
+    unsigned int processed;
+    int to_cpu;
+};
+
+/* Fires once per bulk flush into a worker's queue; drops are frames the full queue refused. */
+SEC("tracepoint/xdp/xdp_cpumap_enqueue")
+int trace_cpumap_enqueue(struct cpumap_enqueue_args *args) {
+    __u32 key = 0;
+    cpumap_dispatch *dispatch = bpf_map_lookup_elem(&cpumap_dispatch_map, &key);
+    if (!dispatch || args->map_id != (int)dispatch->map_id) {
+        return 0;
+    }
+    
+    __u32 cpu = args->to_cpu;
+    cpumap_worker_stats *stats = bpf_map_lookup_elem(&cpumap_stats_map, &cpu);
+    if (stats) {
+        __sync_fetch_and_add(&stats->enqueued, args->processed - args->drops);
+        __sync_fetch_and_add(&stats->queue_drops, args->drops);
+    }
+    return 0;
+}
+
 char _license[] SEC("license") = "GPL";
@@ -1,31 +1,157 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 #include <net/if.h>
 #include <linux/if_link.h>
 #include "common_structs.h"
+#include "config_parser.h"
+#include "event_log.h"
+#include "flow_export.h"
+#include "mapping_vault.h"
+#include "metrics_server.h"
+#include "prog_kern.skel.h"
+#include "rewrite_helpers.h"
+#include "specialization.h"
+#include "xsk_consumer.h"
+
+#define STATS_INTERVAL_SECONDS 5
+#define EVENT_POLL_MAX_MS 1000
+#define POLICY_TOP_RULES 10
+#define MAP_COUNT_BATCH 256
+#define CPUMAP_DISPATCH_PROG_NAME "xdp_cpumap_dispatch"
+#define CPUMAP_WORKER_PROG_NAME "xdp_anonymize_cpumap"
+#define CPUMAP_TRACE_PROG_NAME "trace_cpumap_enqueue"
+#define PIPELINE_PROG_NAME "xdp_anonymize_pipeline"
+#define STAGE_PROG_NAME_LENGTH 32
+#define PIN_LINK_NAME "link"
+#define PIN_PIPELINE_MAP_NAME "pipeline_map"
+
+/* One statistics refresh, shared by the periodic report and the metrics page. */
+typedef struct {
+    anonymization_stats totals;
+    anonymization_stats previous;
+    anonymization_stats *cpu_totals;
+    anonymization_stats queue_totals[MAX_RX_QUEUES];
+    double seconds;
+    struct timespec timestamp;
+    metrics_map_gauge maps[METRICS_MAX_MAPS];
+    __u32 map_count;
+    __u64 cache_resident;
+    cpumap_worker_stats cpumap[CPUMAP_MAX_WORKERS];
+    pipeline_stage_stats pipeline[PIPELINE_STAGE_COUNT];
+    latency_histogram latency[LATENCY_CLASS_COUNT];
+    latency_histogram latency_previous[LATENCY_CLASS_COUNT];
+    bool valid;
+} stats_snapshot;
 
+/*
+ * One anonymized interface. Each gets its own copy of the embedded prog_kern
+ * object, so its maps, config slots and specialized program follow only its
+ * own profile.
+ */
 typedef struct {
+    struct prog_kern *skel;
+    struct bpf_object *obj;
+    int config_generation_map_fd;
     int config_map_fd;
     int stats_map_fd;
+    int output_map_fd;
+    int xsks_map_fd;
+    int pp_table_map_fd;
+    int mac_cache_map_fd;
+    int ipv4_cache_map_fd;
+    int flow_table_map_fd;
+    int policy_ipv4_map_fd;
+    int policy_ipv6_map_fd;
+    int policy_hits_map_fd;
+    int events_map_fd;
+    int vault_ring_map_fd;
+    int cpumap_map_fd;
+    int cpumap_stats_map_fd;
+    int cpumap_dispatch_map_fd;
+    int pipeline_map_fd;
+    int pipeline_stats_map_fd;
+    int latency_map_fd;
     int prog_fd;
+    int specialized_prog_fd;
+    int dispatch_prog_fd;
+    int cpumap_prog_fd;
+    struct bpf_link *cpumap_trace;
+    cpumap_settings active_cpumap;
+    int pipeline_prog_fd;
+    int stage_prog_fds[PIPELINE_STAGE_COUNT];
+    struct bpf_object *stage_objects[PIPELINE_STAGE_COUNT];
+    char active_stages[PIPELINE_STAGE_COUNT][MAX_PROFILE_PATH_LENGTH];
+    int attached_prog_fd;
     int xdp_link_fd;
-    char *interface_name;
+    bool link_pinned;
+    char pin_dir[MAX_PROFILE_PATH_LENGTH];
+    char pin_path[PATH_MAX];
+    int ifindex;
+    char interface_name[MAX_INTERFACE_NAME_LENGTH];
+    xsk_consumer *xsk;
+    flow_exporter *flow_exporter;
+    flow_export_settings active_flow_export;
+    struct timespec next_flow_sweep;
+    flow_sweep_stats flow_sweep;
+    __u64 flows_expired;
+    event_log *event_log;
+    event_settings active_events;
+    __u64 error_events[ANON_ERROR_COUNT];
+    __u64 sample_events;
+    mapping_vault *vault;
+    __u64 vault_new;
+    __u64 vault_known;
+    __u64 vault_collisions;
+    __u64 vault_failed;
+    char config_path[MAX_PROFILE_PATH_LENGTH];
+    char config_basename[NAME_MAX + 1];
+    int watch_descriptor;
+    anonymization_config active_config;
+    policy_set active_policy;
+    xsk_settings active_xsk;
+    __u32 generation;
+    __u64 salt_epoch;
+    struct timespec last_publish;
+    bool reload_requested;
+    stats_snapshot stats;
+} interface_instance;
+
+typedef struct {
+    interface_instance instances[MAX_INTERFACES];
+    __u32 instance_count;
+    int num_cpus;
+    int inotify_fd;
+    int epoll_fd;
+    struct ring_buffer *events;
+    metrics_server *metrics;
+    volatile bool reload_requested;
     volatile bool running;
 } application_state;
 
 static application_state app_state = {
-    .config_map_fd = -1,
-    .stats_map_fd = -1,
-    .prog_fd = -1,
-    .xdp_link_fd = -1,
-    .interface_name = NULL,
+    .instance_count = 0,
+    .num_cpus = 0,
+    .inotify_fd = -1,
+    .epoll_fd = -1,
+    .events = NULL,
+    .metrics = NULL,
+    .reload_requested = false,
     .running = true
 };
 
@@ -34,150 +160,593 @@ static void handle_signal(int sig) {
     app_state.running = false;
 }
 
-static anonymization_config create_default_config(void) {
-    return (anonymization_config){
-        .anonymize_multicast_broadcast = false,
-        .anonymize_srcmac_oui = true,
-        .anonymize_srcmac_id = false,
-        .anonymize_dstmac_oui = false,
-        .anonymize_dstmac_id = true,
-        .preserve_prefix = true,
-        .anonymize_mac_in_arphdr = true,
-        .anonymize_ipv4_in_arphdr = true,
-        .src_ip_mask_lengths = 0xFFFFFF00,
-        .dest_ip_mask_lengths = 0xFFFFFF00,
-        .random_salt = DEFAULT_SALT
+static void handle_reload_signal(int sig) {
+    (void)sig;
+    app_state.reload_requested = true;
+}
+
+static int size_lru_maps(struct bpf_object *obj, const anonymization_config *config) {
+    const struct {
+        const char *name;
+        __u32 entries;
+    } lru_maps[] = {
+        { "mac_cache_map", config->mapping_cache_size },
+        { "ipv4_cache_map", config->mapping_cache_size },
+        { "flow_table_map", config->flow_table_size }
     };
+    
+    for (size_t i = 0; i < sizeof(lru_maps) / sizeof(lru_maps[0]); i++) {
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, lru_maps[i].name);
+        if (!map || bpf_map__set_max_entries(map, lru_maps[i].entries)) {
+            fprintf(stderr, "LRU map %s sizing failed\n", lru_maps[i].name);
+            return -1;
+        }
+    }
+    return 0;
 }
 
-static void trim_whitespace(char *str) {
-    while (*str == ' ') str++;
-    char *end = str + strlen(str) - 1;
-    while (end > str && (*end == ' ' || *end == '\n' || *end == '\r')) {
-        *end = '\0';
-        end--;
+/* Leaves the two-stage programs out of the load unless cpumap_cpus is set. */
+static int prepare_cpumap_programs(struct bpf_object *obj, const cpumap_settings *cpumap) {
+    const char *programs[] = {
+        CPUMAP_DISPATCH_PROG_NAME, CPUMAP_WORKER_PROG_NAME, CPUMAP_TRACE_PROG_NAME
+    };
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        struct bpf_program *prog = bpf_object__find_program_by_name(obj, programs[i]);
+        if (!prog) {
+            fprintf(stderr, "BPF program %s not found\n", programs[i]);
+            return -1;
+        }
+        bpf_program__set_autoload(prog, cpumap->worker_count > 0);
+    }
+    
+    const char *cpu_maps[] = { "cpumap_map", "cpumap_stats_map" };
+    for (size_t i = 0; i < sizeof(cpu_maps) / sizeof(cpu_maps[0]); i++) {
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, cpu_maps[i]);
+        if (!map || bpf_map__set_max_entries(map, app_state.num_cpus)) {
+            fprintf(stderr, "CPU map %s sizing failed\n", cpu_maps[i]);
+            return -1;
+        }
+    }
+    for (__u32 i = 0; i < cpumap->worker_count; i++) {
+        if (cpumap->cpus[i] >= (__u32)app_state.num_cpus) {
+            fprintf(stderr, "cpumap_cpus: CPU %u does not exist\n", cpumap->cpus[i]);
+            return -1;
+        }
     }
+    return 0;
 }
 
-static bool parse_boolean_value(const char *value) {
-    return strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+static void stage_program_name(__u32 stage, char *name, size_t size) {
+    snprintf(name, size, "xdp_stage_%s", pipeline_stage_name(stage));
+}
+
+/* Leaves the pipeline entry point and built-in stages out of the load unless pipeline is set. */
+static int prepare_pipeline_programs(struct bpf_object *obj, bool pipeline) {
+    char name[STAGE_PROG_NAME_LENGTH];
+    for (__u32 stage = 0; stage <= PIPELINE_STAGE_COUNT; stage++) {
+        if (stage < PIPELINE_STAGE_COUNT) {
+            stage_program_name(stage, name, sizeof(name));
+        } else {
+            snprintf(name, sizeof(name), "%s", PIPELINE_PROG_NAME);
+        }
+        struct bpf_program *prog = bpf_object__find_program_by_name(obj, name);
+        if (!prog) {
+            fprintf(stderr, "BPF program %s not found\n", name);
+            return -1;
+        }
+        bpf_program__set_autoload(prog, pipeline);
+    }
+    return 0;
 }
 
-static void apply_config_option(anonymization_config *config, const char *key, const char *value) {
-    if (strcmp(key, "anonymize_srcmac_oui") == 0) {
-        config->anonymize_srcmac_oui = parse_boolean_value(value);
-    } else if (strcmp(key, "anonymize_srcmac_id") == 0) {
-        config->anonymize_srcmac_id = parse_boolean_value(value);
-    } else if (strcmp(key, "anonymize_dstmac_oui") == 0) {
-        config->anonymize_dstmac_oui = parse_boolean_value(value);
-    } else if (strcmp(key, "anonymize_dstmac_id") == 0) {
-        config->anonymize_dstmac_id = parse_boolean_value(value);
-    } else if (strcmp(key, "preserve_prefix") == 0) {
-        config->preserve_prefix = parse_boolean_value(value);
-    } else if (strcmp(key, "anonymize_multicast_broadcast") == 0) {
-        config->anonymize_multicast_broadcast = parse_boolean_value(value);
-    } else if (strcmp(key, "anonymize_mac_in_arphdr") == 0) {
-        config->anonymize_mac_in_arphdr = parse_boolean_value(value);
-    } else if (strcmp(key, "anonymize_ipv4_in_arphdr") == 0) {
-        config->anonymize_ipv4_in_arphdr = parse_boolean_value(value);
-    } else if (strcmp(key, "random_salt") == 0) {
-        config->random_salt = (__u32)strtoul(value, NULL, 0);
+/* Fills every pipeline_map slot with the built-in stage from the daemon's own object. */
+static int setup_pipeline(interface_instance *inst) {
+    char name[STAGE_PROG_NAME_LENGTH];
+    inst->pipeline_prog_fd = bpf_program__fd(bpf_object__find_program_by_name(inst->obj,
+                                             PIPELINE_PROG_NAME));
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        stage_program_name(stage, name, sizeof(name));
+        inst->stage_prog_fds[stage] = bpf_program__fd(bpf_object__find_program_by_name(inst->obj,
+                                                      name));
+        if (inst->stage_prog_fds[stage] < 0 ||
+            bpf_map_update_elem(inst->pipeline_map_fd, &stage, &inst->stage_prog_fds[stage],
+                                BPF_ANY)) {
+            fprintf(stderr, "Pipeline stage %s setup failed: %s\n", pipeline_stage_name(stage),
+                    strerror(errno));
+            return -1;
+        }
+    }
+    if (inst->pipeline_prog_fd < 0) {
+        fprintf(stderr, "XDP program %s not found\n", PIPELINE_PROG_NAME);
+        return -1;
     }
+    inst->attached_prog_fd = inst->pipeline_prog_fd;
+    return 0;
 }
 
-static config_parse_result parse_config_file(const char *filename) {
-    config_parse_result result = {0};
-    result.success = false;
+/*
+ * Loads xdp_stage_<name> from another build of prog_kern.o. Every map
+ * whose name matches one of the instance's maps is shared with it, so
+ * the stage reads the same config slots, handoff state and counters.
+ */
+static struct bpf_object *load_stage_object(const interface_instance *inst, __u32 stage,
+                                            const char *path, int *prog_fd) {
+    char name[STAGE_PROG_NAME_LENGTH];
+    stage_program_name(stage, name, sizeof(name));
     
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        snprintf(result.error_message, sizeof(result.error_message), 
-                "Config file open failed: %s", strerror(errno));
-        return result;
+    struct bpf_object *obj = bpf_object__open_file(path, NULL);
+    if (libbpf_get_error(obj)) {
+        fprintf(stderr, "Pipeline stage object open failed for %s\n", path);
+        return NULL;
     }
     
-    result.config = create_default_config();
+    struct bpf_program *stage_prog = NULL;
+    struct bpf_program *prog;
+    bpf_object__for_each_program(prog, obj) {
+        bool wanted = strcmp(bpf_program__name(prog), name) == 0;
+        bpf_program__set_autoload(prog, wanted);
+        if (wanted) {
+            stage_prog = prog;
+        }
+    }
+    if (!stage_prog) {
+        fprintf(stderr, "%s has no program %s\n", path, name);
+        bpf_object__close(obj);
+        return NULL;
+    }
     
-    char line[MAX_CONFIG_LINE_LENGTH];
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] == '#' || line[0] == '\n') {
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj) {
+        if (bpf_map__is_internal(map)) {
             continue;
         }
-        
-        char *key = strtok(line, ":");
-        char *value = strtok(NULL, ":");
-        
-        if (!key || !value) {
+        int fd = bpf_object__find_map_fd_by_name(inst->obj, bpf_map__name(map));
+        if (fd >= 0 && bpf_map__reuse_fd(map, fd)) {
+            fprintf(stderr, "Pipeline stage map %s sharing failed\n", bpf_map__name(map));
+            bpf_object__close(obj);
+            return NULL;
+        }
+    }
+    
+    int err = bpf_object__load(obj);
+    if (err) {
+        fprintf(stderr, "Pipeline stage object load failed for %s: %s\n", path, strerror(-err));
+        bpf_object__close(obj);
+        return NULL;
+    }
+    *prog_fd = bpf_program__fd(stage_prog);
+    return obj;
+}
+
+/*
+ * Points each pipeline_map slot at its configured stage: a stage object
+ * from pipeline_stage_<name>, or the built-in program when unset. The slot
+ * update is atomic, so frames switch stages without a reattach. Slots
+ * whose setting did not change are left alone.
+ */
+static int update_pipeline_stages(interface_instance *inst,
+                                  char stages[PIPELINE_STAGE_COUNT][MAX_PROFILE_PATH_LENGTH]) {
+    if (inst->pipeline_prog_fd < 0) {
+        return 0;
+    }
+    
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        if (strcmp(stages[stage], inst->active_stages[stage]) == 0) {
             continue;
         }
         
-        trim_whitespace(key);
-        trim_whitespace(value);
+        struct bpf_object *obj = NULL;
+        int prog_fd = inst->stage_prog_fds[stage];
+        if (stages[stage][0]) {
+            obj = load_stage_object(inst, stage, stages[stage], &prog_fd);
+            if (!obj) {
+                return -1;
+            }
+        }
+        if (bpf_map_update_elem(inst->pipeline_map_fd, &stage, &prog_fd, BPF_ANY)) {
+            fprintf(stderr, "Pipeline stage %s swap failed: %s\n", pipeline_stage_name(stage),
+                    strerror(errno));
+            bpf_object__close(obj);
+            return -1;
+        }
         
-        apply_config_option(&result.config, key, value);
+        /* The slot no longer refers to the old program, so its object can go. */
+        bpf_object__close(inst->stage_objects[stage]);
+        inst->stage_objects[stage] = obj;
+        snprintf(inst->active_stages[stage], sizeof(inst->active_stages[stage]), "%s",
+                 stages[stage]);
+        printf("Pipeline stage %s on %s: %s\n", pipeline_stage_name(stage), inst->interface_name,
+               obj ? stages[stage] : "built-in");
+    }
+    return 0;
+}
+
+/*
+ * Gives each worker CPU a queue running xdp_anonymize_cpumap, then
+ * publishes the worker list to the dispatcher along with the cpumap id
+ * the enqueue tracepoint filters on.
+ */
+static int setup_cpumap_workers(interface_instance *inst, const cpumap_settings *cpumap) {
+    struct bpf_cpumap_val value = {
+        .qsize = cpumap->queue_size,
+        .bpf_prog.fd = inst->cpumap_prog_fd
+    };
+    for (__u32 i = 0; i < cpumap->worker_count; i++) {
+        __u32 cpu = cpumap->cpus[i];
+        if (bpf_map_update_elem(inst->cpumap_map_fd, &cpu, &value, BPF_ANY)) {
+            fprintf(stderr, "CPUMAP worker setup failed for CPU %u: %s\n", cpu, strerror(errno));
+            return -1;
+        }
+    }
+    
+    struct bpf_map_info info = {0};
+    __u32 info_length = sizeof(info);
+    if (bpf_obj_get_info_by_fd(inst->cpumap_map_fd, &info, &info_length)) {
+        fprintf(stderr, "CPUMAP info query failed: %s\n", strerror(errno));
+        return -1;
+    }
+    cpumap_dispatch dispatch = { .map_id = info.id, .worker_count = cpumap->worker_count };
+    memcpy(dispatch.cpus, cpumap->cpus, sizeof(dispatch.cpus));
+    __u32 key = 0;
+    if (bpf_map_update_elem(inst->cpumap_dispatch_map_fd, &key, &dispatch, BPF_ANY)) {
+        fprintf(stderr, "CPUMAP dispatch update failed: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    struct bpf_program *trace = bpf_object__find_program_by_name(inst->obj, CPUMAP_TRACE_PROG_NAME);
+    inst->cpumap_trace = trace ? bpf_program__attach(trace) : NULL;
+    if (libbpf_get_error(inst->cpumap_trace)) {
+        fprintf(stderr, "xdp_cpumap_enqueue tracepoint attach failed, queue drops are not counted\n");
+        inst->cpumap_trace = NULL;
     }
     
-    fclose(file);
-    result.success = true;
-    return result;
+    inst->active_cpumap = *cpumap;
+    printf("Spreading %s over %u worker CPUs (queue size %u)\n", inst->interface_name,
+           cpumap->worker_count, cpumap->queue_size);
+    return 0;
 }
 
-static int load_bpf_program(void) {
-    struct bpf_object *obj = bpf_object__open_file("prog_kern.o", NULL);
-    if (libbpf_get_error(obj)) {
-        fprintf(stderr, "BPF object file open failed\n");
+/*
+ * Maps that outlive the daemon when bpf_pin_dir is set: the counters,
+ * the caches and flow table, and the generation their entries are tagged
+ * with. Config slots and everything else belong to one load.
+ */
+static const char *const pinned_map_names[] = {
+    "config_generation_map",
+    "stats_map",
+    "mac_cache_map",
+    "ipv4_cache_map",
+    "flow_table_map",
+    "cpumap_stats_map",
+    "pipeline_stats_map",
+    "latency_map"
+};
+
+static int make_pin_path(char *path, size_t size, const char *dir, const char *name) {
+    if ((size_t)snprintf(path, size, "%s/%s", dir, name) >= size) {
+        fprintf(stderr, "Pin path too long: %s/%s\n", dir, name);
+        return -1;
+    }
+    return 0;
+}
+
+static int create_pin_dir(const char *path) {
+    if (mkdir(path, 0700) && errno != EEXIST) {
+        fprintf(stderr, "Pin directory %s creation failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* True when nothing is pinned at path, or the pinned map has the same definition. */
+static bool pinned_map_matches(const struct bpf_map *map, const char *path) {
+    int fd = bpf_obj_get(path);
+    if (fd < 0) {
+        return true;
+    }
+    
+    struct bpf_map_info info = {0};
+    __u32 info_length = sizeof(info);
+    int err = bpf_obj_get_info_by_fd(fd, &info, &info_length);
+    close(fd);
+    return !err && info.type == bpf_map__type(map) && info.key_size == bpf_map__key_size(map) &&
+           info.value_size == bpf_map__value_size(map) &&
+           info.max_entries == bpf_map__max_entries(map) &&
+           info.map_flags == bpf_map__map_flags(map);
+}
+
+/*
+ * Points the state maps at <bpf_pin_dir>/<interface>/<map>. libbpf reuses
+ * a pinned map and pins a new one when there is none. A pin from a build
+ * or size that no longer matches would fail the load, so it is removed
+ * and that map starts empty.
+ */
+static int pin_state_maps(interface_instance *inst, struct bpf_object *obj, const char *pin_dir) {
+    if (create_pin_dir(pin_dir) ||
+        make_pin_path(inst->pin_path, sizeof(inst->pin_path), pin_dir, inst->interface_name) ||
+        create_pin_dir(inst->pin_path)) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < sizeof(pinned_map_names) / sizeof(pinned_map_names[0]); i++) {
+        char path[PATH_MAX];
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, pinned_map_names[i]);
+        if (!map || make_pin_path(path, sizeof(path), inst->pin_path, pinned_map_names[i])) {
+            return -1;
+        }
+        if (!pinned_map_matches(map, path)) {
+            printf("Pinned %s no longer matches, starting it empty\n", path);
+            unlink(path);
+        }
+        if (bpf_map__set_pin_path(map, path)) {
+            fprintf(stderr, "Pin path setup failed for %s\n", path);
+            return -1;
+        }
+    }
+    snprintf(inst->pin_dir, sizeof(inst->pin_dir), "%s", pin_dir);
+    return 0;
+}
+
+/*
+ * Continues from the generation the pinned caches were last written
+ * under, so their entries are never taken for ones of the new config.
+ */
+static int read_pinned_generation(interface_instance *inst) {
+    char path[PATH_MAX];
+    if (make_pin_path(path, sizeof(path), inst->pin_path, "config_generation_map")) {
+        return -1;
+    }
+    int fd = bpf_obj_get(path);
+    if (fd < 0) {
+        return 0;
+    }
+    
+    __u32 key = 0;
+    int err = bpf_map_lookup_elem(fd, &key, &inst->generation);
+    close(fd);
+    if (err) {
+        fprintf(stderr, "Pinned generation read failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int load_bpf_program(interface_instance *inst, const config_parse_result *parsed) {
+    const anonymization_config *config = &parsed->config;
+    const cpumap_settings *cpumap = &parsed->cpumap;
+    struct prog_kern *skel = prog_kern__open();
+    if (!skel) {
+        fprintf(stderr, "BPF object open failed: %s\n", strerror(errno));
+        return -1;
+    }
+    struct bpf_object *obj = skel->obj;
+    
+    if (size_lru_maps(obj, config)) {
+        prog_kern__destroy(skel);
+        return -1;
+    }
+    struct bpf_map *events_map = bpf_object__find_map_by_name(obj, "events_map");
+    if (!events_map || bpf_map__set_max_entries(events_map, parsed->events.ring_size)) {
+        fprintf(stderr, "Event ring buffer sizing failed\n");
+        prog_kern__destroy(skel);
+        return -1;
+    }
+    if (prepare_cpumap_programs(obj, cpumap) || prepare_pipeline_programs(obj, config->pipeline)) {
+        prog_kern__destroy(skel);
+        return -1;
+    }
+    /* Map sizes are final here, so pinned maps are compared against what will load. */
+    if (parsed->pin_dir[0] &&
+        (pin_state_maps(inst, obj, parsed->pin_dir) || read_pinned_generation(inst))) {
+        prog_kern__destroy(skel);
         return -1;
     }
     
+    /* A rotating salt changes the config at runtime, which only the generic program follows. */
+    bool specialize = config->specialize && !config->salt_rotation_interval &&
+                      !cpumap->worker_count && !config->pipeline;
+    if (config->specialize && config->salt_rotation_interval) {
+        printf("salt_rotation_interval set, using the generic XDP program\n");
+    } else if (config->specialize && cpumap->worker_count) {
+        printf("cpumap_cpus set, workers run the generic XDP program\n");
+    } else if (config->specialize && config->pipeline) {
+        printf("pipeline set, stages read the config from the config map\n");
+    }
+    /* The skeleton maps .rodata, so the variable is written where the loader reads it. */
+    config_specialization *values = (config_specialization *)&skel->rodata->specialization;
+    if (specialize_bpf_object(obj, values, config, inst->generation + 1, specialize)) {
+        specialize = false;
+    }
+    
     int err = bpf_object__load(obj);
     if (err) {
         fprintf(stderr, "BPF object load failed: %s\n", strerror(-err));
-        bpf_object__close(obj);
+        prog_kern__destroy(skel);
         return err;
     }
     
-    struct bpf_program *prog = bpf_object__find_program_by_name(obj, "xdp_anonymize_prog");
+    struct bpf_program *prog = bpf_object__find_program_by_name(obj, GENERIC_PROG_NAME);
     if (!prog) {
         fprintf(stderr, "XDP program not found\n");
-        bpf_object__close(obj);
+        prog_kern__destroy(skel);
         return -1;
     }
     
-    app_state.prog_fd = bpf_program__fd(prog);
-    app_state.config_map_fd = bpf_object__find_map_fd_by_name(obj, "config_map");
-    app_state.stats_map_fd = bpf_object__find_map_fd_by_name(obj, "stats_map");
+    inst->prog_fd = bpf_program__fd(prog);
+    inst->attached_prog_fd = inst->prog_fd;
+    if (specialize) {
+        struct bpf_program *specialized = bpf_object__find_program_by_name(obj, SPECIALIZED_PROG_NAME);
+        inst->specialized_prog_fd = specialized ? bpf_program__fd(specialized) : -1;
+        if (inst->specialized_prog_fd >= 0) {
+            inst->attached_prog_fd = inst->specialized_prog_fd;
+        }
+    }
+    inst->config_generation_map_fd = bpf_object__find_map_fd_by_name(obj, "config_generation_map");
+    inst->config_map_fd = bpf_object__find_map_fd_by_name(obj, "config_map");
+    inst->stats_map_fd = bpf_object__find_map_fd_by_name(obj, "stats_map");
+    inst->output_map_fd = bpf_object__find_map_fd_by_name(obj, "output_devmap");
+    inst->xsks_map_fd = bpf_object__find_map_fd_by_name(obj, "xsks_map");
+    inst->pp_table_map_fd = bpf_object__find_map_fd_by_name(obj, "pp_table_map");
+    inst->mac_cache_map_fd = bpf_object__find_map_fd_by_name(obj, "mac_cache_map");
+    inst->ipv4_cache_map_fd = bpf_object__find_map_fd_by_name(obj, "ipv4_cache_map");
+    inst->flow_table_map_fd = bpf_object__find_map_fd_by_name(obj, "flow_table_map");
+    inst->policy_ipv4_map_fd = bpf_object__find_map_fd_by_name(obj, "policy_ipv4_map");
+    inst->policy_ipv6_map_fd = bpf_object__find_map_fd_by_name(obj, "policy_ipv6_map");
+    inst->policy_hits_map_fd = bpf_object__find_map_fd_by_name(obj, "policy_hits_map");
+    inst->events_map_fd = bpf_object__find_map_fd_by_name(obj, "events_map");
+    inst->vault_ring_map_fd = bpf_object__find_map_fd_by_name(obj, "vault_ring_map");
+    inst->cpumap_map_fd = bpf_object__find_map_fd_by_name(obj, "cpumap_map");
+    inst->cpumap_stats_map_fd = bpf_object__find_map_fd_by_name(obj, "cpumap_stats_map");
+    inst->cpumap_dispatch_map_fd = bpf_object__find_map_fd_by_name(obj, "cpumap_dispatch_map");
+    inst->pipeline_map_fd = bpf_object__find_map_fd_by_name(obj, "pipeline_map");
+    inst->pipeline_stats_map_fd = bpf_object__find_map_fd_by_name(obj, "pipeline_stats_map");
+    inst->latency_map_fd = bpf_object__find_map_fd_by_name(obj, "latency_map");
     
-    if (app_state.config_map_fd < 0 || app_state.stats_map_fd < 0) {
+    if (inst->config_generation_map_fd < 0 ||
+        inst->config_map_fd < 0 || inst->stats_map_fd < 0 ||
+        inst->output_map_fd < 0 || inst->xsks_map_fd < 0 ||
+        inst->pp_table_map_fd < 0 || inst->mac_cache_map_fd < 0 ||
+        inst->ipv4_cache_map_fd < 0 || inst->flow_table_map_fd < 0 ||
+        inst->policy_ipv4_map_fd < 0 || inst->policy_ipv6_map_fd < 0 ||
+        inst->policy_hits_map_fd < 0 || inst->events_map_fd < 0 ||
+        inst->vault_ring_map_fd < 0 || inst->cpumap_map_fd < 0 ||
+        inst->cpumap_stats_map_fd < 0 || inst->cpumap_dispatch_map_fd < 0 ||
+        inst->pipeline_map_fd < 0 || inst->pipeline_stats_map_fd < 0 ||
+        inst->latency_map_fd < 0) {
         fprintf(stderr, "BPF maps not found\n");
-        bpf_object__close(obj);
+        prog_kern__destroy(skel);
+        return -1;
+    }
+    
+    /* The object owns every fd above; keep it open until cleanup. */
+    inst->skel = skel;
+    inst->obj = obj;
+    if (cpumap->worker_count) {
+        inst->dispatch_prog_fd = bpf_program__fd(bpf_object__find_program_by_name(obj,
+                                                 CPUMAP_DISPATCH_PROG_NAME));
+        inst->cpumap_prog_fd = bpf_program__fd(bpf_object__find_program_by_name(obj,
+                                               CPUMAP_WORKER_PROG_NAME));
+        if (setup_cpumap_workers(inst, cpumap)) {
+            return -1;
+        }
+        inst->attached_prog_fd = inst->dispatch_prog_fd;
+    }
+    if (config->pipeline && setup_pipeline(inst)) {
+        return -1;
+    }
+    return 0;
+}
+
+static const char *attached_program_kind(const interface_instance *inst) {
+    return inst->attached_prog_fd == inst->dispatch_prog_fd ? "cpumap dispatch" :
+           inst->attached_prog_fd == inst->pipeline_prog_fd ? "tail-call pipeline" :
+           inst->attached_prog_fd == inst->specialized_prog_fd ? "specialized" : "generic";
+}
+
+/*
+ * A link pinned by an earlier daemon kept its program running while this
+ * one started. Returns 1 with xdp_link_fd set when there is one to adopt;
+ * a pin whose link has lost its interface is removed.
+ */
+static int open_pinned_link(interface_instance *inst) {
+    char path[PATH_MAX];
+    if (!inst->pin_path[0]) {
+        return 0;
+    }
+    if (make_pin_path(path, sizeof(path), inst->pin_path, PIN_LINK_NAME)) {
+        return -1;
+    }
+    int fd = bpf_obj_get(path);
+    if (fd < 0) {
+        return 0;
+    }
+    
+    struct bpf_link_info info = {0};
+    __u32 info_length = sizeof(info);
+    if (bpf_obj_get_info_by_fd(fd, &info, &info_length) || info.type != BPF_LINK_TYPE_XDP ||
+        info.xdp.ifindex != (__u32)inst->ifindex) {
+        printf("Removing stale pinned link %s\n", path);
+        close(fd);
+        unlink(path);
+        return 0;
+    }
+    inst->xdp_link_fd = fd;
+    inst->link_pinned = true;
+    return 1;
+}
+
+/*
+ * Pins the link and the pipeline prog array of the program now attached.
+ * A prog array is emptied once no process or pin holds it, which would
+ * leave a pipeline without stages after the daemon exits. The previous
+ * array is only unpinned here, once its program is no longer attached.
+ */
+static int pin_attached_program(interface_instance *inst) {
+    char path[PATH_MAX];
+    if (make_pin_path(path, sizeof(path), inst->pin_path, PIN_PIPELINE_MAP_NAME)) {
         return -1;
     }
+    unlink(path);
+    if (inst->pipeline_prog_fd >= 0 && bpf_obj_pin(inst->pipeline_map_fd, path)) {
+        fprintf(stderr, "Pipeline map pin failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (inst->link_pinned) {
+        return 0;
+    }
     
-    bpf_object__close(obj);
+    if (make_pin_path(path, sizeof(path), inst->pin_path, PIN_LINK_NAME)) {
+        return -1;
+    }
+    if (bpf_obj_pin(inst->xdp_link_fd, path)) {
+        fprintf(stderr, "XDP link pin failed: %s\n", strerror(errno));
+        return -1;
+    }
+    inst->link_pinned = true;
     return 0;
 }
 
-static int attach_xdp_program(const char *interface) {
-    int ifindex = if_nametoindex(interface);
-    if (ifindex == 0) {
-        fprintf(stderr, "Interface %s not found\n", interface);
+static int attach_xdp_program(interface_instance *inst) {
+    if (inst->xdp_link_fd < 0) {
+        LIBBPF_OPTS(bpf_link_create_opts, opts, .flags = XDP_FLAGS_DRV_MODE);
+        int fd = bpf_link_create(inst->attached_prog_fd, inst->ifindex, BPF_XDP, &opts);
+        if (fd < 0) {
+            fprintf(stderr, "XDP program attach failed: %s\n", strerror(-fd));
+            return -1;
+        }
+        inst->xdp_link_fd = fd;
+        printf("XDP program attached to %s (%s)\n", inst->interface_name,
+               attached_program_kind(inst));
+    }
+    
+    if (inst->pin_path[0] && pin_attached_program(inst)) {
         return -1;
     }
+    return 0;
+}
+
+/* Atomically replaces the specialized program, whose config is frozen, with the map-driven one. */
+static int switch_to_generic_program(interface_instance *inst) {
+    if (inst->attached_prog_fd != inst->specialized_prog_fd) {
+        return 0;
+    }
     
-    int err = bpf_xdp_attach(ifindex, app_state.prog_fd, XDP_FLAGS_DRV_MODE, NULL);
+    LIBBPF_OPTS(bpf_link_update_opts, opts, .flags = BPF_F_REPLACE,
+                .old_prog_fd = inst->attached_prog_fd);
+    int err = bpf_link_update(inst->xdp_link_fd, inst->prog_fd, &opts);
     if (err) {
-        fprintf(stderr, "XDP program attach failed: %s\n", strerror(-err));
+        fprintf(stderr, "Generic XDP program swap failed: %s\n", strerror(-err));
         return err;
     }
     
-    app_state.xdp_link_fd = err;
-    printf("XDP program attached to %s\n", interface);
+    inst->attached_prog_fd = inst->prog_fd;
+    printf("Switched to the generic XDP program for runtime reconfiguration\n");
     return 0;
 }
 
-static int update_bpf_config(const anonymization_config *config) {
-    __u32 key = 0;
-    int err = bpf_map_update_elem(app_state.config_map_fd, &key, config, BPF_ANY);
+static int update_bpf_config(interface_instance *inst, const anonymization_config *config,
+                             __u32 slot) {
+    int err = bpf_map_update_elem(inst->config_map_fd, &slot, config, BPF_ANY);
     if (err) {
         fprintf(stderr, "Config map update failed: %s\n", strerror(-err));
         return err;
@@ -186,95 +755,1521 @@ static int update_bpf_config(const anonymization_config *config) {
     return 0;
 }
 
-static void display_statistics(void) {
-    __u32 key = 0;
-    anonymization_stats stats;
+static int update_prefix_preserving_table(interface_instance *inst,
+                                          const anonymization_config *config, __u32 slot) {
+    if (!config->prefix_preserving) {
+        return 0;
+    }
     
-    int err = bpf_map_lookup_elem(app_state.stats_map_fd, &key, &stats);
-    if (err) {
-        fprintf(stderr, "Statistics retrieval failed: %s\n", strerror(-err));
-        return;
+    prefix_preserving_table *table = malloc(sizeof(*table));
+    if (!table) {
+        fprintf(stderr, "Prefix-preserving table allocation failed\n");
+        return -1;
     }
     
-    printf("\n=== Anonymization Statistics ===\n");
-    printf("Packets processed:     %llu\n", stats.packets_processed);
-    printf("Packets anonymized:    %llu\n", stats.packets_anonymized);
-    printf("MAC addresses anonymized: %llu\n", stats.mac_addresses_anonymized);
-    printf("IP addresses anonymized:  %llu\n", stats.ip_addresses_anonymized);
-    printf("ARP packets anonymized:   %llu\n", stats.arp_packets_anonymized);
-    printf("Errors:               %llu\n", stats.errors);
-    printf("================================\n");
+    fill_prefix_preserving_table(table, config);
+    
+    int err = bpf_map_update_elem(inst->pp_table_map_fd, &slot, table, BPF_ANY);
+    free(table);
+    if (err) {
+        fprintf(stderr, "Prefix-preserving table update failed: %s\n", strerror(errno));
+        return err;
+    }
+    printf("Prefix-preserving table loaded (%u entries)\n", PP_TABLE_SIZE);
+    return 0;
 }
 
-static void cleanup_resources(void) {
-    if (app_state.xdp_link_fd >= 0) {
-        bpf_xdp_detach(app_state.interface_name, XDP_FLAGS_DRV_MODE, NULL);
-        printf("XDP program detached from %s\n", app_state.interface_name);
+/* Deletes one slot's keys from a policy trie; the other slot may still be in use. */
+static int clear_policy_slot(int map_fd, size_t key_size, __u8 slot) {
+    unsigned char *keys = malloc(MAX_POLICY_PREFIXES * key_size);
+    if (!keys) {
+        fprintf(stderr, "Policy key buffer allocation failed\n");
+        return -1;
     }
     
-    if (app_state.config_map_fd >= 0) close(app_state.config_map_fd);
-    if (app_state.stats_map_fd >= 0) close(app_state.stats_map_fd);
-    if (app_state.prog_fd >= 0) close(app_state.prog_fd);
-}
-
-static int setup_resource_limits(void) {
-    struct rlimit rlim = {
-        .rlim_cur = RLIM_INFINITY,
-        .rlim_max = RLIM_INFINITY,
-    };
-    if (setrlimit(RLIMIT_MEMLOCK, &rlim)) {
-        fprintf(stderr, "Resource limit setup failed: %s\n", strerror(errno));
-        return 1;
+    unsigned char key[sizeof(policy_ipv6_key)];
+    void *current = NULL;
+    __u32 count = 0;
+    while (count < MAX_POLICY_PREFIXES && bpf_map_get_next_key(map_fd, current, key) == 0) {
+        if (key[offsetof(policy_ipv4_key, slot)] == slot) {
+            memcpy(keys + count++ * key_size, key, key_size);
+        }
+        current = key;
+    }
+    
+    for (__u32 i = 0; i < count; i++) {
+        bpf_map_delete_elem(map_fd, keys + i * key_size);
     }
+    free(keys);
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <interface> <config_file>\n", argv[0]);
-        fprintf(stderr, "Example: %s eth0 anonymization_config.txt\n", argv[0]);
-        return 1;
+static int insert_policy_prefix(interface_instance *inst, const policy_prefix *prefix, __u8 slot) {
+    if (prefix->family == FLOW_FAMILY_IPV4) {
+        policy_ipv4_key key = { .prefixlen = POLICY_SLOT_BITS + prefix->prefix_len, .slot = slot };
+        memcpy(key.addr, prefix->addr, sizeof(key.addr));
+        return bpf_map_update_elem(inst->policy_ipv4_map_fd, &key, &prefix->rule, BPF_ANY);
     }
     
-    app_state.interface_name = argv[1];
-    const char *config_file = argv[2];
+    policy_ipv6_key key = { .prefixlen = POLICY_SLOT_BITS + prefix->prefix_len, .slot = slot };
+    memcpy(key.addr, prefix->addr, sizeof(key.addr));
+    return bpf_map_update_elem(inst->policy_ipv6_map_fd, &key, &prefix->rule, BPF_ANY);
+}
+
+/*
+ * Replaces the slot's rules and zeroes their hit counters. Identical
+ * prefixes from different rules resolve to the later rule.
+ */
+static int update_policy_maps(interface_instance *inst, const anonymization_config *config,
+                              const policy_set *policy, __u32 slot) {
+    if (clear_policy_slot(inst->policy_ipv4_map_fd, sizeof(policy_ipv4_key), slot) ||
+        clear_policy_slot(inst->policy_ipv6_map_fd, sizeof(policy_ipv6_key), slot)) {
+        return -1;
+    }
+    if (!config->address_policy) {
+        return 0;
+    }
     
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
+    __u64 *zeros = calloc(app_state.num_cpus, sizeof(*zeros));
+    if (!zeros) {
+        fprintf(stderr, "Policy counter buffer allocation failed\n");
+        return -1;
+    }
+    for (__u32 rule = 0; rule < policy->rule_count; rule++) {
+        __u32 index = slot * MAX_POLICY_RULES + rule;
+        bpf_map_update_elem(inst->policy_hits_map_fd, &index, zeros, BPF_ANY);
+    }
+    free(zeros);
     
-    if (setup_resource_limits()) {
-        return 1;
+    for (__u32 i = 0; i < policy->prefix_count; i++) {
+        if (insert_policy_prefix(inst, &policy->prefixes[i], slot)) {
+            fprintf(stderr, "Policy map update failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    printf("Address policy loaded (%u rules, %u prefixes)\n", policy->rule_count,
+           policy->prefix_count);
+    return 0;
+}
+
+static int update_output_port(interface_instance *inst, const anonymization_config *config) {
+    if (config->output_mode != OUTPUT_MODE_REDIRECT) {
+        return 0;
     }
     
-    config_parse_result config_result = parse_config_file(config_file);
-    if (!config_result.success) {
-        fprintf(stderr, "Configuration error: %s\n", config_result.error_message);
-        return 1;
+    __u32 ifindex = config->output_ifindex;
+    int err = bpf_map_update_elem(inst->output_map_fd, &ifindex, &ifindex, BPF_ANY);
+    if (err) {
+        fprintf(stderr, "Output port update failed: %s\n", strerror(errno));
+        return err;
+    }
+    printf("Anonymized frames redirected to ifindex %u\n", ifindex);
+    return 0;
+}
+
+static int start_xsk_consumer(interface_instance *inst, const anonymization_config *config,
+                              const xsk_settings *settings) {
+    if (config->output_mode != OUTPUT_MODE_XSK || inst->xsk) {
+        return 0;
     }
     
-    printf("Configuration loaded\n");
+    inst->xsk = xsk_consumer_start(inst->interface_name, inst->xsks_map_fd, settings);
+    if (!inst->xsk) {
+        fprintf(stderr, "AF_XDP consumer start failed\n");
+        return -1;
+    }
+    inst->active_xsk = *settings;
+    return 0;
+}
+
+/* Reopens the IPFIX exporter only when the target changes; timeouts apply from the next sweep. */
+static int start_flow_exporter(interface_instance *inst, const flow_export_settings *settings) {
+    if (!inst->flow_exporter || strcmp(settings->target, inst->active_flow_export.target) != 0) {
+        flow_exporter *exporter = NULL;
+        if (settings->target[0]) {
+            exporter = flow_exporter_open(settings->target, if_nametoindex(inst->interface_name));
+            if (!exporter) {
+                return -1;
+            }
+        }
+        flow_exporter_close(inst->flow_exporter);
+        inst->flow_exporter = exporter;
+    }
     
-    if (load_bpf_program()) {
-        fprintf(stderr, "BPF program loading failed\n");
-        return 1;
+    inst->active_flow_export = *settings;
+    clock_gettime(CLOCK_MONOTONIC, &inst->next_flow_sweep);
+    inst->next_flow_sweep.tv_sec += settings->interval;
+    return 0;
+}
+
+/* Reopens the event log only when its path changes; the ring size stays as loaded. */
+static int start_event_log(interface_instance *inst, const event_settings *settings) {
+    if (!inst->event_log || strcmp(settings->log_path, inst->active_events.log_path) != 0) {
+        event_log *log = NULL;
+        if (settings->log_path[0]) {
+            log = event_log_open(settings->log_path);
+            if (!log) {
+                return -1;
+            }
+        }
+        event_log_close(inst->event_log);
+        inst->event_log = log;
     }
     
-    if (attach_xdp_program(app_state.interface_name)) {
-        cleanup_resources();
-        return 1;
+    __u32 ring_size = inst->active_events.ring_size;
+    inst->active_events = *settings;
+    if (ring_size) {
+        inst->active_events.ring_size = ring_size;
+    }
+    return 0;
+}
+
+/* Instances naming the same vault file append to one shared mapping. */
+static mapping_vault *find_shared_vault(const char *path) {
+    for (__u32 i = 0; i < app_state.instance_count; i++) {
+        mapping_vault *vault = app_state.instances[i].vault;
+        if (vault && strcmp(mapping_vault_path(vault), path) == 0) {
+            return vault;
+        }
+    }
+    return NULL;
+}
+
+static void release_vault(interface_instance *inst) {
+    mapping_vault *vault = inst->vault;
+    inst->vault = NULL;
+    if (vault && !find_shared_vault(mapping_vault_path(vault))) {
+        mapping_vault_close(vault);
+    }
+}
+
+/* A different vault file has not seen anything yet, so let every pair through again. */
+static void forget_seen_mappings(const interface_instance *inst) {
+    unsigned char *keys = malloc((size_t)VAULT_SEEN_ENTRIES * VAULT_SEEN_KEY_SIZE);
+    if (!keys) {
+        fprintf(stderr, "Vault key buffer allocation failed\n");
+        return;
     }
     
-    if (update_bpf_config(&config_result.config)) {
-        cleanup_resources();
-        return 1;
+    int map_fd = bpf_object__find_map_fd_by_name(inst->obj, "vault_seen_map");
+    unsigned char key[VAULT_SEEN_KEY_SIZE];
+    void *current = NULL;
+    __u32 count = 0;
+    while (count < VAULT_SEEN_ENTRIES && bpf_map_get_next_key(map_fd, current, key) == 0) {
+        memcpy(keys + count++ * VAULT_SEEN_KEY_SIZE, key, VAULT_SEEN_KEY_SIZE);
+        current = key;
+    }
+    for (__u32 i = 0; i < count; i++) {
+        bpf_map_delete_elem(map_fd, keys + i * VAULT_SEEN_KEY_SIZE);
+    }
+    free(keys);
+}
+
+static int start_mapping_vault(interface_instance *inst, const char *path) {
+    if (inst->vault && strcmp(mapping_vault_path(inst->vault), path) == 0) {
+        return 0;
     }
     
-    printf("Anonymization started on %s\n", app_state.interface_name);
-    printf("Press Ctrl+C to stop\n");
+    mapping_vault *vault = NULL;
+    if (path[0]) {
+        vault = find_shared_vault(path);
+        if (!vault) {
+            vault = mapping_vault_open(path, true);
+            if (!vault) {
+                return -1;
+            }
+            printf("Recording address mappings in %s (%llu pairs)\n", path,
+                   (unsigned long long)mapping_vault_count(vault));
+        }
+    }
+    release_vault(inst);
+    inst->vault = vault;
+    if (vault && inst->generation) {
+        forget_seen_mappings(inst);
+    }
+    return 0;
+}
+
+static void sweep_flow_table(interface_instance *inst, bool drain) {
+    flow_sweep_stats sweep;
+    if (flow_table_sweep(inst->flow_table_map_fd, inst->flow_exporter, &inst->active_flow_export,
+                         drain, &sweep) == 0) {
+        inst->flow_sweep = sweep;
+        inst->flows_expired += sweep.expired;
+    }
+}
+
+static void sweep_flow_table_if_due(interface_instance *inst) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < inst->next_flow_sweep.tv_sec ||
+        (now.tv_sec == inst->next_flow_sweep.tv_sec && now.tv_nsec < inst->next_flow_sweep.tv_nsec)) {
+        return;
+    }
     
-    while (app_state.running) {
-        sleep(5);
-        display_statistics();
+    sweep_flow_table(inst, false);
+    inst->next_flow_sweep = now;
+    inst->next_flow_sweep.tv_sec += inst->active_flow_export.interval;
+}
+
+static __u64 current_salt_epoch(__u32 interval) {
+    if (!interval) {
+        return 0;
+    }
+    return (__u64)time(NULL) / interval;
+}
+
+/* Same salt for every packet of an epoch, so restarts inside it reproduce the output. */
+static __u32 derive_epoch_salt(__u32 salt, __u64 epoch) {
+    return mix32(salt ^ mix32((__u32)epoch ^ HASH_MAGIC) ^ mix32((__u32)(epoch >> 32)));
+}
+
+/* SipHash keys rotate the same way: each epoch key is a PRF of the base key. */
+static void derive_epoch_key(const __u64 key[2], __u64 epoch, __u64 epoch_key[2]) {
+    for (__u64 half = 0; half < 2; half++) {
+        __u64 msg[2] = { ((__u64)PRF_DOMAIN_EPOCH << 32) | half, epoch };
+        epoch_key[half] = siphash_2_4(key, msg, 2);
+    }
+}
+
+static void wait_for_slot_grace(const interface_instance *inst) {
+    if (!inst->generation) {
+        return;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long waited_ms = (now.tv_sec - inst->last_publish.tv_sec) * 1000 +
+                     (now.tv_nsec - inst->last_publish.tv_nsec) / 1000000;
+    if (waited_ms < CONFIG_SLOT_GRACE_MS) {
+        usleep((CONFIG_SLOT_GRACE_MS - waited_ms) * 1000);
+    }
+}
+
+/* Writes the config, its prefix-preserving table and policy rules into one slot. */
+static int stage_config(interface_instance *inst, const anonymization_config *config,
+                        const policy_set *policy, __u32 slot, __u64 *epoch) {
+    anonymization_config staged = *config;
+    *epoch = current_salt_epoch(config->salt_rotation_interval);
+    if (config->salt_rotation_interval) {
+        staged.random_salt = derive_epoch_salt(config->random_salt, *epoch);
+        derive_epoch_key(config->hash_key, *epoch, staged.hash_key);
+    }
+    
+    staged.vault_mapping_id = mapping_vault_fingerprint(&staged, policy);
+    
+    if (update_prefix_preserving_table(inst, &staged, slot) ||
+        update_policy_maps(inst, &staged, policy, slot) ||
+        update_bpf_config(inst, &staged, slot)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes the config into the idle slot, then flips config_generation_map
+ * so new packets pick it up. Packets already running keep the slot they
+ * started with.
+ */
+static int publish_config(interface_instance *inst, const anonymization_config *config,
+                          const policy_set *policy) {
+    __u32 next_generation = inst->generation + 1;
+    __u32 slot = next_generation % CONFIG_SLOT_COUNT;
+    __u64 epoch;
+    
+    wait_for_slot_grace(inst);
+    if (stage_config(inst, config, policy, slot, &epoch)) {
+        return -1;
+    }
+    
+    __u32 key = 0;
+    if (bpf_map_update_elem(inst->config_generation_map_fd, &key, &next_generation, BPF_ANY)) {
+        fprintf(stderr, "Config generation update failed: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    inst->generation = next_generation;
+    inst->salt_epoch = epoch;
+    clock_gettime(CLOCK_MONOTONIC, &inst->last_publish);
+    printf("Configuration generation %u active (slot %u)\n", next_generation, slot);
+    return 0;
+}
+
+/*
+ * Takes over a pinned link without detaching it. The running program
+ * shares the generation map, so the new object gets the config in the
+ * slot of the current generation before the link update hands it the
+ * traffic. The publish that follows waits out the old program's frames
+ * and moves on to a new generation, which retires cache entries made
+ * under the previous daemon's config.
+ */
+static int adopt_pinned_link(interface_instance *inst, const anonymization_config *config,
+                             const policy_set *policy) {
+    __u64 epoch;
+    if (stage_config(inst, config, policy, inst->generation % CONFIG_SLOT_COUNT, &epoch)) {
+        return -1;
+    }
+    
+    int err = bpf_link_update(inst->xdp_link_fd, inst->attached_prog_fd, NULL);
+    if (err) {
+        fprintf(stderr, "Pinned XDP link update failed: %s\n", strerror(-err));
+        return err;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &inst->last_publish);
+    printf("Adopted the pinned XDP link on %s (%s), generation %u\n", inst->interface_name,
+           attached_program_kind(inst), inst->generation);
+    return 0;
+}
+
+static bool xsk_settings_equal(const xsk_settings *a, const xsk_settings *b) {
+    return a->queue_count == b->queue_count && a->zero_copy == b->zero_copy &&
+           strcmp(a->sink_spec, b->sink_spec) == 0;
+}
+
+static void reload_configuration(interface_instance *inst) {
+    config_parse_result result = parse_config_file(inst->config_path);
+    if (!result.success) {
+        fprintf(stderr, "Configuration reload rejected: %s\n", result.error_message);
+        return;
+    }
+    
+    anonymization_config *config = &result.config;
+    const anonymization_config previous = inst->active_config;
+    
+    policy_set policy = {0};
+    if (config->address_policy) {
+        policy_parse_result parsed = parse_policy_file(result.policy_file);
+        if (!parsed.success) {
+            fprintf(stderr, "Configuration reload rejected: %s\n", parsed.error_message);
+            return;
+        }
+        policy = parsed.policy;
+    }
+    
+    if (config->mapping_cache_size != previous.mapping_cache_size) {
+        fprintf(stderr, "mapping_cache_size change needs a restart, keeping %u\n",
+                previous.mapping_cache_size);
+        config->mapping_cache_size = previous.mapping_cache_size;
+    }
+    if (config->flow_table_size != previous.flow_table_size) {
+        fprintf(stderr, "flow_table_size change needs a restart, keeping %u\n",
+                previous.flow_table_size);
+        config->flow_table_size = previous.flow_table_size;
+    }
+    if (result.events.ring_size != inst->active_events.ring_size) {
+        fprintf(stderr, "event_ring_size change needs a restart, keeping %u\n",
+                inst->active_events.ring_size);
+    }
+    if (config->pipeline != previous.pipeline) {
+        fprintf(stderr, "pipeline change needs a restart, keeping it %s\n",
+                previous.pipeline ? "on" : "off");
+        config->pipeline = previous.pipeline;
+    }
+    if (memcmp(&result.cpumap, &inst->active_cpumap, sizeof(result.cpumap)) != 0) {
+        fprintf(stderr, "cpumap settings change needs a restart, keeping %u workers\n",
+                inst->active_cpumap.worker_count);
+    }
+    if (strcmp(result.pin_dir, inst->pin_dir) != 0) {
+        fprintf(stderr, "bpf_pin_dir change needs a restart, keeping %s\n",
+                inst->pin_dir[0] ? inst->pin_dir : "none");
+    }
+    if (inst->xsk && config->output_mode == OUTPUT_MODE_XSK &&
+        !xsk_settings_equal(&result.xsk, &inst->active_xsk)) {
+        fprintf(stderr, "AF_XDP settings change needs a restart, keeping current sockets\n");
+    }
+    
+    if (update_output_port(inst, config) || start_xsk_consumer(inst, config, &result.xsk) ||
+        start_flow_exporter(inst, &result.flow_export) || start_event_log(inst, &result.events) ||
+        start_mapping_vault(inst, result.vault_file) || publish_config(inst, config, &policy) ||
+        update_pipeline_stages(inst, result.pipeline_stages) || switch_to_generic_program(inst)) {
+        fprintf(stderr, "Configuration reload failed on %s, generation %u stays active\n",
+                inst->interface_name, inst->generation);
+        free_policy_set(&policy);
+        return;
+    }
+    
+    if (previous.output_mode == OUTPUT_MODE_REDIRECT &&
+        (config->output_mode != OUTPUT_MODE_REDIRECT ||
+         config->output_ifindex != previous.output_ifindex)) {
+        __u32 old_ifindex = previous.output_ifindex;
+        bpf_map_delete_elem(inst->output_map_fd, &old_ifindex);
+    }
+    if (inst->xsk && config->output_mode != OUTPUT_MODE_XSK) {
+        xsk_consumer_stop(inst->xsk);
+        inst->xsk = NULL;
+    }
+    
+    inst->active_config = *config;
+    free_policy_set(&inst->active_policy);
+    inst->active_policy = policy;
+    printf("Configuration reloaded from %s for %s\n", inst->config_path, inst->interface_name);
+}
+
+static void rotate_salt_if_due(interface_instance *inst) {
+    __u32 interval = inst->active_config.salt_rotation_interval;
+    if (!interval || current_salt_epoch(interval) == inst->salt_epoch) {
+        return;
+    }
+    
+    if (publish_config(inst, &inst->active_config, &inst->active_policy) == 0) {
+        printf("Salt rotated on %s for epoch %llu\n", inst->interface_name,
+               (unsigned long long)inst->salt_epoch);
+    }
+}
+
+/*
+ * One inotify fd serves every interface. Watches go on the directories so
+ * editors that replace the file by rename are seen too; profiles sharing a
+ * directory share its watch descriptor and are told apart by name.
+ */
+static void watch_config_file(interface_instance *inst) {
+    char dir_copy[PATH_MAX];
+    char base_copy[PATH_MAX];
+    snprintf(dir_copy, sizeof(dir_copy), "%s", inst->config_path);
+    snprintf(base_copy, sizeof(base_copy), "%s", inst->config_path);
+    snprintf(inst->config_basename, sizeof(inst->config_basename), "%s", basename(base_copy));
+    
+    if (app_state.inotify_fd < 0) {
+        app_state.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = app_state.inotify_fd };
+        if (app_state.inotify_fd < 0 ||
+            epoll_ctl(app_state.epoll_fd, EPOLL_CTL_ADD, app_state.inotify_fd, &event)) {
+            fprintf(stderr, "Config file watch unavailable: %s (SIGHUP still reloads)\n",
+                    strerror(errno));
+            if (app_state.inotify_fd >= 0) close(app_state.inotify_fd);
+            app_state.inotify_fd = -1;
+            return;
+        }
+    }
+    
+    inst->watch_descriptor = inotify_add_watch(app_state.inotify_fd, dirname(dir_copy),
+                                               IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (inst->watch_descriptor < 0) {
+        fprintf(stderr, "Config file watch failed for %s: %s (SIGHUP still reloads)\n",
+                inst->interface_name, strerror(errno));
+    }
+}
+
+static void mark_changed_configs(void) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    
+    while ((len = read(app_state.inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            for (__u32 i = 0; event->len && i < app_state.instance_count; i++) {
+                interface_instance *inst = &app_state.instances[i];
+                if (inst->watch_descriptor == event->wd &&
+                    strcmp(event->name, inst->config_basename) == 0) {
+                    inst->reload_requested = true;
+                }
+            }
+            ptr += sizeof(*event) + event->len;
+        }
+    }
+}
+
+static int next_wakeup_ms(const struct timespec *next_stats) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long timeout = (next_stats->tv_sec - now.tv_sec) * 1000 +
+                   (next_stats->tv_nsec - now.tv_nsec) / 1000000;
+    
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    for (__u32 i = 0; i < app_state.instance_count; i++) {
+        const interface_instance *inst = &app_state.instances[i];
+        __u32 interval = inst->active_config.salt_rotation_interval;
+        if (!interval) {
+            continue;
+        }
+        __u64 boundary = (inst->salt_epoch + 1) * interval;
+        long until_boundary = ((long)(boundary - (__u64)wall.tv_sec)) * 1000 - wall.tv_nsec / 1000000 + 1;
+        if (until_boundary < timeout) {
+            timeout = until_boundary;
+        }
+    }
+    
+    if (timeout > EVENT_POLL_MAX_MS) {
+        timeout = EVENT_POLL_MAX_MS;
+    }
+    return timeout < 0 ? 0 : (int)timeout;
+}
+
+static int handle_packet_event(void *ctx, void *data, size_t size) {
+    interface_instance *inst = ctx;
+    const packet_event *event = data;
+    if (size < offsetof(packet_event, after) ||
+        (event->type == EVENT_TYPE_SAMPLE && size < sizeof(*event))) {
+        return 0;
+    }
+    
+    if (event->type == EVENT_TYPE_SAMPLE) {
+        inst->sample_events++;
+    } else if (event->reason < ANON_ERROR_COUNT) {
+        inst->error_events[event->reason]++;
+    }
+    if (inst->event_log) {
+        event_log_write(inst->event_log, inst->interface_name, event);
+    }
+    return 0;
+}
+
+/* Runs on the daemon thread; the XDP side only ever waits on a full ring, by dropping. */
+static int handle_vault_mapping(void *ctx, void *data, size_t size) {
+    interface_instance *inst = ctx;
+    if (size < sizeof(vault_mapping) || !inst->vault) {
+        return 0;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    __u64 now_ms = (__u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    switch (mapping_vault_add(inst->vault, data, now_ms)) {
+    case VAULT_ADD_NEW:
+        inst->vault_new++;
+        break;
+    case VAULT_ADD_DUPLICATE:
+        inst->vault_known++;
+        break;
+    case VAULT_ADD_COLLISION:
+        inst->vault_new++;
+        inst->vault_collisions++;
+        break;
+    default:
+        inst->vault_failed++;
+        break;
+    }
+    return 0;
+}
+
+static int subscribe_ring(int map_fd, ring_buffer_sample_fn handler, interface_instance *inst) {
+    if (app_state.events) {
+        int err = ring_buffer__add(app_state.events, map_fd, handler, inst);
+        if (err) {
+            fprintf(stderr, "Event ring buffer setup failed: %s\n", strerror(-err));
+            return -1;
+        }
+        return 0;
+    }
+    
+    app_state.events = ring_buffer__new(map_fd, handler, inst, NULL);
+    if (!app_state.events) {
+        fprintf(stderr, "Event ring buffer setup failed: %s\n", strerror(errno));
+        return -1;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = ring_buffer__epoll_fd(app_state.events) };
+    if (epoll_ctl(app_state.epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event)) {
+        fprintf(stderr, "Event ring buffer watch failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Every instance's events_map and vault_ring_map feed one ring_buffer,
+ * whose epoll fd joins the main loop.
+ */
+static int subscribe_events(interface_instance *inst) {
+    return subscribe_ring(inst->events_map_fd, handle_packet_event, inst) ||
+           subscribe_ring(inst->vault_ring_map_fd, handle_vault_mapping, inst) ? -1 : 0;
+}
+
+static void wait_for_events(int timeout_ms) {
+    struct epoll_event events[3];
+    int ready = epoll_wait(app_state.epoll_fd, events, 3, timeout_ms);
+    for (int i = 0; i < ready; i++) {
+        if (events[i].data.fd == app_state.inotify_fd) {
+            mark_changed_configs();
+        } else if (app_state.metrics && events[i].data.fd == metrics_server_fd(app_state.metrics)) {
+            metrics_server_poll(app_state.metrics);
+        } else if (app_state.events) {
+            ring_buffer__poll(app_state.events, 0);
+        }
+    }
+}
+
+static void display_xsk_statistics(const interface_instance *inst) {
+    __u32 queues = xsk_consumer_queue_count(inst->xsk);
+    if (!queues) {
+        return;
+    }
+    
+    printf("--- AF_XDP queues ---\n");
+    for (__u32 i = 0; i < queues; i++) {
+        xsk_queue_stats queue;
+        xsk_consumer_queue_stats(inst->xsk, i, &queue);
+        printf("Queue %3u (%s): received %llu, bytes %llu, sink drops %llu\n",
+               queue.queue_id, queue.zero_copy ? "zero-copy" : "copy",
+               queue.rx_packets, queue.rx_bytes, queue.sink_drops);
+    }
+}
+
+static void accumulate_stats(anonymization_stats *total, const anonymization_stats *cpu) {
+    total->packets_processed += cpu->packets_processed;
+    total->packets_anonymized += cpu->packets_anonymized;
+    total->bytes_processed += cpu->bytes_processed;
+    total->mac_addresses_anonymized += cpu->mac_addresses_anonymized;
+    total->ip_addresses_anonymized += cpu->ip_addresses_anonymized;
+    total->arp_packets_anonymized += cpu->arp_packets_anonymized;
+    total->errors += cpu->errors;
+    total->packets_forwarded += cpu->packets_forwarded;
+    total->forward_errors += cpu->forward_errors;
+    total->cache_hits += cpu->cache_hits;
+    total->cache_misses += cpu->cache_misses;
+    total->cache_inserts += cpu->cache_inserts;
+    total->ipv6_addresses_anonymized += cpu->ipv6_addresses_anonymized;
+    total->ndp_packets_anonymized += cpu->ndp_packets_anonymized;
+    total->vlan_packets += cpu->vlan_packets;
+    total->qinq_packets += cpu->qinq_packets;
+    total->mpls_packets += cpu->mpls_packets;
+    total->vxlan_packets += cpu->vxlan_packets;
+    total->geneve_packets += cpu->geneve_packets;
+    total->gre_packets += cpu->gre_packets;
+    total->ports_anonymized += cpu->ports_anonymized;
+    total->flow_hits += cpu->flow_hits;
+    total->flows_created += cpu->flows_created;
+    total->policy_drops += cpu->policy_drops;
+    total->dhcp_scrubbed += cpu->dhcp_scrubbed;
+    total->dns_scrubbed += cpu->dns_scrubbed;
+    total->icmp_errors_scrubbed += cpu->icmp_errors_scrubbed;
+    total->events_suppressed += cpu->events_suppressed;
+    total->events_lost += cpu->events_lost;
+    total->vault_records += cpu->vault_records;
+    total->vault_lost += cpu->vault_lost;
+    total->frag_packets += cpu->frag_packets;
+    total->frag_copies += cpu->frag_copies;
+}
+
+/*
+ * Counts the entries of a per-CPU hash map with bpf_map_lookup_batch(),
+ * MAP_COUNT_BATCH keys per syscall rather than one bpf_map_get_next_key()
+ * per entry. The kernel copies each value out once per possible CPU,
+ * padded to 8 bytes.
+ */
+static __u64 count_map_entries(int map_fd, size_t key_size, size_t value_size) {
+    size_t value_stride = ((value_size + 7) & ~(size_t)7) * app_state.num_cpus;
+    void *keys = malloc(MAP_COUNT_BATCH * key_size);
+    void *values = malloc(MAP_COUNT_BATCH * value_stride);
+    __u64 entries = 0;
+    if (!keys || !values) {
+        fprintf(stderr, "Map count buffer allocation failed\n");
+        free(keys);
+        free(values);
+        return 0;
+    }
+    
+    __u32 batch;
+    void *in_batch = NULL;
+    for (;;) {
+        __u32 count = MAP_COUNT_BATCH;
+        int err = bpf_map_lookup_batch(map_fd, in_batch, &batch, keys, values, &count, NULL);
+        entries += count;
+        if (err) {
+            if (errno != ENOENT) {
+                fprintf(stderr, "Map entry count failed: %s\n", strerror(errno));
+            }
+            break;
+        }
+        in_batch = &batch;
+    }
+    free(keys);
+    free(values);
+    return entries;
+}
+
+static void display_cache_statistics(const stats_snapshot *snapshot) {
+    const anonymization_stats *stats = &snapshot->totals;
+    __u64 lookups = stats->cache_hits + stats->cache_misses;
+    if (!lookups) {
+        return;
+    }
+    
+    __u64 resident = snapshot->cache_resident;
+    __u64 evictions = stats->cache_inserts > resident ? stats->cache_inserts - resident : 0;
+    
+    printf("Mapping cache:        %llu hits, %llu misses (%.1f%% hit rate)\n",
+           stats->cache_hits, stats->cache_misses, 100.0 * stats->cache_hits / lookups);
+    printf("Mapping cache entries: %llu resident, %llu evicted\n", resident, evictions);
+}
+
+static void display_flow_statistics(const interface_instance *inst,
+                                    const anonymization_stats *stats) {
+    if (stats->ports_anonymized) {
+        printf("Ports anonymized:     %llu packets\n", stats->ports_anonymized);
+    }
+    if (!stats->flows_created && !inst->flows_expired) {
+        return;
+    }
+    
+    printf("Flow table:           %u active, %llu hits, %llu created, %llu expired\n",
+           inst->flow_sweep.active, stats->flow_hits, stats->flows_created, inst->flows_expired);
+}
+
+/* Matches are per address, so a packet can count against two rules. */
+static void display_policy_statistics(const interface_instance *inst,
+                                      const anonymization_stats *stats) {
+    const policy_set *policy = &inst->active_policy;
+    if (!inst->active_config.address_policy || !policy->rule_count) {
+        return;
+    }
+    
+    __u64 *per_cpu = calloc(app_state.num_cpus, sizeof(*per_cpu));
+    if (!per_cpu) {
+        fprintf(stderr, "Statistics buffer allocation failed\n");
+        return;
+    }
+    
+    __u32 top[POLICY_TOP_RULES];
+    __u64 top_hits[POLICY_TOP_RULES];
+    __u32 ranked = 0;
+    __u64 matches = 0;
+    __u32 slot = inst->generation % CONFIG_SLOT_COUNT;
+    for (__u32 rule = 0; rule < policy->rule_count; rule++) {
+        __u32 index = slot * MAX_POLICY_RULES + rule;
+        if (bpf_map_lookup_elem(inst->policy_hits_map_fd, &index, per_cpu)) {
+            continue;
+        }
+        __u64 hits = 0;
+        for (int cpu = 0; cpu < app_state.num_cpus; cpu++) {
+            hits += per_cpu[cpu];
+        }
+        matches += hits;
+        if (!hits) {
+            continue;
+        }
+        
+        /* Insertion into the busiest-rules list, which stays sorted. */
+        __u32 pos = ranked < POLICY_TOP_RULES ? ranked++ : POLICY_TOP_RULES;
+        while (pos > 0 && top_hits[pos - 1] < hits) {
+            if (pos < POLICY_TOP_RULES) {
+                top[pos] = top[pos - 1];
+                top_hits[pos] = top_hits[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < POLICY_TOP_RULES) {
+            top[pos] = rule;
+            top_hits[pos] = hits;
+        }
+    }
+    free(per_cpu);
+    
+    printf("Address policy:       %u rules, %llu matches, %llu packets dropped\n",
+           policy->rule_count, matches, stats->policy_drops);
+    for (__u32 i = 0; i < ranked; i++) {
+        printf("  rule %4u: %-40s %llu\n", top[i] + 1, policy->labels[top[i]], top_hits[i]);
+    }
+}
+
+static void display_event_statistics(const interface_instance *inst,
+                                     const anonymization_stats *stats) {
+    __u64 errors = 0;
+    for (__u32 reason = 0; reason < ANON_ERROR_COUNT; reason++) {
+        errors += inst->error_events[reason];
+    }
+    if (!errors && !inst->sample_events && !stats->events_suppressed && !stats->events_lost) {
+        return;
+    }
+    
+    printf("Events:               %llu errors, %llu samples, %llu rate-limited, %llu lost\n",
+           errors, inst->sample_events, stats->events_suppressed, stats->events_lost);
+    for (__u32 reason = 0; reason < ANON_ERROR_COUNT; reason++) {
+        if (inst->error_events[reason]) {
+            printf("  %-20s %llu\n", event_reason_name(reason), inst->error_events[reason]);
+        }
+    }
+}
+
+static void display_vault_statistics(const interface_instance *inst,
+                                     const anonymization_stats *stats) {
+    if (!inst->vault) {
+        return;
+    }
+    
+    printf("Mapping vault:        %llu pairs, %llu new, %llu known, %llu collisions, %llu lost\n",
+           (unsigned long long)mapping_vault_count(inst->vault), inst->vault_new, inst->vault_known,
+           inst->vault_collisions, stats->vault_lost + inst->vault_failed);
+}
+
+static void display_cpumap_statistics(const interface_instance *inst,
+                                      const stats_snapshot *snapshot) {
+    if (!inst->active_cpumap.worker_count) {
+        return;
+    }
+    
+    printf("--- CPUMAP workers ---\n");
+    for (__u32 i = 0; i < inst->active_cpumap.worker_count; i++) {
+        const cpumap_worker_stats *worker = &snapshot->cpumap[i];
+        printf("CPU %3u: enqueued %llu, queue drops %llu, redirect errors %llu\n",
+               inst->active_cpumap.cpus[i], (unsigned long long)worker->enqueued,
+               (unsigned long long)worker->queue_drops,
+               (unsigned long long)worker->redirect_errors);
+    }
+}
+
+static void display_pipeline_statistics(const interface_instance *inst,
+                                        const stats_snapshot *snapshot) {
+    if (inst->pipeline_prog_fd < 0) {
+        return;
+    }
+    
+    printf("--- Pipeline stages ---\n");
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        const pipeline_stage_stats *stage_stats = &snapshot->pipeline[stage];
+        printf("%-4s: dispatched %llu, anonymized %llu, errors %llu, missed %llu (%s)\n",
+               pipeline_stage_name(stage), (unsigned long long)stage_stats->packets,
+               (unsigned long long)stage_stats->anonymized,
+               (unsigned long long)stage_stats->errors, (unsigned long long)stage_stats->missed,
+               inst->active_stages[stage][0] ? inst->active_stages[stage] : "built-in");
+    }
+}
+
+/* Linear inside the log2 bucket that holds the rank, so off by less than 2x. */
+static double latency_percentile(const __u64 *buckets, __u64 count, double quantile) {
+    double rank = quantile * count;
+    __u64 seen = 0;
+    for (__u32 bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++) {
+        if (buckets[bucket] && seen + buckets[bucket] >= rank) {
+            double low = bucket ? (double)(1ull << bucket) : 0.0;
+            double high = (double)(1ull << (bucket + 1));
+            return low + (high - low) * (rank - seen) / buckets[bucket];
+        }
+        seen += buckets[bucket];
+    }
+    return (double)(1ull << LATENCY_BUCKET_COUNT);
+}
+
+/* Percentiles over the last interval only, so a config change shows up in the next report. */
+static void display_latency_statistics(const interface_instance *inst,
+                                       const stats_snapshot *snapshot) {
+    if (!inst->active_config.latency_histogram) {
+        return;
+    }
+    
+    printf("--- Latency (last interval) ---\n");
+    for (__u32 class = 0; class < LATENCY_CLASS_COUNT; class++) {
+        const latency_histogram *current = &snapshot->latency[class];
+        const latency_histogram *previous = &snapshot->latency_previous[class];
+        __u64 buckets[LATENCY_BUCKET_COUNT];
+        __u64 count = 0;
+        for (__u32 bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++) {
+            buckets[bucket] = current->buckets[bucket] - previous->buckets[bucket];
+            count += buckets[bucket];
+        }
+        if (!count) {
+            continue;
+        }
+        
+        printf("%-5s: %llu frames, mean %.0f ns, p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns\n",
+               latency_class_name(class), (unsigned long long)count,
+               (double)(current->total_ns - previous->total_ns) / count,
+               latency_percentile(buckets, count, 0.5), latency_percentile(buckets, count, 0.99),
+               latency_percentile(buckets, count, 0.999));
+    }
+}
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double counter_rate(__u64 current, __u64 previous, double seconds) {
+    if (seconds <= 0.0 || current < previous) {
+        return 0.0;
+    }
+    return (double)(current - previous) / seconds;
+}
+
+/*
+ * stats_map holds one per-CPU entry per RX queue, fetched with a single
+ * bpf_map_lookup_batch() call. Sums them into the interface totals plus
+ * per-CPU and per-queue breakdowns.
+ */
+static int read_queue_statistics(const interface_instance *inst, anonymization_stats *total,
+                                 anonymization_stats *cpu_totals, anonymization_stats *queue_totals) {
+    anonymization_stats *values = calloc((size_t)MAX_RX_QUEUES * app_state.num_cpus, sizeof(*values));
+    if (!values) {
+        fprintf(stderr, "Statistics buffer allocation failed\n");
+        return -1;
+    }
+    
+    __u32 keys[MAX_RX_QUEUES];
+    __u32 count = MAX_RX_QUEUES;
+    __u32 batch;
+    int err = bpf_map_lookup_batch(inst->stats_map_fd, NULL, &batch, keys, values, &count, NULL);
+    if (err && errno != ENOENT) {
+        fprintf(stderr, "Statistics retrieval failed: %s\n", strerror(errno));
+        free(values);
+        return -1;
+    }
+    
+    for (__u32 i = 0; i < count && i < MAX_RX_QUEUES; i++) {
+        const anonymization_stats *per_cpu = &values[(size_t)i * app_state.num_cpus];
+        __u32 queue = keys[i] < MAX_RX_QUEUES ? keys[i] : MAX_RX_QUEUES - 1;
+        for (int cpu = 0; cpu < app_state.num_cpus; cpu++) {
+            accumulate_stats(total, &per_cpu[cpu]);
+            accumulate_stats(&cpu_totals[cpu], &per_cpu[cpu]);
+            accumulate_stats(&queue_totals[queue], &per_cpu[cpu]);
+        }
+    }
+    free(values);
+    return 0;
+}
+
+/* cpumap_stats_map is a plain array indexed by CPU, updated atomically by the dispatcher. */
+static void read_cpumap_statistics(const interface_instance *inst, stats_snapshot *snapshot) {
+    memset(snapshot->cpumap, 0, sizeof(snapshot->cpumap));
+    for (__u32 i = 0; i < inst->active_cpumap.worker_count; i++) {
+        __u32 cpu = inst->active_cpumap.cpus[i];
+        bpf_map_lookup_elem(inst->cpumap_stats_map_fd, &cpu, &snapshot->cpumap[i]);
+    }
+}
+
+/* pipeline_stats_map is per-CPU, keyed by stage. */
+static void read_pipeline_statistics(const interface_instance *inst, stats_snapshot *snapshot) {
+    memset(snapshot->pipeline, 0, sizeof(snapshot->pipeline));
+    if (inst->pipeline_prog_fd < 0) {
+        return;
+    }
+    
+    pipeline_stage_stats *values = calloc(app_state.num_cpus, sizeof(*values));
+    if (!values) {
+        return;
+    }
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        if (bpf_map_lookup_elem(inst->pipeline_stats_map_fd, &stage, values)) {
+            continue;
+        }
+        pipeline_stage_stats *total = &snapshot->pipeline[stage];
+        for (int cpu = 0; cpu < app_state.num_cpus; cpu++) {
+            total->packets += values[cpu].packets;
+            total->anonymized += values[cpu].anonymized;
+            total->errors += values[cpu].errors;
+            total->missed += values[cpu].missed;
+        }
+    }
+    free(values);
+}
+
+/* latency_map is per-CPU, keyed by frame class; the previous read is kept for interval deltas. */
+static void read_latency_statistics(const interface_instance *inst, stats_snapshot *snapshot) {
+    memcpy(snapshot->latency_previous, snapshot->latency, sizeof(snapshot->latency));
+    latency_histogram *values = calloc(app_state.num_cpus, sizeof(*values));
+    if (!values) {
+        return;
+    }
+    
+    for (__u32 class = 0; class < LATENCY_CLASS_COUNT; class++) {
+        if (bpf_map_lookup_elem(inst->latency_map_fd, &class, values)) {
+            continue;
+        }
+        latency_histogram *total = &snapshot->latency[class];
+        memset(total, 0, sizeof(*total));
+        for (int cpu = 0; cpu < app_state.num_cpus; cpu++) {
+            for (__u32 bucket = 0; bucket < LATENCY_BUCKET_COUNT; bucket++) {
+                total->buckets[bucket] += values[cpu].buckets[bucket];
+            }
+            total->total_ns += values[cpu].total_ns;
+        }
+    }
+    free(values);
+}
+
+static void add_map_gauge(stats_snapshot *snapshot, const char *name, __u64 entries,
+                          __u64 capacity) {
+    if (snapshot->map_count < METRICS_MAX_MAPS) {
+        snapshot->maps[snapshot->map_count++] = (metrics_map_gauge){ name, entries, capacity };
+    }
+}
+
+/* Occupancy of the maps the active config uses; the flow table count comes from its last sweep. */
+static void collect_map_gauges(const interface_instance *inst, stats_snapshot *snapshot) {
+    const anonymization_config *config = &inst->active_config;
+    snapshot->map_count = 0;
+    snapshot->cache_resident = 0;
+    
+    if (config->mapping_cache) {
+        __u64 mac_entries = count_map_entries(inst->mac_cache_map_fd, sizeof(mac_cache_key),
+                                              sizeof(mac_cache_value));
+        __u64 ipv4_entries = count_map_entries(inst->ipv4_cache_map_fd, sizeof(ipv4_cache_key),
+                                               sizeof(ipv4_cache_value));
+        add_map_gauge(snapshot, "mac_cache", mac_entries, config->mapping_cache_size);
+        add_map_gauge(snapshot, "ipv4_cache", ipv4_entries, config->mapping_cache_size);
+        snapshot->cache_resident = mac_entries + ipv4_entries;
+    }
+    if (config->flow_table) {
+        add_map_gauge(snapshot, "flow_table", inst->flow_sweep.active, config->flow_table_size);
+    }
+    if (config->address_policy) {
+        add_map_gauge(snapshot, "policy_prefixes", inst->active_policy.prefix_count,
+                      MAX_POLICY_PREFIXES);
+    }
+}
+
+/* Reads stats_map once per interval; the report and every scrape until the next one share it. */
+static int refresh_statistics(interface_instance *inst) {
+    stats_snapshot *snapshot = &inst->stats;
+    if (!snapshot->cpu_totals) {
+        snapshot->cpu_totals = calloc(app_state.num_cpus, sizeof(*snapshot->cpu_totals));
+        if (!snapshot->cpu_totals) {
+            fprintf(stderr, "Statistics buffer allocation failed\n");
+            return -1;
+        }
+    }
+    
+    anonymization_stats totals = {0};
+    memset(snapshot->cpu_totals, 0, app_state.num_cpus * sizeof(*snapshot->cpu_totals));
+    memset(snapshot->queue_totals, 0, sizeof(snapshot->queue_totals));
+    if (read_queue_statistics(inst, &totals, snapshot->cpu_totals, snapshot->queue_totals)) {
+        snapshot->valid = false;
+        return -1;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (snapshot->valid) {
+        snapshot->previous = snapshot->totals;
+        snapshot->seconds = elapsed_seconds(&snapshot->timestamp, &now);
+    } else {
+        memset(&snapshot->previous, 0, sizeof(snapshot->previous));
+        snapshot->seconds = 0.0;
+    }
+    snapshot->totals = totals;
+    snapshot->timestamp = now;
+    snapshot->valid = true;
+    read_cpumap_statistics(inst, snapshot);
+    read_pipeline_statistics(inst, snapshot);
+    read_latency_statistics(inst, snapshot);
+    collect_map_gauges(inst, snapshot);
+    return 0;
+}
+
+static void display_statistics(const interface_instance *inst) {
+    const stats_snapshot *snapshot = &inst->stats;
+    if (!snapshot->valid) {
+        return;
+    }
+    const anonymization_stats *stats = &snapshot->totals;
+    const anonymization_stats *prev = &snapshot->previous;
+    double seconds = snapshot->seconds;
+    
+    printf("\n=== Anonymization Statistics: %s ===\n", inst->interface_name);
+    printf("Packets processed:     %llu (%.0f pps, %.1f Mbps)\n", stats->packets_processed,
+           counter_rate(stats->packets_processed, prev->packets_processed, seconds),
+           counter_rate(stats->bytes_processed, prev->bytes_processed, seconds) * 8 / 1e6);
+    printf("Packets anonymized:    %llu (%.0f pps)\n", stats->packets_anonymized,
+           counter_rate(stats->packets_anonymized, prev->packets_anonymized, seconds));
+    printf("MAC addresses anonymized: %llu\n", stats->mac_addresses_anonymized);
+    printf("IP addresses anonymized:  %llu\n", stats->ip_addresses_anonymized);
+    printf("ARP packets anonymized:   %llu\n", stats->arp_packets_anonymized);
+    printf("IPv6 addresses anonymized: %llu\n", stats->ipv6_addresses_anonymized);
+    printf("NDP packets anonymized:   %llu\n", stats->ndp_packets_anonymized);
+    printf("Tagged packets:       %llu VLAN, %llu QinQ, %llu MPLS\n", stats->vlan_packets,
+           stats->qinq_packets, stats->mpls_packets);
+    printf("Tunneled packets:     %llu VXLAN, %llu GENEVE, %llu GRE\n", stats->vxlan_packets,
+           stats->geneve_packets, stats->gre_packets);
+    if (stats->frag_packets) {
+        printf("Multi-buffer frames:  %llu (%llu with headers past the linear part)\n",
+               stats->frag_packets, stats->frag_copies);
+    }
+    const anonymization_config *config = &inst->active_config;
+    if (config->scrub_dhcp || config->scrub_dns || config->scrub_icmp_errors) {
+        printf("Payloads scrubbed:    %llu DHCP, %llu DNS, %llu ICMP errors\n",
+               stats->dhcp_scrubbed, stats->dns_scrubbed, stats->icmp_errors_scrubbed);
+    }
+    printf("Errors:               %llu (%.0f/s)\n", stats->errors,
+           counter_rate(stats->errors, prev->errors, seconds));
+    
+    printf("Packets forwarded:    %llu (%.0f pps)\n", stats->packets_forwarded,
+           counter_rate(stats->packets_forwarded, prev->packets_forwarded, seconds));
+    printf("Forward errors:       %llu\n", stats->forward_errors);
+    display_cache_statistics(snapshot);
+    display_flow_statistics(inst, stats);
+    display_policy_statistics(inst, stats);
+    display_event_statistics(inst, stats);
+    display_vault_statistics(inst, stats);
+    
+    printf("--- Per-CPU breakdown ---\n");
+    for (int cpu = 0; cpu < app_state.num_cpus; cpu++) {
+        const anonymization_stats *cpu_stats = &snapshot->cpu_totals[cpu];
+        if (!cpu_stats->packets_processed) {
+            continue;
+        }
+        double share = stats->packets_processed ?
+                       100.0 * cpu_stats->packets_processed / stats->packets_processed : 0.0;
+        printf("CPU %3d: processed %llu (%5.1f%%), anonymized %llu, errors %llu\n",
+               cpu, cpu_stats->packets_processed, share,
+               cpu_stats->packets_anonymized, cpu_stats->errors);
+    }
+    
+    printf("--- Per-RX-queue breakdown ---\n");
+    for (__u32 queue = 0; queue < MAX_RX_QUEUES; queue++) {
+        const anonymization_stats *queue_stats = &snapshot->queue_totals[queue];
+        if (!queue_stats->packets_processed) {
+            continue;
+        }
+        double share = stats->packets_processed ?
+                       100.0 * queue_stats->packets_processed / stats->packets_processed : 0.0;
+        printf("Queue %3u%s: processed %llu (%5.1f%%), anonymized %llu, errors %llu\n",
+               queue, queue == MAX_RX_QUEUES - 1 ? "+" : "",
+               queue_stats->packets_processed, share,
+               queue_stats->packets_anonymized, queue_stats->errors);
+    }
+    display_cpumap_statistics(inst, snapshot);
+    display_pipeline_statistics(inst, snapshot);
+    display_latency_statistics(inst, snapshot);
+    display_xsk_statistics(inst);
+    printf("================================\n");
+}
+
+static void publish_metrics(void) {
+    if (!app_state.metrics) {
+        return;
+    }
+    
+    metrics_interface interfaces[MAX_INTERFACES];
+    __u32 count = 0;
+    for (__u32 i = 0; i < app_state.instance_count; i++) {
+        const interface_instance *inst = &app_state.instances[i];
+        const stats_snapshot *snapshot = &inst->stats;
+        if (!snapshot->valid) {
+            continue;
+        }
+        interfaces[count++] = (metrics_interface){
+            .interface_name = inst->interface_name,
+            .totals = &snapshot->totals,
+            .cpu_totals = snapshot->cpu_totals,
+            .queue_totals = snapshot->queue_totals,
+            .packet_rate = counter_rate(snapshot->totals.packets_processed,
+                                        snapshot->previous.packets_processed, snapshot->seconds),
+            .bit_rate = counter_rate(snapshot->totals.bytes_processed,
+                                     snapshot->previous.bytes_processed, snapshot->seconds) * 8,
+            .error_events = inst->error_events,
+            .sample_events = inst->sample_events,
+            .flows_expired = inst->flows_expired,
+            .vault_collisions = inst->vault_collisions,
+            .cpumap_cpus = inst->active_cpumap.cpus,
+            .cpumap_workers = snapshot->cpumap,
+            .cpumap_worker_count = inst->active_cpumap.worker_count,
+            .pipeline_stages = inst->pipeline_prog_fd >= 0 ? snapshot->pipeline : NULL,
+            .latency = inst->active_config.latency_histogram ? snapshot->latency : NULL,
+            .generation = inst->generation,
+            .maps = snapshot->maps,
+            .map_count = snapshot->map_count
+        };
+    }
+    
+    size_t length;
+    char *page = metrics_render(interfaces, count, app_state.num_cpus, &length);
+    if (page) {
+        metrics_server_publish(app_state.metrics, page, length);
+    }
+}
+
+static void cleanup_instance(interface_instance *inst) {
+    xsk_consumer_stop(inst->xsk);
+    inst->xsk = NULL;
+    
+    /* Closing the link detaches the program unless the link is pinned. */
+    if (inst->xdp_link_fd >= 0) {
+        close(inst->xdp_link_fd);
+        if (inst->link_pinned) {
+            printf("XDP program left running on %s, remove %s to detach it\n",
+                   inst->interface_name, inst->pin_path);
+        } else {
+            printf("XDP program detached from %s\n", inst->interface_name);
+        }
+    }
+    inst->xdp_link_fd = -1;
+    if (inst->cpumap_trace) {
+        bpf_link__destroy(inst->cpumap_trace);
+        inst->cpumap_trace = NULL;
+    }
+    
+    /*
+     * Detached, so the table no longer moves: export whatever is left. A
+     * pinned table keeps filling, and the next daemon exports it.
+     */
+    if (inst->flow_exporter && inst->flow_table_map_fd >= 0 && !inst->link_pinned) {
+        sweep_flow_table(inst, true);
+    }
+    flow_exporter_close(inst->flow_exporter);
+    inst->flow_exporter = NULL;
+    event_log_close(inst->event_log);
+    inst->event_log = NULL;
+    release_vault(inst);
+    
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        bpf_object__close(inst->stage_objects[stage]);
+        inst->stage_objects[stage] = NULL;
+    }
+    prog_kern__destroy(inst->skel);
+    inst->skel = NULL;
+    inst->obj = NULL;
+    free_policy_set(&inst->active_policy);
+    free(inst->stats.cpu_totals);
+    inst->stats.cpu_totals = NULL;
+}
+
+static void cleanup_resources(void) {
+    /* Drain what the programs left before their maps go away. */
+    if (app_state.events) {
+        ring_buffer__consume(app_state.events);
+        ring_buffer__free(app_state.events);
+    }
+    app_state.events = NULL;
+    for (__u32 i = 0; i < app_state.instance_count; i++) {
+        cleanup_instance(&app_state.instances[i]);
+    }
+    if (app_state.inotify_fd >= 0) close(app_state.inotify_fd);
+    app_state.inotify_fd = -1;
+    metrics_server_close(app_state.metrics);
+    app_state.metrics = NULL;
+    if (app_state.epoll_fd >= 0) close(app_state.epoll_fd);
+    app_state.epoll_fd = -1;
+}
+
+static int setup_resource_limits(void) {
+    struct rlimit rlim = {
+        .rlim_cur = RLIM_INFINITY,
+        .rlim_max = RLIM_INFINITY,
+    };
+    if (setrlimit(RLIMIT_MEMLOCK, &rlim)) {
+        fprintf(stderr, "Resource limit setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static void add_instance(const char *interface, const char *config_path) {
+    interface_instance *inst = &app_state.instances[app_state.instance_count++];
+    memset(inst, 0, sizeof(*inst));
+    inst->config_generation_map_fd = -1;
+    inst->config_map_fd = -1;
+    inst->stats_map_fd = -1;
+    inst->output_map_fd = -1;
+    inst->xsks_map_fd = -1;
+    inst->pp_table_map_fd = -1;
+    inst->mac_cache_map_fd = -1;
+    inst->ipv4_cache_map_fd = -1;
+    inst->flow_table_map_fd = -1;
+    inst->policy_ipv4_map_fd = -1;
+    inst->policy_ipv6_map_fd = -1;
+    inst->policy_hits_map_fd = -1;
+    inst->events_map_fd = -1;
+    inst->vault_ring_map_fd = -1;
+    inst->cpumap_map_fd = -1;
+    inst->cpumap_stats_map_fd = -1;
+    inst->cpumap_dispatch_map_fd = -1;
+    inst->pipeline_map_fd = -1;
+    inst->pipeline_stats_map_fd = -1;
+    inst->latency_map_fd = -1;
+    inst->prog_fd = -1;
+    inst->specialized_prog_fd = -1;
+    inst->dispatch_prog_fd = -1;
+    inst->cpumap_prog_fd = -1;
+    inst->pipeline_prog_fd = -1;
+    for (__u32 stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        inst->stage_prog_fds[stage] = -1;
+    }
+    inst->attached_prog_fd = -1;
+    inst->xdp_link_fd = -1;
+    inst->link_pinned = false;
+    inst->watch_descriptor = -1;
+    snprintf(inst->interface_name, sizeof(inst->interface_name), "%s", interface);
+    snprintf(inst->config_path, sizeof(inst->config_path), "%s", config_path);
+}
+
+static int collect_instances(int argc, char *argv[], const char **metrics_target) {
+    const char *program = argv[0];
+    if (argc > 2 && strcmp(argv[1], "-M") == 0) {
+        *metrics_target = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    
+    if (argc == 3 && strcmp(argv[1], "-m") == 0) {
+        interface_map_parse_result map = parse_interface_map(argv[2]);
+        if (!map.success) {
+            fprintf(stderr, "Interface map error: %s\n", map.error_message);
+            return -1;
+        }
+        for (__u32 i = 0; i < map.count; i++) {
+            add_instance(map.profiles[i].interface_name, map.profiles[i].config_path);
+        }
+        return 0;
+    }
+    
+    if (argc != 3 || strlen(argv[1]) >= MAX_INTERFACE_NAME_LENGTH ||
+        strlen(argv[2]) >= MAX_PROFILE_PATH_LENGTH) {
+        fprintf(stderr, "Usage: %s [-M <metrics_listen>] <interface> <config_file>\n", program);
+        fprintf(stderr, "       %s [-M <metrics_listen>] -m <interface_map>\n", program);
+        fprintf(stderr, "Example: %s -M tcp:9464 eth0 anonymization_config.txt\n", program);
+        return -1;
+    }
+    add_instance(argv[1], argv[2]);
+    return 0;
+}
+
+static int start_instance(interface_instance *inst) {
+    config_parse_result config_result = parse_config_file(inst->config_path);
+    if (!config_result.success) {
+        fprintf(stderr, "Configuration error in %s: %s\n", inst->config_path,
+                config_result.error_message);
+        return -1;
+    }
+    
+    printf("Configuration loaded for %s\n", inst->interface_name);
+    
+    if (config_result.config.address_policy) {
+        policy_parse_result parsed = parse_policy_file(config_result.policy_file);
+        if (!parsed.success) {
+            fprintf(stderr, "Configuration error in %s: %s\n", inst->config_path,
+                    parsed.error_message);
+            return -1;
+        }
+        inst->active_policy = parsed.policy;
+    }
+    
+    inst->ifindex = if_nametoindex(inst->interface_name);
+    if (inst->ifindex == 0) {
+        fprintf(stderr, "Interface %s not found\n", inst->interface_name);
+        return -1;
+    }
+    
+    /* The specialized program reads the mapping id from .rodata. */
+    config_result.config.vault_mapping_id =
+        mapping_vault_fingerprint(&config_result.config, &inst->active_policy);
+    if (load_bpf_program(inst, &config_result)) {
+        fprintf(stderr, "BPF program loading failed\n");
+        return -1;
+    }
+    
+    /* Stages go in before an adopted link moves to the new program. */
+    int adopt = open_pinned_link(inst);
+    if (adopt < 0 || update_output_port(inst, &config_result.config) ||
+        start_xsk_consumer(inst, &config_result.config, &config_result.xsk) ||
+        start_flow_exporter(inst, &config_result.flow_export) ||
+        start_event_log(inst, &config_result.events) ||
+        start_mapping_vault(inst, config_result.vault_file) || subscribe_events(inst) ||
+        update_pipeline_stages(inst, config_result.pipeline_stages) ||
+        (adopt && adopt_pinned_link(inst, &config_result.config, &inst->active_policy)) ||
+        publish_config(inst, &config_result.config, &inst->active_policy)) {
+        return -1;
+    }
+    inst->active_config = config_result.config;
+    
+    if (attach_xdp_program(inst)) {
+        return -1;
+    }
+    
+    watch_config_file(inst);
+    printf("Anonymization started on %s\n", inst->interface_name);
+    return 0;
+}
+
+static int start_metrics_server(const char *target) {
+    if (!target) {
+        return 0;
+    }
+    
+    app_state.metrics = metrics_server_open(target);
+    if (!app_state.metrics) {
+        return -1;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = metrics_server_fd(app_state.metrics) };
+    if (epoll_ctl(app_state.epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event)) {
+        fprintf(stderr, "Metrics server watch failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void refresh_all_statistics(bool display) {
+    for (__u32 i = 0; i < app_state.instance_count; i++) {
+        interface_instance *inst = &app_state.instances[i];
+        if (inst->vault) {
+            mapping_vault_sync(inst->vault);
+        }
+        if (refresh_statistics(inst) == 0 && display) {
+            display_statistics(inst);
+        }
+    }
+    publish_metrics();
+}
+
+int main(int argc, char *argv[]) {
+    const char *metrics_target = NULL;
+    if (collect_instances(argc, argv, &metrics_target)) {
+        return 1;
+    }
+    
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGHUP, handle_reload_signal);
+    
+    if (setup_resource_limits()) {
+        return 1;
+    }
+    
+    app_state.num_cpus = libbpf_num_possible_cpus();
+    if (app_state.num_cpus <= 0) {
+        fprintf(stderr, "Possible CPU count unavailable\n");
+        return 1;
+    }
+    
+    app_state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (app_state.epoll_fd < 0) {
+        fprintf(stderr, "Event loop setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    for (__u32 i = 0; i < app_state.instance_count; i++) {
+        if (start_instance(&app_state.instances[i])) {
+            cleanup_resources();
+            return 1;
+        }
+    }
+    if (start_metrics_server(metrics_target)) {
+        cleanup_resources();
+        return 1;
+    }
+    /* Baseline for the first rates, and a page for scrapes before the first report. */
+    refresh_all_statistics(false);
+    
+    printf("Press Ctrl+C to stop, send SIGHUP or edit a profile to reload\n");
+    
+    struct timespec next_stats;
+    clock_gettime(CLOCK_MONOTONIC, &next_stats);
+    next_stats.tv_sec += STATS_INTERVAL_SECONDS;
+    
+    while (app_state.running) {
+        wait_for_events(next_wakeup_ms(&next_stats));
+        if (!app_state.running) {
+            break;
+        }
+        
+        bool reload_all = app_state.reload_requested;
+        app_state.reload_requested = false;
+        for (__u32 i = 0; i < app_state.instance_count; i++) {
+            interface_instance *inst = &app_state.instances[i];
+            if (reload_all || inst->reload_requested) {
+                inst->reload_requested = false;
+                reload_configuration(inst);
+            }
+            rotate_salt_if_due(inst);
+            sweep_flow_table_if_due(inst);
+        }
+        
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next_stats.tv_sec ||
+            (now.tv_sec == next_stats.tv_sec && now.tv_nsec >= next_stats.tv_nsec)) {
+            refresh_all_statistics(true);
+            next_stats = now;
+            next_stats.tv_sec += STATS_INTERVAL_SECONDS;
+        }
     }
     
     cleanup_resources();
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+#include <bpf/btf.h>
+#include "specialization.h"
+
+config_specialization *find_specialization_data(struct bpf_object *obj) {
+    struct bpf_map *rodata = bpf_object__find_map_by_name(obj, ".rodata");
+    struct btf *btf = bpf_object__btf(obj);
+    if (!rodata || !btf) {
+        return NULL;
+    }
+    
+    size_t size = 0;
+    char *data = bpf_map__initial_value(rodata, &size);
+    const struct btf_type *section = btf__type_by_id(btf, bpf_map__btf_value_type_id(rodata));
+    if (!data || !section || !btf_is_datasec(section)) {
+        return NULL;
+    }
+    
+    const struct btf_var_secinfo *var = btf_var_secinfos(section);
+    for (__u16 i = 0; i < btf_vlen(section); i++, var++) {
+        const struct btf_type *type = btf__type_by_id(btf, var->type);
+        const char *name = type ? btf__name_by_offset(btf, type->name_off) : NULL;
+        if (name && strcmp(name, SPECIALIZATION_VAR_NAME) == 0) {
+            bool fits = var->size == sizeof(config_specialization) &&
+                        var->offset + var->size <= size;
+            return fits ? (config_specialization *)(data + var->offset) : NULL;
+        }
+    }
+    return NULL;
+}
+
+int specialize_bpf_object(struct bpf_object *obj, config_specialization *values,
+                          const anonymization_config *config, __u32 generation, bool enable) {
+    struct bpf_program *prog = bpf_object__find_program_by_name(obj, SPECIALIZED_PROG_NAME);
+    if (!prog) {
+        fprintf(stderr, "Specialized XDP program not found\n");
+        return -1;
+    }
+    
+    if (!enable) {
+        bpf_program__set_autoload(prog, false);
+        return 0;
+    }
+    
+    if (!values) {
+        fprintf(stderr, "Specialization data not found, using generic program\n");
+        bpf_program__set_autoload(prog, false);
+        return -1;
+    }
+    
+    values->config = *config;
+    values->generation = generation;
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SPECIALIZATION_H
+#define SPECIALIZATION_H
+
+#include <stdbool.h>
+#include <bpf/libbpf.h>
+#include "common_structs.h"
+
+#define GENERIC_PROG_NAME "xdp_anonymize_prog"
+#define SPECIALIZED_PROG_NAME "xdp_anonymize_specialized"
+#define SPECIALIZATION_VAR_NAME "specialization"
+
+/*
+ * Finds the specialization variable in the .rodata of an opened object
+ * through its BTF, for objects loaded without the skeleton. Returns NULL
+ * when the object has none of the expected size.
+ */
+config_specialization *find_specialization_data(struct bpf_object *obj);
+
+/*
+ * Prepares an opened, not yet loaded prog_kern object. With enable set,
+ * values (its .rodata copy of the specialization variable) is filled with
+ * config and generation; otherwise xdp_anonymize_specialized is left out
+ * of the load. Returns -1 (and leaves it out) when values is NULL.
+ */
+int specialize_bpf_object(struct bpf_object *obj, config_specialization *values,
+                          const anonymization_config *config, __u32 generation, bool enable);
+
+#endif
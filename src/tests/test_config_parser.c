@@ -0,0 +1,65 @@
+#define _GNU_SOURCE
+
+#include "test_helpers.h"
+#include "config_parser.h"
+
+static config_parse_result parse_bytes(const void *data, size_t len) {
+    char path[TEST_PATH_LENGTH];
+    config_parse_result result = {0};
+    if (write_test_file(path, data, len)) {
+        snprintf(result.error_message, sizeof(result.error_message), "fixture write failed");
+        return result;
+    }
+    result = parse_config_file(path);
+    unlink(path);
+    return result;
+}
+
+static void expect_error(const char *name, const void *data, size_t len, const char *message) {
+    config_parse_result result = parse_bytes(data, len);
+    CHECK(!result.success, "%s: accepted", name);
+    CHECK(strstr(result.error_message, message), "%s: error \"%s\" lacks \"%s\"", name,
+          result.error_message, message);
+}
+
+#define EXPECT_ERROR(name, text, message) expect_error(name, text, sizeof(text) - 1, message)
+
+int main(int argc, char *argv[]) {
+    /* A pcap file header, as once committed in place of the bench profiles. */
+    static const unsigned char pcap_header[] = {
+        0xd4, 0xc3, 0xb2, 0xa1, 0x02, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, '\n'
+    };
+    expect_error("pcap", pcap_header, sizeof(pcap_header), ":1: not a text line");
+    
+    EXPECT_ERROR("nul byte", "anonymize_srcipv4: yes\nanon\0ymize_dstipv4: no\n",
+                 ":2: not a text line");
+    EXPECT_ERROR("control byte", "anonymize_srcipv4: yes\x01\n", ":1: not a text line");
+    EXPECT_ERROR("no separator", "anonymize_srcipv4: yes\n\njunk\n",
+                 ":3: expected <key>: <value>");
+    EXPECT_ERROR("no key", "# comment\n: yes\n", ":2: missing key");
+    EXPECT_ERROR("no value", "anonymize_srcipv4:   # comment\n", ":1: missing value");
+    EXPECT_ERROR("bad value", "anonymize_srcipv4: yes\nmapping_cache_size: 0\n",
+                 "Invalid value for mapping_cache_size at");
+    
+    char long_line[MAX_CONFIG_LINE_LENGTH + 16];
+    memset(long_line, 'a', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\n';
+    expect_error("long line", long_line, sizeof(long_line), ":1: line too long");
+    
+    static const char valid[] = "# comment\n\n  anonymize_srcipv4: no  # trailing\r\n"
+                                "\t\n"
+                                "anonymize_dstipv4: yes";
+    config_parse_result result = parse_bytes(valid, sizeof(valid) - 1);
+    CHECK(result.success, "valid: %s", result.error_message);
+    CHECK(!result.config.anonymize_srcipv4 && result.config.anonymize_dstipv4,
+          "valid: settings not applied");
+    
+    /* Every shipped config and profile must parse. */
+    for (int i = 1; i < argc; i++) {
+        result = parse_config_file(argv[i]);
+        CHECK(result.success, "%s: %s", argv[i], result.error_message);
+    }
+    
+    return test_result("test_config_parser");
+}
@@ -0,0 +1,40 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Minimal checks for the userspace tests: report every failure, exit non-zero at the end. */
+static int test_failures;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        test_failures++; \
+    } \
+} while (0)
+
+/* Writes len bytes to a fresh file under /tmp; path must hold TEST_PATH_LENGTH bytes. */
+#define TEST_PATH_LENGTH 64
+
+static inline int write_test_file(char *path, const void *data, size_t len) {
+    snprintf(path, TEST_PATH_LENGTH, "/tmp/xdp-anon-test-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t written = write(fd, data, len);
+    close(fd);
+    return written == (ssize_t)len ? 0 : -1;
+}
+
+static inline int test_result(const char *name) {
+    printf("%-28s %s\n", name, test_failures ? "FAILED" : "ok");
+    return test_failures ? 1 : 0;
+}
+
+#endif
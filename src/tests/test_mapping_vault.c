@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+
+#include "test_helpers.h"
+#include "mapping_vault.h"
+
+#define TEST_MAPPING_ID 0x5a17c0de
+
+static vault_mapping ipv4_mapping(__u8 field, __u8 original, __u8 anonymized) {
+    vault_mapping mapping = {
+        .mapping_id = TEST_MAPPING_ID,
+        .kind = VAULT_KIND_IPV4,
+        .field = field,
+        .original = { 192, 0, 2, original },
+        .anonymized = { 10, 83, 2, anonymized }
+    };
+    return mapping;
+}
+
+/*
+ * anon-vault reverse matches on kind and anonymized address alone, so two
+ * originals that anonymize alike must be flagged even when one was seen as
+ * a source and the other as a destination.
+ */
+static void check_collisions(const char *path) {
+    mapping_vault *vault = mapping_vault_open(path, true);
+    CHECK(vault, "cannot create vault %s", path);
+    if (!vault) {
+        return;
+    }
+    
+    vault_mapping src = ipv4_mapping(MAPPING_FIELD_SRC, 1, 17);
+    vault_mapping src_again = ipv4_mapping(MAPPING_FIELD_SRC, 1, 17);
+    vault_mapping dst_same = ipv4_mapping(MAPPING_FIELD_DST, 1, 17);
+    vault_mapping dst_other = ipv4_mapping(MAPPING_FIELD_DST, 2, 17);
+    vault_mapping dst_unique = ipv4_mapping(MAPPING_FIELD_DST, 3, 18);
+    
+    CHECK(mapping_vault_add(vault, &src, 1000) == VAULT_ADD_NEW, "first pair not new");
+    CHECK(mapping_vault_add(vault, &src_again, 1001) == VAULT_ADD_DUPLICATE,
+          "repeated pair not deduplicated");
+    CHECK(mapping_vault_add(vault, &dst_other, 1002) == VAULT_ADD_COLLISION,
+          "dst pair sharing a src pair's anonymized address not flagged");
+    CHECK(mapping_vault_add(vault, &dst_same, 1003) == VAULT_ADD_NEW,
+          "same original as dst flagged as a collision");
+    CHECK(mapping_vault_add(vault, &dst_unique, 1004) == VAULT_ADD_NEW, "unique pair not new");
+    
+    CHECK(mapping_vault_count(vault) == 4, "expected 4 records, got %llu",
+          (unsigned long long)mapping_vault_count(vault));
+    CHECK(mapping_vault_collisions(vault) == 1, "expected 1 collision, got %llu",
+          (unsigned long long)mapping_vault_collisions(vault));
+    if (mapping_vault_count(vault) == 4) {
+        CHECK(mapping_vault_record(vault, 1)->flags & VAULT_FLAG_COLLISION,
+              "colliding record not flagged");
+        CHECK(!(mapping_vault_record(vault, 2)->flags & VAULT_FLAG_COLLISION),
+              "same original as dst flagged");
+    }
+    mapping_vault_close(vault);
+    
+    /* Reopening rebuilds the indexes from the file. */
+    vault = mapping_vault_open(path, true);
+    CHECK(vault, "cannot reopen vault %s", path);
+    if (!vault) {
+        return;
+    }
+    CHECK(mapping_vault_collisions(vault) == 1, "collision count lost on reopen");
+    vault_mapping late = ipv4_mapping(MAPPING_FIELD_SRC, 4, 18);
+    CHECK(mapping_vault_add(vault, &late, 1005) == VAULT_ADD_COLLISION,
+          "src pair sharing a reopened dst pair's anonymized address not flagged");
+    mapping_vault_close(vault);
+}
+
+int main(void) {
+    char path[TEST_PATH_LENGTH];
+    if (write_test_file(path, "", 0)) {
+        fprintf(stderr, "Cannot create a test file under /tmp\n");
+        return 1;
+    }
+    check_collisions(path);
+    unlink(path);
+    return test_result("test_mapping_vault");
+}
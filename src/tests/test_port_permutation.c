@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+
+#include "test_helpers.h"
+#include "config_parser.h"
+#include "rewrite_helpers.h"
+
+#define PORT_ADJACENT_MAX_PERCENT 0.1
+
+/*
+ * process_port() must be a bijection on the ports it remaps, and must not
+ * keep neighbouring ports together, or the port order shows through.
+ */
+static void check_port_permutation(const char *name, const anonymization_config *config) {
+    static __u8 seen[65536];
+    memset(seen, 0, sizeof(seen));
+    
+    __u32 adjacent = 0;
+    __u32 previous = 0;
+    for (__u32 port = 0; port < 65536; port++) {
+        __u32 mapped = process_port(port, config);
+        if (port < PORT_PRESERVE_BELOW) {
+            CHECK(mapped == port, "%s: well-known port %u moved to %u", name, port, mapped);
+            continue;
+        }
+        if (mapped < PORT_PRESERVE_BELOW || seen[mapped]) {
+            CHECK(false, "%s: maps %u to %u twice or below %u", name, port, mapped,
+                  PORT_PRESERVE_BELOW);
+            return;
+        }
+        seen[mapped] = 1;
+        if (port > PORT_PRESERVE_BELOW && mapped == previous + 1) {
+            adjacent++;
+        }
+        previous = mapped;
+    }
+    
+    double percent = 100.0 * adjacent / (65535 - PORT_PRESERVE_BELOW);
+    CHECK(percent <= PORT_ADJACENT_MAX_PERCENT,
+          "%s: keeps %u adjacent pairs (%.2f%%), more than %.1f%%", name, adjacent, percent,
+          PORT_ADJACENT_MAX_PERCENT);
+}
+
+int main(int argc, char *argv[]) {
+    static const __u32 salts[] = { 0, 1, 0x12345678, 0xDEADBEEF, 0xFFFFFFFF };
+    char name[64];
+    
+    anonymization_config config = create_default_config();
+    for (size_t i = 0; i < sizeof(salts) / sizeof(salts[0]); i++) {
+        config.hash_function = HASH_FUNCTION_LEGACY;
+        config.random_salt = salts[i];
+        snprintf(name, sizeof(name), "legacy salt %#x", salts[i]);
+        check_port_permutation(name, &config);
+        
+        config.hash_function = HASH_FUNCTION_SIPHASH;
+        config.hash_key[0] = 0x0706050403020100ull ^ salts[i];
+        config.hash_key[1] = 0x0F0E0D0C0B0A0908ull * (i + 1);
+        snprintf(name, sizeof(name), "siphash key %zu", i);
+        check_port_permutation(name, &config);
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        config_parse_result parsed = parse_config_file(argv[i]);
+        CHECK(parsed.success, "%s: %s", argv[i], parsed.error_message);
+        if (parsed.success) {
+            check_port_permutation(argv[i], &parsed.config);
+        }
+    }
+    
+    return test_result("test_port_permutation");
+}
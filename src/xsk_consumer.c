@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_xdp.h>
+#include <bpf/bpf.h>
+#include "xsk_consumer.h"
+#include "packet_sink.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+typedef struct {
+    __u32 cached_prod;
+    __u32 cached_cons;
+    __u32 mask;
+    __u32 size;
+    __u32 *producer;
+    __u32 *consumer;
+    __u32 *flags;
+    void *ring;
+    void *mapping;
+    size_t mapping_size;
+} xsk_ring;
+
+typedef struct {
+    int fd;
+    __u32 queue_id;
+    void *umem_area;
+    size_t umem_size;
+    xsk_ring fill;
+    xsk_ring completion;
+    xsk_ring rx;
+    packet_sink *sink;
+    pthread_t thread;
+    bool thread_started;
+    bool zero_copy;
+    __u64 rx_packets;
+    __u64 rx_bytes;
+    volatile bool *running;
+} xsk_socket_state;
+
+struct xsk_consumer {
+    __u32 queue_count;
+    volatile bool running;
+    xsk_socket_state sockets[MAX_XSK_QUEUES];
+};
+
+static inline __u32 xsk_prod_reserve(xsk_ring *ring, __u32 count) {
+    __u32 free_entries = ring->cached_cons - ring->cached_prod;
+    if (free_entries < count) {
+        ring->cached_cons = __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE) + ring->size;
+        free_entries = ring->cached_cons - ring->cached_prod;
+    }
+    return free_entries < count ? free_entries : count;
+}
+
+static inline void xsk_prod_submit(xsk_ring *ring, __u32 count) {
+    ring->cached_prod += count;
+    __atomic_store_n(ring->producer, ring->cached_prod, __ATOMIC_RELEASE);
+}
+
+static inline __u32 xsk_cons_peek(xsk_ring *ring, __u32 count) {
+    __u32 entries = ring->cached_prod - ring->cached_cons;
+    if (entries == 0) {
+        ring->cached_prod = __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE);
+        entries = ring->cached_prod - ring->cached_cons;
+    }
+    return entries < count ? entries : count;
+}
+
+static inline void xsk_cons_release(xsk_ring *ring, __u32 count) {
+    ring->cached_cons += count;
+    __atomic_store_n(ring->consumer, ring->cached_cons, __ATOMIC_RELEASE);
+}
+
+static inline __u64 *xsk_addr_ring_entry(xsk_ring *ring, __u32 index) {
+    return &((__u64 *)ring->ring)[index & ring->mask];
+}
+
+static inline struct xdp_desc *xsk_desc_ring_entry(xsk_ring *ring, __u32 index) {
+    return &((struct xdp_desc *)ring->ring)[index & ring->mask];
+}
+
+static int map_ring(int fd, xsk_ring *ring, const struct xdp_ring_offset *offsets,
+                    __u32 size, size_t entry_size, off_t pgoff, bool producer_ring) {
+    ring->mapping_size = offsets->desc + size * entry_size;
+    ring->mapping = mmap(NULL, ring->mapping_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (ring->mapping == MAP_FAILED) {
+        ring->mapping = NULL;
+        return -errno;
+    }
+    
+    ring->producer = (__u32 *)((char *)ring->mapping + offsets->producer);
+    ring->consumer = (__u32 *)((char *)ring->mapping + offsets->consumer);
+    ring->flags = (__u32 *)((char *)ring->mapping + offsets->flags);
+    ring->ring = (char *)ring->mapping + offsets->desc;
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->cached_prod = *ring->producer;
+    ring->cached_cons = *ring->consumer;
+    if (producer_ring) {
+        ring->cached_cons += size;
+    }
+    return 0;
+}
+
+static void unmap_ring(xsk_ring *ring) {
+    if (ring->mapping) {
+        munmap(ring->mapping, ring->mapping_size);
+        ring->mapping = NULL;
+    }
+}
+
+static int configure_umem(xsk_socket_state *xsk) {
+    xsk->umem_size = (size_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+    xsk->umem_area = mmap(NULL, xsk->umem_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (xsk->umem_area == MAP_FAILED) {
+        xsk->umem_area = NULL;
+        return -errno;
+    }
+    
+    struct xdp_umem_reg umem_reg = {
+        .addr = (__u64)(unsigned long)xsk->umem_area,
+        .len = xsk->umem_size,
+        .chunk_size = XSK_FRAME_SIZE,
+        .headroom = 0
+    };
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg))) {
+        return -errno;
+    }
+    
+    int ring_size = XSK_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size))) {
+        return -errno;
+    }
+    
+    struct xdp_mmap_offsets offsets;
+    socklen_t optlen = sizeof(offsets);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &optlen)) {
+        return -errno;
+    }
+    
+    int err = map_ring(xsk->fd, &xsk->fill, &offsets.fr, XSK_RING_SIZE, sizeof(__u64),
+                       XDP_UMEM_PGOFF_FILL_RING, true);
+    if (!err) {
+        err = map_ring(xsk->fd, &xsk->completion, &offsets.cr, XSK_RING_SIZE, sizeof(__u64),
+                       XDP_UMEM_PGOFF_COMPLETION_RING, false);
+    }
+    if (!err) {
+        err = map_ring(xsk->fd, &xsk->rx, &offsets.rx, XSK_RING_SIZE, sizeof(struct xdp_desc),
+                       XDP_PGOFF_RX_RING, false);
+    }
+    return err;
+}
+
+static void populate_fill_ring(xsk_socket_state *xsk) {
+    __u32 count = xsk_prod_reserve(&xsk->fill, XSK_NUM_FRAMES);
+    for (__u32 i = 0; i < count; i++) {
+        *xsk_addr_ring_entry(&xsk->fill, xsk->fill.cached_prod + i) = (__u64)i * XSK_FRAME_SIZE;
+    }
+    xsk_prod_submit(&xsk->fill, count);
+}
+
+static int bind_socket(xsk_socket_state *xsk, int ifindex, bool zero_copy) {
+    struct sockaddr_xdp addr = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = xsk->queue_id,
+        .sxdp_flags = XDP_USE_NEED_WAKEUP | (zero_copy ? XDP_ZEROCOPY : XDP_COPY)
+    };
+    if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        return -errno;
+    }
+    xsk->zero_copy = zero_copy;
+    return 0;
+}
+
+/* With XDP_USE_NEED_WAKEUP the driver only refills from the fill ring after a syscall. */
+static void kick_fill_ring(xsk_socket_state *xsk) {
+    if (__atomic_load_n(xsk->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+static void drain_completion_ring(xsk_socket_state *xsk) {
+    __u32 count = xsk_cons_peek(&xsk->completion, XSK_BATCH_SIZE);
+    if (count) {
+        xsk_cons_release(&xsk->completion, count);
+    }
+}
+
+static void process_rx_batch(xsk_socket_state *xsk) {
+    __u32 received = xsk_cons_peek(&xsk->rx, XSK_BATCH_SIZE);
+    if (!received) {
+        struct pollfd pfd = { .fd = xsk->fd, .events = POLLIN };
+        poll(&pfd, 1, XSK_POLL_TIMEOUT_MS);
+        return;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    
+    /*
+     * Every frame is owned by exactly one ring, so recycled frames should
+     * always fit; if the fill ring is short, the rest stay on the rx ring
+     * for the next batch.
+     */
+    received = xsk_prod_reserve(&xsk->fill, received);
+    if (!received) {
+        kick_fill_ring(xsk);
+        return;
+    }
+    
+    __u32 rx_index = xsk->rx.cached_cons;
+    __u32 fill_index = xsk->fill.cached_prod;
+    __u64 bytes = 0;
+    for (__u32 i = 0; i < received; i++) {
+        const struct xdp_desc *desc = xsk_desc_ring_entry(&xsk->rx, rx_index + i);
+        xsk->sink->write(xsk->sink, (char *)xsk->umem_area + desc->addr, desc->len, &now);
+        bytes += desc->len;
+        *xsk_addr_ring_entry(&xsk->fill, fill_index + i) =
+            desc->addr - (desc->addr % XSK_FRAME_SIZE);
+    }
+    
+    xsk_cons_release(&xsk->rx, received);
+    xsk_prod_submit(&xsk->fill, received);
+    kick_fill_ring(xsk);
+    /* Read by the daemon thread for statistics. */
+    __atomic_fetch_add(&xsk->rx_packets, received, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&xsk->rx_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static void *xsk_consumer_thread(void *arg) {
+    xsk_socket_state *xsk = arg;
+    
+    while (*xsk->running) {
+        process_rx_batch(xsk);
+        drain_completion_ring(xsk);
+    }
+    
+    xsk->sink->flush(xsk->sink);
+    return NULL;
+}
+
+static void close_socket(xsk_socket_state *xsk) {
+    unmap_ring(&xsk->rx);
+    unmap_ring(&xsk->completion);
+    unmap_ring(&xsk->fill);
+    if (xsk->fd >= 0) {
+        close(xsk->fd);
+        xsk->fd = -1;
+    }
+    if (xsk->umem_area) {
+        munmap(xsk->umem_area, xsk->umem_size);
+        xsk->umem_area = NULL;
+    }
+    packet_sink_close(xsk->sink);
+    xsk->sink = NULL;
+}
+
+static int open_socket(xsk_socket_state *xsk, int ifindex, int xsks_map_fd,
+                       const xsk_settings *settings) {
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd < 0) {
+        fprintf(stderr, "AF_XDP socket creation failed: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    int err = configure_umem(xsk);
+    if (err) {
+        fprintf(stderr, "AF_XDP UMEM setup failed on queue %u: %s\n", xsk->queue_id, strerror(-err));
+        return -1;
+    }
+    
+    populate_fill_ring(xsk);
+    
+    err = bind_socket(xsk, ifindex, settings->zero_copy);
+    if (err && settings->zero_copy) {
+        fprintf(stderr, "Zero-copy bind failed on queue %u (%s), using copy mode\n",
+                xsk->queue_id, strerror(-err));
+        err = bind_socket(xsk, ifindex, false);
+    }
+    if (err) {
+        fprintf(stderr, "AF_XDP bind failed on queue %u: %s\n", xsk->queue_id, strerror(-err));
+        return -1;
+    }
+    
+    xsk->sink = packet_sink_open(settings->sink_spec, xsk->queue_id);
+    if (!xsk->sink) {
+        return -1;
+    }
+    
+    if (bpf_map_update_elem(xsks_map_fd, &xsk->queue_id, &xsk->fd, BPF_ANY)) {
+        fprintf(stderr, "XSKMAP update failed on queue %u: %s\n", xsk->queue_id, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+xsk_consumer *xsk_consumer_start(const char *interface, int xsks_map_fd,
+                                 const xsk_settings *settings) {
+    int ifindex = if_nametoindex(interface);
+    if (ifindex == 0) {
+        fprintf(stderr, "Interface %s not found\n", interface);
+        return NULL;
+    }
+    
+    if (settings->queue_count == 0 || settings->queue_count > MAX_XSK_QUEUES) {
+        fprintf(stderr, "Invalid AF_XDP queue count: %u\n", settings->queue_count);
+        return NULL;
+    }
+    
+    xsk_consumer *consumer = calloc(1, sizeof(*consumer));
+    if (!consumer) {
+        return NULL;
+    }
+    consumer->running = true;
+    
+    for (__u32 queue = 0; queue < settings->queue_count; queue++) {
+        xsk_socket_state *xsk = &consumer->sockets[queue];
+        xsk->fd = -1;
+        xsk->queue_id = queue;
+        xsk->running = &consumer->running;
+        consumer->queue_count = queue + 1;
+        
+        if (open_socket(xsk, ifindex, xsks_map_fd, settings)) {
+            xsk_consumer_stop(consumer);
+            return NULL;
+        }
+        
+        if (pthread_create(&xsk->thread, NULL, xsk_consumer_thread, xsk)) {
+            fprintf(stderr, "AF_XDP consumer thread start failed on queue %u\n", queue);
+            xsk_consumer_stop(consumer);
+            return NULL;
+        }
+        xsk->thread_started = true;
+        
+        printf("AF_XDP socket bound to %s queue %u (%s)\n", interface, queue,
+               xsk->zero_copy ? "zero-copy" : "copy");
+    }
+    
+    return consumer;
+}
+
+void xsk_consumer_stop(xsk_consumer *consumer) {
+    if (!consumer) {
+        return;
+    }
+    
+    consumer->running = false;
+    for (__u32 queue = 0; queue < consumer->queue_count; queue++) {
+        xsk_socket_state *xsk = &consumer->sockets[queue];
+        if (xsk->thread_started) {
+            pthread_join(xsk->thread, NULL);
+        }
+        close_socket(xsk);
+    }
+    free(consumer);
+}
+
+__u32 xsk_consumer_queue_count(const xsk_consumer *consumer) {
+    return consumer ? consumer->queue_count : 0;
+}
+
+void xsk_consumer_queue_stats(const xsk_consumer *consumer, __u32 index,
+                              xsk_queue_stats *stats) {
+    const xsk_socket_state *xsk = &consumer->sockets[index];
+    stats->queue_id = xsk->queue_id;
+    stats->rx_packets = __atomic_load_n(&xsk->rx_packets, __ATOMIC_RELAXED);
+    stats->rx_bytes = __atomic_load_n(&xsk->rx_bytes, __ATOMIC_RELAXED);
+    stats->sink_drops = xsk->sink ? __atomic_load_n(&xsk->sink->dropped, __ATOMIC_RELAXED) : 0;
+    stats->zero_copy = xsk->zero_copy;
+}
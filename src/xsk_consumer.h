@@ -0,0 +1,32 @@
+#ifndef XSK_CONSUMER_H
+#define XSK_CONSUMER_H
+
+#include <linux/types.h>
+#include <stdbool.h>
+#include "common_structs.h"
+
+#define XSK_FRAME_SIZE 4096
+#define XSK_RING_SIZE 2048
+/* Receive only: every frame sits in the fill or rx ring, so the UMEM holds one ring's worth. */
+#define XSK_NUM_FRAMES XSK_RING_SIZE
+#define XSK_BATCH_SIZE 64
+#define XSK_POLL_TIMEOUT_MS 100
+
+typedef struct {
+    __u32 queue_id;
+    __u64 rx_packets;
+    __u64 rx_bytes;
+    __u64 sink_drops;
+    bool zero_copy;
+} xsk_queue_stats;
+
+typedef struct xsk_consumer xsk_consumer;
+
+xsk_consumer *xsk_consumer_start(const char *interface, int xsks_map_fd,
+                                 const xsk_settings *settings);
+void xsk_consumer_stop(xsk_consumer *consumer);
+__u32 xsk_consumer_queue_count(const xsk_consumer *consumer);
+void xsk_consumer_queue_stats(const xsk_consumer *consumer, __u32 index,
+                              xsk_queue_stats *stats);
+
+#endif